@@ -129,6 +129,7 @@ cd "$SRC_DIR"
     --target="$TARGET" \
     --build="$BUILD" \
     CFLAGS="-mms-bitfields -I$INSTALL_DIR/include -O3" \
+    CPPFLAGS_FOR_BUILD="-I$INSTALL_DIR/include" \
     PKG_CONFIG="$RUN_PKG_CONFIG"
 
 make -j4
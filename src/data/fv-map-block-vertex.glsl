@@ -0,0 +1,153 @@
+/*
+ * Finvenkisto
+ *
+ * Copyright (C) 2026 Neil Roberts
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Draws a single block of the map for each instance. The vertices
+ * are the faces of a unit block and the details of the block are
+ * looked up in a texture that has a texel for each block. Faces that
+ * are hidden by the neighbouring block are collapsed to a point. */
+
+/* The corner of the face within the block, whether the vertex is at
+ * the top of the face and the face number. The faces are the top,
+ * north, south, west and east in that order. */
+attribute vec4 position;
+/* The position of the block within the tile */
+attribute vec2 block_offset;
+
+uniform mat4 transform;
+uniform mat3 normal_transform;
+/* The position of the tile in blocks */
+uniform vec2 tile_position;
+
+/* The four bytes of the fv_map_block_t for each block with the
+ * least-significant byte in the red component */
+uniform sampler2D blocks;
+uniform vec2 map_size;
+
+#ifdef HAVE_TEXTURE_2D_ARRAY
+varying float tex_layer;
+#else
+uniform vec2 block_size;
+uniform float blocks_per_column;
+
+varying vec2 tex_origin;
+#endif
+
+varying vec2 tex_repeat;
+varying float wrap_t;
+varying float tint;
+
+/* Everything outside of the map is treated as an empty floor */
+vec4
+get_block(vec2 pos)
+{
+        if (any(lessThan(pos, vec2(0.0))) ||
+            any(greaterThanEqual(pos, map_size)))
+                return vec4(0.0);
+
+        return floor(texture2DLod(blocks, (pos + 0.5) / map_size, 0.0) *
+                     255.0 + 0.5);
+}
+
+float
+get_height(vec4 block)
+{
+        /* The type is in the top two bits. A half wall is type 1 and
+         * a full wall is type 2 which is also their height. Floors
+         * and specials are flat. */
+        float type = floor(block.a / 64.0);
+
+        return type > 2.5 ? 0.0 : type;
+}
+
+void
+main()
+{
+        vec2 pos = tile_position + block_offset;
+        vec4 block = get_block(pos);
+        float face = position.w;
+        float z = get_height(block);
+        float oz, image;
+        vec2 direction;
+        vec3 normal;
+
+        if (face < 0.5) {
+                /* Top */
+                image = mod(block.r, 64.0);
+                normal = vec3(0.0, 0.0, 1.0);
+                oz = z;
+                tex_repeat = vec2(position.x, 1.0 - position.y);
+                /* The tops repeat in both directions */
+                wrap_t = 1.0;
+        } else {
+                if (face < 1.5) {
+                        /* North */
+                        image = floor(block.r / 64.0) +
+                                mod(block.g, 16.0) * 4.0;
+                        direction = vec2(0.0, 1.0);
+                        tex_repeat.x = 1.0 - position.x;
+                } else if (face < 2.5) {
+                        /* South */
+                        image = floor(block.b / 4.0);
+                        direction = vec2(0.0, -1.0);
+                        tex_repeat.x = position.x;
+                } else if (face < 3.5) {
+                        /* West */
+                        image = mod(block.a, 64.0);
+                        direction = vec2(-1.0, 0.0);
+                        tex_repeat.x = 1.0 - position.y;
+                } else {
+                        /* East */
+                        image = floor(block.g / 16.0) +
+                                mod(block.b, 4.0) * 16.0;
+                        direction = vec2(1.0, 0.0);
+                        tex_repeat.x = position.y;
+                }
+
+                oz = get_height(get_block(pos + direction));
+
+                /* Faces that don't stick out above the neighbour
+                 * are collapsed so that they won't be rasterised */
+                if (z <= oz) {
+                        gl_Position = vec4(2.0, 2.0, 2.0, 1.0);
+                        return;
+                }
+
+                normal = vec3(direction, 0.0);
+                tex_repeat.y = (1.0 - position.z) * (z - oz);
+                /* The walls use the full height of the image */
+                wrap_t = 0.0;
+        }
+
+        tint = get_lighting_tint(normal_transform, normal);
+
+        gl_Position = transform * vec4(pos + position.xy,
+                                       mix(oz, z, position.z),
+                                       1.0);
+
+#ifdef HAVE_TEXTURE_2D_ARRAY
+        tex_layer = image;
+#else
+        /* Each column of images in the atlas is two blocks wide to
+         * make space for the padding */
+        float column = floor((image + 0.5) / blocks_per_column);
+        tex_origin = (vec2(column * 2.0,
+                           image - column * blocks_per_column) *
+                      block_size);
+#endif
+}
@@ -0,0 +1,82 @@
+/*
+ * Finvenkisto
+ *
+ * Copyright (C) 2026 Neil Roberts
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+varying vec2 tex_repeat;
+varying float wrap_t;
+varying float tint;
+
+#ifdef HAVE_TEXTURE_2D_ARRAY
+
+varying float tex_layer;
+
+uniform sampler2DArray tex;
+
+vec3
+get_color()
+{
+        /* The walls are two blocks high and each block is in its
+         * own layer. The texture is set to repeat so the coordinates
+         * can be used directly. The small scale stops the bottom
+         * edge of a half wall from reaching the next layer. */
+        float row = clamp(floor(tex_repeat.y * 0.999), 0.0, 1.0);
+
+        return texture2DArray(tex,
+                              vec3(tex_repeat,
+                                   tex_layer + row * (1.0 - wrap_t))).rgb;
+}
+
+#else /* HAVE_TEXTURE_2D_ARRAY */
+
+varying vec2 tex_origin;
+
+uniform sampler2D tex;
+uniform vec2 block_size;
+
+vec3
+get_color()
+{
+#ifdef HAVE_SHADER_TEXTURE_LOD
+        vec2 block_coord = vec2(fract(tex_repeat.x),
+                                mix(tex_repeat.y,
+                                    fract(tex_repeat.y),
+                                    wrap_t));
+        vec2 tex_coord = tex_origin + block_coord * block_size;
+        /* The wrapping makes the texture coordinates jump at the
+         * edge of each block which would make the automatic mipmap
+         * selection pick the smallest level there. The unwrapped
+         * coordinates give the right gradients. */
+        vec2 unwrapped = tex_repeat * block_size;
+        return texture2DGradARB(tex,
+                                tex_coord,
+                                dFdx(unwrapped),
+                                dFdy(unwrapped)).rgb;
+#else
+        /* The painter doesn't merge the faces when the mipmap level
+         * can't be picked so the coordinates never need wrapping */
+        return texture2D(tex, tex_origin + tex_repeat * block_size).rgb;
+#endif
+}
+
+#endif /* HAVE_TEXTURE_2D_ARRAY */
+
+void
+main()
+{
+        gl_FragColor = vec4(get_color() * tint, 1.0);
+}
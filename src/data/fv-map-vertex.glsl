@@ -17,37 +17,53 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+/* The lighting is baked into the fourth component of the position
+ * along with the ambient occlusion so this shader doesn't do any
+ * lighting calculations */
 attribute vec4 position;
-attribute vec2 tex_coord_attrib;
+/* The texture coordinates in blocks, the image number and whether
+ * the image repeats vertically */
+attribute vec4 tex_coord_attrib;
 
 uniform mat4 transform;
-uniform mat3 normal_transform;
+/* The position of the tile in blocks. The vertex positions are
+ * relative to this */
+uniform vec2 tile_position;
 
-varying vec2 tex_coord;
+#ifdef HAVE_TEXTURE_2D_ARRAY
+varying float tex_layer;
+#else
+uniform vec2 block_size;
+uniform float blocks_per_column;
+
+varying vec2 tex_origin;
+#endif
+
+varying vec2 tex_repeat;
+varying float wrap_t;
 varying float tint;
 
 void
 main()
 {
-        vec3 normal;
-
-        if (position[3] < 1.0) {
-                normal = vec3(0.0, 0.0, 1.0);
-        } else {
-                float normal_index = position[3] - 128.0;
-                float normal_sign = sign(normal_index);
+        tint = position.w / 255.0;
+        wrap_t = tex_coord_attrib.w;
 
-                normal.z = 0.0;
+        gl_Position = transform * vec4(position.xy + tile_position,
+                                       position.z,
+                                       1.0);
 
-                if (abs(normal_index) > 100.0)
-                        normal.xy = vec2(normal_sign, 0.0);
-                else
-                        normal.xy = vec2(0.0, normal_sign);
-        }
+        tex_repeat = tex_coord_attrib.xy;
 
-        tint = get_lighting_tint(normal_transform, normal);
-
-        gl_Position = transform * vec4(position.xyz, 1.0);
-        tex_coord = tex_coord_attrib;
+#ifdef HAVE_TEXTURE_2D_ARRAY
+        tex_layer = tex_coord_attrib.z;
+#else
+        /* Each column of images in the atlas is two blocks wide to
+         * make space for the padding */
+        float image = tex_coord_attrib.z;
+        float column = floor((image + 0.5) / blocks_per_column);
+        tex_origin = (vec2(column * 2.0,
+                           image - column * blocks_per_column) *
+                      block_size);
+#endif
 }
-
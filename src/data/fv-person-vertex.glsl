@@ -21,6 +21,10 @@ attribute vec3 position;
 attribute vec2 tex_coord_attrib;
 attribute vec3 normal_attrib;
 
+/* Used to undo the quantization of the model positions */
+uniform vec3 position_scale;
+uniform vec3 position_offset;
+
 #if defined(HAVE_INSTANCED_ARRAYS) && defined(HAVE_TEXTURE_2D_ARRAY)
 attribute mat4 transform;
 attribute mat3 normal_transform;
@@ -39,7 +43,9 @@ varying vec2 tint;
 void
 main()
 {
-        gl_Position = transform * vec4(position, 1.0);
+        gl_Position = transform * vec4(position * position_scale +
+                                       position_offset,
+                                       1.0);
 
 #if defined(HAVE_INSTANCED_ARRAYS) && defined(HAVE_TEXTURE_2D_ARRAY)
         tex_coord = vec3(tex_coord_attrib, tex_layer);
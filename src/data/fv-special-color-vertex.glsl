@@ -21,6 +21,10 @@ attribute vec3 position;
 attribute vec3 color_attrib;
 attribute vec3 normal_attrib;
 
+/* Used to undo the quantization of the model positions */
+uniform vec3 position_scale;
+uniform vec3 position_offset;
+
 #ifdef HAVE_INSTANCED_ARRAYS
 attribute mat4 transform;
 attribute mat3 normal_transform;
@@ -34,7 +38,9 @@ varying vec3 color;
 void
 main()
 {
-        gl_Position = transform * vec4(position, 1.0);
+        gl_Position = transform * vec4(position * position_scale +
+                                       position_offset,
+                                       1.0);
         color = color_attrib * get_lighting_tint(normal_transform,
                                                  normal_attrib);
 }
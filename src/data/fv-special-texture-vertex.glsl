@@ -21,6 +21,10 @@ attribute vec3 position;
 attribute vec2 tex_coord_attrib;
 attribute vec3 normal_attrib;
 
+/* Used to undo the quantization of the model positions */
+uniform vec3 position_scale;
+uniform vec3 position_offset;
+
 #ifdef HAVE_INSTANCED_ARRAYS
 attribute mat4 transform;
 attribute mat3 normal_transform;
@@ -35,7 +39,9 @@ varying float tint;
 void
 main()
 {
-        gl_Position = transform * vec4(position, 1.0);
+        gl_Position = transform * vec4(position * position_scale +
+                                       position_offset,
+                                       1.0);
         tex_coord = tex_coord_attrib;
         tint = get_lighting_tint(normal_transform, normal_attrib);
 }
@@ -35,7 +35,12 @@ def make_horizontal_padding(dst, dst_x, dst_y, src, src_x, src_y):
     for x in range(dst_x, dst_x + PADDING_SIZE):
         dst.paste(pattern, (x, dst_y))
 
-images = list(map(Image.open, sys.argv[2:]))
+if len(sys.argv) < 4:
+    sys.stderr.write("usage: make-map-texture.py <atlas> <layers> <header> "
+                     "<image>...\n")
+    sys.exit(1)
+
+images = list(map(Image.open, sys.argv[4:]))
 
 image_width = 0
 image_height = 0
@@ -123,3 +128,46 @@ for image in images:
                                     image, BLOCK_SIZE - 1, part)
 
 final_image.save(sys.argv[1])
+
+# The same images without any padding as a tall strip with one block
+# per layer for when texture arrays are available. Images that are
+# more than one block high take up consecutive layers.
+n_layers = sum(image.size[1] // BLOCK_SIZE for image in images)
+layers_image = Image.new('RGB', (BLOCK_SIZE, n_layers * BLOCK_SIZE))
+layer = 0
+
+for image in images:
+    layers_image.paste(image, (0, layer * BLOCK_SIZE))
+    image.layer = layer
+    layer += image.size[1] // BLOCK_SIZE
+
+layers_image.save(sys.argv[2])
+
+# The map refers to the images by their position in the atlas in
+# blocks so the header has a table to convert that to a layer. The
+# table has an entry for every value of the six-bit image fields of
+# a block so that the game can look up any block without checking it.
+N_SLOTS = 1 << 6
+blocks_per_column = image_height // BLOCK_SIZE
+slot_layers = {}
+
+for image in images:
+    slot = (image.position[0] // (BLOCK_SIZE + PADDING_SIZE * 2) *
+            blocks_per_column +
+            image.position[1] // BLOCK_SIZE)
+    if slot >= N_SLOTS:
+        sys.stderr.write("Too many images for the map texture\n")
+        sys.exit(1)
+    slot_layers[slot] = image.layer
+
+with open(sys.argv[3], 'w') as header:
+    header.write("/* Automatically generated by make-map-texture.py, "
+                 "do not edit */\n\n"
+                 "#define FV_MAP_TEXTURE_N_LAYERS {}\n\n"
+                 "static const uint8_t\n"
+                 "fv_map_texture_layers[] = {{\n".format(n_layers))
+
+    for slot in range(0, N_SLOTS):
+        header.write("        {},\n".format(slot_layers.get(slot, 0)))
+
+    header.write("};\n")
@@ -0,0 +1,504 @@
+# Finvenkisto
+#
+# Copyright (C) 2014, 2015, 2017 Neil Roberts
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+# Converts the map image into the binary map file that the game
+# loads at runtime. The layout must match the structs in
+# src/fv-map-format.h. Everything is little-endian.
+#
+# The file also contains the mesh for each tile so that the game
+# doesn't have to generate it. The generator below must produce
+# exactly the same vertices as the one in src/fv-map-mesh.c, which
+# is still used for tiles that are modified while the game is running.
+
+import sys
+import struct
+from PIL import Image
+
+MAP_WIDTH = 40
+MAP_HEIGHT = 48
+
+MAP_TILE_WIDTH = 8
+MAP_TILE_HEIGHT = 8
+
+MAP_TILES_X = MAP_WIDTH // MAP_TILE_WIDTH
+MAP_TILES_Y = MAP_HEIGHT // MAP_TILE_HEIGHT
+
+# Start position. When there is more than one player the players are
+# put on a horizontal line centered around this point
+MAP_START_X = MAP_WIDTH / 2.0
+MAP_START_Y = 8.5
+
+MAGIC = b'FVMAP003'
+HEADER_FORMAT = '<8sIIIIffIIIIIIIIIII'
+TILE_FORMAT = '<II'
+SPECIAL_FORMAT = '<HHHH'
+MESH_FORMAT = '<IIII'
+VERTEX_FORMAT = '<8B'
+ALIGNMENT = 16
+
+FLAG_WALL_MASK = 1 << 0
+FLAG_MESHES = 1 << 1
+
+# These must match the values in src/fv-map-mesh.c
+LIGHT_UP = 230
+LIGHT_NORTH = 128
+LIGHT_EAST = 162
+LIGHT_SOUTH = 196
+LIGHT_WEST = 128
+
+AO_FACTORS = [140, 179, 217, 255]
+
+BLOCK_TYPES = {
+    'FLOOR': 0,
+    'HALF_WALL': 1,
+    'FULL_WALL': 2,
+    'SPECIAL': 3
+}
+
+IMAGE_BLOCK_SIZE = 4
+
+# The map is defined by a PNG image. Each 4x4 rectangle of the image
+# represents a block in the map. The colours of the block have the
+# following significance:
+#
+#     xnxx
+#     wtxe
+#     xhxx
+#     xsxx
+#
+# Where the letters represent the following:
+#
+#  t:          The image to use for the top of the block. These are indexed
+#              from the TOPS dict.
+#  n, e, s, w: The colour for the walls of the block. However if the
+#              colour is the same as the top of the block then it is ignored.
+#              Otherwise they are indexed from the SIDES dict.
+#  h:          If this is different from the top colour then the tile is either
+#              a half-height wall, or an invisible block (ie, a
+#              special) depending on whether the walls are marked.
+#  x:          The colour is ignored.
+#
+# The ignored pixels are usually set to something as a reminder if
+# there are specials at that location although this script doesn't
+# check that.
+#
+# The area below the main map is used to describe the positions of the
+# specials. Each pair of pixels that is not white encodes a special.
+# The colours are interpreted as follows:
+#
+# R1  - x position
+# G1  - y position
+# B1  - special number
+# G2  - Most-significant byte of the rotation
+# B2  - Least-significant byte of the rotation
+#
+# The rotation is a 16-bit number where 65536 represents a full
+# rotation.
+
+TOPS = {
+    'b95': 4, # brick flooring
+    'c90': 0, # wall top
+    '452': 6, # grass
+    'eee': 2, # bathroom floor
+    '522': 19, # room floor
+    '933': 21, # wood
+    '54c': 31, # sleeping bag 1
+    '54d': 32 # sleeping bag 2
+}
+
+SIDES = {
+    '644': 8, # brick wall
+    '9cc': 11, # inner wall
+    'ddd': 14, # bathroom wall
+    'ccc': 16, # bathroom wall special
+    '911': 23, # table side
+    '56c': 25, # welcome poster 1
+    '56d': 28, # welcome poster 2
+    '001': 34, # chalkboard 1
+    '002': 37, # chalkboard 2
+}
+
+def peek_color(image, bx, by, x, y):
+    x += bx * IMAGE_BLOCK_SIZE
+    y += by * IMAGE_BLOCK_SIZE
+
+    def make_nibble(v):
+        if (v & 0xf) << 4 != (v & 0xf0):
+            sys.stderr.write("Bad colour at " + str(x) + ", " + str(y) + "\n")
+            sys.exit(1)
+        return hex(v >> 4)[2:]
+
+    return ''.join(map(make_nibble, image.getpixel((x, y))[0:3]))
+
+def compare_special(special):
+    # Sort by the special number
+    return special[3]
+
+def align(value):
+    return (value + ALIGNMENT - 1) & ~(ALIGNMENT - 1)
+
+def pad(data):
+    return data + b'\0' * (align(len(data)) - len(data))
+
+def generate_tiles(image):
+    tiles = [[] for i in range(0, MAP_TILES_X * MAP_TILES_Y)]
+
+    for x in range(0, image.size[0] - 1, 2):
+        for y in range(MAP_HEIGHT * IMAGE_BLOCK_SIZE, image.size[1]):
+            pos = image.getpixel((x, y))[0:3]
+
+            if pos == (255, 255, 255):
+                continue
+
+            details = image.getpixel((x + 1, y))
+
+            sx = pos[0]
+            sy = pos[1]
+            special_index = pos[2]
+            rotation = (details[1] << 8) | details[2]
+
+            tx = sx // MAP_TILE_WIDTH
+            ty = sy // MAP_TILE_HEIGHT
+            specials = tiles[tx + ty * MAP_TILES_X]
+
+            specials.append((sx, sy,
+                             rotation,
+                             special_index))
+
+    tile_data = []
+    special_data = []
+    n_specials = 0
+
+    for specials in tiles:
+        # Sort according to the model number so that the render can
+        # combine multiple copies of a model into a single draw call
+        specials.sort(key = compare_special)
+
+        tile_data.append(struct.pack(TILE_FORMAT, n_specials, len(specials)))
+
+        for special in specials:
+            special_data.append(struct.pack(SPECIAL_FORMAT, *special))
+
+        n_specials += len(specials)
+
+    return b''.join(tile_data), b''.join(special_data), n_specials
+
+def generate_blocks(image):
+    blocks = []
+    wall_mask = bytearray((MAP_WIDTH * MAP_HEIGHT + 7) // 8)
+
+    for y in range(MAP_HEIGHT - 1, -1, -1):
+        for x in range(0, MAP_WIDTH):
+            top_color = peek_color(image, x, y, 1, 1)
+            top = TOPS[top_color]
+            half_height_or_special = peek_color(image, x, y, 1, 2) != top_color
+
+            north_color = peek_color(image, x, y, 1, 0)
+            if north_color == top_color:
+                north = 0
+                east = 0
+                south = 0
+                west = 0
+
+                if half_height_or_special:
+                    block_type = 'SPECIAL'
+                else:
+                    block_type = 'FLOOR'
+            else:
+                north = SIDES[north_color]
+                east = SIDES[peek_color(image, x, y, 3, 1)]
+                south = SIDES[peek_color(image, x, y, 1, 3)]
+                west = SIDES[peek_color(image, x, y, 0, 1)]
+                if half_height_or_special:
+                    block_type = 'HALF_WALL'
+                else:
+                    block_type = 'FULL_WALL'
+
+            if block_type != 'FLOOR':
+                pos = len(blocks)
+                wall_mask[pos // 8] |= 1 << (pos % 8)
+
+            blocks.append((BLOCK_TYPES[block_type] << 30) |
+                          top |
+                          (north << 6) |
+                          (east << 12) |
+                          (south << 18) |
+                          (west << 24))
+
+    return blocks, bytes(wall_mask)
+
+def get_block_height(block):
+    block_type = block >> 30
+
+    if block_type == BLOCK_TYPES['FULL_WALL']:
+        return 2
+    elif block_type == BLOCK_TYPES['HALF_WALL']:
+        return 1
+    else:
+        return 0
+
+def get_position_height(blocks, x, y):
+    if x < 0 or x >= MAP_WIDTH or y < 0 or y >= MAP_HEIGHT:
+        return 0
+
+    return get_block_height(blocks[y * MAP_WIDTH + x])
+
+def get_light(face_light, ao):
+    return (face_light * AO_FACTORS[ao] + 127) // 255
+
+# Gets the ambient occlusion level for a corner of the top of a block
+# in the same way as the game
+def get_corner_ao(blocks, x, y, dx, dy, z):
+    side1 = get_position_height(blocks, x + dx, y) > z
+    side2 = get_position_height(blocks, x, y + dy) > z
+    corner = get_position_height(blocks, x + dx, y + dy) > z
+
+    if side1 and side2:
+        return 0
+
+    return 3 - (side1 + side2 + corner)
+
+# Returns a tuple of the image, the height of the top of the face and
+# the height of the bottom, or None if the face isn't visible. The
+# tops also have a tuple of the ambient occlusion level of each corner.
+def get_face(blocks, x, y, face_type):
+    block = blocks[y * MAP_WIDTH + x]
+    z = get_block_height(block)
+
+    if face_type == 'top':
+        ao = tuple(get_corner_ao(blocks, x, y, dx, dy, z)
+                   for dx, dy in [(-1, -1), (1, -1), (-1, 1), (1, 1)])
+        return (block & 0x3f, z, z, ao)
+    elif face_type == 'north':
+        face = ((block >> 6) & 0x3f, z, get_position_height(blocks, x, y + 1))
+    elif face_type == 'south':
+        face = ((block >> 18) & 0x3f, z, get_position_height(blocks, x, y - 1))
+    elif face_type == 'west':
+        face = ((block >> 24) & 0x3f, z, get_position_height(blocks, x - 1, y))
+    elif face_type == 'east':
+        face = ((block >> 12) & 0x3f, z, get_position_height(blocks, x + 1, y))
+
+    if face[1] > face[2]:
+        return face
+    else:
+        return None
+
+class Mesh:
+    def __init__(self, x, y):
+        self.x = x
+        self.y = y
+        self.vertices = []
+        self.indices = []
+
+    # Adds a quad. Each corner is a tuple of x, y, z in blocks and
+    # there is a light for each corner
+    def add_quad(self, corners, lights, image, width, height, wrap_t):
+        first = len(self.vertices)
+        tex_coords = [(0, height), (width, height), (0, 0), (width, 0)]
+
+        for (x, y, z), light, (s, t) in zip(corners, lights, tex_coords):
+            self.vertices.append(struct.pack(VERTEX_FORMAT,
+                                             x - self.x, y - self.y, z,
+                                             light,
+                                             s, t,
+                                             image,
+                                             wrap_t))
+
+        self.indices.extend(first + i for i in [0, 1, 2, 2, 1, 3])
+
+def generate_tops(blocks, mesh):
+    faces = [[get_face(blocks, mesh.x + x, mesh.y + y, 'top')
+              for x in range(0, MAP_TILE_WIDTH)]
+             for y in range(0, MAP_TILE_HEIGHT)]
+    used = [[False] * MAP_TILE_WIDTH for y in range(0, MAP_TILE_HEIGHT)]
+
+    # Greedily grow each unused square into the largest rectangle of
+    # matching squares in the same way as the game
+    for y in range(0, MAP_TILE_HEIGHT):
+        for x in range(0, MAP_TILE_WIDTH):
+            if used[y][x]:
+                continue
+
+            face = faces[y][x]
+            # Squares with different ambient occlusion at each corner
+            # can't be merged
+            mergeable = len(set(face[3])) == 1
+
+            w = 1
+            while (mergeable and
+                   x + w < MAP_TILE_WIDTH and
+                   not used[y][x + w] and
+                   faces[y][x + w] == face):
+                w += 1
+
+            h = 1
+            while (mergeable and
+                   y + h < MAP_TILE_HEIGHT and
+                   all(not used[y + h][x + i] and faces[y + h][x + i] == face
+                       for i in range(0, w))):
+                h += 1
+
+            for j in range(0, h):
+                for i in range(0, w):
+                    used[y + j][x + i] = True
+
+            x1 = mesh.x + x
+            y1 = mesh.y + y
+            x2 = x1 + w
+            y2 = y1 + h
+            z = face[1]
+
+            mesh.add_quad([(x1, y1, z), (x2, y1, z), (x1, y2, z), (x2, y2, z)],
+                          [get_light(LIGHT_UP, ao) for ao in face[3]],
+                          face[0],
+                          w, h,
+                          1)
+
+def add_side(mesh, face_type, face, line, start, end):
+    image, z, oz = face
+
+    if face_type == 'north':
+        corners = [(end, line + 1, oz), (start, line + 1, oz),
+                   (end, line + 1, z), (start, line + 1, z)]
+        light = LIGHT_NORTH
+    elif face_type == 'south':
+        corners = [(start, line, oz), (end, line, oz),
+                   (start, line, z), (end, line, z)]
+        light = LIGHT_SOUTH
+    elif face_type == 'west':
+        corners = [(line, end, oz), (line, start, oz),
+                   (line, end, z), (line, start, z)]
+        light = LIGHT_WEST
+    elif face_type == 'east':
+        corners = [(line + 1, start, oz), (line + 1, end, oz),
+                   (line + 1, start, z), (line + 1, end, z)]
+        light = LIGHT_EAST
+
+    mesh.add_quad(corners,
+                  [get_light(light, 3)] * 4,
+                  image,
+                  end - start, z - oz,
+                  0)
+
+def generate_sides(blocks, mesh, face_type):
+    along_x = face_type in ('north', 'south')
+
+    if along_x:
+        lines = range(mesh.y, mesh.y + MAP_TILE_HEIGHT)
+        line_start = mesh.x
+        line_length = MAP_TILE_WIDTH
+    else:
+        lines = range(mesh.x, mesh.x + MAP_TILE_WIDTH)
+        line_start = mesh.y
+        line_length = MAP_TILE_HEIGHT
+
+    # The walls are merged along the line of blocks that they face
+    for line in lines:
+        run = None
+        run_start = 0
+
+        for pos in range(line_start, line_start + line_length + 1):
+            if pos < line_start + line_length:
+                if along_x:
+                    face = get_face(blocks, pos, line, face_type)
+                else:
+                    face = get_face(blocks, line, pos, face_type)
+            else:
+                face = None
+
+            if run is not None and face != run:
+                add_side(mesh, face_type, run, line, run_start, pos)
+                run = None
+
+            if face is not None and run is None:
+                run = face
+                run_start = pos
+
+def generate_meshes(blocks):
+    meshes = []
+    vertices = []
+    indices = []
+
+    for ty in range(0, MAP_TILES_Y):
+        for tx in range(0, MAP_TILES_X):
+            mesh = Mesh(tx * MAP_TILE_WIDTH, ty * MAP_TILE_HEIGHT)
+
+            generate_tops(blocks, mesh)
+            for face_type in ('north', 'south', 'west', 'east'):
+                generate_sides(blocks, mesh, face_type)
+
+            meshes.append(struct.pack(MESH_FORMAT,
+                                      len(vertices),
+                                      len(mesh.vertices),
+                                      len(indices),
+                                      len(mesh.indices)))
+            vertices.extend(mesh.vertices)
+            indices.extend(mesh.indices)
+
+    return (b''.join(meshes),
+            b''.join(vertices),
+            struct.pack('<' + str(len(indices)) + 'H', *indices),
+            len(vertices),
+            len(indices))
+
+if len(sys.argv) != 3:
+    sys.stderr.write("usage: make-map.py <map-image> <output>\n")
+    sys.exit(1)
+
+image = Image.open(sys.argv[1])
+
+if (image.size[0] < MAP_WIDTH * IMAGE_BLOCK_SIZE or
+    image.size[1] < MAP_HEIGHT * IMAGE_BLOCK_SIZE):
+    sys.stderr.write("Map image is not the correct size\n")
+    sys.exit(1)
+
+blocks, wall_mask = generate_blocks(image)
+tiles, specials, n_specials = generate_tiles(image)
+meshes, vertices, indices, n_vertices, n_indices = generate_meshes(blocks)
+
+sections = [struct.pack('<' + str(len(blocks)) + 'I', *blocks),
+            tiles,
+            specials,
+            wall_mask,
+            meshes,
+            vertices,
+            indices]
+offsets = []
+offset = align(struct.calcsize(HEADER_FORMAT))
+
+for section in sections:
+    offsets.append(offset)
+    offset += align(len(section))
+
+header = struct.pack(HEADER_FORMAT,
+                     MAGIC,
+                     MAP_WIDTH,
+                     MAP_HEIGHT,
+                     MAP_TILE_WIDTH,
+                     MAP_TILE_HEIGHT,
+                     MAP_START_X,
+                     MAP_START_Y,
+                     n_specials,
+                     FLAG_WALL_MASK | FLAG_MESHES,
+                     n_vertices,
+                     n_indices,
+                     *offsets)
+
+with open(sys.argv[2], 'wb') as out:
+    out.write(pad(header))
+    for section in sections:
+        out.write(pad(section))
@@ -0,0 +1,100 @@
+#!/usr/bin/python3
+
+# Finvenkisto
+#
+# Copyright (C) 2026 Neil Roberts
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+# Packs all of the data files into a single archive that the game can
+# map into memory and upload directly to GL without decoding
+# anything. The layout must match the structs in src/fv-pack.h.
+# Everything is little-endian. The models should be given as the .fvm
+# files generated by make-fvm, which are already in a GPU-ready form,
+# so they are stored verbatim like the shaders.
+
+from PIL import Image
+import struct
+import sys
+import os
+
+MAGIC = b'FVPACK01'
+HEADER_FORMAT = '<8sII'
+ENTRY_FORMAT = '<56sII'
+IMAGE_HEADER_FORMAT = '<IIII'
+ALIGNMENT = 16
+
+def align(value):
+    return (value + ALIGNMENT - 1) & ~(ALIGNMENT - 1)
+
+def pad(data):
+    return data + b'\0' * (align(len(data)) - len(data))
+
+def pack_image(filename):
+    image = Image.open(filename)
+
+    # Convert to the same number of components that stb_image would
+    # give us
+    if image.mode == 'P':
+        if 'transparency' in image.info:
+            image = image.convert('RGBA')
+        else:
+            image = image.convert('RGB')
+    elif image.mode not in ('L', 'LA', 'RGB', 'RGBA'):
+        image = image.convert('RGBA')
+
+    components = len(image.mode)
+    header = struct.pack(IMAGE_HEADER_FORMAT,
+                         image.size[0],
+                         image.size[1],
+                         components,
+                         0)
+
+    return pad(header) + image.tobytes()
+
+def pack_file(filename):
+    if filename.endswith('.png'):
+        return pack_image(filename)
+    else:
+        with open(filename, 'rb') as f:
+            return f.read()
+
+if len(sys.argv) < 2:
+    print("usage: make-pack.py <output> <file>...", file=sys.stderr)
+    sys.exit(1)
+
+# The entries are sorted by name so that the game can do a binary
+# search
+files = sorted(sys.argv[2:], key=os.path.basename)
+
+entries = []
+offset = align(struct.calcsize(HEADER_FORMAT) +
+               struct.calcsize(ENTRY_FORMAT) * len(files))
+blobs = []
+
+for filename in files:
+    name = os.path.basename(filename).encode('utf-8')
+    if len(name) >= struct.calcsize('<56s'):
+        raise Exception(filename + ': name too long')
+
+    blob = pack_file(filename)
+    entries.append(struct.pack(ENTRY_FORMAT, name, offset, len(blob)))
+    blobs.append(pad(blob))
+    offset += len(blobs[-1])
+
+with open(sys.argv[1], 'wb') as out:
+    toc = struct.pack(HEADER_FORMAT, MAGIC, len(files), 0) + b''.join(entries)
+    out.write(pad(toc))
+    for blob in blobs:
+        out.write(blob)
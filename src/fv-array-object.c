@@ -27,23 +27,9 @@
 #include "fv-gl.h"
 #include "fv-util.h"
 
-#define MAX_ATTRIBUTES 16
-
-static uint32_t enabled_attribs = 0;
-
-struct fv_array_object_attribute {
-        GLint size;
-        GLenum type;
-        GLboolean normalized;
-        GLsizei stride;
-        GLuint divisor;
-        GLuint buffer;
-        size_t buffer_offset;
-};
-
 struct fv_array_object {
         uint32_t enabled_attribs;
-        struct fv_array_object_attribute attributes[MAX_ATTRIBUTES];
+        struct fv_gl_attribute attributes[FV_GL_MAX_ATTRIBUTES];
         GLuint element_buffer;
 };
 
@@ -87,8 +73,8 @@ fv_array_object_set_attribute(struct fv_array_object *array,
 
         if (fv_gl.have_vertex_array_objects) {
                 vao = FV_ARRAY_OBJECT_FROM_POINTER(array);
-                fv_gl.glBindVertexArray(vao);
-                fv_gl.glBindBuffer(GL_ARRAY_BUFFER, buffer);
+                fv_gl_bind_vertex_array(vao);
+                fv_gl_bind_buffer(GL_ARRAY_BUFFER, buffer);
                 fv_gl.glVertexAttribPointer(index,
                                             size,
                                             type,
@@ -116,7 +102,7 @@ fv_array_object_set_element_buffer(struct fv_array_object *array,
                                    GLuint buffer)
 {
         if (fv_gl.have_vertex_array_objects)
-                fv_gl.glBindVertexArray(FV_ARRAY_OBJECT_FROM_POINTER(array));
+                fv_gl_bind_vertex_array(FV_ARRAY_OBJECT_FROM_POINTER(array));
         else
                 array->element_buffer = buffer;
 
@@ -124,45 +110,75 @@ fv_array_object_set_element_buffer(struct fv_array_object *array,
          * available so that the callee can assume it's bound and fill
          * it with data.
          */
-        fv_gl.glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffer);
+        fv_gl_bind_buffer(GL_ELEMENT_ARRAY_BUFFER, buffer);
+}
+
+static bool
+attribute_pointer_equal(const struct fv_gl_attribute *a,
+                        const struct fv_gl_attribute *b)
+{
+        return (a->size == b->size &&
+                a->type == b->type &&
+                a->normalized == b->normalized &&
+                a->stride == b->stride &&
+                a->buffer == b->buffer &&
+                a->buffer_offset == b->buffer_offset);
+}
+
+static void
+apply_attribute(int index,
+                const struct fv_gl_attribute *attrib)
+{
+        struct fv_gl_state *state = &fv_gl.state;
+        struct fv_gl_attribute *applied = state->attributes + index;
+        bool known = !!(state->known_attributes & (1 << index));
+        bool redundant;
+
+        /* Only emit the calls for the parts of the attribute state
+         * that differ from what was last applied to this index */
+
+        redundant = known && attribute_pointer_equal(applied, attrib);
+
+        if (!fv_gl_record_state_call(redundant)) {
+                fv_gl_bind_buffer(GL_ARRAY_BUFFER, attrib->buffer);
+                fv_gl.glVertexAttribPointer(index,
+                                            attrib->size,
+                                            attrib->type,
+                                            attrib->normalized,
+                                            attrib->stride,
+                                            (GLvoid *) (intptr_t)
+                                            attrib->buffer_offset);
+        }
+
+        if (fv_gl.have_instanced_arrays) {
+                redundant = known && applied->divisor == attrib->divisor;
+
+                if (!fv_gl_record_state_call(redundant))
+                        fv_gl.glVertexAttribDivisor(index, attrib->divisor);
+        }
+
+        *applied = *attrib;
+        state->known_attributes |= 1 << index;
 }
 
 void
 fv_array_object_bind(struct fv_array_object *array)
 {
-        const struct fv_array_object_attribute *attrib;
-        GLuint last_buffer;
+        uint32_t enabled_attribs = fv_gl.state.enabled_attributes;
         uint32_t attribs;
         int index;
 
         if (fv_gl.have_vertex_array_objects) {
-                fv_gl.glBindVertexArray(FV_ARRAY_OBJECT_FROM_POINTER(array));
+                fv_gl_bind_vertex_array(FV_ARRAY_OBJECT_FROM_POINTER(array));
                 return;
         }
 
-        last_buffer = ~(GLuint) 0;
         attribs = array->enabled_attribs;
 
         while ((index = fv_util_ffs(attribs))) {
                 index--;
-                attrib = array->attributes + index;
                 attribs &= ~(1 << index);
-
-                if (last_buffer != attrib->buffer) {
-                        last_buffer = attrib->buffer;
-                        fv_gl.glBindBuffer(GL_ARRAY_BUFFER, last_buffer);
-                }
-
-                fv_gl.glVertexAttribPointer(index,
-                                            attrib->size,
-                                            attrib->type,
-                                            attrib->normalized,
-                                            attrib->stride,
-                                            (GLvoid *) (intptr_t)
-                                            attrib->buffer_offset);
-
-                if (fv_gl.have_instanced_arrays)
-                        fv_gl.glVertexAttribDivisor(index, attrib->divisor);
+                apply_attribute(index, array->attributes + index);
         }
 
         attribs = array->enabled_attribs ^ enabled_attribs;
@@ -177,11 +193,11 @@ fv_array_object_bind(struct fv_array_object *array)
                         fv_gl.glDisableVertexAttribArray(index);
         }
 
-        enabled_attribs = array->enabled_attribs;
+        fv_gl.state.enabled_attributes = array->enabled_attribs;
 
         if (array->element_buffer)
-                fv_gl.glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,
-                                   array->element_buffer);
+                fv_gl_bind_buffer(GL_ELEMENT_ARRAY_BUFFER,
+                                  array->element_buffer);
 }
 
 void
@@ -191,7 +207,7 @@ fv_array_object_free(struct fv_array_object *array)
 
         if (fv_gl.have_vertex_array_objects) {
                 vao = FV_ARRAY_OBJECT_FROM_POINTER(array);
-                fv_gl.glDeleteVertexArrays(1, &vao);
+                fv_gl_delete_vertex_arrays(1, &vao);
         } else {
                 fv_free(array);
         }
@@ -23,6 +23,7 @@
 
 #include "fv-data.h"
 #include "fv-util.h"
+#include "fv-pack.h"
 
 #ifdef WIN32
 #define FV_DATA_SEPARATOR "\\"
@@ -30,26 +31,96 @@
 #define FV_DATA_SEPARATOR "/"
 #endif
 
+#define FV_DATA_PACK_NAME "finvenkisto.pack"
+
+#ifndef EMSCRIPTEN
+static char *
+data_path = NULL;
+
+static struct fv_pack *
+data_pack = NULL;
+#endif
+
+void
+fv_data_init(void)
+{
+#ifndef EMSCRIPTEN
+        char *base_path = SDL_GetBasePath();
+        char *pack_filename;
+
+        if (base_path == NULL)
+                return;
+
+        data_path = fv_strconcat(base_path,
+                                 FV_DATA_SEPARATOR "data" FV_DATA_SEPARATOR,
+                                 NULL);
+
+        SDL_free(base_path);
+
+        pack_filename = fv_strconcat(data_path, FV_DATA_PACK_NAME, NULL);
+        data_pack = fv_pack_open(pack_filename);
+        fv_free(pack_filename);
+#endif /* EMSCRIPTEN */
+}
+
+const void *
+fv_data_get_packed(const char *name,
+                   size_t *size)
+{
+#ifdef EMSCRIPTEN
+        return NULL;
+#else
+        if (data_pack == NULL)
+                return NULL;
+
+        return fv_pack_find(data_pack, name, size);
+#endif
+}
+
 char *
 fv_data_get_filename(const char *name)
 {
 #ifdef EMSCRIPTEN
         return fv_strdup(name);
 #else
-        char *data_path = SDL_GetBasePath();
+        if (data_path == NULL)
+                return NULL;
+
+        return fv_strconcat(data_path, name, NULL);
+#endif /* EMSCRIPTEN */
+}
+
+char *
+fv_data_get_cache_filename(const char *name)
+{
+#ifdef EMSCRIPTEN
+        return NULL;
+#else
+        char *cache_path = SDL_GetPrefPath("finvenkisto", "finvenkisto");
         char *full_path;
 
-        if (data_path == NULL)
+        if (cache_path == NULL)
                 return NULL;
 
-        full_path = fv_strconcat(data_path,
-                                 FV_DATA_SEPARATOR "data"
-                                 FV_DATA_SEPARATOR,
-                                 name,
-                                 NULL);
+        /* The pref path always ends with a separator */
+        full_path = fv_strconcat(cache_path, name, NULL);
 
-        SDL_free(data_path);
+        SDL_free(cache_path);
 
         return full_path;
 #endif /* EMSCRIPTEN */
 }
+
+void
+fv_data_deinit(void)
+{
+#ifndef EMSCRIPTEN
+        if (data_pack) {
+                fv_pack_close(data_pack);
+                data_pack = NULL;
+        }
+
+        fv_free(data_path);
+        data_path = NULL;
+#endif
+}
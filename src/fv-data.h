@@ -20,7 +20,34 @@
 #ifndef FV_DATA_H
 #define FV_DATA_H
 
+#include <stddef.h>
+
+/* Must be called before any of the other functions. It finds the data
+ * directory and maps the data pack if there is one.
+ */
+void
+fv_data_init(void);
+
 char *
 fv_data_get_filename(const char *name);
 
+/* Gets the data for a file from the pre-built data pack. Returns NULL
+ * if there is no pack or the file isn't in it, in which case the
+ * file should be loaded with fv_data_get_filename instead. This can
+ * be called from any thread.
+ */
+const void *
+fv_data_get_packed(const char *name,
+                   size_t *size);
+
+/* Gets the full path to a file in a per-user directory that can be
+ * used to cache generated data between runs. Returns NULL if there
+ * is no such directory.
+ */
+char *
+fv_data_get_cache_filename(const char *name);
+
+void
+fv_data_deinit(void);
+
 #endif /* FV_DATA_H */
@@ -0,0 +1,123 @@
+/*
+ * Finvenkisto
+ *
+ * Copyright (C) 2026 Neil Roberts
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+
+#ifdef HAVE_MMAP
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "fv-file.h"
+#include "fv-util.h"
+
+#ifdef HAVE_MMAP
+
+const uint8_t *
+fv_file_map(const char *filename,
+            size_t *size_out)
+{
+        struct stat statbuf;
+        void *data;
+        int fd;
+
+        fd = open(filename, O_RDONLY);
+
+        if (fd == -1)
+                return NULL;
+
+        if (fstat(fd, &statbuf) == -1 || statbuf.st_size <= 0) {
+                close(fd);
+                return NULL;
+        }
+
+        data = mmap(NULL, /* addr */
+                    statbuf.st_size,
+                    PROT_READ,
+                    MAP_PRIVATE,
+                    fd,
+                    0 /* offset */);
+
+        close(fd);
+
+        if (data == MAP_FAILED)
+                return NULL;
+
+        *size_out = statbuf.st_size;
+
+        return data;
+}
+
+void
+fv_file_unmap(const uint8_t *data,
+              size_t size)
+{
+        munmap((void *) data, size);
+}
+
+#else /* HAVE_MMAP */
+
+const uint8_t *
+fv_file_map(const char *filename,
+            size_t *size_out)
+{
+        uint8_t *data;
+        FILE *file;
+        long size;
+
+        file = fopen(filename, "rb");
+
+        if (file == NULL)
+                return NULL;
+
+        if (fseek(file, 0, SEEK_END) != 0 ||
+            (size = ftell(file)) <= 0 ||
+            fseek(file, 0, SEEK_SET) != 0) {
+                fclose(file);
+                return NULL;
+        }
+
+        data = fv_alloc(size);
+
+        if (fread(data, 1, size, file) != size) {
+                fv_free(data);
+                fclose(file);
+                return NULL;
+        }
+
+        fclose(file);
+
+        *size_out = size;
+
+        return data;
+}
+
+void
+fv_file_unmap(const uint8_t *data,
+              size_t size)
+{
+        fv_free((void *) data);
+}
+
+#endif /* HAVE_MMAP */
@@ -0,0 +1,39 @@
+/*
+ * Finvenkisto
+ *
+ * Copyright (C) 2026 Neil Roberts
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FV_FILE_H
+#define FV_FILE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Maps the whole of a file read-only into memory. If mmap isn't
+ * available the file is read into an allocated buffer instead.
+ * Returns NULL if the file can't be opened or is empty. Errors are
+ * not reported.
+ */
+const uint8_t *
+fv_file_map(const char *filename,
+            size_t *size_out);
+
+void
+fv_file_unmap(const uint8_t *data,
+              size_t size);
+
+#endif /* FV_FILE_H */
@@ -0,0 +1,294 @@
+/*
+ * Finvenkisto
+ *
+ * Copyright (C) 2026 Neil Roberts
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <SDL.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "fv-frame-scheduler.h"
+#include "fv-util.h"
+#include "fv-buffer.h"
+
+/* SDL_Delay can oversleep by a millisecond or two so the last part
+ * of the wait for the next frame is spent spinning instead */
+#define FV_FRAME_SCHEDULER_SPIN_TIME_MS 2
+
+/* Number of recent input latencies kept to calculate the
+ * percentiles */
+#define FV_FRAME_SCHEDULER_MAX_LATENCIES 4096
+
+struct fv_frame_scheduler {
+        /* Time between frames at the frame rate cap in units of
+         * SDL_GetPerformanceCounter or zero if there is no cap */
+        Uint64 frame_period;
+        /* The earliest time that the next frame can start */
+        Uint64 next_frame_start;
+        /* The time that the last frame ended or zero if there hasn't
+         * been one yet */
+        Uint64 last_frame_end;
+
+        /* Times of the input events that haven't been shown yet in
+         * units of SDL_GetPerformanceCounter. The first
+         * n_latched_inputs of them are included in the current
+         * frame. */
+        struct fv_buffer pending_inputs;
+        size_t n_latched_inputs;
+
+        /* Ring buffer of the most recent latencies */
+        Uint64 latencies[FV_FRAME_SCHEDULER_MAX_LATENCIES];
+
+        struct fv_frame_scheduler_stats stats;
+};
+
+static int
+set_swap_interval(enum fv_frame_scheduler_vsync vsync)
+{
+#ifdef EMSCRIPTEN
+        /* The browser decides when to paint and setting the swap
+         * interval on Emscripten would change the main loop timing */
+        return 1;
+#else
+        switch (vsync) {
+        case FV_FRAME_SCHEDULER_VSYNC_ADAPTIVE:
+                if (SDL_GL_SetSwapInterval(-1) == 0)
+                        return -1;
+                /* flow through */
+        case FV_FRAME_SCHEDULER_VSYNC_ON:
+                if (SDL_GL_SetSwapInterval(1) == 0)
+                        return 1;
+                break;
+        case FV_FRAME_SCHEDULER_VSYNC_OFF:
+                break;
+        }
+
+        SDL_GL_SetSwapInterval(0);
+
+        return 0;
+#endif
+}
+
+struct fv_frame_scheduler *
+fv_frame_scheduler_new(enum fv_frame_scheduler_vsync vsync,
+                       int max_fps)
+{
+        struct fv_frame_scheduler *scheduler = fv_alloc(sizeof *scheduler);
+
+        memset(&scheduler->stats, 0, sizeof scheduler->stats);
+
+        if (max_fps > 0) {
+                scheduler->frame_period =
+                        SDL_GetPerformanceFrequency() / max_fps;
+        } else {
+                scheduler->frame_period = 0;
+        }
+
+        scheduler->next_frame_start = 0;
+        scheduler->last_frame_end = 0;
+
+        fv_buffer_init(&scheduler->pending_inputs);
+        scheduler->n_latched_inputs = 0;
+
+        scheduler->stats.swap_interval = set_swap_interval(vsync);
+
+        return scheduler;
+}
+
+static void
+sleep_until(Uint64 target)
+{
+        Uint64 frequency = SDL_GetPerformanceFrequency();
+        Uint64 now, remaining_ms;
+
+        while ((now = SDL_GetPerformanceCounter()) < target) {
+                remaining_ms = (target - now) * 1000 / frequency;
+
+                if (remaining_ms > FV_FRAME_SCHEDULER_SPIN_TIME_MS) {
+                        SDL_Delay(remaining_ms -
+                                  FV_FRAME_SCHEDULER_SPIN_TIME_MS);
+                }
+        }
+}
+
+void
+fv_frame_scheduler_begin_frame(struct fv_frame_scheduler *scheduler)
+{
+        Uint64 period = scheduler->frame_period;
+        Uint64 start;
+
+        if (period == 0)
+                return;
+
+        start = SDL_GetPerformanceCounter();
+
+        if (start < scheduler->next_frame_start) {
+                sleep_until(scheduler->next_frame_start);
+                scheduler->stats.sleep_time +=
+                        SDL_GetPerformanceCounter() - start;
+                start = scheduler->next_frame_start;
+        }
+
+        /* The next frame is scheduled from when this one was due
+         * rather than when it actually started so that the frame
+         * rate doesn't drift. If the frame was more than a whole
+         * period late then it starts again from now instead of
+         * trying to catch up with a burst of frames. */
+        if (start - scheduler->next_frame_start > period)
+                scheduler->next_frame_start = start + period;
+        else
+                scheduler->next_frame_start += period;
+}
+
+static void
+record_latencies(struct fv_frame_scheduler *scheduler,
+                 Uint64 now)
+{
+        struct fv_frame_scheduler_stats *stats = &scheduler->stats;
+        Uint64 *inputs = (Uint64 *) scheduler->pending_inputs.data;
+        size_t n_latched = scheduler->n_latched_inputs;
+        Uint64 latency;
+        size_t i;
+
+        for (i = 0; i < n_latched; i++) {
+                latency = now > inputs[i] ? now - inputs[i] : 0;
+
+                scheduler->latencies[stats->n_latencies %
+                                     FV_FRAME_SCHEDULER_MAX_LATENCIES] =
+                        latency;
+
+                if (latency > stats->max_latency)
+                        stats->max_latency = latency;
+
+                stats->n_latencies++;
+        }
+
+        memmove(inputs,
+                inputs + n_latched,
+                scheduler->pending_inputs.length - n_latched * sizeof *inputs);
+        scheduler->pending_inputs.length -= n_latched * sizeof *inputs;
+        scheduler->n_latched_inputs = 0;
+}
+
+void
+fv_frame_scheduler_end_frame(struct fv_frame_scheduler *scheduler)
+{
+        struct fv_frame_scheduler_stats *stats = &scheduler->stats;
+        Uint64 now = SDL_GetPerformanceCounter();
+        Uint64 frame_time;
+
+        if (scheduler->n_latched_inputs > 0)
+                record_latencies(scheduler, now);
+
+        if (scheduler->last_frame_end) {
+                frame_time = now - scheduler->last_frame_end;
+
+                if (stats->n_frames == 0 ||
+                    frame_time < stats->min_frame_time)
+                        stats->min_frame_time = frame_time;
+                if (frame_time > stats->max_frame_time)
+                        stats->max_frame_time = frame_time;
+
+                stats->frame_time += frame_time;
+                stats->n_frames++;
+        }
+
+        scheduler->last_frame_end = now;
+}
+
+void
+fv_frame_scheduler_idle(struct fv_frame_scheduler *scheduler)
+{
+        scheduler->last_frame_end = 0;
+        scheduler->stats.n_idle_waits++;
+}
+
+void
+fv_frame_scheduler_queue_input(struct fv_frame_scheduler *scheduler,
+                               uint32_t timestamp)
+{
+        Uint64 now = SDL_GetPerformanceCounter();
+        Sint32 age = SDL_GetTicks() - timestamp;
+        Uint64 input_time;
+
+        /* The event timestamp only has millisecond precision so it is
+         * converted to the performance counter by subtracting its age
+         * from the current time */
+        if (age > 0)
+                input_time = now - SDL_GetPerformanceFrequency() * age / 1000;
+        else
+                input_time = now;
+
+        fv_buffer_append(&scheduler->pending_inputs,
+                         &input_time,
+                         sizeof input_time);
+}
+
+void
+fv_frame_scheduler_latch_inputs(struct fv_frame_scheduler *scheduler)
+{
+        scheduler->n_latched_inputs =
+                scheduler->pending_inputs.length / sizeof (Uint64);
+}
+
+static int
+compare_latency(const void *a,
+                const void *b)
+{
+        Uint64 latency_a = *(const Uint64 *) a;
+        Uint64 latency_b = *(const Uint64 *) b;
+
+        if (latency_a < latency_b)
+                return -1;
+        if (latency_a > latency_b)
+                return 1;
+        return 0;
+}
+
+void
+fv_frame_scheduler_get_stats(struct fv_frame_scheduler *scheduler,
+                             struct fv_frame_scheduler_stats *stats)
+{
+        Uint64 *sorted;
+        size_t n;
+
+        *stats = scheduler->stats;
+
+        n = MIN(stats->n_latencies, FV_FRAME_SCHEDULER_MAX_LATENCIES);
+
+        if (n == 0)
+                return;
+
+        sorted = fv_alloc(n * sizeof *sorted);
+        memcpy(sorted, scheduler->latencies, n * sizeof *sorted);
+        qsort(sorted, n, sizeof *sorted, compare_latency);
+
+        stats->latency_p50 = sorted[(n - 1) * 50 / 100];
+        stats->latency_p90 = sorted[(n - 1) * 90 / 100];
+        stats->latency_p99 = sorted[(n - 1) * 99 / 100];
+
+        fv_free(sorted);
+}
+
+void
+fv_frame_scheduler_free(struct fv_frame_scheduler *scheduler)
+{
+        fv_buffer_destroy(&scheduler->pending_inputs);
+        fv_free(scheduler);
+}
@@ -0,0 +1,99 @@
+/*
+ * Finvenkisto
+ *
+ * Copyright (C) 2026 Neil Roberts
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FV_FRAME_SCHEDULER_H
+#define FV_FRAME_SCHEDULER_H
+
+#include <stdint.h>
+
+enum fv_frame_scheduler_vsync {
+        FV_FRAME_SCHEDULER_VSYNC_OFF,
+        FV_FRAME_SCHEDULER_VSYNC_ON,
+        /* Waits for the vertical blank unless the frame is late in
+         * which case it swaps immediately. Falls back to normal vsync
+         * if the driver doesn't support it. */
+        FV_FRAME_SCHEDULER_VSYNC_ADAPTIVE
+};
+
+struct fv_frame_scheduler_stats {
+        /* The swap interval that the driver accepted */
+        int swap_interval;
+        /* Number of frame times recorded. There isn't one for the
+         * first frame. */
+        unsigned long n_frames;
+        /* Total, shortest and longest time between the end of two
+         * frames in units of SDL_GetPerformanceCounter */
+        uint64_t frame_time;
+        uint64_t min_frame_time;
+        uint64_t max_frame_time;
+        /* Time spent sleeping to keep to the frame rate cap */
+        uint64_t sleep_time;
+        /* Number of times the main loop waited for an event because
+         * nothing needed painting */
+        unsigned long n_idle_waits;
+        /* Number of input events whose latency was measured from
+         * the event until the swap of the first frame that included
+         * it. The percentiles only cover the most recent events. */
+        unsigned long n_latencies;
+        uint64_t latency_p50;
+        uint64_t latency_p90;
+        uint64_t latency_p99;
+        uint64_t max_latency;
+};
+
+/* Must be called with the GL context current because it sets the
+ * swap interval. A max_fps of zero means there is no cap. */
+struct fv_frame_scheduler *
+fv_frame_scheduler_new(enum fv_frame_scheduler_vsync vsync,
+                       int max_fps);
+
+/* Sleeps until it is time to start the next frame */
+void
+fv_frame_scheduler_begin_frame(struct fv_frame_scheduler *scheduler);
+
+/* Records the timing of a frame. Should be called after swapping the
+ * buffers. */
+void
+fv_frame_scheduler_end_frame(struct fv_frame_scheduler *scheduler);
+
+/* Should be called when the main loop waits for an event instead of
+ * painting so that the time spent waiting isn't counted as a frame */
+void
+fv_frame_scheduler_idle(struct fv_frame_scheduler *scheduler);
+
+/* Records an input event that happened at the given SDL_GetTicks
+ * time so that its latency can be measured */
+void
+fv_frame_scheduler_queue_input(struct fv_frame_scheduler *scheduler,
+                               uint32_t timestamp);
+
+/* Should be called once the state for the frame has been fetched and
+ * it includes all of the queued inputs. Their latency will be
+ * recorded when the frame ends. */
+void
+fv_frame_scheduler_latch_inputs(struct fv_frame_scheduler *scheduler);
+
+void
+fv_frame_scheduler_get_stats(struct fv_frame_scheduler *scheduler,
+                             struct fv_frame_scheduler_stats *stats);
+
+void
+fv_frame_scheduler_free(struct fv_frame_scheduler *scheduler);
+
+#endif /* FV_FRAME_SCHEDULER_H */
@@ -35,6 +35,7 @@
 #include "fv-map.h"
 #include "fv-gl.h"
 #include "fv-paint-state.h"
+#include "fv-static-geometry.h"
 
 #define FV_GAME_FRUSTUM_TOP 1.428f
 /* 40° vertical FOV angle when the height of the display is
@@ -52,6 +53,9 @@ struct fv_game {
 
         struct fv_paint_state paint_state;
 
+        /* Shared buffers for the vertices of all the static models */
+        struct fv_static_geometry *static_geometry;
+
         struct fv_map_painter *map_painter;
         struct fv_person_painter *person_painter;
         struct fv_shout_painter *shout_painter;
@@ -74,11 +78,17 @@ fv_game_new(struct fv_image_data *image_data,
                          -30.0f,
                          1.0f, 0.0f, 0.0f);
 
-        game->map_painter = fv_map_painter_new(image_data, shader_data);
+        game->static_geometry = fv_static_geometry_new();
+
+        game->map_painter = fv_map_painter_new(image_data,
+                                               shader_data,
+                                               game->static_geometry);
         if (game->map_painter == NULL)
                 goto error;
 
-        game->person_painter = fv_person_painter_new(image_data, shader_data);
+        game->person_painter = fv_person_painter_new(image_data,
+                                                     shader_data,
+                                                     game->static_geometry);
         if (game->person_painter == NULL)
                 goto error_map;
 
@@ -86,6 +96,8 @@ fv_game_new(struct fv_image_data *image_data,
         if (game->shout_painter == NULL)
                 goto error_person;
 
+        fv_static_geometry_upload(game->static_geometry);
+
         return game;
 
 error_person:
@@ -93,6 +105,7 @@ error_person:
 error_map:
         fv_map_painter_free(game->map_painter);
 error:
+        fv_static_geometry_free(game->static_geometry);
         fv_free(game);
 
         return NULL;
@@ -239,8 +252,8 @@ fv_game_covers_framebuffer(struct fv_game *game,
          * viewport */
         return (center_x - visible_w / 2.0f >= 0.0f &&
                 center_y - visible_h / 2.0f >= 0.0f &&
-                center_x + visible_w / 2.0f <= FV_MAP_WIDTH &&
-                center_y + visible_h / 2.0f <= FV_MAP_HEIGHT);
+                center_x + visible_w / 2.0f <= fv_map.width &&
+                center_y + visible_h / 2.0f <= fv_map.height);
 }
 
 void
@@ -251,11 +264,17 @@ fv_game_paint(struct fv_game *game,
 {
         game->paint_state.center_x = center_x;
         game->paint_state.center_y = center_y;
+        game->paint_state.viewport_height = height;
 
         update_projection(game, width, height);
 
         update_modelview(game, logic);
 
+        /* The person and map painters both need the depth test so it
+         * is enabled once around both of them rather than each
+         * painter toggling it */
+        fv_gl_enable(GL_DEPTH_TEST);
+
         fv_person_painter_paint(game->person_painter,
                                 logic,
                                 &game->paint_state);
@@ -264,16 +283,32 @@ fv_game_paint(struct fv_game *game,
                              logic,
                              &game->paint_state);
 
+        fv_gl_disable(GL_DEPTH_TEST);
+
         fv_shout_painter_paint(game->shout_painter,
                                logic,
                                &game->paint_state);
 }
 
+void
+fv_game_end_frame(struct fv_game *game)
+{
+        fv_person_painter_end_frame(game->person_painter);
+}
+
+void
+fv_game_get_map_stats(struct fv_game *game,
+                      struct fv_map_painter_stats *stats)
+{
+        fv_map_painter_get_stats(game->map_painter, stats);
+}
+
 void
 fv_game_free(struct fv_game *game)
 {
         fv_shout_painter_free(game->shout_painter);
         fv_person_painter_free(game->person_painter);
         fv_map_painter_free(game->map_painter);
+        fv_static_geometry_free(game->static_geometry);
         fv_free(game);
 }
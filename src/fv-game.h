@@ -25,6 +25,7 @@
 #include "fv-logic.h"
 #include "fv-shader-data.h"
 #include "fv-image-data.h"
+#include "fv-map-painter.h"
 
 struct fv_game *
 fv_game_new(struct fv_image_data *image_data,
@@ -36,11 +37,20 @@ fv_game_paint(struct fv_game *game,
               int width, int height,
               struct fv_logic *logic);
 
+/* Should be called after painting all of the viewports for a
+ * frame */
+void
+fv_game_end_frame(struct fv_game *game);
+
 bool
 fv_game_covers_framebuffer(struct fv_game *game,
                            float center_x, float center_y,
                            int width, int height);
 
+void
+fv_game_get_map_stats(struct fv_game *game,
+                      struct fv_map_painter_stats *stats);
+
 void
 fv_game_free(struct fv_game *game);
 
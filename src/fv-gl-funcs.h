@@ -53,6 +53,8 @@
 FV_GL_BEGIN_GROUP(00,
                   NULL,
                   NULL)
+FV_GL_FUNC(void,
+           glActiveTexture, (GLenum texture))
 FV_GL_FUNC(void,
            glAttachShader, (GLuint program, GLuint shader))
 FV_GL_FUNC(void,
@@ -144,6 +146,11 @@ FV_GL_FUNC(void,
            glUniform1i, (GLint location, GLint v0))
 FV_GL_FUNC(void,
            glUniform1f, (GLint location, GLfloat v0))
+FV_GL_FUNC(void,
+           glUniform2f, (GLint location, GLfloat v0, GLfloat v1))
+FV_GL_FUNC(void,
+           glUniform3fv, (GLint location, GLsizei count,
+                          const GLfloat *value))
 FV_GL_FUNC(void,
            glUniformMatrix4fv, (GLint location, GLsizei count,
                                 GLboolean transpose, const GLfloat *value))
@@ -198,6 +205,25 @@ FV_GL_FUNC(void,
                                      GLsizei instancecount))
 FV_GL_END_GROUP()
 
+/* Base vertex drawing. This is used to draw models that share a
+ * buffer without having to offset their indices */
+FV_GL_BEGIN_GROUP(FV_GL_ALT_VERSION(32, -1),
+                  FV_GL_ALT_EXT("GL_ARB_draw_elements_base_vertex", NULL),
+                  FV_GL_ALT_SUFFIX("", NULL))
+FV_GL_FUNC(void,
+           glDrawRangeElementsBaseVertex, (GLenum mode,
+                                           GLuint start, GLuint end,
+                                           GLsizei count, GLenum type,
+                                           const void *indices,
+                                           GLint basevertex))
+FV_GL_FUNC(void,
+           glDrawElementsInstancedBaseVertex, (GLenum mode, GLsizei count,
+                                               GLenum type,
+                                               const void *indices,
+                                               GLsizei instancecount,
+                                               GLint basevertex))
+FV_GL_END_GROUP()
+
 /* FBOs. This is only used for generating mipmaps */
 FV_GL_BEGIN_GROUP(FV_GL_ALT_VERSION(30, 0),
                   FV_GL_ALT_EXT("GL_ARB_framebuffer_object", NULL),
@@ -245,6 +271,33 @@ FV_GL_FUNC(void,
                                  const GLvoid *indices))
 FV_GL_END_GROUP()
 
+/* Parallel shader compilation. GL_ARB_parallel_shader_compile has
+ * the same function with an ARB suffix which is checked for
+ * separately in fv_gl_init. WebGL doesn't have the function at all
+ * and always lets the browser choose the number of threads.
+ */
+FV_GL_BEGIN_GROUP(-1,
+                  FV_GL_ALT_EXT("GL_KHR_parallel_shader_compile", NULL),
+                  FV_GL_ALT_SUFFIX("KHR", NULL))
+FV_GL_FUNC(void,
+           glMaxShaderCompilerThreads, (GLuint count))
+FV_GL_END_GROUP()
+
+/* Program binaries. These are only used to cache the linked shaders */
+FV_GL_BEGIN_GROUP(FV_GL_ALT_VERSION(41, -1),
+                  FV_GL_ALT_EXT("GL_ARB_get_program_binary", NULL),
+                  FV_GL_ALT_SUFFIX("", NULL))
+FV_GL_FUNC(void,
+           glGetProgramBinary, (GLuint program, GLsizei bufSize,
+                                GLsizei *length, GLenum *binaryFormat,
+                                void *binary))
+FV_GL_FUNC(void,
+           glProgramBinary, (GLuint program, GLenum binaryFormat,
+                             const void *binary, GLsizei length))
+FV_GL_FUNC(void,
+           glProgramParameteri, (GLuint program, GLenum pname, GLint value))
+FV_GL_END_GROUP()
+
 #undef FV_GL_ALT_VERSION
 #undef FV_GL_ALT_EXT
 #undef FV_GL_ALT_SUFFIX
@@ -153,11 +153,14 @@ void
 fv_gl_init(void)
 {
         int sample_buffers = 0;
+        int n_binary_formats = 0;
         int max_vertex_attribs;
         int i;
 
         memset(&fv_gl, 0, sizeof fv_gl);
 
+        fv_gl_reset_state();
+
         fv_gl.glGetString = SDL_GL_GetProcAddress("glGetString");
 
         get_gl_version();
@@ -167,6 +170,12 @@ fv_gl_init(void)
 
         fv_gl.have_map_buffer_range = fv_gl.glMapBufferRange != NULL;
         fv_gl.have_vertex_array_objects = fv_gl.glGenVertexArrays != NULL;
+        /* The instanced version is only needed if instanced arrays
+         * are available */
+        fv_gl.have_draw_elements_base_vertex =
+                fv_gl.glDrawRangeElementsBaseVertex != NULL &&
+                (fv_gl.glDrawElementsInstancedBaseVertex != NULL ||
+                 fv_gl.glDrawElementsInstanced == NULL);
 
         /* On GLES2 (and thus WebGL) non-power-of-two textures are
          * only supported if no mipmaps are used and the repeat mode
@@ -193,4 +202,326 @@ fv_gl_init(void)
 #endif
 
         fv_gl.have_multisampling = sample_buffers != 0;
+
+        /* The extension can be advertised with zero binary formats
+         * in which case it is useless */
+        if (fv_gl.glGetProgramBinary) {
+                fv_gl.glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS,
+                                    &n_binary_formats);
+        }
+
+        fv_gl.have_program_binary = n_binary_formats > 0;
+
+#ifdef EMSCRIPTEN
+        fv_gl.have_vertex_type_2_10_10_10_rev = false;
+#else
+        fv_gl.have_vertex_type_2_10_10_10_rev =
+                fv_gl.major_version * 10 + fv_gl.minor_version >= 33 ||
+                SDL_GL_ExtensionSupported("GL_ARB_vertex_type_2_10_10_10_rev");
+#endif
+
+        /* This is used to pick the mipmap level when the map shader
+         * wraps the texture coordinates. GLSL ES would additionally
+         * need the extension for derivatives so it is only used on
+         * desktop GL. */
+#ifdef EMSCRIPTEN
+        fv_gl.have_shader_texture_lod = false;
+#else
+        fv_gl.have_shader_texture_lod =
+                SDL_GL_ExtensionSupported("GL_ARB_shader_texture_lod");
+#endif
+
+        if (fv_gl.glMaxShaderCompilerThreads == NULL &&
+            SDL_GL_ExtensionSupported("GL_ARB_parallel_shader_compile")) {
+                fv_gl.glMaxShaderCompilerThreads =
+                        SDL_GL_GetProcAddress("glMaxShaderCompilerThreadsARB");
+        }
+
+        /* Let the driver use as many threads as it wants to compile
+         * the shaders in the background */
+        if (fv_gl.glMaxShaderCompilerThreads)
+                fv_gl.glMaxShaderCompilerThreads(0xffffffff);
+}
+
+void
+fv_gl_reset_state(void)
+{
+        struct fv_gl_state *state = &fv_gl.state;
+        int unit, target;
+
+        state->program = FV_GL_STATE_UNKNOWN;
+        state->vertex_array = FV_GL_STATE_UNKNOWN;
+        state->array_buffer = FV_GL_STATE_UNKNOWN;
+        state->element_array_buffer = FV_GL_STATE_UNKNOWN;
+        state->active_texture_unit = -1;
+
+        for (unit = 0; unit < FV_GL_MAX_TEXTURE_UNITS; unit++) {
+                for (target = 0; target < FV_GL_N_TEXTURE_TARGETS; target++)
+                        state->textures[unit][target] = FV_GL_STATE_UNKNOWN;
+        }
+
+        state->known_capabilities = 0;
+        state->enabled_capabilities = 0;
+        state->viewport_known = false;
+
+        state->enabled_attributes = 0;
+        state->known_attributes = 0;
+}
+
+float
+fv_gl_get_redundant_call_rate(void)
+{
+        if (fv_gl.state.n_calls == 0)
+                return 0.0f;
+
+        return fv_gl.state.n_redundant_calls / (float) fv_gl.state.n_calls;
+}
+
+void
+fv_gl_active_texture(GLenum texture)
+{
+        int unit = texture - GL_TEXTURE0;
+        bool redundant = unit == fv_gl.state.active_texture_unit;
+
+        if (fv_gl_record_state_call(redundant))
+                return;
+
+        fv_gl.state.active_texture_unit = unit;
+        fv_gl.glActiveTexture(texture);
+}
+
+static int
+get_texture_target_index(GLenum target)
+{
+        switch (target) {
+        case GL_TEXTURE_2D:
+                return FV_GL_TEXTURE_TARGET_2D;
+        case GL_TEXTURE_2D_ARRAY:
+                return FV_GL_TEXTURE_TARGET_2D_ARRAY;
+        default:
+                return -1;
+        }
+}
+
+void
+fv_gl_bind_texture(GLenum target, GLuint texture)
+{
+        int unit = fv_gl.state.active_texture_unit;
+        int target_index = get_texture_target_index(target);
+        GLuint *binding;
+
+        /* If we don't know what the active unit is then we can't
+         * track the binding */
+        if (unit < 0 || unit >= FV_GL_MAX_TEXTURE_UNITS || target_index < 0) {
+                fv_gl_record_state_call(false);
+                fv_gl.glBindTexture(target, texture);
+                return;
+        }
+
+        binding = &fv_gl.state.textures[unit][target_index];
+
+        if (fv_gl_record_state_call(*binding == texture))
+                return;
+
+        *binding = texture;
+        fv_gl.glBindTexture(target, texture);
+}
+
+void
+fv_gl_bind_buffer(GLenum target, GLuint buffer)
+{
+        GLuint *binding;
+
+        switch (target) {
+        case GL_ARRAY_BUFFER:
+                binding = &fv_gl.state.array_buffer;
+                break;
+        case GL_ELEMENT_ARRAY_BUFFER:
+                binding = &fv_gl.state.element_array_buffer;
+                break;
+        default:
+                fv_gl_record_state_call(false);
+                fv_gl.glBindBuffer(target, buffer);
+                return;
+        }
+
+        if (fv_gl_record_state_call(*binding == buffer))
+                return;
+
+        *binding = buffer;
+        fv_gl.glBindBuffer(target, buffer);
+}
+
+void
+fv_gl_bind_vertex_array(GLuint array)
+{
+        if (fv_gl_record_state_call(fv_gl.state.vertex_array == array))
+                return;
+
+        fv_gl.state.vertex_array = array;
+        /* The element buffer binding is part of the vertex array
+         * object state so we no longer know what it is */
+        fv_gl.state.element_array_buffer = FV_GL_STATE_UNKNOWN;
+        fv_gl.glBindVertexArray(array);
+}
+
+static int
+get_capability_index(GLenum cap)
+{
+        switch (cap) {
+        case GL_BLEND:
+                return FV_GL_CAPABILITY_BLEND;
+        case GL_CULL_FACE:
+                return FV_GL_CAPABILITY_CULL_FACE;
+        case GL_DEPTH_TEST:
+                return FV_GL_CAPABILITY_DEPTH_TEST;
+#ifdef GL_MULTISAMPLE
+        case GL_MULTISAMPLE:
+                return FV_GL_CAPABILITY_MULTISAMPLE;
+#endif
+        default:
+                return -1;
+        }
+}
+
+static bool
+set_capability(GLenum cap, bool enabled)
+{
+        int index = get_capability_index(cap);
+        bool was_enabled;
+        uint32_t bit;
+
+        if (index < 0)
+                return fv_gl_record_state_call(false);
+
+        bit = UINT32_C(1) << index;
+        was_enabled = !!(fv_gl.state.enabled_capabilities & bit);
+
+        if (fv_gl_record_state_call((fv_gl.state.known_capabilities & bit) &&
+                                    was_enabled == enabled))
+                return true;
+
+        fv_gl.state.known_capabilities |= bit;
+
+        if (enabled)
+                fv_gl.state.enabled_capabilities |= bit;
+        else
+                fv_gl.state.enabled_capabilities &= ~bit;
+
+        return false;
+}
+
+void
+fv_gl_enable(GLenum cap)
+{
+        if (!set_capability(cap, true))
+                fv_gl.glEnable(cap);
+}
+
+void
+fv_gl_disable(GLenum cap)
+{
+        if (!set_capability(cap, false))
+                fv_gl.glDisable(cap);
+}
+
+void
+fv_gl_viewport(GLint x, GLint y, GLsizei width, GLsizei height)
+{
+        GLint *viewport = fv_gl.state.viewport;
+
+        if (fv_gl_record_state_call(fv_gl.state.viewport_known &&
+                                    viewport[0] == x &&
+                                    viewport[1] == y &&
+                                    viewport[2] == width &&
+                                    viewport[3] == height))
+                return;
+
+        viewport[0] = x;
+        viewport[1] = y;
+        viewport[2] = width;
+        viewport[3] = height;
+        fv_gl.state.viewport_known = true;
+
+        fv_gl.glViewport(x, y, width, height);
+}
+
+static void
+forget_name(GLuint *binding,
+            GLsizei n,
+            const GLuint *names)
+{
+        int i;
+
+        for (i = 0; i < n; i++) {
+                if (*binding == names[i]) {
+                        /* GL will have reverted the binding to zero */
+                        *binding = 0;
+                        break;
+                }
+        }
+}
+
+void
+fv_gl_delete_program(GLuint program)
+{
+        /* Deleting the current program doesn't unbind it so we just
+         * mark it as unknown to make sure the next use goes through */
+        if (fv_gl.state.program == program)
+                fv_gl.state.program = FV_GL_STATE_UNKNOWN;
+
+        fv_gl.glDeleteProgram(program);
+}
+
+void
+fv_gl_delete_buffers(GLsizei n, const GLuint *buffers)
+{
+        struct fv_gl_state *state = &fv_gl.state;
+        int i, j;
+
+        forget_name(&state->array_buffer, n, buffers);
+        forget_name(&state->element_array_buffer, n, buffers);
+
+        /* Any attributes of the default vertex array that were using
+         * the buffers will have been detached */
+        for (i = 0; i < FV_GL_MAX_ATTRIBUTES; i++) {
+                for (j = 0; j < n; j++) {
+                        if (state->attributes[i].buffer == buffers[j]) {
+                                state->known_attributes &= ~(1 << i);
+                                break;
+                        }
+                }
+        }
+
+        fv_gl.glDeleteBuffers(n, buffers);
+}
+
+void
+fv_gl_delete_textures(GLsizei n, const GLuint *textures)
+{
+        int unit, target;
+
+        for (unit = 0; unit < FV_GL_MAX_TEXTURE_UNITS; unit++) {
+                for (target = 0; target < FV_GL_N_TEXTURE_TARGETS; target++) {
+                        forget_name(&fv_gl.state.textures[unit][target],
+                                    n, textures);
+                }
+        }
+
+        fv_gl.glDeleteTextures(n, textures);
+}
+
+void
+fv_gl_delete_vertex_arrays(GLsizei n, const GLuint *arrays)
+{
+        GLuint old_array = fv_gl.state.vertex_array;
+
+        forget_name(&fv_gl.state.vertex_array, n, arrays);
+
+        /* If the bound array was deleted then the element buffer
+         * binding reverts to that of the default array */
+        if (fv_gl.state.vertex_array != old_array)
+                fv_gl.state.element_array_buffer = FV_GL_STATE_UNKNOWN;
+
+        fv_gl.glDeleteVertexArrays(n, arrays);
 }
@@ -22,6 +22,83 @@
 
 #include <GL/gl.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+/* Maximum number of texture units whose bindings are tracked by the
+ * state cache. Bindings on any higher units are always passed
+ * straight through to GL.
+ */
+#define FV_GL_MAX_TEXTURE_UNITS 4
+
+#define FV_GL_MAX_ATTRIBUTES 16
+
+/* Value used in the state cache for an object binding whose current
+ * value isn't known. This is never a valid object name so the next
+ * bind will always be passed through to GL.
+ */
+#define FV_GL_STATE_UNKNOWN (~(GLuint) 0)
+
+enum fv_gl_texture_target {
+        FV_GL_TEXTURE_TARGET_2D,
+        FV_GL_TEXTURE_TARGET_2D_ARRAY,
+        FV_GL_N_TEXTURE_TARGETS
+};
+
+enum fv_gl_capability {
+        FV_GL_CAPABILITY_BLEND,
+        FV_GL_CAPABILITY_CULL_FACE,
+        FV_GL_CAPABILITY_DEPTH_TEST,
+        FV_GL_CAPABILITY_MULTISAMPLE,
+        FV_GL_N_CAPABILITIES
+};
+
+struct fv_gl_attribute {
+        GLint size;
+        GLenum type;
+        GLboolean normalized;
+        GLsizei stride;
+        GLuint divisor;
+        GLuint buffer;
+        size_t buffer_offset;
+};
+
+/* A shadow copy of the parts of the GL state that the painters
+ * change frequently. The fv_gl_* wrapper functions below use this to
+ * skip calls that wouldn't change anything.
+ */
+struct fv_gl_state {
+        GLuint program;
+        GLuint vertex_array;
+        GLuint array_buffer;
+        GLuint element_array_buffer;
+
+        int active_texture_unit;
+        GLuint textures[FV_GL_MAX_TEXTURE_UNITS][FV_GL_N_TEXTURE_TARGETS];
+
+        /* Bitmask of the capabilities whose state is known and of
+         * the ones that are known to be enabled */
+        uint32_t known_capabilities;
+        uint32_t enabled_capabilities;
+
+        bool viewport_known;
+        GLint viewport[4];
+
+        /* Attribute state of the default vertex array. This is only
+         * used when vertex array objects are emulated. Nothing else
+         * enables attributes so after a reset they are all assumed to
+         * be disabled but their pointers are unknown.
+         */
+        uint32_t enabled_attributes;
+        uint32_t known_attributes;
+        struct fv_gl_attribute attributes[FV_GL_MAX_ATTRIBUTES];
+
+        /* Number of state changes requested through the wrappers and
+         * the number of those that were dropped because they
+         * wouldn't have had any effect */
+        unsigned long n_calls;
+        unsigned long n_redundant_calls;
+};
 
 struct fv_gl {
 #define FV_GL_BEGIN_GROUP(a, b, c)
@@ -41,6 +118,12 @@ struct fv_gl {
         bool have_instanced_arrays;
         bool have_npot_mipmaps;
         bool have_multisampling;
+        bool have_program_binary;
+        bool have_vertex_type_2_10_10_10_rev;
+        bool have_draw_elements_base_vertex;
+        bool have_shader_texture_lod;
+
+        struct fv_gl_state state;
 };
 
 extern struct fv_gl fv_gl;
@@ -48,6 +131,79 @@ extern struct fv_gl fv_gl;
 void
 fv_gl_init(void);
 
+/* Marks all of the cached state as unknown. This should be called
+ * whenever the state may have been changed without going through the
+ * wrappers, for example when the context is recreated.
+ */
+void
+fv_gl_reset_state(void);
+
+/* Returns the fraction of state changes that were dropped by the
+ * state cache.
+ */
+float
+fv_gl_get_redundant_call_rate(void);
+
+void
+fv_gl_active_texture(GLenum texture);
+
+void
+fv_gl_bind_texture(GLenum target, GLuint texture);
+
+void
+fv_gl_bind_buffer(GLenum target, GLuint buffer);
+
+void
+fv_gl_bind_vertex_array(GLuint array);
+
+void
+fv_gl_enable(GLenum cap);
+
+void
+fv_gl_disable(GLenum cap);
+
+void
+fv_gl_viewport(GLint x, GLint y, GLsizei width, GLsizei height);
+
+/* Records a request to change the state in the statistics and
+ * returns the value of redundant for convenience.
+ */
+static inline bool
+fv_gl_record_state_call(bool redundant)
+{
+        fv_gl.state.n_calls++;
+
+        if (redundant)
+                fv_gl.state.n_redundant_calls++;
+
+        return redundant;
+}
+
+static inline void
+fv_gl_use_program(GLuint program)
+{
+        if (fv_gl_record_state_call(fv_gl.state.program == program))
+                return;
+
+        fv_gl.state.program = program;
+        fv_gl.glUseProgram(program);
+}
+
+/* The following delete objects and also forget about them in the
+ * state cache in case the names get reused.
+ */
+void
+fv_gl_delete_program(GLuint program);
+
+void
+fv_gl_delete_buffers(GLsizei n, const GLuint *buffers);
+
+void
+fv_gl_delete_textures(GLsizei n, const GLuint *textures);
+
+void
+fv_gl_delete_vertex_arrays(GLsizei n, const GLuint *arrays);
+
 static inline void
 fv_gl_draw_range_elements(GLenum mode,
                           GLuint start, GLuint end,
@@ -109,12 +109,12 @@ fv_hud_new(struct fv_image_data *image_data,
 
         hud->program = shader_data->programs[FV_SHADER_DATA_PROGRAM_HUD];
 
-        fv_gl.glUseProgram(hud->program);
+        fv_gl_use_program(hud->program);
         tex_location = fv_gl.glGetUniformLocation(hud->program, "tex");
         fv_gl.glUniform1i(tex_location, 0);
 
         fv_gl.glGenTextures(1, &hud->tex);
-        fv_gl.glBindTexture(GL_TEXTURE_2D, hud->tex);
+        fv_gl_bind_texture(GL_TEXTURE_2D, hud->tex);
         fv_image_data_set_2d(image_data,
                              GL_TEXTURE_2D,
                              0, /* level */
@@ -160,7 +160,7 @@ fv_hud_new(struct fv_image_data *image_data,
         fv_map_buffer_unmap();
 
         fv_gl.glGenBuffers(1, &hud->vertex_buffer);
-        fv_gl.glBindBuffer(GL_ARRAY_BUFFER, hud->vertex_buffer);
+        fv_gl_bind_buffer(GL_ARRAY_BUFFER, hud->vertex_buffer);
         fv_gl.glBufferData(GL_ARRAY_BUFFER,
                            FV_HUD_MAX_RECTANGLES * 4 *
                            sizeof (struct fv_hud_vertex),
@@ -195,7 +195,7 @@ fv_hud_begin_rectangles(struct fv_hud *hud,
                         int screen_width,
                         int screen_height)
 {
-        fv_gl.glBindBuffer(GL_ARRAY_BUFFER, hud->vertex_buffer);
+        fv_gl_bind_buffer(GL_ARRAY_BUFFER, hud->vertex_buffer);
         hud->vertex = fv_map_buffer_map(GL_ARRAY_BUFFER,
                                         sizeof (struct fv_hud_vertex) *
                                         FV_HUD_MAX_RECTANGLES * 4,
@@ -262,13 +262,13 @@ fv_hud_end_rectangles(struct fv_hud *hud)
         /* There's no benefit to using multisampling for the HUD
          * because it is only drawing screen-aligned rectangles */
         if (fv_gl.have_multisampling)
-                fv_gl.glDisable(GL_MULTISAMPLE);
+                fv_gl_disable(GL_MULTISAMPLE);
 
-        fv_gl.glEnable(GL_BLEND);
+        fv_gl_enable(GL_BLEND);
 
-        fv_gl.glUseProgram(hud->program);
+        fv_gl_use_program(hud->program);
 
-        fv_gl.glBindTexture(GL_TEXTURE_2D, hud->tex);
+        fv_gl_bind_texture(GL_TEXTURE_2D, hud->tex);
 
         fv_array_object_bind(hud->array);
 
@@ -280,9 +280,9 @@ fv_hud_end_rectangles(struct fv_hud *hud)
                                   NULL);
 
         if (fv_gl.have_multisampling)
-                fv_gl.glEnable(GL_MULTISAMPLE);
+                fv_gl_enable(GL_MULTISAMPLE);
 
-        fv_gl.glDisable(GL_BLEND);
+        fv_gl_disable(GL_BLEND);
 }
 
 static void
@@ -574,12 +574,22 @@ fv_hud_paint_game_state(struct fv_hud *hud,
         fv_hud_end_rectangles(hud);
 }
 
+bool
+fv_hud_is_animating(struct fv_logic *logic)
+{
+        /* The fina venko image slides in followed by the venko image
+         * half way through and then nothing moves */
+        return (fv_logic_get_state(logic) == FV_LOGIC_STATE_FINA_VENKO &&
+                fv_logic_get_time_since_fina_venko(logic) <
+                FV_HUD_FINA_VENKO_SLIDE_TIME * 1.5f);
+}
+
 void
 fv_hud_free(struct fv_hud *hud)
 {
-        fv_gl.glDeleteBuffers(1, &hud->vertex_buffer);
-        fv_gl.glDeleteBuffers(1, &hud->element_buffer);
+        fv_gl_delete_buffers(1, &hud->vertex_buffer);
+        fv_gl_delete_buffers(1, &hud->element_buffer);
         fv_array_object_free(hud->array);
-        fv_gl.glDeleteTextures(1, &hud->tex);
+        fv_gl_delete_textures(1, &hud->tex);
         fv_free(hud);
 }
@@ -47,6 +47,11 @@ fv_hud_paint_game_state(struct fv_hud *hud,
                         int screen_height,
                         struct fv_logic *logic);
 
+/* Returns true if the game state HUD will look different in the next
+ * frame even if the logic doesn't change */
+bool
+fv_hud_is_animating(struct fv_logic *logic);
+
 void
 fv_hud_free(struct fv_hud *hud);
 
@@ -29,17 +29,20 @@
 #include "fv-error-message.h"
 #include "fv-gl.h"
 
-struct fv_image_data {
-        uint32_t loaded_event;
-        bool result_sent;
-};
-
 static const char *
 fv_image_data_files[] = {
 #include "data/fv-image-data-files.h"
         NULL
 };
 
+struct fv_image_data {
+        uint32_t loaded_event;
+        bool result_sent;
+        /* The filenames to load where the images that aren't needed
+         * are replaced with an empty string */
+        const char *files[FV_N_ELEMENTS(fv_image_data_files)];
+};
+
 static void
 send_result(struct fv_image_data *data,
             enum fv_image_data_result result)
@@ -55,6 +58,8 @@ send_result(struct fv_image_data *data,
                         var i;
                         for (i = 0; i < Module.images.length; i++) {
                                 var img = Module.images[i];
+                                if (img == null)
+                                        continue;
                                 img.onload = undefined;
                                 img.onerror = undefined;
                         }
@@ -79,23 +84,40 @@ fv_image_data_send_fail(struct fv_image_data *data)
         send_result(data, FV_IMAGE_DATA_FAIL);
 }
 
+void
+fv_image_data_set_n_threads(int n_threads)
+{
+        /* The browser decodes the images so this has no effect */
+}
+
 struct fv_image_data *
 fv_image_data_new(uint32_t loaded_event)
 {
         struct fv_image_data *data = fv_alloc(sizeof *data);
+        int i;
 
         data->loaded_event = loaded_event;
         data->result_sent = false;
 
+        for (i = 0; fv_image_data_files[i]; i++) {
+                if (fv_image_data_is_needed(i))
+                        data->files[i] = fv_image_data_files[i];
+                else
+                        data->files[i] = "";
+        }
+
+        data->files[i] = NULL;
+
         EM_ASM_({
                         var image_name;
                         var loaded_count = 0;
+                        var n_images = 0;
                         var i;
 
                         function load_cb()
                         {
                                 loaded_count++;
-                                if (loaded_count >= Module.images.length)
+                                if (loaded_count >= n_images)
                                         _fv_image_data_send_success($1);
                         };
 
@@ -107,14 +129,19 @@ fv_image_data_new(uint32_t loaded_event)
                         Module.images = [];
 
                         for (i = 0; (image_name = HEAP32[($0 >> 2) + i]); i++) {
+                                var filename = Module.UTF8ToString(image_name);
+                                if (filename.length == 0) {
+                                        Module.images.push(null);
+                                        continue;
+                                }
                                 var img = document.createElement("img");
                                 img.onload = load_cb;
                                 img.onerror = error_cb;
-                                img.src = "data/" +
-                                        Module.UTF8ToString(image_name);
+                                img.src = "data/" + filename;
                                 Module.images.push(img);
+                                n_images++;
                         }
-                }, fv_image_data_files, data);
+                }, data->files, data);
 
         return data;
 }
@@ -166,6 +193,17 @@ fv_image_data_set_sub_2d(struct fv_image_data *data,
                 }, target, level, x_offset, y_offset, image);
 }
 
+void
+fv_image_data_set_3d(struct fv_image_data *data,
+                     GLenum target,
+                     GLint level,
+                     GLint internal_format,
+                     GLint depth,
+                     enum fv_image_data_image image)
+{
+        assert(!"3D texturing not available in WebGL");
+}
+
 void
 fv_image_data_set_sub_3d(struct fv_image_data *data,
                          GLenum target,
@@ -183,6 +221,8 @@ fv_image_data_free(struct fv_image_data *data)
                         var i;
                         for (i = 0; i < Module.images.length; i++) {
                                 var img = Module.images[i];
+                                if (img == null)
+                                        continue;
                                 img.onload = undefined;
                                 img.onerror = undefined;
                         }
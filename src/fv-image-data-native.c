@@ -26,6 +26,7 @@
 #include "fv-util.h"
 #include "fv-error-message.h"
 #include "fv-gl.h"
+#include "fv-pack.h"
 
 #define STB_IMAGE_IMPLEMENTATION 1
 #include "stb_image.h"
@@ -33,7 +34,9 @@
 struct image_details {
         int width, height;
         GLenum format, type;
-        uint8_t *pixels;
+        const uint8_t *pixels;
+        /* False if the pixels point into the data pack */
+        bool owns_pixels;
 };
 
 static const char *
@@ -41,29 +44,96 @@ image_filenames[] = {
 #include "data/fv-image-data-files.h"
 };
 
+/* Maximum number of threads used to decode the images */
+#define FV_IMAGE_DATA_MAX_THREADS 8
+
 struct fv_image_data {
         bool loaded;
         struct image_details images[FV_N_ELEMENTS(image_filenames)];
+
+        uint32_t loaded_event;
+
+        SDL_Thread *threads[FV_IMAGE_DATA_MAX_THREADS];
+        int n_threads;
+
+        /* Index of the next image that a worker thread should load */
+        SDL_atomic_t next_image;
+        /* Number of threads that haven't finished yet */
+        SDL_atomic_t n_running_threads;
+        /* Set to 1 by the first thread that fails to load an image */
+        SDL_atomic_t failed;
 };
 
-static uint8_t *
+static int
+n_threads_setting = 0;
+
+static GLenum
+get_format(int components)
+{
+        switch (components) {
+        case 3:
+                return GL_RGB;
+        case 4:
+                return GL_RGBA;
+        default:
+                return GL_ALPHA;
+        }
+}
+
+static bool
+load_packed_image(const char *name,
+                  struct image_details *image)
+{
+        const struct fv_pack_image *header;
+        size_t size, max_pixels;
+
+        header = fv_data_get_packed(name, &size);
+
+        if (header == NULL ||
+            size < sizeof *header ||
+            header->width == 0 ||
+            header->components < 1 ||
+            header->components > 4)
+                return false;
+
+        /* The height is checked with a division so that the size of
+         * the pixels can't overflow when size_t is 32-bit */
+        max_pixels = (size - sizeof *header) / header->components;
+
+        if (header->height > max_pixels / header->width)
+                return false;
+
+        /* The pixels are used directly from the mapped pack */
+        image->pixels = (const uint8_t *) (header + 1);
+        image->owns_pixels = false;
+        image->width = header->width;
+        image->height = header->height;
+        image->format = get_format(header->components);
+        image->type = GL_UNSIGNED_BYTE;
+
+        return true;
+}
+
+static bool
 load_image(const char *name,
-           int *width,
-           int *height,
-           GLenum *format,
-           GLenum *type)
+           struct image_details *image)
 {
-        char *filename = fv_data_get_filename(name);
+        char *filename;
         int components;
         uint8_t *data;
 
+        if (load_packed_image(name, image))
+                return true;
+
+        filename = fv_data_get_filename(name);
+
         if (filename == NULL) {
                 fv_error_message("Failed to get filename for %s", name);
-                return NULL;
+                return false;
         }
 
         data = stbi_load(filename,
-                         width, height,
+                         &image->width, &image->height,
                          &components,
                          0 /* components */);
 
@@ -72,26 +142,17 @@ load_image(const char *name,
                                  filename,
                                  stbi_failure_reason());
                 fv_free(filename);
-                return NULL;
+                return false;
         }
 
         fv_free(filename);
 
-        switch (components) {
-        case 3:
-                *format = GL_RGB;
-                break;
-        case 4:
-                *format = GL_RGBA;
-                break;
-        default:
-                *format = GL_ALPHA;
-                break;
-        }
-
-        *type = GL_UNSIGNED_BYTE;
+        image->pixels = data;
+        image->owns_pixels = true;
+        image->format = get_format(components);
+        image->type = GL_UNSIGNED_BYTE;
 
-        return data;
+        return true;
 }
 
 static void
@@ -106,38 +167,118 @@ send_result(uint32_t loaded_event,
         SDL_PushEvent(&event);
 }
 
-struct fv_image_data *
-fv_image_data_new(uint32_t loaded_event)
+static void
+release_thread(struct fv_image_data *data)
 {
-        struct fv_image_data *data;
+        if (SDL_AtomicDecRef(&data->n_running_threads) &&
+            !SDL_AtomicGet(&data->failed)) {
+                /* The event queue has a lock so the main thread will
+                 * see all of the images when it receives the event */
+                data->loaded = true;
+                send_result(data->loaded_event, FV_IMAGE_DATA_SUCCESS);
+        }
+}
+
+static int
+load_thread(void *user_data)
+{
+        struct fv_image_data *data = user_data;
         struct image_details *image;
-        enum fv_image_data_result result;
         int i;
 
-        data = fv_alloc(sizeof *data);
+        /* Each thread keeps taking the next image until they are all
+         * loaded or one of the threads has failed */
+        while (!SDL_AtomicGet(&data->failed)) {
+                i = SDL_AtomicAdd(&data->next_image, 1);
+
+                if (i >= FV_N_ELEMENTS(data->images))
+                        break;
+
+                if (!fv_image_data_is_needed(i))
+                        continue;
 
-        for (i = 0; i < FV_N_ELEMENTS(data->images); i++) {
                 image = data->images + i;
-                image->pixels = load_image(image_filenames[i],
-                                           &image->width,
-                                           &image->height,
-                                           &image->format,
-                                           &image->type);
-
-                if (image->pixels == NULL) {
-                        for (; i >= 0; --i)
-                                fv_free(data->images[i].pixels);
-                        data->loaded = false;
-                        result = FV_IMAGE_DATA_FAIL;
-                        goto done;
+
+                if (!load_image(image_filenames[i], image)) {
+                        /* Report the failure straight away instead
+                         * of waiting for the other threads */
+                        if (SDL_AtomicCAS(&data->failed, 0, 1)) {
+                                send_result(data->loaded_event,
+                                            FV_IMAGE_DATA_FAIL);
+                        }
+                        break;
                 }
         }
 
-        data->loaded = true;
-        result = FV_IMAGE_DATA_SUCCESS;
+        release_thread(data);
+
+        return 0;
+}
+
+static int
+get_n_threads(void)
+{
+        int n_threads = n_threads_setting;
+
+        if (n_threads <= 0)
+                n_threads = SDL_GetCPUCount();
+
+        return MIN(MAX(n_threads, 1),
+                   MIN(FV_IMAGE_DATA_MAX_THREADS,
+                       FV_N_ELEMENTS(image_filenames)));
+}
 
-done:
-        send_result(loaded_event, result);
+void
+fv_image_data_set_n_threads(int n_threads)
+{
+        n_threads_setting = n_threads;
+}
+
+struct fv_image_data *
+fv_image_data_new(uint32_t loaded_event)
+{
+        struct fv_image_data *data;
+        int n_threads = get_n_threads();
+        int i;
+
+        data = fv_calloc(sizeof *data);
+
+        data->loaded_event = loaded_event;
+
+        SDL_AtomicSet(&data->next_image, 0);
+        SDL_AtomicSet(&data->failed, 0);
+        /* Hold a reference while the threads are being started so
+         * that the result isn't sent too early */
+        SDL_AtomicSet(&data->n_running_threads, 1);
+
+        /* stb_image lazily initialises some static tables the first
+         * time it decodes a PNG. Do it here so that the threads don't
+         * race to do it. */
+        stbi__init_zdefaults();
+
+        for (i = 0; i < n_threads; i++) {
+                SDL_AtomicIncRef(&data->n_running_threads);
+
+                data->threads[i] = SDL_CreateThread(load_thread,
+                                                    "fv-image-data",
+                                                    data);
+
+                if (data->threads[i] == NULL) {
+                        /* This can't drop to zero because of the
+                         * extra reference */
+                        SDL_AtomicAdd(&data->n_running_threads, -1);
+                        break;
+                }
+
+                data->n_threads++;
+        }
+
+        /* If no threads could be created then just load the images
+         * synchronously */
+        if (data->n_threads == 0)
+                load_thread(data);
+        else
+                release_thread(data);
 
         return data;
 }
@@ -191,6 +332,28 @@ fv_image_data_set_sub_2d(struct fv_image_data *data,
                               img->pixels);
 }
 
+void
+fv_image_data_set_3d(struct fv_image_data *data,
+                     GLenum target,
+                     GLint level,
+                     GLint internal_format,
+                     GLint depth,
+                     enum fv_image_data_image image)
+{
+        const struct image_details *img = data->images + image;
+        assert(data->loaded);
+        assert(img->height % depth == 0);
+
+        fv_gl.glTexImage3D(target,
+                           level,
+                           internal_format,
+                           img->width, img->height / depth,
+                           depth,
+                           0, /* border */
+                           img->format, img->type,
+                           img->pixels);
+}
+
 void
 fv_image_data_set_sub_3d(struct fv_image_data *data,
                          GLenum target,
@@ -215,9 +378,14 @@ fv_image_data_free(struct fv_image_data *data)
 {
         int i;
 
-        if (data->loaded) {
-                for (i = 0; i < FV_N_ELEMENTS(data->images); i++)
-                        fv_free(data->images[i].pixels);
+        /* If one of the threads failed then the others might still
+         * be running */
+        for (i = 0; i < data->n_threads; i++)
+                SDL_WaitThread(data->threads[i], NULL);
+
+        for (i = 0; i < FV_N_ELEMENTS(data->images); i++) {
+                if (data->images[i].owns_pixels)
+                        fv_free((uint8_t *) data->images[i].pixels);
         }
 
         fv_free(data);
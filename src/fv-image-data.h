@@ -23,6 +23,8 @@
 #include <stdint.h>
 #include <GL/gl.h>
 
+#include "fv-gl.h"
+
 enum fv_image_data_image {
 #include "data/fv-image-data-enum.h"
 };
@@ -34,6 +36,34 @@ enum fv_image_data_result {
 
 struct fv_image_data;
 
+/* Returns whether the image is used with the current GL context.
+ * Images that aren't needed aren't loaded so they can't be used. The
+ * map painter only uses the layers of the map texture if texture
+ * arrays are available and the padded atlas otherwise.
+ */
+static inline bool
+fv_image_data_is_needed(enum fv_image_data_image image)
+{
+        switch (image) {
+        case FV_IMAGE_DATA_MAP_TEXTURE:
+                return !fv_gl.have_texture_2d_array;
+        case FV_IMAGE_DATA_MAP_TEXTURE_LAYERS:
+                return fv_gl.have_texture_2d_array;
+        default:
+                return true;
+        }
+}
+
+/* Sets the number of threads used to decode the images. Zero means
+ * to pick a number based on the number of CPUs.
+ */
+void
+fv_image_data_set_n_threads(int n_threads);
+
+/* Starts loading the images. The loaded_event will be pushed to the
+ * SDL event queue once they are all loaded or as soon as one of them
+ * fails.
+ */
 struct fv_image_data *
 fv_image_data_new(uint32_t loaded_event);
 
@@ -57,6 +87,16 @@ fv_image_data_set_sub_2d(struct fv_image_data *data,
                          GLint x_offset, GLint y_offset,
                          enum fv_image_data_image image);
 
+/* Sets the whole image as a 3D texture where the image is a vertical
+ * strip of the layers */
+void
+fv_image_data_set_3d(struct fv_image_data *data,
+                     GLenum target,
+                     GLint level,
+                     GLint internal_format,
+                     GLint depth,
+                     enum fv_image_data_image image);
+
 void
 fv_image_data_set_sub_3d(struct fv_image_data *data,
                          GLenum target,
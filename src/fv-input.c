@@ -76,12 +76,14 @@ struct player {
 
         int16_t x_axis;
         int16_t y_axis;
+        /* The controller that last moved the axes or -1 */
+        SDL_JoystickID axis_controller;
         float controller_direction;
         float controller_speed;
 };
 
 struct fv_input {
-        struct fv_logic *logic;
+        struct fv_simulation *simulation;
 
         int n_players;
         int next_player;
@@ -120,17 +122,18 @@ fv_input_reset(struct fv_input *input)
                 input->players[i].controller_speed = 0.0f;
                 input->players[i].x_axis = 0;
                 input->players[i].y_axis = 0;
+                input->players[i].axis_controller = -1;
         }
 
         input->state = FV_INPUT_STATE_CHOOSING_N_PLAYERS;
 }
 
 struct fv_input *
-fv_input_new(struct fv_logic *logic)
+fv_input_new(struct fv_simulation *simulation)
 {
         struct fv_input *input = fv_alloc(sizeof *input);
 
-        input->logic = logic;
+        input->simulation = simulation;
         input->state_changed_cb = NULL;
 
         fv_input_reset(input);
@@ -169,7 +172,8 @@ fv_input_get_next_player(struct fv_input *input)
 
 static void
 update_direction(struct fv_input *input,
-                 int player_num)
+                 int player_num,
+                 Uint32 timestamp)
 {
         const struct player *player = input->players + player_num;
         float direction;
@@ -215,26 +219,34 @@ update_direction(struct fv_input *input,
                 break;
         }
 
-        fv_logic_set_direction(input->logic, player_num, speed, direction);
+        fv_simulation_set_direction(input->simulation,
+                                    player_num,
+                                    speed,
+                                    direction,
+                                    timestamp);
 }
 
 static void
 set_key_state(struct fv_input *input,
               int player_num,
               enum key_code key,
-              bool state)
+              bool state,
+              Uint32 timestamp)
 {
         struct player *player = input->players + player_num;
 
         if (key == KEY_CODE_SHOUT) {
-                if (input->state == FV_INPUT_STATE_PLAYING && state)
-                        fv_logic_shout(input->logic, player_num);
+                if (input->state == FV_INPUT_STATE_PLAYING && state) {
+                        fv_simulation_shout(input->simulation,
+                                            player_num,
+                                            timestamp);
+                }
         } else if (!!(player->pressed_keys & (1 << key)) != state) {
                 if (state)
                         player->pressed_keys |= (1 << key);
                 else
                         player->pressed_keys &= ~(1 << key);
-                update_direction(input, player_num);
+                update_direction(input, player_num, timestamp);
         }
 }
 
@@ -395,7 +407,8 @@ found_key:
                 set_key_state(input,
                               0, /* player_num */
                               key_code,
-                              state);
+                              state,
+                              event->timestamp);
                 return true;
         }
 
@@ -406,7 +419,8 @@ found_key:
                         set_key_state(input,
                                       player_num,
                                       key_code,
-                                      state);
+                                      state,
+                                      event->timestamp);
                         return true;
                 }
         }
@@ -539,7 +553,8 @@ handle_playing_button(struct fv_input *input,
                 set_key_state(input,
                               0, /* player_num */
                               key_code,
-                              state);
+                              state,
+                              event->timestamp);
                 return true;
         }
 
@@ -551,7 +566,8 @@ handle_playing_button(struct fv_input *input,
                         set_key_state(input,
                                       player_num,
                                       key_code,
-                                      state);
+                                      state,
+                                      event->timestamp);
                         return true;
                 }
         }
@@ -575,12 +591,54 @@ handle_game_controller_button(struct fv_input *input,
         return false;
 }
 
+static void
+set_axes(struct fv_input *input,
+         int player_num,
+         int16_t x_axis,
+         int16_t y_axis,
+         Uint32 timestamp)
+{
+        struct player *player = input->players + player_num;
+        int mag_squared;
+
+        /* The latched value is usually followed by an event with the
+         * same value so there's no need to queue another command */
+        if (x_axis == player->x_axis && y_axis == player->y_axis)
+                return;
+
+        player->x_axis = x_axis;
+        player->y_axis = y_axis;
+
+        mag_squared = (player->y_axis * (int) player->y_axis +
+                       player->x_axis * (int) player->x_axis);
+
+        if (mag_squared <= (MIN_JOYSTICK_AXIS_MOVEMENT *
+                            MIN_JOYSTICK_AXIS_MOVEMENT)) {
+                player->controller_direction = 0.0f;
+                player->controller_speed = 0.0f;
+        } else {
+                if (mag_squared >= (MAX_JOYSTICK_AXIS_MOVEMENT *
+                                    MAX_JOYSTICK_AXIS_MOVEMENT)) {
+                        player->controller_speed = 1.0f;
+                } else {
+                        player->controller_speed =
+                                ((sqrtf(mag_squared) -
+                                  MIN_JOYSTICK_AXIS_MOVEMENT) /
+                                 (MAX_JOYSTICK_AXIS_MOVEMENT -
+                                  MIN_JOYSTICK_AXIS_MOVEMENT));
+                }
+                player->controller_direction = atan2f(player->y_axis,
+                                                      player->x_axis);
+        }
+
+        update_direction(input, player_num, timestamp);
+}
+
 static bool
 handle_game_controller_axis_motion(struct fv_input *input,
                                    const SDL_ControllerAxisEvent *event)
 {
         struct player *player;
-        int mag_squared;
         int16_t value = event->value;
         int player_num;
 
@@ -614,38 +672,69 @@ found_player:
         if (value < -INT16_MAX)
                 value = -INT16_MAX;
 
-        if (event->axis)
-                player->y_axis = -value;
-        else
-                player->x_axis = value;
-
-        mag_squared = (player->y_axis * (int) player->y_axis +
-                       player->x_axis * (int) player->x_axis);
+        player->axis_controller = event->which;
 
-        if (mag_squared <= (MIN_JOYSTICK_AXIS_MOVEMENT *
-                            MIN_JOYSTICK_AXIS_MOVEMENT)) {
-                player->controller_direction = 0.0f;
-                player->controller_speed = 0.0f;
+        if (event->axis) {
+                set_axes(input,
+                         player_num,
+                         player->x_axis,
+                         -value,
+                         event->timestamp);
         } else {
-                if (mag_squared >= (MAX_JOYSTICK_AXIS_MOVEMENT *
-                                    MAX_JOYSTICK_AXIS_MOVEMENT)) {
-                        player->controller_speed = 1.0f;
-                } else {
-                        player->controller_speed =
-                                ((sqrtf(mag_squared) -
-                                  MIN_JOYSTICK_AXIS_MOVEMENT) /
-                                 (MAX_JOYSTICK_AXIS_MOVEMENT -
-                                  MIN_JOYSTICK_AXIS_MOVEMENT));
-                }
-                player->controller_direction = atan2f(player->y_axis,
-                                                      player->x_axis);
+                set_axes(input,
+                         player_num,
+                         value,
+                         player->y_axis,
+                         event->timestamp);
         }
 
-        update_direction(input, player_num);
-
         return true;
 }
 
+void
+fv_input_latch_controllers(struct fv_input *input)
+{
+        SDL_GameController *controller;
+        const struct player *player;
+        SDL_JoystickID id;
+        Sint16 x_axis, y_axis;
+        Uint32 timestamp;
+        int player_num;
+
+        if (input->state != FV_INPUT_STATE_PLAYING)
+                return;
+
+        /* Read the controllers now instead of waiting for the next
+         * time the events are pumped */
+        SDL_GameControllerUpdate();
+
+        timestamp = SDL_GetTicks();
+
+        for (player_num = 0; player_num < input->n_players; player_num++) {
+                player = input->players + player_num;
+
+                if (player->axis_controller == -1)
+                        continue;
+
+                id = player->axis_controller;
+                controller = SDL_GameControllerFromInstanceID(id);
+                if (controller == NULL)
+                        continue;
+
+                x_axis = SDL_GameControllerGetAxis(controller,
+                                                   SDL_CONTROLLER_AXIS_LEFTX);
+                y_axis = SDL_GameControllerGetAxis(controller,
+                                                   SDL_CONTROLLER_AXIS_LEFTY);
+
+                if (x_axis < -INT16_MAX)
+                        x_axis = -INT16_MAX;
+                if (y_axis < -INT16_MAX)
+                        y_axis = -INT16_MAX;
+
+                set_axes(input, player_num, x_axis, -y_axis, timestamp);
+        }
+}
+
 static bool
 handle_joystick_added(struct fv_input *input,
                       const SDL_JoyDeviceEvent *event)
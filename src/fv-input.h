@@ -23,6 +23,7 @@
 #include <stdbool.h>
 
 #include "fv-logic.h"
+#include "fv-simulation.h"
 
 enum fv_input_state {
         FV_INPUT_STATE_CHOOSING_N_PLAYERS,
@@ -34,7 +35,7 @@ typedef void
 (* fv_input_state_changed_cb)(void *user_data);
 
 struct fv_input *
-fv_input_new(struct fv_logic *logic);
+fv_input_new(struct fv_simulation *simulation);
 
 void
 fv_input_set_state_changed_cb(struct fv_input *input,
@@ -50,10 +51,19 @@ fv_input_get_n_players(struct fv_input *input);
 int
 fv_input_get_next_player(struct fv_input *input);
 
+/* The event timestamp is passed on to the simulation so that the
+ * input is applied at the time it actually happened */
 bool
 fv_input_handle_event(struct fv_input *input,
                       const SDL_Event *event);
 
+/* Reads the latest position of the controller axes directly instead
+ * of waiting for the events. This should be called just before
+ * fetching the state for a frame so that the camera follows the
+ * freshest input. */
+void
+fv_input_latch_controllers(struct fv_input *input);
+
 void
 fv_input_reset(struct fv_input *input);
 
@@ -118,6 +118,13 @@ struct fv_logic_player {
         float shout_distance;
         /* Time in seconds since the player started shouting */
         float shout_time;
+
+        /* Where the player was at the start of the last update and
+         * the time of that position. A late change of direction
+         * moves the player back along the path between there and
+         * the current position. */
+        float last_x, last_y;
+        unsigned int last_move_ticks;
 };
 
 struct fv_logic {
@@ -198,11 +205,11 @@ fv_logic_reset(struct fv_logic *logic,
 
         for (i = 0; i < n_players; i++) {
                 player = logic->players + i;
-                player->position.x = (FV_MAP_START_X -
+                player->position.x = (fv_map.start_x -
                                       (n_players - 1) *
                                       FV_LOGIC_PLAYER_START_GAP / 2.0f +
                                       i * FV_LOGIC_PLAYER_START_GAP);
-                player->position.y = FV_MAP_START_Y;
+                player->position.y = fv_map.start_y;
                 player->position.current_direction = -M_PI / 2.0f;
                 player->position.target_direction = 0.0f;
                 player->position.speed = 0.0f;
@@ -212,6 +219,10 @@ fv_logic_reset(struct fv_logic *logic,
                 player->center_x = player->position.x;
                 player->center_y = player->position.y;
 
+                player->last_x = player->position.x;
+                player->last_y = player->position.y;
+                player->last_move_ticks = 0;
+
                 player->score = 0;
         }
 
@@ -234,16 +245,6 @@ fv_logic_new(void)
         return logic;
 }
 
-static bool
-is_wall(int x, int y)
-{
-        if (x < 0 || x >= FV_MAP_WIDTH ||
-            y < 0 || y >= FV_MAP_HEIGHT)
-                return true;
-
-        return FV_MAP_IS_WALL(fv_map.blocks[y * FV_MAP_WIDTH + x]);
-}
-
 static bool
 position_in_range(const struct fv_logic_position *position,
                   float x, float y,
@@ -314,17 +315,14 @@ update_position_direction(struct fv_logic *logic,
 }
 
 static void
-update_position_xy(struct fv_logic *logic,
-                   struct fv_logic_position *position,
-                   float progress_secs)
+move_position(struct fv_logic *logic,
+              struct fv_logic_position *position,
+              float dx, float dy)
 {
-        float distance;
         float diff;
         float pos;
 
-        distance = position->speed * progress_secs;
-
-        diff = distance * cosf(position->target_direction);
+        diff = dx;
 
         /* Don't let the player move more than one tile per frame
          * because otherwise it might be possible to skip over
@@ -334,28 +332,45 @@ update_position_xy(struct fv_logic *logic,
 
         pos = (position->x + diff +
                copysignf(FV_LOGIC_PERSON_SIZE / 2.0f, diff));
-        if (!is_wall(floorf(pos),
-                     floorf(position->y + FV_LOGIC_PERSON_SIZE / 2.0f)) &&
-            !is_wall(floorf(pos),
-                     floorf(position->y - FV_LOGIC_PERSON_SIZE / 2.0f)) &&
+        if (!fv_map_is_wall(floorf(pos),
+                            floorf(position->y +
+                                   FV_LOGIC_PERSON_SIZE / 2.0f)) &&
+            !fv_map_is_wall(floorf(pos),
+                            floorf(position->y -
+                                   FV_LOGIC_PERSON_SIZE / 2.0f)) &&
             !person_blocking(logic, position, pos, position->y))
                 position->x += diff;
 
-        diff = distance * sinf(position->target_direction);
+        diff = dy;
 
         if (fabsf(diff) > 1.0f)
                 diff = copysign(1.0f, diff);
 
         pos = (position->y + diff +
                copysignf(FV_LOGIC_PERSON_SIZE / 2.0f, diff));
-        if (!is_wall(floorf(position->x + FV_LOGIC_PERSON_SIZE / 2.0f),
-                     floorf(pos)) &&
-            !is_wall(floorf(position->x - FV_LOGIC_PERSON_SIZE / 2.0f),
-                     floorf(pos)) &&
+        if (!fv_map_is_wall(floorf(position->x +
+                                   FV_LOGIC_PERSON_SIZE / 2.0f),
+                            floorf(pos)) &&
+            !fv_map_is_wall(floorf(position->x -
+                                   FV_LOGIC_PERSON_SIZE / 2.0f),
+                            floorf(pos)) &&
             !person_blocking(logic, position, position->x, pos))
                 position->y += diff;
 }
 
+static void
+update_position_xy(struct fv_logic *logic,
+                   struct fv_logic_position *position,
+                   float progress_secs)
+{
+        float distance = position->speed * progress_secs;
+
+        move_position(logic,
+                      position,
+                      distance * cosf(position->target_direction),
+                      distance * sinf(position->target_direction));
+}
+
 static void
 update_position(struct fv_logic *logic,
                 struct fv_logic_position *position,
@@ -368,6 +383,15 @@ update_position(struct fv_logic *logic,
         update_position_direction(logic, position, progress_secs);
 }
 
+static bool
+position_changed(const struct fv_logic_position *a,
+                 const struct fv_logic_position *b)
+{
+        return (a->x != b->x ||
+                a->y != b->y ||
+                a->current_direction != b->current_direction);
+}
+
 static void
 update_center(struct fv_logic_player *player)
 {
@@ -726,46 +750,157 @@ update_shouts(struct fv_logic *logic,
         check_esperantification(logic);
 }
 
-void
+bool
 fv_logic_update(struct fv_logic *logic, unsigned int ticks)
 {
         unsigned int progress = ticks - logic->last_ticks;
+        struct fv_logic_position old_position;
         float progress_secs;
+        bool changed;
         int i;
 
         logic->last_ticks = ticks;
 
+        /* Remember where the players were before this update for
+         * fv_logic_set_direction. This is done even if they won't
+         * move so that the path doesn't include a skipped time. */
+        for (i = 0; i < logic->n_players && progress > 0; i++) {
+                logic->players[i].last_x = logic->players[i].position.x;
+                logic->players[i].last_y = logic->players[i].position.y;
+                logic->players[i].last_move_ticks = ticks - progress;
+        }
+
         /* If we've skipped over half a second then we'll assume something
          * has gone wrong and we won't do anything */
         if (progress >= 500)
-                return;
+                return false;
 
         if (logic->state != FV_LOGIC_STATE_RUNNING)
-                return;
+                return false;
 
         progress_secs = progress / 1000.0f;
 
+        /* The shouts grow and eventually disappear so they always
+         * need painting. Esperantifying someone can only happen
+         * while shouting. */
+        changed = logic->anyone_shouting;
+
         update_shouts(logic, progress_secs);
 
-        for (i = 0; i < logic->n_players; i++)
+        for (i = 0; i < logic->n_players; i++) {
+                old_position = logic->players[i].position;
                 update_player_movement(logic,
                                        logic->players + i,
                                        progress_secs);
+                if (position_changed(&old_position,
+                                     &logic->players[i].position))
+                        changed = true;
+        }
 
-        for (i = 0; i < FV_PERSON_N_NPCS; i++)
+        for (i = 0; i < FV_PERSON_N_NPCS; i++) {
+                old_position = logic->npcs[i].position;
                 update_npc_movement(logic, i, progress_secs);
+                if (position_changed(&old_position,
+                                     &logic->npcs[i].position))
+                        changed = true;
+        }
+
+        return changed;
+}
+
+static bool
+npc_is_moving(const struct fv_logic *logic,
+              int npc_num)
+{
+        const struct fv_logic_npc *npc = logic->npcs + npc_num;
+        const struct fv_person_npc *initial_state = fv_person_npcs + npc_num;
+
+        if (npc->state == FV_LOGIC_NPC_STATE_AFRAID)
+                return true;
+
+        if (npc->esperantified)
+                return false;
+
+        /* The other motions move all the time or wait for a time to
+         * pass */
+        if (initial_state->motion != FV_PERSON_MOTION_STATIC)
+                return true;
+
+        return (npc->state != FV_LOGIC_NPC_STATE_NORMAL ||
+                npc->position.current_direction != initial_state->direction);
+}
+
+/* Returns whether fv_logic_update could change anything without any
+ * more input. If not, the logic doesn't need to be updated until the
+ * next command. */
+bool
+fv_logic_is_moving(const struct fv_logic *logic)
+{
+        int i;
+
+        if (logic->state != FV_LOGIC_STATE_RUNNING)
+                return false;
+
+        if (logic->anyone_shouting)
+                return true;
+
+        for (i = 0; i < logic->n_players; i++) {
+                if (logic->players[i].position.speed)
+                        return true;
+        }
+
+        for (i = 0; i < FV_PERSON_N_NPCS; i++) {
+                if (npc_is_moving(logic, i))
+                        return true;
+        }
+
+        return false;
 }
 
 void
 fv_logic_set_direction(struct fv_logic *logic,
                        int player_num,
                        float speed,
-                       float direction)
+                       float direction,
+                       float late_secs)
 {
         struct fv_logic_player *player = logic->players + player_num;
+        struct fv_logic_position *position = &player->position;
+        unsigned int late_ticks = late_secs * 1000.0f + 0.5f;
+        unsigned int elapsed;
+        float back;
+
+        position->speed = FV_LOGIC_PLAYER_SPEED * speed;
+        position->target_direction = direction;
+
+        /* The players only move while the game is running */
+        if (late_ticks == 0 ||
+            logic->state != FV_LOGIC_STATE_RUNNING ||
+            player_num >= logic->n_players)
+                return;
 
-        player->position.speed = FV_LOGIC_PLAYER_SPEED * speed;
-        player->position.target_direction = direction;
+        /* The player can't be moved back further than the start of
+         * the last update */
+        elapsed = logic->last_ticks - player->last_move_ticks;
+        late_ticks = MIN(late_ticks, elapsed);
+
+        if (late_ticks == 0)
+                return;
+
+        /* Move the player back to where it actually was when the
+         * input happened, assuming that it moved steadily during the
+         * last update. If it was blocked then it stays where it is.
+         * From there it moves with the new speed for the late time. */
+        back = late_ticks / (float) elapsed;
+        position->x -= (position->x - player->last_x) * back;
+        position->y -= (position->y - player->last_y) * back;
+
+        player->last_x = position->x;
+        player->last_y = position->y;
+        player->last_move_ticks = logic->last_ticks - late_ticks;
+
+        update_position_xy(logic, position, late_ticks / 1000.0f);
+        update_center(player);
 }
 
 void
@@ -784,6 +919,13 @@ fv_logic_shout(struct fv_logic *logic,
         logic->anyone_shouting = true;
 }
 
+void
+fv_logic_copy(struct fv_logic *dest,
+              const struct fv_logic *src)
+{
+        *dest = *src;
+}
+
 void
 fv_logic_free(struct fv_logic *logic)
 {
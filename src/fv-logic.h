@@ -65,10 +65,14 @@ void
 fv_logic_reset(struct fv_logic *logic,
                int n_players);
 
-void
+/* Returns true if anything visible changed */
+bool
 fv_logic_update(struct fv_logic *logic,
                 unsigned int ticks);
 
+bool
+fv_logic_is_moving(const struct fv_logic *logic);
+
 void
 fv_logic_get_center(struct fv_logic *logic,
                     int player_num,
@@ -86,13 +90,18 @@ fv_logic_for_each_shout(struct fv_logic *logic,
 
 /* The direction is given in radians where 0 is the positive x-axis
  * and the angle is measured counter-clockwise from that. The speed is
- * normalised to the range [0,1].
+ * normalised to the range [0,1]. If the logic has already been
+ * updated past the time that the direction changed then late_secs is
+ * how far past it. The player is moved back to where it was at that
+ * time, but not further back than the last update, and then moved
+ * with the new speed from there.
  */
 void
 fv_logic_set_direction(struct fv_logic *logic,
                        int player_num,
                        float speed,
-                       float direction);
+                       float direction,
+                       float late_secs);
 
 int
 fv_logic_get_n_crocodiles(struct fv_logic *logic);
@@ -114,6 +123,12 @@ fv_logic_get_score(struct fv_logic *logic,
 float
 fv_logic_get_time_since_fina_venko(struct fv_logic *logic);
 
+/* Copies the whole state of the logic so that it can be painted
+ * while the original carries on being updated */
+void
+fv_logic_copy(struct fv_logic *dest,
+              const struct fv_logic *src);
+
 void
 fv_logic_free(struct fv_logic *logic);
 
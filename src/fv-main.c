@@ -26,6 +26,8 @@
 #include <stdlib.h>
 #include <time.h>
 #include <stdarg.h>
+#include <string.h>
+#include <errno.h>
 
 #include "fv-game.h"
 #include "fv-logic.h"
@@ -37,6 +39,9 @@
 #include "fv-map.h"
 #include "fv-error-message.h"
 #include "fv-input.h"
+#include "fv-data.h"
+#include "fv-frame-scheduler.h"
+#include "fv-simulation.h"
 
 #ifdef EMSCRIPTEN
 #include <emscripten.h>
@@ -60,6 +65,11 @@
 #define FV_GL_PROFILE SDL_GL_CONTEXT_PROFILE_COMPATIBILITY
 #endif
 
+/* Time in milliseconds to wait for an event when nothing on the
+ * screen is changing. The simulation sends an event when it changes
+ * so this is just a safety net. */
+#define IDLE_TIMEOUT 1000
+
 struct viewport {
         int x, y;
         int width, height;
@@ -81,30 +91,58 @@ struct data {
                 bool shader_data_loaded;
         } graphics;
 
+        /* Time the main thread spent compiling or loading the
+         * shaders in performance counter ticks so that the effect of
+         * the program binary cache can be measured */
+        Uint64 shader_load_time;
+        int n_cached_programs;
+
+        /* Time from starting to load the images until the loaded
+         * event is received */
+        Uint64 image_load_start;
+        Uint64 image_load_time;
+
+        struct fv_simulation *simulation;
+        Uint32 simulation_event;
+        /* The latest state from the simulation and its serial
+         * number */
         struct fv_logic *logic;
+        unsigned int logic_serial;
 
         bool quit;
         bool is_fullscreen;
+        bool show_stats;
+        /* Measure the time from each input event until the frame
+         * that shows it is swapped */
+        bool measure_latency;
 
         bool viewports_dirty;
         int n_viewports;
 
-        unsigned int start_time;
+        /* Set when an event might have changed what is on the screen
+         * so that the next frame will be painted */
+        bool redraw_queued;
+        /* Set when the logic or the HUD changed in the last update
+         * which means they will probably carry on changing */
+        bool animating;
 
         struct fv_input *input;
 
+        enum fv_frame_scheduler_vsync vsync;
+        int max_fps;
+        struct fv_frame_scheduler *frame_scheduler;
+
         struct viewport viewports[FV_LOGIC_MAX_PLAYERS];
 };
 
 static void
 reset_menu_state(struct data *data)
 {
-        data->start_time = SDL_GetTicks();
         data->viewports_dirty = true;
         data->n_viewports = 1;
 
         fv_input_reset(data->input);
-        fv_logic_reset(data->logic, 0);
+        fv_simulation_reset(data->simulation, 0);
 }
 
 #ifndef EMSCRIPTEN
@@ -168,9 +206,8 @@ input_state_changed_cb(void *user_data)
         struct data *data = user_data;
 
         if (fv_input_get_state(data->input) == FV_INPUT_STATE_PLAYING) {
-                data->start_time = SDL_GetTicks();
-                fv_logic_reset(data->logic,
-                               fv_input_get_n_players(data->input));
+                fv_simulation_reset(data->simulation,
+                                    fv_input_get_n_players(data->input));
         }
 
         data->viewports_dirty = true;
@@ -195,13 +232,48 @@ destroy_graphics(struct data *data)
         }
 }
 
+static bool
+start_shaders(struct data *data)
+{
+        Uint64 start_time = SDL_GetPerformanceCounter();
+
+        if (!fv_shader_data_init(&data->graphics.shader_data))
+                return false;
+
+        data->graphics.shader_data_loaded = true;
+
+        data->shader_load_time += SDL_GetPerformanceCounter() - start_time;
+
+        return true;
+}
+
+static bool
+finish_shaders(struct data *data)
+{
+        Uint64 start_time = SDL_GetPerformanceCounter();
+
+        if (!fv_shader_data_finish(&data->graphics.shader_data))
+                return false;
+
+        data->shader_load_time += SDL_GetPerformanceCounter() - start_time;
+        data->n_cached_programs =
+                data->graphics.shader_data.n_cached_programs;
+
+        return true;
+}
+
 static void
 create_graphics(struct data *data)
 {
         /* All of the painting functions expect to have the default
          * OpenGL state plus the following modifications */
 
-        fv_gl.glEnable(GL_CULL_FACE);
+        /* The context might be new so forget everything the state
+         * cache knows */
+        fv_gl_reset_state();
+        fv_gl_active_texture(GL_TEXTURE0);
+
+        fv_gl_enable(GL_CULL_FACE);
         fv_gl.glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
         /* The current program, vertex array, array buffer and bound
@@ -209,10 +281,13 @@ create_graphics(struct data *data)
 
         data->last_fb_width = data->last_fb_height = 0;
 
-        if (!fv_shader_data_init(&data->graphics.shader_data))
+        /* The shaders are normally already being compiled while the
+         * images were loading, unless the context was lost */
+        if (!data->graphics.shader_data_loaded && !start_shaders(data))
                 goto error;
 
-        data->graphics.shader_data_loaded = true;
+        if (!finish_shaders(data))
+                goto error;
 
         data->graphics.hud = fv_hud_new(data->image_data,
                                         &data->graphics.shader_data);
@@ -241,6 +316,9 @@ static void
 handle_image_data_event(struct data *data,
                         const SDL_UserEvent *event)
 {
+        data->image_load_time = (SDL_GetPerformanceCounter() -
+                                 data->image_load_start);
+
         switch ((enum fv_image_data_result) event->code) {
         case FV_IMAGE_DATA_SUCCESS:
                 create_graphics(data);
@@ -284,11 +362,23 @@ handle_event(struct data *data,
                 goto handled;
         }
 
-        if (fv_input_handle_event(data->input, event))
+        if (event->type == data->simulation_event)
+                goto handled;
+
+        if (fv_input_handle_event(data->input, event)) {
+                if (data->measure_latency &&
+                    event->type != SDL_JOYDEVICEADDED &&
+                    event->type != SDL_JOYDEVICEREMOVED) {
+                        fv_frame_scheduler_queue_input(data->frame_scheduler,
+                                                       event->common.timestamp);
+                }
                 goto handled;
+        }
+
+        return;
 
 handled:
-        (void) 0;
+        data->redraw_queued = true;
 }
 
 static void
@@ -370,8 +460,8 @@ update_centers(struct data *data)
                 }
         } else {
                 for (i = 0; i < data->n_viewports; i++) {
-                        data->viewports[i].center_x = FV_MAP_START_X;
-                        data->viewports[i].center_y = FV_MAP_START_Y;
+                        data->viewports[i].center_x = fv_map.start_x;
+                        data->viewports[i].center_y = fv_map.start_y;
                 }
         }
 }
@@ -411,6 +501,40 @@ need_clear(struct data *data)
         return false;
 }
 
+/* Fetches the latest state of the logic and returns whether a frame
+ * needs to be painted */
+static bool
+update_state(struct data *data)
+{
+        unsigned int serial;
+        bool animating;
+
+        /* This is as late as possible before the camera is positioned
+         * for the frame */
+        fv_input_latch_controllers(data->input);
+
+        data->logic = fv_simulation_get_logic(data->simulation, &serial);
+
+        if (data->measure_latency &&
+            fv_simulation_is_up_to_date(data->simulation))
+                fv_frame_scheduler_latch_inputs(data->frame_scheduler);
+
+        animating = serial != data->logic_serial;
+        data->logic_serial = serial;
+
+        if (fv_hud_is_animating(data->logic))
+                animating = true;
+
+        data->animating = animating;
+
+        if (!animating && !data->redraw_queued)
+                return false;
+
+        data->redraw_queued = false;
+
+        return true;
+}
+
 static void
 paint(struct data *data)
 {
@@ -421,14 +545,12 @@ paint(struct data *data)
         SDL_GetWindowSize(data->window, &w, &h);
 
         if (w != data->last_fb_width || h != data->last_fb_height) {
-                fv_gl.glViewport(0, 0, w, h);
+                fv_gl_viewport(0, 0, w, h);
                 data->last_fb_width = w;
                 data->last_fb_height = h;
                 data->viewports_dirty = true;
         }
 
-        fv_logic_update(data->logic, SDL_GetTicks() - data->start_time);
-
         update_viewports(data);
         update_centers(data);
 
@@ -439,10 +561,10 @@ paint(struct data *data)
 
         for (i = 0; i < data->n_viewports; i++) {
                 if (data->n_viewports != 1)
-                        fv_gl.glViewport(data->viewports[i].x,
-                                         data->viewports[i].y,
-                                         data->viewports[i].width,
-                                         data->viewports[i].height);
+                        fv_gl_viewport(data->viewports[i].x,
+                                       data->viewports[i].y,
+                                       data->viewports[i].width,
+                                       data->viewports[i].height);
                 fv_game_paint(data->graphics.game,
                               data->viewports[i].center_x,
                               data->viewports[i].center_y,
@@ -451,8 +573,10 @@ paint(struct data *data)
                               data->logic);
         }
 
+        fv_game_end_frame(data->graphics.game);
+
         if (data->n_viewports != 1)
-                fv_gl.glViewport(0, 0, w, h);
+                fv_gl_viewport(0, 0, w, h);
 
         paint_hud(data, w, h);
 
@@ -501,6 +625,97 @@ check_gl_version(void)
         return true;
 }
 
+static void
+show_stats(struct data *data)
+{
+        struct fv_map_painter_stats map_stats;
+        struct fv_frame_scheduler_stats frame_stats;
+        double frequency = SDL_GetPerformanceFrequency();
+
+        printf("GL state changes: %lu, redundant: %lu (%.1f%%)\n",
+               fv_gl.state.n_calls,
+               fv_gl.state.n_redundant_calls,
+               fv_gl_get_redundant_call_rate() * 100.0f);
+
+        if (data->shader_load_time > 0) {
+                printf("Shader load time: %.2f ms, "
+                       "%i/%i programs from the binary cache\n",
+                       data->shader_load_time * 1000.0 /
+                       SDL_GetPerformanceFrequency(),
+                       data->n_cached_programs,
+                       FV_SHADER_DATA_N_PROGRAMS);
+        }
+
+        if (data->image_load_time > 0) {
+                printf("Image load time: %.2f ms\n",
+                       data->image_load_time * 1000.0 /
+                       SDL_GetPerformanceFrequency());
+        }
+
+        fv_frame_scheduler_get_stats(data->frame_scheduler, &frame_stats);
+
+        if (frame_stats.n_frames > 0) {
+                printf("Swap interval: %i, frames: %lu, "
+                       "idle waits: %lu\n"
+                       "Frame time: %.2f ms (min %.2f, max %.2f), "
+                       "sleep: %.2f ms/frame\n",
+                       frame_stats.swap_interval,
+                       frame_stats.n_frames,
+                       frame_stats.n_idle_waits,
+                       frame_stats.frame_time * 1000.0 /
+                       frequency /
+                       frame_stats.n_frames,
+                       frame_stats.min_frame_time * 1000.0 / frequency,
+                       frame_stats.max_frame_time * 1000.0 / frequency,
+                       frame_stats.sleep_time * 1000.0 /
+                       frequency /
+                       frame_stats.n_frames);
+        }
+
+        if (frame_stats.n_latencies > 0) {
+                printf("Input latency: p50 %.2f ms, p90 %.2f ms, "
+                       "p99 %.2f ms, max %.2f ms, events: %lu\n",
+                       frame_stats.latency_p50 * 1000.0 / frequency,
+                       frame_stats.latency_p90 * 1000.0 / frequency,
+                       frame_stats.latency_p99 * 1000.0 / frequency,
+                       frame_stats.max_latency * 1000.0 / frequency,
+                       frame_stats.n_latencies);
+        }
+
+        if (data->graphics.game) {
+                fv_game_get_map_stats(data->graphics.game, &map_stats);
+                printf("Map mode: %s, block memory: %.1f KiB, "
+                       "paint time: %.3f ms/frame\n",
+                       map_stats.mode == FV_MAP_PAINTER_MODE_BLOCK_INSTANCES ?
+                       "block instances" :
+                       "tile meshes",
+                       map_stats.block_memory / 1024.0,
+                       map_stats.n_paints ?
+                       map_stats.paint_time * 1000.0 /
+                       SDL_GetPerformanceFrequency() /
+                       map_stats.n_paints :
+                       0.0);
+                printf("Map tiles resident: %i/%i (peak %i), "
+                       "streamed: %lu, evicted: %lu, rebuilt: %lu\n"
+                       "Map tile misses: %lu/%lu (%.1f%%), "
+                       "time: %.2f ms\n",
+                       map_stats.n_resident,
+                       map_stats.n_slots,
+                       map_stats.max_resident,
+                       map_stats.n_streamed,
+                       map_stats.n_evictions,
+                       map_stats.n_rebuilds,
+                       map_stats.n_misses,
+                       map_stats.n_tile_draws,
+                       map_stats.n_tile_draws ?
+                       map_stats.n_misses * 100.0 /
+                       map_stats.n_tile_draws :
+                       0.0,
+                       map_stats.miss_time * 1000.0 /
+                       SDL_GetPerformanceFrequency());
+        }
+}
+
 static void
 show_help(void)
 {
@@ -509,13 +724,53 @@ show_help(void)
                "Opcioj:\n"
                " -h       Montru ĉi tiun helpmesaĝon\n"
                " -f       Rulu la ludon en fenestro\n"
-               " -p       Rulu la ludon plenekrane (defaŭlto)\n");
+               " -p       Rulu la ludon plenekrane (defaŭlto)\n"
+               " -s       Montru statistikojn je la fino\n"
+               " -l       Mezuru la latentecon de la enigo kaj montru "
+               "ĝin je la fino\n"
+               " -b       Desegnu la mapon per instancoj de blokoj\n"
+               " -t <n>   Uzu <n> fadenojn por ŝargi la bildojn\n"
+               " -v <r>   Vertikala sinkronigo: adapta (defaŭlto), "
+               "jes aŭ ne\n"
+               " -r <n>   Desegnu maksimume <n> bildojn sekunde "
+               "(0 = senlime)\n");
+}
+
+static bool
+process_argument_value(int argc, char **argv,
+                       int *arg_num,
+                       const char **flags,
+                       const char **value)
+{
+        /* The value can either be the rest of the flags or the next
+         * argument */
+        if ((*flags)[1]) {
+                *value = *flags + 1;
+        } else if (*arg_num + 1 < argc) {
+                *value = argv[++*arg_num];
+        } else {
+                fprintf(stderr, "Opcio ‘%c’ bezonas argumenton\n", **flags);
+                show_help();
+                return false;
+        }
+
+        /* Skip the rest of the flags */
+        *flags += strlen(*flags) - 1;
+
+        return true;
 }
 
 static bool
 process_argument_flags(struct data *data,
-                       const char *flags)
+                       int argc, char **argv,
+                       int *arg_num)
 {
+        const char *flags = argv[*arg_num] + 1;
+        const char *value;
+        char *tail;
+        long n_threads, max_fps;
+        enum fv_map_painter_mode map_mode;
+
         while (*flags) {
                 switch (*flags) {
                 case 'h':
@@ -530,6 +785,75 @@ process_argument_flags(struct data *data,
                         data->is_fullscreen = true;
                         break;
 
+                case 's':
+                        data->show_stats = true;
+                        break;
+
+                case 'l':
+                        data->measure_latency = true;
+                        data->show_stats = true;
+                        break;
+
+                case 'b':
+                        map_mode = FV_MAP_PAINTER_MODE_BLOCK_INSTANCES;
+                        fv_map_painter_set_mode(map_mode);
+                        break;
+
+                case 't':
+                        if (!process_argument_value(argc, argv,
+                                                    arg_num,
+                                                    &flags,
+                                                    &value))
+                                return false;
+                        errno = 0;
+                        n_threads = strtol(value, &tail, 10);
+                        if (errno || *tail || n_threads < 1) {
+                                fprintf(stderr,
+                                        "Nevalida nombro da fadenoj ‘%s’\n",
+                                        value);
+                                return false;
+                        }
+                        fv_image_data_set_n_threads(n_threads);
+                        break;
+
+                case 'v':
+                        if (!process_argument_value(argc, argv,
+                                                    arg_num,
+                                                    &flags,
+                                                    &value))
+                                return false;
+                        if (!strcmp(value, "adapta")) {
+                                data->vsync =
+                                        FV_FRAME_SCHEDULER_VSYNC_ADAPTIVE;
+                        } else if (!strcmp(value, "jes")) {
+                                data->vsync = FV_FRAME_SCHEDULER_VSYNC_ON;
+                        } else if (!strcmp(value, "ne")) {
+                                data->vsync = FV_FRAME_SCHEDULER_VSYNC_OFF;
+                        } else {
+                                fprintf(stderr,
+                                        "Nevalida sinkronigo ‘%s’\n",
+                                        value);
+                                return false;
+                        }
+                        break;
+
+                case 'r':
+                        if (!process_argument_value(argc, argv,
+                                                    arg_num,
+                                                    &flags,
+                                                    &value))
+                                return false;
+                        errno = 0;
+                        max_fps = strtol(value, &tail, 10);
+                        if (errno || *tail || max_fps < 0 || max_fps > 1000) {
+                                fprintf(stderr,
+                                        "Nevalida bildrapido ‘%s’\n",
+                                        value);
+                                return false;
+                        }
+                        data->max_fps = max_fps;
+                        break;
+
                 default:
                         fprintf(stderr, "Neatendita opcio ‘%c’\n", *flags);
                         show_help();
@@ -550,7 +874,7 @@ process_arguments(struct data *data,
 
         for (i = 1; i < argc; i++) {
                 if (argv[i][0] == '-') {
-                        if (!process_argument_flags(data, argv[i] + 1))
+                        if (!process_argument_flags(data, argc, argv, &i))
                                 return false;
                 } else {
                         fprintf(stderr, "Neatendita argumento ‘%s’\n", argv[i]);
@@ -606,7 +930,14 @@ emscripten_loop_cb(void *user_data)
         while (SDL_PollEvent(&event))
                 handle_event(data, &event);
 
+        /* The browser will keep calling this every frame but there's
+         * no need to paint if nothing has changed */
+        if (!update_state(data))
+                return;
+
         paint(data);
+
+        fv_frame_scheduler_end_frame(data->frame_scheduler);
 }
 
 static int
@@ -681,17 +1012,36 @@ iterate_main_loop(struct data *data)
 
         if (data->graphics.game == NULL) {
                 SDL_WaitEvent(&event);
-                data->start_time = SDL_GetTicks();
                 handle_event(data, &event);
                 return;
         }
 
-        if (SDL_PollEvent(&event)) {
+        if (data->animating || data->redraw_queued) {
+                /* Wait for the frame rate cap before handling the
+                 * events so that the frame is painted with the latest
+                 * input */
+                fv_frame_scheduler_begin_frame(data->frame_scheduler);
+        } else {
+                /* Nothing on the screen is changing so block until
+                 * something happens instead of painting the same
+                 * frame again */
+                fv_frame_scheduler_idle(data->frame_scheduler);
+
+                if (SDL_WaitEventTimeout(&event, IDLE_TIMEOUT))
+                        handle_event(data, &event);
+        }
+
+        /* Handle all of the pending events before each frame so that
+         * a burst of input events doesn't hold up painting */
+        while (SDL_PollEvent(&event))
                 handle_event(data, &event);
+
+        if (data->quit || !update_state(data))
                 return;
-        }
 
         paint(data);
+
+        fv_frame_scheduler_end_frame(data->frame_scheduler);
 }
 
 #endif /* EMSCRIPTEN */
@@ -711,6 +1061,16 @@ main(int argc, char **argv)
         data.is_fullscreen = true;
 #endif
 
+        data.show_stats = false;
+        data.measure_latency = false;
+        data.redraw_queued = true;
+        data.animating = false;
+        data.vsync = FV_FRAME_SCHEDULER_VSYNC_ADAPTIVE;
+        data.max_fps = 0;
+        data.shader_load_time = 0;
+        data.n_cached_programs = 0;
+        data.image_load_time = 0;
+
         memset(&data.graphics, 0, sizeof data.graphics);
 
         if (!process_arguments(&data, argc, argv)) {
@@ -727,6 +1087,13 @@ main(int argc, char **argv)
                 goto out;
         }
 
+        fv_data_init();
+
+        if (!fv_map_load()) {
+                ret = EXIT_FAILURE;
+                goto out_data;
+        }
+
         SDL_GL_SetAttribute(SDL_GL_RED_SIZE, 8);
         SDL_GL_SetAttribute(SDL_GL_GREEN_SIZE, 8);
         SDL_GL_SetAttribute(SDL_GL_BLUE_SIZE, 8);
@@ -759,7 +1126,7 @@ main(int argc, char **argv)
                         fv_error_message("Failed to create SDL window: %s",
                                          SDL_GetError());
                         ret = EXIT_FAILURE;
-                        goto out_sdl;
+                        goto out_map;
                 }
         }
 
@@ -784,18 +1151,32 @@ main(int argc, char **argv)
                 goto out_context;
         }
 
+        /* Start compiling the shaders before loading the images so
+         * that the driver can compile them in the background */
+        if (!start_shaders(&data)) {
+                ret = EXIT_FAILURE;
+                goto out_context;
+        }
+
         SDL_ShowCursor(0);
 
+        data.frame_scheduler = fv_frame_scheduler_new(data.vsync,
+                                                      data.max_fps);
+
         data.image_data_event = SDL_RegisterEvents(1);
 
         data.quit = false;
 
-        data.logic = fv_logic_new();
-        data.input = fv_input_new(data.logic);
+        data.simulation_event = SDL_RegisterEvents(1);
+        data.simulation = fv_simulation_new(data.simulation_event);
+        data.logic = fv_simulation_get_logic(data.simulation,
+                                             &data.logic_serial);
+        data.input = fv_input_new(data.simulation);
         fv_input_set_state_changed_cb(data.input,
                                       input_state_changed_cb,
                                       &data);
 
+        data.image_load_start = SDL_GetPerformanceCounter();
         data.image_data = fv_image_data_new(data.image_data_event);
 
         reset_menu_state(&data);
@@ -825,8 +1206,12 @@ main(int argc, char **argv)
                 iterate_main_loop(&data);
 #endif
 
+        if (data.show_stats)
+                show_stats(&data);
+
         fv_input_free(data.input);
-        fv_logic_free(data.logic);
+        fv_simulation_free(data.simulation);
+        fv_frame_scheduler_free(data.frame_scheduler);
 
         destroy_graphics(&data);
 
@@ -838,7 +1223,10 @@ main(int argc, char **argv)
         SDL_GL_DeleteContext(data.gl_context);
  out_window:
         SDL_DestroyWindow(data.window);
- out_sdl:
+ out_map:
+        fv_map_unload();
+ out_data:
+        fv_data_deinit();
         SDL_Quit();
  out:
         return ret;
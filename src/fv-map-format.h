@@ -0,0 +1,95 @@
+/*
+ * Finvenkisto
+ *
+ * Copyright (C) 2026 Neil Roberts
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FV_MAP_FORMAT_H
+#define FV_MAP_FORMAT_H
+
+#include <stdint.h>
+
+/* A .fvmap file contains the map in the form that the game uses at
+ * runtime. It is generated from fv-map.ppm at build time by
+ * make-map.py. The file starts with the header below. The other
+ * sections follow at the offsets given in the header, each aligned
+ * to FV_MAP_FORMAT_ALIGNMENT. All values are little-endian.
+ *
+ * The blocks are an array of width×height fv_map_block_t values with
+ * y=0 at the bottom of the map. The map is divided into tiles of
+ * tile_width×tile_height blocks. For each tile there is an
+ * fv_map_format_tile giving a range of specials in the specials
+ * array. Within a tile the specials are sorted by their number.
+ *
+ * If the FV_MAP_FORMAT_FLAG_WALL_MASK flag is set then the file also
+ * has a precomputed mask with one bit per block which is set if the
+ * block is a wall. The bits are in the same order as the blocks with
+ * the least-significant bit of each byte first.
+ *
+ * If the FV_MAP_FORMAT_FLAG_MESHES flag is set then the file also has
+ * the mesh for each tile generated in the same way as the painter
+ * would. For each tile there is an fv_map_format_mesh giving a range
+ * of vertices in the vertices section and a range of 16-bit indices
+ * in the indices section. The indices are relative to the first
+ * vertex of the tile. Each vertex is FV_MAP_FORMAT_VERTEX_SIZE bytes
+ * in the layout of struct fv_map_mesh_vertex in fv-map-mesh.h.
+ */
+
+#define FV_MAP_FORMAT_MAGIC "FVMAP003"
+
+#define FV_MAP_FORMAT_ALIGNMENT 16
+
+#define FV_MAP_FORMAT_FLAG_WALL_MASK (1 << 0)
+#define FV_MAP_FORMAT_FLAG_MESHES (1 << 1)
+
+#define FV_MAP_FORMAT_VERTEX_SIZE 8
+/* Offset of the byte in each vertex that has the image number */
+#define FV_MAP_FORMAT_VERTEX_IMAGE_OFFSET 6
+
+struct fv_map_format_tile {
+        uint32_t first_special;
+        uint32_t n_specials;
+};
+
+struct fv_map_format_mesh {
+        uint32_t first_vertex;
+        uint32_t n_vertices;
+        uint32_t first_index;
+        uint32_t n_indices;
+};
+
+struct fv_map_format_header {
+        char magic[8];
+        uint32_t width;
+        uint32_t height;
+        uint32_t tile_width;
+        uint32_t tile_height;
+        float start_x;
+        float start_y;
+        uint32_t n_specials;
+        uint32_t flags;
+        uint32_t n_vertices;
+        uint32_t n_indices;
+        uint32_t blocks_offset;
+        uint32_t tiles_offset;
+        uint32_t specials_offset;
+        uint32_t wall_mask_offset;
+        uint32_t meshes_offset;
+        uint32_t vertices_offset;
+        uint32_t indices_offset;
+};
+
+#endif /* FV_MAP_FORMAT_H */
@@ -0,0 +1,496 @@
+/*
+ * Finvenkisto
+ *
+ * Copyright (C) 2014, 2015 Neil Roberts
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <string.h>
+#include <assert.h>
+
+#include "fv-map-mesh.h"
+#include "fv-map.h"
+#include "fv-util.h"
+
+/* The map is always drawn with the same rotation so the lighting
+ * for each direction of face is constant. Instead of calculating it
+ * in the vertex shader it is baked into a byte in the vertex. These
+ * are the tints that fv-lighting.glsl would give for each direction
+ * scaled to 255. They must match the values in make-map.py.
+ */
+#define FV_MAP_MESH_LIGHT_UP 230
+#define FV_MAP_MESH_LIGHT_NORTH 128
+#define FV_MAP_MESH_LIGHT_EAST 162
+#define FV_MAP_MESH_LIGHT_SOUTH 196
+#define FV_MAP_MESH_LIGHT_WEST 128
+
+enum face_type {
+        FACE_TYPE_TOP,
+        FACE_TYPE_NORTH,
+        FACE_TYPE_SOUTH,
+        FACE_TYPE_WEST,
+        FACE_TYPE_EAST,
+};
+
+struct face {
+        int image;
+        /* Height of the top of the face and of the bottom */
+        int z, oz;
+        /* Ambient occlusion level for each corner in the same order
+         * as the vertices of the quad. 3 is unoccluded. Only the
+         * tops have any occlusion. */
+        int ao[4];
+};
+
+/* Multiplier for the light of a corner at each ambient occlusion
+ * level out of 255. These must match the values in make-map.py. */
+static const uint8_t
+ao_factors[] = { 140, 179, 217, 255 };
+
+static float
+get_block_height(fv_map_block_t block)
+{
+        switch (FV_MAP_GET_BLOCK_TYPE(block)) {
+        case FV_MAP_BLOCK_TYPE_FULL_WALL:
+                return 2.0f;
+        case FV_MAP_BLOCK_TYPE_HALF_WALL:
+                return 1.0f;
+        default:
+                return 0.0f;
+        }
+}
+
+static float
+get_position_height(int x, int y)
+{
+        if (x < 0 || x >= fv_map.width ||
+            y < 0 || y >= fv_map.height)
+                return 0.0f;
+
+        return get_block_height(fv_map.blocks[y * fv_map.width + x]);
+}
+
+static struct fv_map_mesh_vertex *
+reserve_quad(struct fv_map_mesh *mesh)
+{
+        struct fv_map_mesh_vertex *v;
+        uint16_t *idx;
+        size_t v1, i1;
+
+        v1 = mesh->vertices.length / sizeof (struct fv_map_mesh_vertex);
+        fv_buffer_set_length(&mesh->vertices,
+                             sizeof (struct fv_map_mesh_vertex) * (v1 + 4));
+        v = (struct fv_map_mesh_vertex *) mesh->vertices.data + v1;
+        /* Clear the vertices so that the walls get a wrap_t of zero
+         * and the mesh is exactly the same as the one generated at
+         * build time */
+        memset(v, 0, sizeof *v * 4);
+
+        v1 -= mesh->first_vertex;
+        assert(v1 + 4 <= UINT16_MAX + 1);
+
+        i1 = mesh->indices.length / sizeof (uint16_t);
+        fv_buffer_set_length(&mesh->indices,
+                             sizeof (uint16_t) * (i1 + 6));
+        idx = (uint16_t *) mesh->indices.data + i1;
+
+        *(idx++) = v1 + 0;
+        *(idx++) = v1 + 1;
+        *(idx++) = v1 + 2;
+        *(idx++) = v1 + 2;
+        *(idx++) = v1 + 1;
+        *(idx++) = v1 + 3;
+
+        return v;
+}
+
+static struct fv_map_mesh_vertex *
+add_horizontal_side(struct fv_map_mesh *mesh,
+                    int y,
+                    int x1, int z1,
+                    int x2, int z2)
+{
+        struct fv_map_mesh_vertex *v = reserve_quad(mesh);
+        int i;
+
+        for (i = 0; i < 4; i++)
+                v[i].y = y - mesh->y;
+
+        v[0].x = x1 - mesh->x;
+        v[0].z = z1;
+        v[1].x = x2 - mesh->x;
+        v[1].z = z1;
+        v[2].x = x1 - mesh->x;
+        v[2].z = z2;
+        v[3].x = x2 - mesh->x;
+        v[3].z = z2;
+
+        return v;
+}
+
+static struct fv_map_mesh_vertex *
+add_vertical_side(struct fv_map_mesh *mesh,
+                  int x,
+                  int y1, int z1,
+                  int y2, int z2)
+{
+        struct fv_map_mesh_vertex *v = reserve_quad(mesh);
+        int i;
+
+        for (i = 0; i < 4; i++)
+                v[i].x = x - mesh->x;
+
+        v[0].y = y1 - mesh->y;
+        v[0].z = z1;
+        v[1].y = y2 - mesh->y;
+        v[1].z = z1;
+        v[2].y = y1 - mesh->y;
+        v[2].z = z2;
+        v[3].y = y2 - mesh->y;
+        v[3].z = z2;
+
+        return v;
+}
+
+static void
+set_tex_coords_for_image(struct fv_map_mesh_vertex v[4],
+                         int image,
+                         int width,
+                         int height)
+{
+        int i;
+
+        for (i = 0; i < 4; i++)
+                v[i].image = image;
+
+        v[0].s = 0;
+        v[0].t = height;
+        v[1].s = width;
+        v[1].t = height;
+        v[2].s = 0;
+        v[2].t = 0;
+        v[3].s = width;
+        v[3].t = 0;
+}
+
+static uint8_t
+get_light(int face_light,
+          int ao)
+{
+        return (face_light * ao_factors[ao] + 127) / 255;
+}
+
+static void
+set_lights(struct fv_map_mesh_vertex *v,
+           int face_light)
+{
+        int i;
+
+        for (i = 0; i < 4; i++)
+                v[i].light = get_light(face_light, 3);
+}
+
+/* Gets the ambient occlusion level for the corner of the top of a
+ * block in the direction dx,dy. Each of the two neighbouring blocks
+ * along the edges and the block on the diagonal darkens the corner
+ * if it is higher than the top. Two raised edges fully occlude the
+ * corner regardless of the diagonal. */
+static int
+get_corner_ao(int x, int y,
+              int dx, int dy,
+              int z)
+{
+        bool side1 = get_position_height(x + dx, y) > z;
+        bool side2 = get_position_height(x, y + dy) > z;
+        bool corner = get_position_height(x + dx, y + dy) > z;
+
+        if (side1 && side2)
+                return 0;
+
+        return 3 - (side1 + side2 + corner);
+}
+
+static bool
+get_face(int x, int y,
+         enum face_type type,
+         struct face *face)
+{
+        fv_map_block_t block = fv_map.blocks[y * fv_map.width + x];
+        size_t i;
+
+        face->z = get_block_height(block);
+
+        for (i = 0; i < FV_N_ELEMENTS(face->ao); i++)
+                face->ao[i] = 3;
+
+        switch (type) {
+        case FACE_TYPE_TOP:
+                face->image = FV_MAP_GET_BLOCK_TOP_IMAGE(block);
+                face->oz = face->z;
+                face->ao[0] = get_corner_ao(x, y, -1, -1, face->z);
+                face->ao[1] = get_corner_ao(x, y, 1, -1, face->z);
+                face->ao[2] = get_corner_ao(x, y, -1, 1, face->z);
+                face->ao[3] = get_corner_ao(x, y, 1, 1, face->z);
+                return true;
+        case FACE_TYPE_NORTH:
+                face->image = FV_MAP_GET_BLOCK_NORTH_IMAGE(block);
+                face->oz = get_position_height(x, y + 1);
+                break;
+        case FACE_TYPE_SOUTH:
+                face->image = FV_MAP_GET_BLOCK_SOUTH_IMAGE(block);
+                face->oz = get_position_height(x, y - 1);
+                break;
+        case FACE_TYPE_WEST:
+                face->image = FV_MAP_GET_BLOCK_WEST_IMAGE(block);
+                face->oz = get_position_height(x - 1, y);
+                break;
+        case FACE_TYPE_EAST:
+                face->image = FV_MAP_GET_BLOCK_EAST_IMAGE(block);
+                face->oz = get_position_height(x + 1, y);
+                break;
+        }
+
+        return face->z > face->oz;
+}
+
+/* Checks whether the two faces can be merged into one quad. Faces
+ * whose corners have different ambient occlusion are never merged
+ * because the light would be interpolated across the whole quad. */
+static bool
+faces_equal(const struct face *a,
+            const struct face *b)
+{
+        int i;
+
+        for (i = 0; i < 4; i++) {
+                if (a->ao[i] != a->ao[0] || b->ao[i] != a->ao[0])
+                        return false;
+        }
+
+        return a->image == b->image && a->z == b->z && a->oz == b->oz;
+}
+
+static bool
+can_merge(const struct fv_map_mesh *mesh,
+          const struct face *a,
+          const struct face *b)
+{
+        return mesh->merge_faces && faces_equal(a, b);
+}
+
+static void
+add_top(struct fv_map_mesh *mesh,
+        const struct face *face,
+        int x1, int y1,
+        int x2, int y2)
+{
+        struct fv_map_mesh_vertex *v = reserve_quad(mesh);
+        int i;
+
+        for (i = 0; i < 4; i++) {
+                v[i].z = face->z;
+                v[i].light = get_light(FV_MAP_MESH_LIGHT_UP, face->ao[i]);
+                v[i].wrap_t = 1;
+        }
+
+        v[0].x = x1 - mesh->x;
+        v[0].y = y1 - mesh->y;
+        v[1].x = x2 - mesh->x;
+        v[1].y = y1 - mesh->y;
+        v[2].x = x1 - mesh->x;
+        v[2].y = y2 - mesh->y;
+        v[3].x = x2 - mesh->x;
+        v[3].y = y2 - mesh->y;
+
+        set_tex_coords_for_image(v, face->image, x2 - x1, y2 - y1);
+}
+
+static void
+generate_tops(struct fv_map_mesh *mesh,
+              int tx, int ty)
+{
+        struct face faces[FV_MAP_TILE_HEIGHT][FV_MAP_TILE_WIDTH];
+        bool used[FV_MAP_TILE_HEIGHT][FV_MAP_TILE_WIDTH];
+        const struct face *face;
+        int x, y, w, h, i, j;
+        int bx = tx * FV_MAP_TILE_WIDTH;
+        int by = ty * FV_MAP_TILE_HEIGHT;
+
+        for (y = 0; y < FV_MAP_TILE_HEIGHT; y++) {
+                for (x = 0; x < FV_MAP_TILE_WIDTH; x++) {
+                        get_face(bx + x, by + y, FACE_TYPE_TOP, &faces[y][x]);
+                        used[y][x] = false;
+                }
+        }
+
+        /* Greedily grow each unused square into the largest
+         * rectangle of matching squares, first along the row and
+         * then downwards for as long as the whole row matches */
+        for (y = 0; y < FV_MAP_TILE_HEIGHT; y++) {
+                for (x = 0; x < FV_MAP_TILE_WIDTH; x++) {
+                        if (used[y][x])
+                                continue;
+
+                        face = &faces[y][x];
+
+                        for (w = 1; x + w < FV_MAP_TILE_WIDTH; w++) {
+                                if (used[y][x + w] ||
+                                    !can_merge(mesh, face, &faces[y][x + w]))
+                                        break;
+                        }
+
+                        for (h = 1; y + h < FV_MAP_TILE_HEIGHT; h++) {
+                                for (i = 0; i < w; i++) {
+                                        if (used[y + h][x + i] ||
+                                            !can_merge(mesh,
+                                                       face,
+                                                       &faces[y + h][x + i]))
+                                                break;
+                                }
+                                if (i < w)
+                                        break;
+                        }
+
+                        for (j = 0; j < h; j++) {
+                                for (i = 0; i < w; i++)
+                                        used[y + j][x + i] = true;
+                        }
+
+                        add_top(mesh,
+                                face,
+                                bx + x, by + y,
+                                bx + x + w, by + y + h);
+                }
+        }
+}
+
+static void
+add_side(struct fv_map_mesh *mesh,
+         enum face_type type,
+         const struct face *face,
+         int line,
+         int start, int end)
+{
+        struct fv_map_mesh_vertex *v;
+
+        switch (type) {
+        case FACE_TYPE_NORTH:
+                v = add_horizontal_side(mesh,
+                                        line + 1,
+                                        end, face->oz,
+                                        start, face->z);
+                set_lights(v, FV_MAP_MESH_LIGHT_NORTH);
+                break;
+        case FACE_TYPE_SOUTH:
+                v = add_horizontal_side(mesh,
+                                        line,
+                                        start, face->oz,
+                                        end, face->z);
+                set_lights(v, FV_MAP_MESH_LIGHT_SOUTH);
+                break;
+        case FACE_TYPE_WEST:
+                v = add_vertical_side(mesh,
+                                      line,
+                                      end, face->oz,
+                                      start, face->z);
+                set_lights(v, FV_MAP_MESH_LIGHT_WEST);
+                break;
+        case FACE_TYPE_EAST:
+                v = add_vertical_side(mesh,
+                                      line + 1,
+                                      start, face->oz,
+                                      end, face->z);
+                set_lights(v, FV_MAP_MESH_LIGHT_EAST);
+                break;
+        default:
+                assert(!"Unexpected face type");
+                return;
+        }
+
+        set_tex_coords_for_image(v,
+                                 face->image,
+                                 end - start,
+                                 face->z - face->oz);
+}
+
+static void
+generate_sides(struct fv_map_mesh *mesh,
+               enum face_type type,
+               int tx, int ty)
+{
+        bool along_x = type == FACE_TYPE_NORTH || type == FACE_TYPE_SOUTH;
+        int bx = tx * FV_MAP_TILE_WIDTH;
+        int by = ty * FV_MAP_TILE_HEIGHT;
+        int n_lines = along_x ? FV_MAP_TILE_HEIGHT : FV_MAP_TILE_WIDTH;
+        int line_length = along_x ? FV_MAP_TILE_WIDTH : FV_MAP_TILE_HEIGHT;
+        int line_start = along_x ? bx : by;
+        struct face run, face;
+        bool have_run, have_face;
+        int line, pos, run_start = 0;
+
+        /* The walls are always a single block high so they only need
+         * to be merged along the line of blocks that they face */
+        for (line = along_x ? by : bx;
+             line < (along_x ? by : bx) + n_lines;
+             line++) {
+                have_run = false;
+
+                for (pos = line_start;
+                     pos <= line_start + line_length;
+                     pos++) {
+                        if (pos < line_start + line_length) {
+                                have_face = get_face(along_x ? pos : line,
+                                                     along_x ? line : pos,
+                                                     type,
+                                                     &face);
+                        } else {
+                                have_face = false;
+                        }
+
+                        if (have_run &&
+                            (!have_face ||
+                             !can_merge(mesh, &run, &face))) {
+                                add_side(mesh, type, &run,
+                                         line,
+                                         run_start, pos);
+                                have_run = false;
+                        }
+
+                        if (have_face && !have_run) {
+                                run = face;
+                                run_start = pos;
+                                have_run = true;
+                        }
+                }
+        }
+}
+
+void
+fv_map_mesh_generate(struct fv_map_mesh *mesh,
+                     int tx, int ty)
+{
+        mesh->first_vertex = (mesh->vertices.length /
+                              sizeof (struct fv_map_mesh_vertex));
+        mesh->x = tx * FV_MAP_TILE_WIDTH;
+        mesh->y = ty * FV_MAP_TILE_HEIGHT;
+
+        generate_tops(mesh, tx, ty);
+        generate_sides(mesh, FACE_TYPE_NORTH, tx, ty);
+        generate_sides(mesh, FACE_TYPE_SOUTH, tx, ty);
+        generate_sides(mesh, FACE_TYPE_WEST, tx, ty);
+        generate_sides(mesh, FACE_TYPE_EAST, tx, ty);
+}
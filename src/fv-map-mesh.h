@@ -0,0 +1,71 @@
+/*
+ * Finvenkisto
+ *
+ * Copyright (C) 2026 Neil Roberts
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FV_MAP_MESH_H
+#define FV_MAP_MESH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "fv-buffer.h"
+
+/* This is the same layout as the vertices in the map file generated
+ * by make-map.py */
+struct fv_map_mesh_vertex {
+        /* The position is relative to the origin of the tile */
+        uint8_t x, y, z;
+        /* The light is encoded as the fourth component of the
+         * position rather than its own component because I read
+         * somewhere that all attributes should be aligned to a float.
+         * I'm not sure if this is true or not but it's not really
+         * difficult to do so we might as well play it safe. It
+         * includes the ambient occlusion and 255 is fully lit.
+         */
+        uint8_t light;
+        /* The texture coordinates are in units of blocks. Faces that
+         * span several blocks are merged into a single quad so the
+         * fragment shader wraps these to repeat the image. */
+        uint8_t s, t;
+        /* Index of the image within the texture atlas */
+        uint8_t image;
+        /* 1 for the tops which repeat the image in both directions
+         * or 0 for the walls which use the full height of the image */
+        uint8_t wrap_t;
+};
+
+struct fv_map_mesh {
+        struct fv_buffer indices;
+        struct fv_buffer vertices;
+        /* The vertex that the indices of the current tile are
+         * relative to and the position of the tile in blocks */
+        int first_vertex;
+        int x, y;
+        /* Whether neighbouring faces can be merged into one quad */
+        bool merge_faces;
+};
+
+/* Appends the quads for the blocks of a tile of the map to the
+ * buffers. The indices are relative to the first vertex of the tile.
+ * The buffers must be initialised and merge_faces set beforehand.
+ */
+void
+fv_map_mesh_generate(struct fv_map_mesh *mesh,
+                     int tx, int ty);
+
+#endif /* FV_MAP_MESH_H */
@@ -19,38 +19,56 @@
 
 #include "config.h"
 
+#include <SDL.h>
 #include <math.h>
-#include <limits.h>
 #include <assert.h>
 #include <string.h>
 #include <stddef.h>
 
 #include "fv-map-painter.h"
 #include "fv-map.h"
+#include "fv-map-format.h"
 #include "fv-util.h"
 #include "fv-buffer.h"
 #include "fv-gl.h"
 #include "fv-model.h"
 #include "fv-array-object.h"
 #include "fv-map-buffer.h"
+#include "fv-map-mesh.h"
+#include "data/map-texture-layers.h"
 
 #define FV_MAP_PAINTER_TEXTURE_BLOCK_SIZE 64
 
-#define FV_MAP_PAINTER_N_MODELS FV_N_ELEMENTS(fv_map_painter_models)
-
 /* Maximum number of special instances to render in one draw call */
 #define FV_MAP_PAINTER_MAX_SPECIALS 16
 
-/* The normals for the map are only ever one of the the following
- * directions so instead of encoding each component of the normal in
- * the vertex we just encode a byte with one of the following values
- * and let the vertex shader expand it out.
- */
-#define FV_MAP_PAINTER_NORMAL_UP 0
-#define FV_MAP_PAINTER_NORMAL_NORTH 166
-#define FV_MAP_PAINTER_NORMAL_EAST 255
-#define FV_MAP_PAINTER_NORMAL_SOUTH 90
-#define FV_MAP_PAINTER_NORMAL_WEST 3
+/* The tile meshes are generated on demand and kept in a fixed number
+ * of slots in the vertex and index buffers. When all of the slots
+ * are used the least recently drawn tile is evicted. */
+#define FV_MAP_PAINTER_N_SLOTS 256
+
+/* The most quads that a tile can need is a top and four sides for
+ * every block. Each slot is big enough for that. */
+#define FV_MAP_PAINTER_MAX_TILE_QUADS \
+        (FV_MAP_TILE_WIDTH * FV_MAP_TILE_HEIGHT * 5)
+#define FV_MAP_PAINTER_SLOT_VERTICES (FV_MAP_PAINTER_MAX_TILE_QUADS * 4)
+#define FV_MAP_PAINTER_SLOT_INDICES (FV_MAP_PAINTER_MAX_TILE_QUADS * 6)
+
+/* Tiles within this many tiles of the visible area are generated
+ * ahead of time by the worker threads */
+#define FV_MAP_PAINTER_PREFETCH_DISTANCE 1
+
+/* Maximum number of tiles waiting to be generated */
+#define FV_MAP_PAINTER_QUEUE_SIZE 64
+
+#define FV_MAP_PAINTER_MAX_THREADS 4
+
+/* In the block instances mode there is one instance for each block
+ * of a tile. The texture describing the blocks is bound to its own
+ * unit so that it doesn't disturb the map texture on unit 0. */
+#define FV_MAP_PAINTER_BLOCK_INSTANCES \
+        (FV_MAP_TILE_WIDTH * FV_MAP_TILE_HEIGHT)
+#define FV_MAP_PAINTER_BLOCK_TEXTURE_UNIT 1
 
 struct fv_map_painter_model {
         const char *filename;
@@ -58,7 +76,7 @@ struct fv_map_painter_model {
 };
 
 static struct fv_map_painter_model
-fv_map_painter_models[] = {
+fv_map_painter_models[FV_MAP_PAINTER_N_MODELS] = {
         { "table.ply", 0 },
         { "toilet.ply", 0 },
         { "teaset.ply", 0 },
@@ -71,12 +89,38 @@ struct fv_map_painter_program {
         GLuint id;
         GLuint modelview_transform;
         GLuint normal_transform;
+        GLuint position_scale;
+        GLuint position_offset;
+};
+
+enum tile_state {
+        /* The tile isn't in a slot and no one is generating it */
+        TILE_STATE_NONE,
+        /* A worker thread has been asked to generate the tile */
+        TILE_STATE_QUEUED,
+        /* The mesh for the tile is in a slot */
+        TILE_STATE_RESIDENT
 };
 
 struct fv_map_painter_tile {
-        size_t offset;
-        int count;
-        int min, max;
+        enum tile_state state;
+        int slot;
+        /* The version of the map tile that the mesh in the slot was
+         * generated from */
+        unsigned int version;
+};
+
+/* Each slot has its own range of vertices and the indices are
+ * relative to the first one so that the map can be bigger than what
+ * 16-bit indices could otherwise address */
+struct fv_map_painter_slot {
+        /* The tile in the slot or -1 if it is free */
+        int tile;
+        int n_indices;
+        int n_vertices;
+        /* Links in the list of slots ordered by when they were last
+         * drawn, most recent first */
+        int prev, next;
 };
 
 struct fv_map_painter_special {
@@ -84,14 +128,62 @@ struct fv_map_painter_special {
         struct fv_model model;
 };
 
+/* A tile along with the version of the map tile when it was queued.
+ * If the map is modified while a worker is generating the tile then
+ * the version won't match anymore and the result is thrown away. */
+struct queued_tile {
+        int tile;
+        unsigned int version;
+};
+
+struct generated_tile {
+        struct queued_tile tile;
+        struct fv_map_mesh data;
+        struct generated_tile *next;
+};
+
 struct fv_map_painter {
         GLuint vertices_buffer;
         GLuint indices_buffer;
         struct fv_array_object *array;
-        struct fv_map_painter_tile tiles[FV_MAP_TILES_X *
-                                         FV_MAP_TILES_Y];
+        struct fv_map_painter_tile *tiles;
+        GLint tile_position;
+
+        struct fv_map_painter_slot slots[FV_MAP_PAINTER_N_SLOTS];
+        int lru_head, lru_tail;
+
+        /* Used to generate the tiles that are needed immediately */
+        struct fv_map_mesh scratch;
+
+        SDL_Thread *threads[FV_MAP_PAINTER_MAX_THREADS];
+        int n_threads;
+        /* The mutex protects the queue, the generated list and quit */
+        SDL_mutex *mutex;
+        /* Signalled when tiles are added to the queue */
+        SDL_cond *cond;
+        /* Signalled when a worker has generated a tile */
+        SDL_cond *generated_cond;
+        bool quit;
+        struct queued_tile queue[FV_MAP_PAINTER_QUEUE_SIZE];
+        int queue_start, queue_length;
+        /* Tiles generated by the threads waiting to be uploaded */
+        struct generated_tile *generated;
+
+        struct fv_map_painter_stats stats;
+
+        /* Used instead of the tile meshes in the block instances
+         * mode. The version of each tile in the tiles array is then
+         * the version that was last copied into the block texture. */
+        bool use_block_instances;
+        GLuint block_texture;
+        GLuint block_vertices_buffer;
+        GLuint block_indices_buffer;
+        GLuint block_instances_buffer;
+        struct fv_array_object *block_array;
+        GLint block_tile_position;
 
         struct fv_map_painter_program map_program;
+        struct fv_map_painter_program block_program;
         struct fv_map_painter_program color_program;
         struct fv_map_painter_program texture_program;
 
@@ -104,18 +196,12 @@ struct fv_map_painter {
 
         GLuint texture;
         int texture_width, texture_height;
-};
-
-struct vertex {
-        uint8_t x, y, z;
-        /* The normal is encoded as the fourth component of the
-         * position rather than its own component because I read
-         * somewhere that all attributes should be aligned to a float.
-         * I'm not sure if this is true or not but it's not really
-         * difficult to do so we might as well play it safe.
-         */
-        uint8_t normal;
-        uint16_t s, t;
+        /* Whether the texture is a 2D array with a layer for each
+         * image instead of a padded atlas */
+        bool use_texture_array;
+        /* Whether the shader can repeat the texture of a block
+         * across a merged face without leaving seams */
+        bool merge_faces;
 };
 
 struct instance {
@@ -123,252 +209,83 @@ struct instance {
         float normal_transform[3 * 3];
 };
 
-struct tile_data {
-        struct fv_buffer indices;
-        struct fv_buffer vertices;
+/* A vertex of the unit block used in the block instances mode */
+struct block_vertex {
+        /* The corner of the face within the block */
+        uint8_t x, y;
+        /* 1 if the vertex is at the top of the face. The actual
+         * heights are looked up from the block texture. */
+        uint8_t top;
+        /* A value from enum face_type */
+        uint8_t face;
 };
 
-static float
-get_block_height(fv_map_block_t block)
-{
-        switch (FV_MAP_GET_BLOCK_TYPE(block)) {
-        case FV_MAP_BLOCK_TYPE_FULL_WALL:
-                return 2.0f;
-        case FV_MAP_BLOCK_TYPE_HALF_WALL:
-                return 1.0f;
-        default:
-                return 0.0f;
-        }
-}
-
-static float
-get_position_height(int x, int y)
-{
-        if (x < 0 || x >= FV_MAP_WIDTH ||
-            y < 0 || y >= FV_MAP_HEIGHT)
-                return 0.0f;
-
-        return get_block_height(fv_map.blocks[y * FV_MAP_WIDTH + x]);
-}
-
-static struct vertex *
-reserve_quad(struct tile_data *data)
-{
-        struct vertex *v;
-        uint16_t *idx;
-        size_t v1, i1;
-
-        v1 = data->vertices.length / sizeof (struct vertex);
-        fv_buffer_set_length(&data->vertices,
-                             sizeof (struct vertex) * (v1 + 4));
-        v = (struct vertex *) data->vertices.data + v1;
-
-        i1 = data->indices.length / sizeof (uint16_t);
-        fv_buffer_set_length(&data->indices,
-                             sizeof (uint16_t) * (i1 + 6));
-        idx = (uint16_t *) data->indices.data + i1;
-
-        *(idx++) = v1 + 0;
-        *(idx++) = v1 + 1;
-        *(idx++) = v1 + 2;
-        *(idx++) = v1 + 2;
-        *(idx++) = v1 + 1;
-        *(idx++) = v1 + 3;
-
-        return v;
-}
-
-static struct vertex *
-add_horizontal_side(struct tile_data *data,
-                    int y,
-                    int x1, int z1,
-                    int x2, int z2)
-{
-        struct vertex *v = reserve_quad(data);
-        int i;
-
-        for (i = 0; i < 4; i++)
-                v[i].y = y;
-
-        v[0].x = x1;
-        v[0].z = z1;
-        v[1].x = x2;
-        v[1].z = z1;
-        v[2].x = x1;
-        v[2].z = z2;
-        v[3].x = x2;
-        v[3].z = z2;
-
-        return v;
-}
-
-static struct vertex *
-add_vertical_side(struct tile_data *data,
-                  int x,
-                  int y1, int z1,
-                  int y2, int z2)
-{
-        struct vertex *v = reserve_quad(data);
-        int i;
-
-        for (i = 0; i < 4; i++)
-                v[i].x = x;
-
-        v[0].y = y1;
-        v[0].z = z1;
-        v[1].y = y2;
-        v[1].z = z1;
-        v[2].y = y1;
-        v[2].z = z2;
-        v[3].y = y2;
-        v[3].z = z2;
-
-        return v;
-}
-
-static void
-set_tex_coords_for_image(struct fv_map_painter *painter,
-                         struct vertex v[4],
-                         int image,
-                         int height)
-{
-        int blocks_h = (painter->texture_height /
-                        FV_MAP_PAINTER_TEXTURE_BLOCK_SIZE);
-        int is1 = image / blocks_h * FV_MAP_PAINTER_TEXTURE_BLOCK_SIZE * 2;
-        int it1 = image % blocks_h * FV_MAP_PAINTER_TEXTURE_BLOCK_SIZE;
-        uint16_t s1 = is1 * (UINT16_MAX - 1) / painter->texture_width;
-        uint16_t t1 = it1 * (UINT16_MAX - 1) / painter->texture_height;
-        uint16_t s2 = ((is1 + FV_MAP_PAINTER_TEXTURE_BLOCK_SIZE) *
-                       (UINT16_MAX - 1) / painter->texture_width);
-        uint16_t t2 = ((it1 + FV_MAP_PAINTER_TEXTURE_BLOCK_SIZE * height) *
-                       (UINT16_MAX - 1) / painter->texture_height);
-
-        v[0].s = s1;
-        v[0].t = t2;
-        v[1].s = s2;
-        v[1].t = t2;
-        v[2].s = s1;
-        v[2].t = t1;
-        v[3].s = s2;
-        v[3].t = t1;
-}
-
-static void
-set_normals(struct vertex *v,
-            int8_t value)
-{
-        int i;
-
-        for (i = 0; i < 4; i++)
-                v[i].normal = value;
-}
+/* The position of a block within the tile for each instance */
+struct block_instance {
+        uint8_t x, y;
+};
 
-static void
-generate_square(struct fv_map_painter *painter,
-                struct tile_data *data,
-                int x, int y)
-{
-        fv_map_block_t block = fv_map.blocks[y * FV_MAP_WIDTH + x];
-        struct vertex *v;
-        int i;
-        int z, oz;
-
-        v = reserve_quad(data);
-
-        z = get_block_height(block);
-
-        set_tex_coords_for_image(painter, v,
-                                 FV_MAP_GET_BLOCK_TOP_IMAGE(block),
-                                 1.0f);
-        set_normals(v, FV_MAP_PAINTER_NORMAL_UP);
-
-        for (i = 0; i < 4; i++)
-                v[i].z = z;
-
-        v->x = x;
-        v->y = y;
-        v++;
-        v->x = x + 1;
-        v->y = y;
-        v++;
-        v->x = x;
-        v->y = y + 1;
-        v++;
-        v->x = x + 1;
-        v->y = y + 1;
-
-        /* Add the side walls */
-        if (z > (oz = get_position_height(x, y + 1))) {
-                v = add_horizontal_side(data, y + 1, x + 1, oz, x, z);
-                set_normals(v, FV_MAP_PAINTER_NORMAL_NORTH);
-                set_tex_coords_for_image(painter, v,
-                                         FV_MAP_GET_BLOCK_NORTH_IMAGE(block),
-                                         z - oz);
-        }
-        if (z > (oz = get_position_height(x, y - 1))) {
-                v = add_horizontal_side(data, y, x, oz, x + 1, z);
-                set_normals(v, FV_MAP_PAINTER_NORMAL_SOUTH);
-                set_tex_coords_for_image(painter, v,
-                                         FV_MAP_GET_BLOCK_SOUTH_IMAGE(block),
-                                         z - oz);
-        }
-        if (z > (oz = get_position_height(x - 1, y))) {
-                v = add_vertical_side(data, x, y + 1, oz, y, z);
-                set_normals(v, FV_MAP_PAINTER_NORMAL_WEST);
-                set_tex_coords_for_image(painter, v,
-                                         FV_MAP_GET_BLOCK_WEST_IMAGE(block),
-                                         z - oz);
-        }
-        if (z > (oz = get_position_height(x + 1, y))) {
-                v = add_vertical_side(data, x + 1, y, oz, y + 1, z);
-                set_normals(v, FV_MAP_PAINTER_NORMAL_EAST);
-                set_tex_coords_for_image(painter, v,
-                                         FV_MAP_GET_BLOCK_EAST_IMAGE(block),
-                                         z - oz);
-        }
-}
+enum face_type {
+        FACE_TYPE_TOP,
+        FACE_TYPE_NORTH,
+        FACE_TYPE_SOUTH,
+        FACE_TYPE_WEST,
+        FACE_TYPE_EAST,
+};
 
-static void
-generate_tile(struct fv_map_painter *painter,
-              struct tile_data *data,
-              int tx, int ty)
-{
-        int x, y;
+/* The faces of the unit block used in the block instances mode with
+ * their corners in the same order as the quads of the tile meshes */
+static const struct block_vertex
+block_vertices[] = {
+        { 0, 0, 1, FACE_TYPE_TOP },
+        { 1, 0, 1, FACE_TYPE_TOP },
+        { 0, 1, 1, FACE_TYPE_TOP },
+        { 1, 1, 1, FACE_TYPE_TOP },
+        { 1, 1, 0, FACE_TYPE_NORTH },
+        { 0, 1, 0, FACE_TYPE_NORTH },
+        { 1, 1, 1, FACE_TYPE_NORTH },
+        { 0, 1, 1, FACE_TYPE_NORTH },
+        { 0, 0, 0, FACE_TYPE_SOUTH },
+        { 1, 0, 0, FACE_TYPE_SOUTH },
+        { 0, 0, 1, FACE_TYPE_SOUTH },
+        { 1, 0, 1, FACE_TYPE_SOUTH },
+        { 0, 1, 0, FACE_TYPE_WEST },
+        { 0, 0, 0, FACE_TYPE_WEST },
+        { 0, 1, 1, FACE_TYPE_WEST },
+        { 0, 0, 1, FACE_TYPE_WEST },
+        { 1, 0, 0, FACE_TYPE_EAST },
+        { 1, 1, 0, FACE_TYPE_EAST },
+        { 1, 0, 1, FACE_TYPE_EAST },
+        { 1, 1, 1, FACE_TYPE_EAST },
+};
 
-        for (y = 0; y < FV_MAP_TILE_HEIGHT; y++) {
-                for (x = 0; x < FV_MAP_TILE_WIDTH; x++) {
-                        generate_square(painter,
-                                        data,
-                                        tx * FV_MAP_TILE_WIDTH + x,
-                                        ty * FV_MAP_TILE_HEIGHT + y);
-                }
-        }
+#define FV_MAP_PAINTER_N_BLOCK_QUADS (FV_N_ELEMENTS(block_vertices) / 4)
 
-}
+static enum fv_map_painter_mode
+mode_setting = FV_MAP_PAINTER_MODE_TILE_MESHES;
 
 static bool
 load_models(struct fv_map_painter *painter,
-            struct fv_image_data *image_data)
+            struct fv_image_data *image_data,
+            struct fv_static_geometry *geometry)
 {
         struct fv_map_painter_special *special;
-        struct fv_map_painter_program *program;
         bool res;
-        GLint transform;
-        size_t offset;
-        int i, j;
+        int i;
 
         for (i = 0; i < FV_MAP_PAINTER_N_MODELS; i++) {
                 special = painter->specials + i;
 
                 res = fv_model_load(&special->model,
+                                    geometry,
                                     fv_map_painter_models[i].filename);
                 if (!res)
                         goto error;
 
                 if (fv_map_painter_models[i].texture) {
                         fv_gl.glGenTextures(1, &painter->specials[i].texture);
-                        fv_gl.glBindTexture(GL_TEXTURE_2D,
-                                            painter->specials[i].texture);
+                        fv_gl_bind_texture(GL_TEXTURE_2D,
+                                           painter->specials[i].texture);
                         fv_image_data_set_2d(image_data,
                                              GL_TEXTURE_2D,
                                              0, /* level */
@@ -387,46 +304,8 @@ load_models(struct fv_map_painter *painter,
                         fv_gl.glTexParameteri(GL_TEXTURE_2D,
                                               GL_TEXTURE_WRAP_T,
                                               GL_CLAMP_TO_EDGE);
-
-                        program = &painter->texture_program;
                 } else {
                         painter->specials[i].texture = 0;
-
-                        program = &painter->color_program;
-                }
-
-                if (!fv_gl.have_instanced_arrays)
-                        continue;
-
-                transform = program->modelview_transform;
-
-                for (j = 0; j < 4; j++) {
-                        offset = offsetof(struct instance, modelview[j * 4]);
-                        fv_array_object_set_attribute(special->model.array,
-                                                      transform + j,
-                                                      4, /* size */
-                                                      GL_FLOAT,
-                                                      GL_FALSE, /* normalized */
-                                                      sizeof (struct instance),
-                                                      1, /* divisor */
-                                                      painter->instance_buffer,
-                                                      offset);
-                }
-
-                transform = program->normal_transform;
-
-                for (j = 0; j < 3; j++) {
-                        offset = offsetof(struct instance,
-                                          normal_transform[j * 3]);
-                        fv_array_object_set_attribute(special->model.array,
-                                                      transform + j,
-                                                      3, /* size */
-                                                      GL_FLOAT,
-                                                      GL_FALSE, /* normalized */
-                                                      sizeof (struct instance),
-                                                      1, /* divisor */
-                                                      painter->instance_buffer,
-                                                      offset);
                 }
         }
 
@@ -434,10 +313,9 @@ load_models(struct fv_map_painter *painter,
 
 error:
         while (--i >= 0) {
-                fv_model_destroy(&painter->specials[i].model);
                 if (painter->specials[i].texture) {
-                        fv_gl.glDeleteTextures(1,
-                                               &painter->specials[i].texture);
+                        fv_gl_delete_textures(1,
+                                              &painter->specials[i].texture);
                 }
         }
 
@@ -455,6 +333,15 @@ smallest_pot(int x)
         return y;
 }
 
+static void
+init_position_uniforms(struct fv_map_painter_program *program)
+{
+        program->position_scale =
+                fv_gl.glGetUniformLocation(program->id, "position_scale");
+        program->position_offset =
+                fv_gl.glGetUniformLocation(program->id, "position_offset");
+}
+
 static void
 init_programs(struct fv_map_painter *painter,
               struct fv_shader_data *shader_data)
@@ -464,14 +351,22 @@ init_programs(struct fv_map_painter *painter,
         painter->map_program.modelview_transform =
                 fv_gl.glGetUniformLocation(painter->map_program.id,
                                            "transform");
-        painter->map_program.normal_transform =
-                fv_gl.glGetUniformLocation(painter->map_program.id,
+        painter->block_program.id =
+                shader_data->programs[FV_SHADER_DATA_PROGRAM_MAP_BLOCKS];
+        painter->block_program.modelview_transform =
+                fv_gl.glGetUniformLocation(painter->block_program.id,
+                                           "transform");
+        painter->block_program.normal_transform =
+                fv_gl.glGetUniformLocation(painter->block_program.id,
                                            "normal_transform");
         painter->color_program.id =
                 shader_data->programs[FV_SHADER_DATA_PROGRAM_SPECIAL_COLOR];
         painter->texture_program.id =
                 shader_data->programs[FV_SHADER_DATA_PROGRAM_SPECIAL_TEXTURE];
 
+        init_position_uniforms(&painter->color_program);
+        init_position_uniforms(&painter->texture_program);
+
         if (fv_gl.have_instanced_arrays) {
                 painter->color_program.modelview_transform =
                         fv_gl.glGetAttribLocation(painter->color_program.id,
@@ -501,33 +396,32 @@ init_programs(struct fv_map_painter *painter,
         }
 }
 
-struct fv_map_painter *
-fv_map_painter_new(struct fv_image_data *image_data,
-                   struct fv_shader_data *shader_data)
+static void
+set_atlas_uniforms(struct fv_map_painter *painter,
+                   GLuint program)
 {
-        struct fv_map_painter *painter;
-        struct tile_data data;
-        struct fv_map_painter_tile *tile;
-        int first, tx, ty;
-        int tex_width, tex_height;
-        GLuint tex_uniform;
-
-        painter = fv_alloc(sizeof *painter);
-
-        if (fv_gl.have_instanced_arrays) {
-                fv_gl.glGenBuffers(1, &painter->instance_buffer);
-                fv_gl.glBindBuffer(GL_ARRAY_BUFFER, painter->instance_buffer);
-                fv_gl.glBufferData(GL_ARRAY_BUFFER,
-                                   sizeof (struct instance) *
-                                   FV_MAP_PAINTER_MAX_SPECIALS,
-                                   NULL, /* data */
-                                   GL_DYNAMIC_DRAW);
-        }
-
-        init_programs(painter, shader_data);
+        GLint uniform;
+
+        /* The images are stacked in columns that are two blocks wide
+         * including the padding */
+        fv_gl_use_program(program);
+        uniform = fv_gl.glGetUniformLocation(program, "block_size");
+        fv_gl.glUniform2f(uniform,
+                          FV_MAP_PAINTER_TEXTURE_BLOCK_SIZE /
+                          (float) painter->texture_width,
+                          FV_MAP_PAINTER_TEXTURE_BLOCK_SIZE /
+                          (float) painter->texture_height);
+        uniform = fv_gl.glGetUniformLocation(program, "blocks_per_column");
+        fv_gl.glUniform1f(uniform,
+                          painter->texture_height /
+                          FV_MAP_PAINTER_TEXTURE_BLOCK_SIZE);
+}
 
-        if (!load_models(painter, image_data))
-                goto error_instance_buffer;
+static void
+create_atlas_texture(struct fv_map_painter *painter,
+                     struct fv_image_data *image_data)
+{
+        int tex_width, tex_height;
 
         fv_image_data_get_size(image_data,
                                FV_IMAGE_DATA_MAP_TEXTURE,
@@ -542,7 +436,7 @@ fv_map_painter_new(struct fv_image_data *image_data,
         }
 
         fv_gl.glGenTextures(1, &painter->texture);
-        fv_gl.glBindTexture(GL_TEXTURE_2D, painter->texture);
+        fv_gl_bind_texture(GL_TEXTURE_2D, painter->texture);
         fv_gl.glTexImage2D(GL_TEXTURE_2D,
                            0, /* level */
                            GL_RGB,
@@ -571,164 +465,1211 @@ fv_map_painter_new(struct fv_image_data *image_data,
                               GL_TEXTURE_WRAP_T,
                               GL_CLAMP_TO_EDGE);
 
-        tex_uniform = fv_gl.glGetUniformLocation(painter->map_program.id,
-                                                 "tex");
-        fv_gl.glUseProgram(painter->map_program.id);
-        fv_gl.glUniform1i(tex_uniform, 0);
-
-        tex_uniform = fv_gl.glGetUniformLocation(painter->texture_program.id,
-                                                 "tex");
-        fv_gl.glUseProgram(painter->texture_program.id);
-        fv_gl.glUniform1i(tex_uniform, 0);
+        set_atlas_uniforms(painter, painter->map_program.id);
 
-        fv_buffer_init(&data.vertices);
-        fv_buffer_init(&data.indices);
-
-        tile = painter->tiles;
-
-        for (ty = 0; ty < FV_MAP_TILES_Y; ty++) {
-                for (tx = 0; tx < FV_MAP_TILES_X; tx++) {
-                        first = data.indices.length / sizeof (uint16_t);
-                        tile->min = (data.vertices.length /
-                                     sizeof (struct vertex));
-                        tile->offset = data.indices.length;
-                        generate_tile(painter, &data, tx, ty);
-                        tile->max = (data.vertices.length /
-                                     sizeof (struct vertex)) - 1;
-                        tile->count = (data.indices.length /
-                                       sizeof (uint16_t) -
-                                       first);
-                        tile++;
-                }
-        }
+        if (painter->use_block_instances)
+                set_atlas_uniforms(painter, painter->block_program.id);
+}
 
-        assert(data.vertices.length / sizeof (struct vertex) < 65536);
+static void
+create_layers_texture(struct fv_map_painter *painter,
+                      struct fv_image_data *image_data)
+{
+        fv_gl.glGenTextures(1, &painter->texture);
+        fv_gl_bind_texture(GL_TEXTURE_2D_ARRAY, painter->texture);
+        fv_image_data_set_3d(image_data,
+                             GL_TEXTURE_2D_ARRAY,
+                             0, /* level */
+                             GL_RGB,
+                             FV_MAP_TEXTURE_N_LAYERS,
+                             FV_IMAGE_DATA_MAP_TEXTURE_LAYERS);
+
+        fv_gl.glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+        fv_gl.glTexParameteri(GL_TEXTURE_2D_ARRAY,
+                              GL_TEXTURE_MIN_FILTER,
+                              GL_LINEAR_MIPMAP_NEAREST);
+        fv_gl.glTexParameteri(GL_TEXTURE_2D_ARRAY,
+                              GL_TEXTURE_MAG_FILTER,
+                              GL_LINEAR);
+        /* Each layer is a single block so the hardware can do the
+         * repeating for the merged faces */
+        fv_gl.glTexParameteri(GL_TEXTURE_2D_ARRAY,
+                              GL_TEXTURE_WRAP_S,
+                              GL_REPEAT);
+        fv_gl.glTexParameteri(GL_TEXTURE_2D_ARRAY,
+                              GL_TEXTURE_WRAP_T,
+                              GL_REPEAT);
+}
 
-        painter->array = fv_array_object_new();
+static void
+convert_images_to_layers(struct fv_buffer *vertices)
+{
+        struct fv_map_mesh_vertex *v =
+                (struct fv_map_mesh_vertex *) vertices->data;
+        size_t n_vertices = vertices->length / sizeof *v;
+        size_t i;
+
+        for (i = 0; i < n_vertices; i++) {
+                assert(v[i].image < FV_N_ELEMENTS(fv_map_texture_layers));
+                v[i].image = fv_map_texture_layers[v[i].image];
+        }
+}
 
-        fv_gl.glGenBuffers(1, &painter->vertices_buffer);
-        fv_gl.glBindBuffer(GL_ARRAY_BUFFER, painter->vertices_buffer);
-        fv_gl.glBufferData(GL_ARRAY_BUFFER,
-                           data.vertices.length,
-                           data.vertices.data,
-                           GL_STATIC_DRAW);
+static void
+set_vertex_attributes(struct fv_map_painter *painter,
+                      int first_vertex)
+{
+        size_t offset = first_vertex * sizeof (struct fv_map_mesh_vertex);
 
         fv_array_object_set_attribute(painter->array,
                                       FV_SHADER_DATA_ATTRIB_POSITION,
                                       4, /* size */
                                       GL_UNSIGNED_BYTE,
                                       GL_FALSE, /* normalized */
-                                      sizeof (struct vertex),
+                                      sizeof (struct fv_map_mesh_vertex),
                                       0, /* divisor */
                                       painter->vertices_buffer,
-                                      offsetof(struct vertex, x));
+                                      offset +
+                                      offsetof(struct fv_map_mesh_vertex, x));
 
         fv_array_object_set_attribute(painter->array,
                                       FV_SHADER_DATA_ATTRIB_TEX_COORD,
-                                      2, /* size */
-                                      GL_UNSIGNED_SHORT,
-                                      GL_TRUE, /* normalized */
-                                      sizeof (struct vertex),
+                                      4, /* size */
+                                      GL_UNSIGNED_BYTE,
+                                      GL_FALSE, /* normalized */
+                                      sizeof (struct fv_map_mesh_vertex),
                                       0, /* divisor */
                                       painter->vertices_buffer,
-                                      offsetof(struct vertex, s));
+                                      offset +
+                                      offsetof(struct fv_map_mesh_vertex, s));
+}
 
-        fv_gl.glGenBuffers(1, &painter->indices_buffer);
-        fv_array_object_set_element_buffer(painter->array,
-                                           painter->indices_buffer);
-        fv_gl.glBufferData(GL_ELEMENT_ARRAY_BUFFER,
-                           data.indices.length,
-                           data.indices.data,
-                           GL_STATIC_DRAW);
+/* Generates the mesh for a tile. This is called from the worker
+ * threads as well as the main thread. It only reads the map and
+ * settings that don't change after the painter is created. The
+ * version is the version of the map tile when the tile was requested.
+ * The map tile's own version isn't used because the main thread may
+ * be modifying it. */
+static void
+build_tile(const struct fv_map_painter *painter,
+           struct fv_map_mesh *data,
+           int tile,
+           unsigned int version)
+{
+        const struct fv_map_tile *map_tile = fv_map.tiles + tile;
+
+        fv_buffer_set_length(&data->vertices, 0);
+        fv_buffer_set_length(&data->indices, 0);
+
+        data->merge_faces = painter->merge_faces;
+
+        /* If the tile hasn't been modified then the mesh that was
+         * generated at build time can be used directly. The baked
+         * mesh has merged faces so it can't be used otherwise. If
+         * it is invalid then the tile is generated instead. */
+        if (version == 0 &&
+            map_tile->vertices &&
+            painter->merge_faces &&
+            fv_map_validate_tile_mesh(map_tile)) {
+                assert(sizeof (struct fv_map_mesh_vertex) ==
+                       FV_MAP_FORMAT_VERTEX_SIZE);
+                assert(offsetof(struct fv_map_mesh_vertex, image) ==
+                       FV_MAP_FORMAT_VERTEX_IMAGE_OFFSET);
+
+                fv_buffer_append(&data->vertices,
+                                 map_tile->vertices,
+                                 map_tile->n_vertices *
+                                 sizeof (struct fv_map_mesh_vertex));
+                fv_buffer_append(&data->indices,
+                                 map_tile->indices,
+                                 map_tile->n_indices *
+                                 sizeof (uint16_t));
+        } else {
+                /* This can be called from a worker thread while the
+                 * main thread is modifying the map */
+                fv_map_lock_read();
+                fv_map_mesh_generate(data,
+                                     tile % fv_map.tiles_x,
+                                     tile / fv_map.tiles_x);
+                fv_map_unlock_read();
+        }
 
-        fv_buffer_destroy(&data.indices);
-        fv_buffer_destroy(&data.vertices);
+        if (painter->use_texture_array)
+                convert_images_to_layers(&data->vertices);
+}
 
-        return painter;
+static void
+init_slots(struct fv_map_painter *painter)
+{
+        int i;
 
-error_instance_buffer:
-        if (fv_gl.have_instanced_arrays)
-                fv_gl.glDeleteBuffers(1, &painter->instance_buffer);
-        fv_free(painter);
+        for (i = 0; i < FV_MAP_PAINTER_N_SLOTS; i++) {
+                painter->slots[i].tile = -1;
+                painter->slots[i].prev = i - 1;
+                painter->slots[i].next = i + 1;
+        }
 
-        return NULL;
+        painter->slots[FV_MAP_PAINTER_N_SLOTS - 1].next = -1;
+        painter->lru_head = 0;
+        painter->lru_tail = FV_MAP_PAINTER_N_SLOTS - 1;
 }
 
 static void
-flush_specials(struct fv_map_painter *painter)
+unlink_slot(struct fv_map_painter *painter,
+            int slot_num)
 {
-        const struct fv_map_painter_special *special;
-        struct fv_map_painter_program *program;
+        struct fv_map_painter_slot *slot = painter->slots + slot_num;
 
-        if (painter->n_instances == 0)
+        if (slot->prev == -1)
+                painter->lru_head = slot->next;
+        else
+                painter->slots[slot->prev].next = slot->next;
+
+        if (slot->next == -1)
+                painter->lru_tail = slot->prev;
+        else
+                painter->slots[slot->next].prev = slot->prev;
+}
+
+/* Moves the slot to the front of the LRU list */
+static void
+touch_slot(struct fv_map_painter *painter,
+           int slot_num)
+{
+        struct fv_map_painter_slot *slot = painter->slots + slot_num;
+
+        if (painter->lru_head == slot_num)
                 return;
 
-        special = painter->specials + painter->current_special;
+        unlink_slot(painter, slot_num);
 
-        fv_map_buffer_flush(0, /* offset */
-                            sizeof (struct instance) *
-                            painter->n_instances);
-        fv_map_buffer_unmap();
+        slot->prev = -1;
+        slot->next = painter->lru_head;
+        painter->slots[painter->lru_head].prev = slot_num;
+        painter->lru_head = slot_num;
+}
 
-        if (special->texture) {
-                fv_gl.glBindTexture(GL_TEXTURE_2D, special->texture);
-                program = &painter->texture_program;
-        } else {
-                program = &painter->color_program;
-        }
-        fv_gl.glUseProgram(program->id);
+/* Takes the least recently used slot, evicting its tile if it has
+ * one */
+static int
+take_slot(struct fv_map_painter *painter)
+{
+        int slot_num = painter->lru_tail;
+        struct fv_map_painter_slot *slot = painter->slots + slot_num;
 
-        fv_array_object_bind(special->model.array);
+        if (slot->tile != -1) {
+                painter->tiles[slot->tile].state = TILE_STATE_NONE;
+                painter->stats.n_evictions++;
+                painter->stats.n_resident--;
+        }
 
-        fv_gl.glDrawElementsInstanced(GL_TRIANGLES,
-                                      special->model.n_indices,
-                                      GL_UNSIGNED_SHORT,
-                                      NULL, /* offset */
-                                      painter->n_instances);
+        touch_slot(painter, slot_num);
 
-        painter->n_instances = 0;
+        return slot_num;
 }
 
+/* Frees the slot and moves it to the end of the LRU list so that it
+ * will be the next one to be used */
 static void
-paint_special(struct fv_map_painter *painter,
-              const struct fv_map_special *special,
-              const struct fv_transform *transform_in)
+release_slot(struct fv_map_painter *painter,
+             int slot_num)
 {
-        struct fv_transform transform = *transform_in;
-        struct fv_map_painter_program *program;
-        struct instance *instance;
-        GLuint texture;
+        struct fv_map_painter_slot *slot = painter->slots + slot_num;
 
-        if (painter->current_special != special->num ||
-            painter->n_instances >= FV_MAP_PAINTER_MAX_SPECIALS)
-                flush_specials(painter);
+        slot->tile = -1;
+        painter->stats.n_resident--;
 
-        fv_matrix_translate(&transform.modelview,
-                            special->x + 0.5f,
-                            special->y + 0.5f,
-                            0.0f);
-        if (special->rotation != 0)
-                fv_matrix_rotate(&transform.modelview,
-                                 special->rotation * 360.0f /
-                                 (UINT16_MAX + 1.0f),
-                                 0.0f, 0.0f, 1.0f);
+        if (painter->lru_tail == slot_num)
+                return;
 
-        fv_transform_dirty(&transform);
-        fv_transform_ensure_mvp(&transform);
-        fv_transform_ensure_normal_transform(&transform);
+        unlink_slot(painter, slot_num);
 
-        if (fv_gl.have_instanced_arrays) {
-                if (painter->n_instances == 0) {
-                        fv_gl.glBindBuffer(GL_ARRAY_BUFFER,
-                                           painter->instance_buffer);
-                        painter->instance_buffer_map =
-                                fv_map_buffer_map(GL_ARRAY_BUFFER,
-                                                  sizeof (struct instance) *
-                                                  FV_MAP_PAINTER_MAX_SPECIALS,
-                                                  true /* flush_explicit */,
-                                                  GL_DYNAMIC_DRAW);
-                        painter->current_special = special->num;
-                }
+        slot->next = -1;
+        slot->prev = painter->lru_tail;
+        painter->slots[painter->lru_tail].next = slot_num;
+        painter->lru_tail = slot_num;
+}
+
+static void
+upload_tile(struct fv_map_painter *painter,
+            int tile,
+            unsigned int version,
+            const struct fv_map_mesh *data)
+{
+        struct fv_map_painter_slot *slot;
+        int slot_num = take_slot(painter);
+
+        slot = painter->slots + slot_num;
+        slot->tile = tile;
+        slot->n_vertices = (data->vertices.length /
+                            sizeof (struct fv_map_mesh_vertex));
+        slot->n_indices = data->indices.length / sizeof (uint16_t);
+
+        assert(slot->n_vertices <= FV_MAP_PAINTER_SLOT_VERTICES);
+        assert(slot->n_indices <= FV_MAP_PAINTER_SLOT_INDICES);
+
+        fv_gl_bind_buffer(GL_ARRAY_BUFFER, painter->vertices_buffer);
+        fv_gl.glBufferSubData(GL_ARRAY_BUFFER,
+                              slot_num *
+                              FV_MAP_PAINTER_SLOT_VERTICES *
+                              sizeof (struct fv_map_mesh_vertex),
+                              data->vertices.length,
+                              data->vertices.data);
+
+        fv_array_object_set_element_buffer(painter->array,
+                                           painter->indices_buffer);
+        fv_gl.glBufferSubData(GL_ELEMENT_ARRAY_BUFFER,
+                              slot_num *
+                              FV_MAP_PAINTER_SLOT_INDICES *
+                              sizeof (uint16_t),
+                              data->indices.length,
+                              data->indices.data);
+
+        painter->tiles[tile].state = TILE_STATE_RESIDENT;
+        painter->tiles[tile].slot = slot_num;
+        painter->tiles[tile].version = version;
+
+        painter->stats.n_resident++;
+        if (painter->stats.n_resident > painter->stats.max_resident)
+                painter->stats.max_resident = painter->stats.n_resident;
+}
+
+static void
+free_generated_tile(struct generated_tile *generated)
+{
+        fv_buffer_destroy(&generated->data.vertices);
+        fv_buffer_destroy(&generated->data.indices);
+        fv_free(generated);
+}
+
+/* Must be called with the mutex locked */
+static struct queued_tile
+pop_queue(struct fv_map_painter *painter)
+{
+        struct queued_tile tile = painter->queue[painter->queue_start];
+
+        painter->queue_start = ((painter->queue_start + 1) %
+                                FV_MAP_PAINTER_QUEUE_SIZE);
+        painter->queue_length--;
+
+        return tile;
+}
+
+static int
+worker_thread(void *user_data)
+{
+        struct fv_map_painter *painter = user_data;
+        struct generated_tile *generated;
+        struct queued_tile tile;
+
+        SDL_LockMutex(painter->mutex);
+
+        while (true) {
+                while (!painter->quit && painter->queue_length == 0)
+                        SDL_CondWait(painter->cond, painter->mutex);
+
+                if (painter->quit)
+                        break;
+
+                tile = pop_queue(painter);
+
+                SDL_UnlockMutex(painter->mutex);
+
+                generated = fv_alloc(sizeof *generated);
+                generated->tile = tile;
+                fv_buffer_init(&generated->data.vertices);
+                fv_buffer_init(&generated->data.indices);
+                build_tile(painter,
+                           &generated->data,
+                           tile.tile,
+                           tile.version);
+
+                SDL_LockMutex(painter->mutex);
+
+                generated->next = painter->generated;
+                painter->generated = generated;
+
+                SDL_CondSignal(painter->generated_cond);
+        }
+
+        SDL_UnlockMutex(painter->mutex);
+
+        return 0;
+}
+
+static void
+start_threads(struct fv_map_painter *painter)
+{
+        int n_threads;
+        int i;
+
+        painter->n_threads = 0;
+        painter->quit = false;
+        painter->queue_start = 0;
+        painter->queue_length = 0;
+        painter->generated = NULL;
+
+        painter->mutex = SDL_CreateMutex();
+        if (painter->mutex == NULL)
+                return;
+
+        painter->cond = SDL_CreateCond();
+        if (painter->cond == NULL)
+                goto error_mutex;
+
+        painter->generated_cond = SDL_CreateCond();
+        if (painter->generated_cond == NULL)
+                goto error_cond;
+
+        /* Leave a core for the main thread */
+        n_threads = MIN(MAX(SDL_GetCPUCount() - 1, 1),
+                        FV_MAP_PAINTER_MAX_THREADS);
+
+        for (i = 0; i < n_threads; i++) {
+                painter->threads[i] = SDL_CreateThread(worker_thread,
+                                                       "fv-map-painter",
+                                                       painter);
+                if (painter->threads[i] == NULL)
+                        break;
+
+                painter->n_threads++;
+        }
+
+        /* If there are no threads then the tiles are only generated
+         * on the main thread when they are drawn */
+        return;
+
+error_cond:
+        SDL_DestroyCond(painter->cond);
+error_mutex:
+        SDL_DestroyMutex(painter->mutex);
+        painter->mutex = NULL;
+}
+
+static void
+stop_threads(struct fv_map_painter *painter)
+{
+        struct generated_tile *generated, *next;
+        int i;
+
+        if (painter->mutex == NULL)
+                return;
+
+        SDL_LockMutex(painter->mutex);
+        painter->quit = true;
+        SDL_CondBroadcast(painter->cond);
+        SDL_UnlockMutex(painter->mutex);
+
+        for (i = 0; i < painter->n_threads; i++)
+                SDL_WaitThread(painter->threads[i], NULL /* status */);
+
+        for (generated = painter->generated; generated; generated = next) {
+                next = generated->next;
+                free_generated_tile(generated);
+        }
+
+        SDL_DestroyCond(painter->generated_cond);
+        SDL_DestroyCond(painter->cond);
+        SDL_DestroyMutex(painter->mutex);
+}
+
+/* Asks the worker threads to generate the tiles in the given range
+ * if they aren't already available. If urgent is true the tiles are
+ * put at the front of the queue. */
+static void
+queue_tiles(struct fv_map_painter *painter,
+            int x_min, int x_max,
+            int y_min, int y_max,
+            bool urgent)
+{
+        struct fv_map_painter_tile *tile;
+        int queue_pos;
+        bool queued_any = false;
+        int x, y;
+
+        if (painter->n_threads == 0)
+                return;
+
+        x_min = MAX(x_min, 0);
+        x_max = MIN(x_max, fv_map.tiles_x);
+        y_min = MAX(y_min, 0);
+        y_max = MIN(y_max, fv_map.tiles_y);
+
+        SDL_LockMutex(painter->mutex);
+
+        for (y = y_min; y < y_max; y++) {
+                for (x = x_min; x < x_max; x++) {
+                        tile = painter->tiles + y * fv_map.tiles_x + x;
+
+                        if (tile->state != TILE_STATE_NONE)
+                                continue;
+
+                        if (painter->queue_length >= FV_MAP_PAINTER_QUEUE_SIZE)
+                                goto done;
+
+                        if (urgent) {
+                                painter->queue_start =
+                                        (painter->queue_start +
+                                         FV_MAP_PAINTER_QUEUE_SIZE - 1) %
+                                        FV_MAP_PAINTER_QUEUE_SIZE;
+                                queue_pos = painter->queue_start;
+                        } else {
+                                queue_pos = ((painter->queue_start +
+                                              painter->queue_length) %
+                                             FV_MAP_PAINTER_QUEUE_SIZE);
+                        }
+
+                        painter->queue[queue_pos].tile =
+                                y * fv_map.tiles_x + x;
+                        painter->queue[queue_pos].version =
+                                fv_map.tiles[y * fv_map.tiles_x + x].version;
+                        painter->queue_length++;
+                        tile->state = TILE_STATE_QUEUED;
+                        queued_any = true;
+                }
+        }
+
+done:
+        if (queued_any)
+                SDL_CondBroadcast(painter->cond);
+
+        SDL_UnlockMutex(painter->mutex);
+}
+
+/* Uploads a tile that was generated from the queue. Returns false if
+ * the result isn't needed anymore. */
+static bool
+upload_queued_tile(struct fv_map_painter *painter,
+                   const struct queued_tile *queued,
+                   const struct fv_map_mesh *data)
+{
+        struct fv_map_painter_tile *tile = painter->tiles + queued->tile;
+
+        /* The tile may have already been generated on the main
+         * thread because it was needed before the worker finished */
+        if (tile->state != TILE_STATE_QUEUED)
+                return false;
+
+        /* If the map was modified after the tile was queued then the
+         * mesh is out of date. It will be generated again when it is
+         * needed. */
+        if (queued->version != fv_map.tiles[queued->tile].version) {
+                tile->state = TILE_STATE_NONE;
+                return false;
+        }
+
+        upload_tile(painter, queued->tile, queued->version, data);
+
+        return true;
+}
+
+/* Uploads the tiles that the worker threads have finished */
+static void
+upload_generated_tiles(struct fv_map_painter *painter)
+{
+        struct generated_tile *generated, *next;
+
+        if (painter->n_threads == 0)
+                return;
+
+        SDL_LockMutex(painter->mutex);
+        generated = painter->generated;
+        painter->generated = NULL;
+        SDL_UnlockMutex(painter->mutex);
+
+        for (; generated; generated = next) {
+                next = generated->next;
+
+                if (upload_queued_tile(painter,
+                                       &generated->tile,
+                                       &generated->data))
+                        painter->stats.n_streamed++;
+
+                free_generated_tile(generated);
+        }
+}
+
+/* Makes sure that the tile is in a slot and returns the slot number */
+static int
+get_tile_slot(struct fv_map_painter *painter,
+              int tile_num)
+{
+        struct fv_map_painter_tile *tile = painter->tiles + tile_num;
+        unsigned int version = fv_map.tiles[tile_num].version;
+        int old_slot;
+        Uint64 start;
+
+        painter->stats.n_tile_draws++;
+
+        if (tile->state == TILE_STATE_RESIDENT) {
+                if (tile->version == version) {
+                        touch_slot(painter, tile->slot);
+                        return tile->slot;
+                }
+
+                /* The map has been modified since the tile was
+                 * generated. The new mesh is put in a different slot
+                 * rather than overwriting the old one so that the GL
+                 * driver doesn't have to wait for any previous frames
+                 * that are still using it. */
+                old_slot = tile->slot;
+
+                build_tile(painter, &painter->scratch, tile_num, version);
+                upload_tile(painter, tile_num, version, &painter->scratch);
+
+                /* The old slot may have been the least recently used
+                 * one in which case it has already been reused */
+                if (tile->slot != old_slot)
+                        release_slot(painter, old_slot);
+
+                painter->stats.n_rebuilds++;
+
+                return tile->slot;
+        }
+
+        start = SDL_GetPerformanceCounter();
+
+        build_tile(painter, &painter->scratch, tile_num, version);
+        upload_tile(painter, tile_num, version, &painter->scratch);
+
+        painter->stats.miss_time += SDL_GetPerformanceCounter() - start;
+
+        return tile->slot;
+}
+
+/* Counts the tiles in the range that aren't in a slot. If
+ * only_queued is true then it only counts the ones that are waiting
+ * for a worker. */
+static int
+count_missing_tiles(struct fv_map_painter *painter,
+                    int x_min, int x_max,
+                    int y_min, int y_max,
+                    bool only_queued)
+{
+        const struct fv_map_painter_tile *tile;
+        int n_missing = 0;
+        int x, y;
+
+        for (y = y_min; y < y_max; y++) {
+                for (x = x_min; x < x_max; x++) {
+                        tile = painter->tiles + y * fv_map.tiles_x + x;
+
+                        if (only_queued ?
+                            tile->state == TILE_STATE_QUEUED :
+                            tile->state != TILE_STATE_RESIDENT)
+                                n_missing++;
+                }
+        }
+
+        return n_missing;
+}
+
+/* Takes a tile from the queue and generates it on the main thread.
+ * Returns false if the queue is empty. */
+static bool
+help_generate_tile(struct fv_map_painter *painter)
+{
+        struct queued_tile tile;
+
+        SDL_LockMutex(painter->mutex);
+
+        if (painter->queue_length == 0) {
+                SDL_UnlockMutex(painter->mutex);
+                return false;
+        }
+
+        tile = pop_queue(painter);
+
+        SDL_UnlockMutex(painter->mutex);
+
+        build_tile(painter, &painter->scratch, tile.tile, tile.version);
+
+        upload_queued_tile(painter, &tile, &painter->scratch);
+
+        return true;
+}
+
+static void
+wait_for_generated_tile(struct fv_map_painter *painter)
+{
+        SDL_LockMutex(painter->mutex);
+
+        while (painter->generated == NULL && painter->queue_length == 0)
+                SDL_CondWait(painter->generated_cond, painter->mutex);
+
+        SDL_UnlockMutex(painter->mutex);
+}
+
+/* Generates all of the visible tiles that aren't in a slot yet.
+ * The worker threads and the main thread all take tiles from the
+ * queue so that when a lot of tiles are needed at once, such as
+ * for the first frame, they are generated in parallel. */
+static void
+generate_missing_tiles(struct fv_map_painter *painter,
+                       int x_min, int x_max,
+                       int y_min, int y_max)
+{
+        int n_missing;
+        Uint64 start;
+
+        n_missing = count_missing_tiles(painter,
+                                        x_min, x_max,
+                                        y_min, y_max,
+                                        false /* only_queued */);
+        if (n_missing == 0)
+                return;
+
+        painter->stats.n_misses += n_missing;
+
+        /* With only one tile it is quicker to just generate it when
+         * it is drawn */
+        if (painter->n_threads == 0 || n_missing <= 1)
+                return;
+
+        start = SDL_GetPerformanceCounter();
+
+        queue_tiles(painter,
+                    x_min, x_max,
+                    y_min, y_max,
+                    true /* urgent */);
+
+        /* Any tiles that didn't fit in the queue are generated when
+         * they are drawn */
+        while (true) {
+                upload_generated_tiles(painter);
+
+                if (count_missing_tiles(painter,
+                                        x_min, x_max,
+                                        y_min, y_max,
+                                        true /* only_queued */) == 0)
+                        break;
+
+                if (!help_generate_tile(painter))
+                        wait_for_generated_tile(painter);
+        }
+
+        painter->stats.miss_time += SDL_GetPerformanceCounter() - start;
+}
+
+void
+fv_map_painter_set_mode(enum fv_map_painter_mode mode)
+{
+        mode_setting = mode;
+}
+
+static bool
+can_use_block_instances(void)
+{
+        GLint max_vertex_textures = 0, max_texture_size = 0;
+
+        if (!fv_gl.have_instanced_arrays)
+                return false;
+
+        fv_gl.glGetIntegerv(GL_MAX_VERTEX_TEXTURE_IMAGE_UNITS,
+                            &max_vertex_textures);
+        fv_gl.glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_texture_size);
+
+        return (max_vertex_textures >= 1 &&
+                fv_map.width <= max_texture_size &&
+                fv_map.height <= max_texture_size);
+}
+
+static fv_map_block_t
+convert_block_to_layers(fv_map_block_t block)
+{
+        fv_map_block_t result = block & FV_MAP_BLOCK_TYPE_MASK;
+        int shift, image;
+
+        /* The five images are in consecutive groups of six bits */
+        for (shift = 0; shift < 30; shift += 6) {
+                image = (block >> shift) & ((1 << 6) - 1);
+                result |= ((fv_map_block_t) fv_map_texture_layers[image] <<
+                           shift);
+        }
+
+        return result;
+}
+
+/* Gets the texels for the block texture for a rectangle of the map.
+ * The bytes are explicitly stored in little-endian order so that the
+ * shader can decode them regardless of the CPU. */
+static void
+get_block_texels(const struct fv_map_painter *painter,
+                 int x, int y,
+                 int width, int height,
+                 uint8_t *texels)
+{
+        fv_map_block_t block;
+        int bx, by;
+
+        for (by = y; by < y + height; by++) {
+                for (bx = x; bx < x + width; bx++) {
+                        block = fv_map.blocks[by * fv_map.width + bx];
+
+                        if (painter->use_texture_array)
+                                block = convert_block_to_layers(block);
+
+                        *(texels++) = block;
+                        *(texels++) = block >> 8;
+                        *(texels++) = block >> 16;
+                        *(texels++) = block >> 24;
+                }
+        }
+}
+
+static void
+create_block_texture(struct fv_map_painter *painter)
+{
+        uint8_t *texels;
+
+        texels = fv_alloc((size_t) fv_map.width * fv_map.height * 4);
+
+        get_block_texels(painter,
+                         0, 0,
+                         fv_map.width, fv_map.height,
+                         texels);
+
+        fv_gl_active_texture(GL_TEXTURE0 + FV_MAP_PAINTER_BLOCK_TEXTURE_UNIT);
+
+        fv_gl.glGenTextures(1, &painter->block_texture);
+        fv_gl_bind_texture(GL_TEXTURE_2D, painter->block_texture);
+        fv_gl.glTexImage2D(GL_TEXTURE_2D,
+                           0, /* level */
+                           GL_RGBA,
+                           fv_map.width, fv_map.height,
+                           0, /* border */
+                           GL_RGBA,
+                           GL_UNSIGNED_BYTE,
+                           texels);
+
+        /* Each texel is looked up exactly so there is no filtering
+         * and no mipmaps. This also makes it work with
+         * non-power-of-two maps on GLES2. */
+        fv_gl.glTexParameteri(GL_TEXTURE_2D,
+                              GL_TEXTURE_MIN_FILTER,
+                              GL_NEAREST);
+        fv_gl.glTexParameteri(GL_TEXTURE_2D,
+                              GL_TEXTURE_MAG_FILTER,
+                              GL_NEAREST);
+        fv_gl.glTexParameteri(GL_TEXTURE_2D,
+                              GL_TEXTURE_WRAP_S,
+                              GL_CLAMP_TO_EDGE);
+        fv_gl.glTexParameteri(GL_TEXTURE_2D,
+                              GL_TEXTURE_WRAP_T,
+                              GL_CLAMP_TO_EDGE);
+
+        fv_gl_active_texture(GL_TEXTURE0);
+
+        fv_free(texels);
+}
+
+/* Copies the blocks of a modified tile into the block texture. The
+ * texture must be bound to the active unit. The blocks surrounding
+ * the tile are copied too because the walls of the tile depend on
+ * them and their own tile might not be visible. */
+static void
+update_block_texture(struct fv_map_painter *painter,
+                     int tx, int ty)
+{
+        uint8_t texels[(FV_MAP_TILE_WIDTH + 2) *
+                       (FV_MAP_TILE_HEIGHT + 2) *
+                       4];
+        int x_min = MAX(tx * FV_MAP_TILE_WIDTH - 1, 0);
+        int x_max = MIN((tx + 1) * FV_MAP_TILE_WIDTH + 1, fv_map.width);
+        int y_min = MAX(ty * FV_MAP_TILE_HEIGHT - 1, 0);
+        int y_max = MIN((ty + 1) * FV_MAP_TILE_HEIGHT + 1, fv_map.height);
+
+        get_block_texels(painter,
+                         x_min, y_min,
+                         x_max - x_min, y_max - y_min,
+                         texels);
+
+        fv_gl.glTexSubImage2D(GL_TEXTURE_2D,
+                              0, /* level */
+                              x_min, y_min,
+                              x_max - x_min, y_max - y_min,
+                              GL_RGBA,
+                              GL_UNSIGNED_BYTE,
+                              texels);
+
+        painter->stats.n_rebuilds++;
+}
+
+static void
+init_block_instances(struct fv_map_painter *painter)
+{
+        struct block_instance instances[FV_MAP_PAINTER_BLOCK_INSTANCES];
+        uint8_t indices[FV_MAP_PAINTER_N_BLOCK_QUADS * 6];
+        uint8_t *idx = indices;
+        GLint block_offset;
+        GLint uniform;
+        int i;
+
+        for (i = 0; i < FV_MAP_PAINTER_BLOCK_INSTANCES; i++) {
+                instances[i].x = i % FV_MAP_TILE_WIDTH;
+                instances[i].y = i / FV_MAP_TILE_WIDTH;
+        }
+
+        for (i = 0; i < FV_MAP_PAINTER_N_BLOCK_QUADS; i++) {
+                *(idx++) = i * 4 + 0;
+                *(idx++) = i * 4 + 1;
+                *(idx++) = i * 4 + 2;
+                *(idx++) = i * 4 + 2;
+                *(idx++) = i * 4 + 1;
+                *(idx++) = i * 4 + 3;
+        }
+
+        painter->block_array = fv_array_object_new();
+
+        fv_gl.glGenBuffers(1, &painter->block_vertices_buffer);
+        fv_gl_bind_buffer(GL_ARRAY_BUFFER, painter->block_vertices_buffer);
+        fv_gl.glBufferData(GL_ARRAY_BUFFER,
+                           sizeof block_vertices,
+                           block_vertices,
+                           GL_STATIC_DRAW);
+
+        fv_array_object_set_attribute(painter->block_array,
+                                      FV_SHADER_DATA_ATTRIB_POSITION,
+                                      4, /* size */
+                                      GL_UNSIGNED_BYTE,
+                                      GL_FALSE, /* normalized */
+                                      sizeof (struct block_vertex),
+                                      0, /* divisor */
+                                      painter->block_vertices_buffer,
+                                      offsetof(struct block_vertex, x));
+
+        fv_gl.glGenBuffers(1, &painter->block_instances_buffer);
+        fv_gl_bind_buffer(GL_ARRAY_BUFFER, painter->block_instances_buffer);
+        fv_gl.glBufferData(GL_ARRAY_BUFFER,
+                           sizeof instances,
+                           instances,
+                           GL_STATIC_DRAW);
+
+        block_offset = fv_gl.glGetAttribLocation(painter->block_program.id,
+                                                 "block_offset");
+        fv_array_object_set_attribute(painter->block_array,
+                                      block_offset,
+                                      2, /* size */
+                                      GL_UNSIGNED_BYTE,
+                                      GL_FALSE, /* normalized */
+                                      sizeof (struct block_instance),
+                                      1, /* divisor */
+                                      painter->block_instances_buffer,
+                                      offsetof(struct block_instance, x));
+
+        fv_gl.glGenBuffers(1, &painter->block_indices_buffer);
+        fv_array_object_set_element_buffer(painter->block_array,
+                                           painter->block_indices_buffer);
+        fv_gl.glBufferData(GL_ELEMENT_ARRAY_BUFFER,
+                           sizeof indices,
+                           indices,
+                           GL_STATIC_DRAW);
+
+        create_block_texture(painter);
+
+        fv_gl_use_program(painter->block_program.id);
+        uniform = fv_gl.glGetUniformLocation(painter->block_program.id,
+                                             "tex");
+        fv_gl.glUniform1i(uniform, 0);
+        uniform = fv_gl.glGetUniformLocation(painter->block_program.id,
+                                             "blocks");
+        fv_gl.glUniform1i(uniform, FV_MAP_PAINTER_BLOCK_TEXTURE_UNIT);
+        uniform = fv_gl.glGetUniformLocation(painter->block_program.id,
+                                             "map_size");
+        fv_gl.glUniform2f(uniform, fv_map.width, fv_map.height);
+
+        painter->block_tile_position =
+                fv_gl.glGetUniformLocation(painter->block_program.id,
+                                           "tile_position");
+
+        painter->stats.block_memory = (sizeof block_vertices +
+                                       sizeof instances +
+                                       sizeof indices +
+                                       (size_t) fv_map.width *
+                                       fv_map.height * 4);
+
+        /* There are no worker threads in this mode */
+        painter->n_threads = 0;
+        painter->mutex = NULL;
+}
+
+static void
+init_tile_meshes(struct fv_map_painter *painter)
+{
+        init_slots(painter);
+        painter->stats.n_slots = FV_MAP_PAINTER_N_SLOTS;
+        painter->stats.block_memory = (FV_MAP_PAINTER_N_SLOTS *
+                                       (FV_MAP_PAINTER_SLOT_VERTICES *
+                                        sizeof (struct fv_map_mesh_vertex) +
+                                        FV_MAP_PAINTER_SLOT_INDICES *
+                                        sizeof (uint16_t)));
+
+        fv_buffer_init(&painter->scratch.vertices);
+        fv_buffer_init(&painter->scratch.indices);
+
+        painter->array = fv_array_object_new();
+
+        fv_gl.glGenBuffers(1, &painter->vertices_buffer);
+        fv_gl_bind_buffer(GL_ARRAY_BUFFER, painter->vertices_buffer);
+        fv_gl.glBufferData(GL_ARRAY_BUFFER,
+                           FV_MAP_PAINTER_N_SLOTS *
+                           FV_MAP_PAINTER_SLOT_VERTICES *
+                           sizeof (struct fv_map_mesh_vertex),
+                           NULL, /* data */
+                           GL_DYNAMIC_DRAW);
+
+        set_vertex_attributes(painter, 0 /* first_vertex */);
+
+        fv_gl.glGenBuffers(1, &painter->indices_buffer);
+        fv_array_object_set_element_buffer(painter->array,
+                                           painter->indices_buffer);
+        fv_gl.glBufferData(GL_ELEMENT_ARRAY_BUFFER,
+                           FV_MAP_PAINTER_N_SLOTS *
+                           FV_MAP_PAINTER_SLOT_INDICES *
+                           sizeof (uint16_t),
+                           NULL, /* data */
+                           GL_DYNAMIC_DRAW);
+
+        start_threads(painter);
+}
+
+struct fv_map_painter *
+fv_map_painter_new(struct fv_image_data *image_data,
+                   struct fv_shader_data *shader_data,
+                   struct fv_static_geometry *geometry)
+{
+        struct fv_map_painter *painter;
+        GLuint tex_uniform;
+        int i;
+
+        painter = fv_alloc(sizeof *painter);
+
+        painter->use_block_instances =
+                (mode_setting == FV_MAP_PAINTER_MODE_BLOCK_INSTANCES &&
+                 can_use_block_instances());
+
+        if (fv_gl.have_instanced_arrays) {
+                fv_gl.glGenBuffers(1, &painter->instance_buffer);
+                fv_gl_bind_buffer(GL_ARRAY_BUFFER, painter->instance_buffer);
+                fv_gl.glBufferData(GL_ARRAY_BUFFER,
+                                   sizeof (struct instance) *
+                                   FV_MAP_PAINTER_MAX_SPECIALS,
+                                   NULL, /* data */
+                                   GL_DYNAMIC_DRAW);
+        }
+
+        init_programs(painter, shader_data);
+
+        if (!load_models(painter, image_data, geometry))
+                goto error_instance_buffer;
+
+        tex_uniform = fv_gl.glGetUniformLocation(painter->map_program.id,
+                                                 "tex");
+        fv_gl_use_program(painter->map_program.id);
+        fv_gl.glUniform1i(tex_uniform, 0);
+
+        painter->tile_position =
+                fv_gl.glGetUniformLocation(painter->map_program.id,
+                                           "tile_position");
+
+        /* The texture array is only used if the shader will also
+         * have the HAVE_TEXTURE_2D_ARRAY define */
+        painter->use_texture_array = fv_gl.have_texture_2d_array;
+        /* Without texture arrays the texture has to be wrapped in
+         * the shader which only works without seams if it can pick
+         * the mipmap level itself. Otherwise each block gets its own
+         * quad so that the coordinates never need wrapping. */
+        painter->merge_faces = (painter->use_texture_array ||
+                                fv_gl.have_shader_texture_lod);
+
+        if (painter->use_texture_array)
+                create_layers_texture(painter, image_data);
+        else
+                create_atlas_texture(painter, image_data);
+
+        tex_uniform = fv_gl.glGetUniformLocation(painter->texture_program.id,
+                                                 "tex");
+        fv_gl_use_program(painter->texture_program.id);
+        fv_gl.glUniform1i(tex_uniform, 0);
+
+        /* No geometry is generated yet. The tiles are generated when
+         * they are first needed. */
+        painter->tiles = fv_alloc(sizeof *painter->tiles *
+                                  fv_map.tiles_x *
+                                  fv_map.tiles_y);
+
+        for (i = 0; i < fv_map.tiles_x * fv_map.tiles_y; i++) {
+                painter->tiles[i].state = TILE_STATE_NONE;
+                painter->tiles[i].version = fv_map.tiles[i].version;
+        }
+
+        memset(&painter->stats, 0, sizeof painter->stats);
+
+        if (painter->use_block_instances) {
+                painter->stats.mode = FV_MAP_PAINTER_MODE_BLOCK_INSTANCES;
+                init_block_instances(painter);
+        } else {
+                painter->stats.mode = FV_MAP_PAINTER_MODE_TILE_MESHES;
+                init_tile_meshes(painter);
+        }
+
+        return painter;
+
+error_instance_buffer:
+        if (fv_gl.have_instanced_arrays)
+                fv_gl_delete_buffers(1, &painter->instance_buffer);
+        fv_free(painter);
+
+        return NULL;
+}
+
+static void
+set_up_instanced_arrays(struct fv_map_painter *painter)
+{
+        const struct fv_map_painter_special *special;
+        const struct fv_map_painter_program *program;
+        GLint transform;
+        size_t offset;
+        int i, j, k;
+
+        for (i = 0; i < FV_MAP_PAINTER_N_MODELS; i++) {
+                special = painter->specials + i;
+
+                /* The array objects are shared between all models
+                 * that have the same vertex format so there's no
+                 * need to set up the same one twice */
+                for (k = 0; k < i; k++) {
+                        if (painter->specials[k].model.array ==
+                            special->model.array)
+                                break;
+                }
+                if (k < i)
+                        continue;
+
+                if (special->texture)
+                        program = &painter->texture_program;
+                else
+                        program = &painter->color_program;
+
+                transform = program->modelview_transform;
+
+                for (j = 0; j < 4; j++) {
+                        offset = offsetof(struct instance, modelview[j * 4]);
+                        fv_array_object_set_attribute(special->model.array,
+                                                      transform + j,
+                                                      4, /* size */
+                                                      GL_FLOAT,
+                                                      GL_FALSE, /* normalized */
+                                                      sizeof (struct instance),
+                                                      1, /* divisor */
+                                                      painter->instance_buffer,
+                                                      offset);
+                }
+
+                transform = program->normal_transform;
+
+                for (j = 0; j < 3; j++) {
+                        offset = offsetof(struct instance,
+                                          normal_transform[j * 3]);
+                        fv_array_object_set_attribute(special->model.array,
+                                                      transform + j,
+                                                      3, /* size */
+                                                      GL_FLOAT,
+                                                      GL_FALSE, /* normalized */
+                                                      sizeof (struct instance),
+                                                      1, /* divisor */
+                                                      painter->instance_buffer,
+                                                      offset);
+                }
+        }
+}
+
+static void
+set_position_uniforms(const struct fv_map_painter_program *program,
+                      const struct fv_model *model)
+{
+        fv_gl.glUniform3fv(program->position_scale,
+                           1, /* count */
+                           model->position_scale);
+        fv_gl.glUniform3fv(program->position_offset,
+                           1, /* count */
+                           model->position_offset);
+}
+
+static void
+flush_specials(struct fv_map_painter *painter)
+{
+        const struct fv_map_painter_special *special;
+        struct fv_map_painter_program *program;
+
+        if (painter->n_instances == 0)
+                return;
+
+        special = painter->specials + painter->current_special;
+
+        fv_map_buffer_flush(0, /* offset */
+                            sizeof (struct instance) *
+                            painter->n_instances);
+        fv_map_buffer_unmap();
+
+        if (special->texture) {
+                fv_gl_bind_texture(GL_TEXTURE_2D, special->texture);
+                program = &painter->texture_program;
+        } else {
+                program = &painter->color_program;
+        }
+        fv_gl_use_program(program->id);
+        set_position_uniforms(program, &special->model);
+
+        fv_array_object_bind(special->model.array);
+
+        fv_model_paint_instanced(&special->model,
+                                 0, /* lod */
+                                 painter->n_instances);
+
+        painter->n_instances = 0;
+}
+
+static void
+paint_special(struct fv_map_painter *painter,
+              const struct fv_map_special *special,
+              const struct fv_transform *transform_in)
+{
+        struct fv_transform transform = *transform_in;
+        struct fv_map_painter_program *program;
+        struct instance *instance;
+        GLuint texture;
+
+        if (painter->current_special != special->num ||
+            painter->n_instances >= FV_MAP_PAINTER_MAX_SPECIALS)
+                flush_specials(painter);
+
+        fv_matrix_translate(&transform.modelview,
+                            special->x + 0.5f,
+                            special->y + 0.5f,
+                            0.0f);
+        if (special->rotation != 0)
+                fv_matrix_rotate(&transform.modelview,
+                                 special->rotation * 360.0f /
+                                 (UINT16_MAX + 1.0f),
+                                 0.0f, 0.0f, 1.0f);
+
+        fv_transform_dirty(&transform);
+        fv_transform_ensure_mvp(&transform);
+        fv_transform_ensure_normal_transform(&transform);
+
+        if (fv_gl.have_instanced_arrays) {
+                if (painter->n_instances == 0) {
+                        fv_gl_bind_buffer(GL_ARRAY_BUFFER,
+                                          painter->instance_buffer);
+                        painter->instance_buffer_map =
+                                fv_map_buffer_map(GL_ARRAY_BUFFER,
+                                                  sizeof (struct instance) *
+                                                  FV_MAP_PAINTER_MAX_SPECIALS,
+                                                  true /* flush_explicit */,
+                                                  GL_DYNAMIC_DRAW);
+                        painter->current_special = special->num;
+                }
 
                 instance = painter->instance_buffer_map + painter->n_instances;
                 memcpy(instance->modelview,
@@ -742,12 +1683,14 @@ paint_special(struct fv_map_painter *painter,
         } else {
                 texture = painter->specials[special->num].texture;
                 if (texture) {
-                        fv_gl.glBindTexture(GL_TEXTURE_2D, texture);
+                        fv_gl_bind_texture(GL_TEXTURE_2D, texture);
                         program = &painter->texture_program;
                 } else {
                         program = &painter->color_program;
                 }
-                fv_gl.glUseProgram(program->id);
+                fv_gl_use_program(program->id);
+                set_position_uniforms(program,
+                                      &painter->specials[special->num].model);
                 fv_gl.glUniformMatrix4fv(program->modelview_transform,
                                          1, /* count */
                                          GL_FALSE, /* transpose */
@@ -760,18 +1703,108 @@ paint_special(struct fv_map_painter *painter,
         }
 }
 
+static void
+paint_tile(struct fv_map_painter *painter,
+           int x, int y)
+{
+        int slot_num = get_tile_slot(painter, y * fv_map.tiles_x + x);
+        const struct fv_map_painter_slot *slot = painter->slots + slot_num;
+        int first_vertex = slot_num * FV_MAP_PAINTER_SLOT_VERTICES;
+        size_t offset = (slot_num *
+                         FV_MAP_PAINTER_SLOT_INDICES *
+                         sizeof (uint16_t));
+
+        if (slot->n_indices == 0)
+                return;
+
+        fv_gl.glUniform2f(painter->tile_position,
+                          x * FV_MAP_TILE_WIDTH,
+                          y * FV_MAP_TILE_HEIGHT);
+
+        if (fv_gl.have_draw_elements_base_vertex) {
+                fv_array_object_bind(painter->array);
+                fv_gl.glDrawRangeElementsBaseVertex(GL_TRIANGLES,
+                                                    0,
+                                                    slot->n_vertices - 1,
+                                                    slot->n_indices,
+                                                    GL_UNSIGNED_SHORT,
+                                                    (void *) (intptr_t)
+                                                    offset,
+                                                    first_vertex);
+        } else {
+                /* Point the attributes at the first vertex of the
+                 * slot instead */
+                set_vertex_attributes(painter, first_vertex);
+                fv_array_object_bind(painter->array);
+                fv_gl_draw_range_elements(GL_TRIANGLES,
+                                          0,
+                                          slot->n_vertices - 1,
+                                          slot->n_indices,
+                                          GL_UNSIGNED_SHORT,
+                                          (void *) (intptr_t)
+                                          offset);
+        }
+}
+
+static void
+paint_blocks(struct fv_map_painter *painter,
+             int x_min, int x_max,
+             int y_min, int y_max)
+{
+        struct fv_map_painter_tile *tile;
+        GLsizei n_indices = FV_MAP_PAINTER_N_BLOCK_QUADS * 6;
+        GLsizei n_instances = FV_MAP_PAINTER_BLOCK_INSTANCES;
+        int tile_num;
+        int x, y;
+
+        fv_gl_active_texture(GL_TEXTURE0 + FV_MAP_PAINTER_BLOCK_TEXTURE_UNIT);
+        fv_gl_bind_texture(GL_TEXTURE_2D, painter->block_texture);
+
+        /* Bring the texture up to date before drawing anything so
+         * that the driver doesn't have to wait for a draw call that
+         * is using it */
+        for (y = y_min; y < y_max; y++) {
+                for (x = x_min; x < x_max; x++) {
+                        tile_num = y * fv_map.tiles_x + x;
+                        tile = painter->tiles + tile_num;
+
+                        if (tile->version == fv_map.tiles[tile_num].version)
+                                continue;
+
+                        update_block_texture(painter, x, y);
+                        tile->version = fv_map.tiles[tile_num].version;
+                }
+        }
+
+        fv_gl_active_texture(GL_TEXTURE0);
+
+        fv_array_object_bind(painter->block_array);
+
+        for (y = y_min; y < y_max; y++) {
+                for (x = x_max - 1; x >= x_min; x--) {
+                        fv_gl.glUniform2f(painter->block_tile_position,
+                                          x * FV_MAP_TILE_WIDTH,
+                                          y * FV_MAP_TILE_HEIGHT);
+                        fv_gl.glDrawElementsInstanced(GL_TRIANGLES,
+                                                      n_indices,
+                                                      GL_UNSIGNED_BYTE,
+                                                      NULL, /* indices */
+                                                      n_instances);
+                        painter->stats.n_tile_draws++;
+                }
+        }
+}
+
 void
 fv_map_painter_paint(struct fv_map_painter *painter,
                      struct fv_logic *logic,
                      struct fv_paint_state *paint_state)
 {
+        struct fv_map_painter_program *program;
         int x_min, x_max, y_min, y_max;
-        int idx_min;
-        int idx_max;
-        const struct fv_map_painter_tile *tile = NULL;
-        int count;
         int y, x, i;
         const struct fv_map_tile *map_tile;
+        Uint64 start = SDL_GetPerformanceCounter();
 
         x_min = floorf((paint_state->center_x - paint_state->visible_w / 2.0f) /
                        FV_MAP_TILE_WIDTH);
@@ -784,24 +1817,41 @@ fv_map_painter_paint(struct fv_map_painter *painter,
 
         if (x_min < 0)
                 x_min = 0;
-        if (x_max > FV_MAP_TILES_X)
-                x_max = FV_MAP_TILES_X;
+        if (x_max > fv_map.tiles_x)
+                x_max = fv_map.tiles_x;
         if (y_min < 0)
                 y_min = 0;
-        if (y_max > FV_MAP_TILES_Y)
-                y_max = FV_MAP_TILES_Y;
+        if (y_max > fv_map.tiles_y)
+                y_max = fv_map.tiles_y;
 
         if (y_min >= y_max || x_min >= x_max)
                 return;
 
-        fv_gl.glEnable(GL_DEPTH_TEST);
+        if (!painter->use_block_instances) {
+                upload_generated_tiles(painter);
+
+                generate_missing_tiles(painter, x_min, x_max, y_min, y_max);
+
+                /* Start generating the tiles around the edge of the
+                 * visible area so that they will hopefully be ready
+                 * before they are needed */
+                queue_tiles(painter,
+                            x_min - FV_MAP_PAINTER_PREFETCH_DISTANCE,
+                            x_max + FV_MAP_PAINTER_PREFETCH_DISTANCE,
+                            y_min - FV_MAP_PAINTER_PREFETCH_DISTANCE,
+                            y_max + FV_MAP_PAINTER_PREFETCH_DISTANCE,
+                            false /* urgent */);
+        }
 
         painter->n_instances = 0;
         painter->current_special = 0;
 
+        if (fv_gl.have_instanced_arrays)
+                set_up_instanced_arrays(painter);
+
         for (y = y_min; y < y_max; y++) {
                 for (x = x_max - 1; x >= x_min; x--) {
-                        map_tile = fv_map.tiles + y * FV_MAP_TILES_X + x;
+                        map_tile = fv_map.tiles + y * fv_map.tiles_x + x;
                         for (i = 0; i < map_tile->n_specials; i++) {
                                 paint_special(painter,
                                               map_tile->specials + i,
@@ -813,46 +1863,52 @@ fv_map_painter_paint(struct fv_map_painter *painter,
         flush_specials(painter);
 
         fv_transform_ensure_mvp(&paint_state->transform);
-        fv_transform_ensure_normal_transform(&paint_state->transform);
 
-        fv_gl.glUseProgram(painter->map_program.id);
-        fv_gl.glUniformMatrix4fv(painter->map_program.modelview_transform,
+        if (painter->use_block_instances)
+                program = &painter->block_program;
+        else
+                program = &painter->map_program;
+
+        fv_gl_use_program(program->id);
+        fv_gl.glUniformMatrix4fv(program->modelview_transform,
                                  1, /* count */
                                  GL_FALSE, /* transpose */
                                  &paint_state->transform.mvp.xx);
-        fv_gl.glUniformMatrix3fv(painter->map_program.normal_transform,
-                                 1, /* count */
-                                 GL_FALSE, /* transpose */
-                                 paint_state->transform.normal_transform);
-
-        fv_gl.glBindTexture(GL_TEXTURE_2D, painter->texture);
 
-        fv_array_object_bind(painter->array);
+        /* The tile meshes have the lighting baked into the vertices
+         * so only the block instances need the normal transform */
+        if (painter->use_block_instances) {
+                fv_transform_ensure_normal_transform(&paint_state->transform);
+                fv_gl.glUniformMatrix3fv(program->normal_transform,
+                                         1, /* count */
+                                         GL_FALSE, /* transpose */
+                                         paint_state->
+                                         transform.normal_transform);
+        }
 
-        for (y = y_min; y < y_max; y++) {
-                count = 0;
-                idx_min = INT_MAX;
-                idx_max = INT_MIN;
+        fv_gl_bind_texture(painter->use_texture_array ?
+                           GL_TEXTURE_2D_ARRAY :
+                           GL_TEXTURE_2D,
+                           painter->texture);
 
-                for (x = x_max - 1; x >= x_min; x--) {
-                        tile = painter->tiles +
-                                y * FV_MAP_TILES_X + x;
-                        count += tile->count;
-                        if (tile->min < idx_min)
-                                idx_min = tile->min;
-                        if (tile->max > idx_max)
-                                idx_max = tile->max;
+        if (painter->use_block_instances) {
+                paint_blocks(painter, x_min, x_max, y_min, y_max);
+        } else {
+                for (y = y_min; y < y_max; y++) {
+                        for (x = x_max - 1; x >= x_min; x--)
+                                paint_tile(painter, x, y);
                 }
-
-                fv_gl_draw_range_elements(GL_TRIANGLES,
-                                          idx_min, idx_max,
-                                          count,
-                                          GL_UNSIGNED_SHORT,
-                                          (void *) (intptr_t)
-                                          tile->offset);
         }
 
-        fv_gl.glDisable(GL_DEPTH_TEST);
+        painter->stats.n_paints++;
+        painter->stats.paint_time += SDL_GetPerformanceCounter() - start;
+}
+
+void
+fv_map_painter_get_stats(struct fv_map_painter *painter,
+                         struct fv_map_painter_stats *stats)
+{
+        *stats = painter->stats;
 }
 
 void
@@ -860,19 +1916,32 @@ fv_map_painter_free(struct fv_map_painter *painter)
 {
         int i;
 
-        fv_gl.glDeleteTextures(1, &painter->texture);
-        fv_array_object_free(painter->array);
-        fv_gl.glDeleteBuffers(1, &painter->vertices_buffer);
-        fv_gl.glDeleteBuffers(1, &painter->indices_buffer);
+        if (painter->use_block_instances) {
+                fv_gl_delete_textures(1, &painter->block_texture);
+                fv_array_object_free(painter->block_array);
+                fv_gl_delete_buffers(1, &painter->block_vertices_buffer);
+                fv_gl_delete_buffers(1, &painter->block_instances_buffer);
+                fv_gl_delete_buffers(1, &painter->block_indices_buffer);
+        } else {
+                stop_threads(painter);
+
+                fv_array_object_free(painter->array);
+                fv_gl_delete_buffers(1, &painter->vertices_buffer);
+                fv_gl_delete_buffers(1, &painter->indices_buffer);
+                fv_buffer_destroy(&painter->scratch.vertices);
+                fv_buffer_destroy(&painter->scratch.indices);
+        }
+
+        fv_gl_delete_textures(1, &painter->texture);
+        fv_free(painter->tiles);
 
         if (fv_gl.have_instanced_arrays)
-                fv_gl.glDeleteBuffers(1, &painter->instance_buffer);
+                fv_gl_delete_buffers(1, &painter->instance_buffer);
 
         for (i = 0; i < FV_MAP_PAINTER_N_MODELS; i++) {
-                fv_model_destroy(&painter->specials[i].model);
                 if (painter->specials[i].texture) {
-                        fv_gl.glDeleteTextures(1,
-                                               &painter->specials[i].texture);
+                        fv_gl_delete_textures(1,
+                                              &painter->specials[i].texture);
                 }
         }
 
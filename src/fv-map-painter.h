@@ -20,20 +20,82 @@
 #ifndef FV_MAP_PAINTER_H
 #define FV_MAP_PAINTER_H
 
+#include <stdint.h>
+#include <stddef.h>
+
 #include "fv-image-data.h"
 #include "fv-shader-data.h"
 #include "fv-logic.h"
 #include "fv-paint-state.h"
+#include "fv-static-geometry.h"
+
+/* Number of models for the specials. The num of each special in the
+ * map must be less than this. */
+#define FV_MAP_PAINTER_N_MODELS 6
+
+enum fv_map_painter_mode {
+        /* The blocks are drawn from meshes generated for each tile */
+        FV_MAP_PAINTER_MODE_TILE_MESHES,
+        /* Each block is an instance of a unit block that is
+         * expanded by the vertex shader from a texture containing
+         * the map */
+        FV_MAP_PAINTER_MODE_BLOCK_INSTANCES
+};
+
+struct fv_map_painter_stats {
+        /* The mode that is actually being used */
+        enum fv_map_painter_mode mode;
+        /* Bytes of GL buffer and texture memory used to draw the
+         * blocks, not including the map texture */
+        size_t block_memory;
+        /* Number of times the map was painted and the CPU time
+         * spent doing it in units of SDL_GetPerformanceCounter */
+        unsigned long n_paints;
+        uint64_t paint_time;
+
+        /* Number of tile meshes that fit in the buffers */
+        int n_slots;
+        /* Number of tile meshes currently in the buffers and the
+         * highest that number has been */
+        int n_resident;
+        int max_resident;
+        /* Number of times a tile was drawn */
+        unsigned long n_tile_draws;
+        /* Number of times a tile wasn't ready when it was drawn */
+        unsigned long n_misses;
+        /* Time spent waiting for those tiles to be generated in
+         * units of SDL_GetPerformanceCounter */
+        uint64_t miss_time;
+        /* Number of tiles generated ahead of time by the worker
+         * threads */
+        unsigned long n_streamed;
+        /* Number of tiles that were removed to make space */
+        unsigned long n_evictions;
+        /* Number of tiles generated again because the map changed */
+        unsigned long n_rebuilds;
+};
+
+/* Sets the mode to use for painters created after this. If the GL
+ * driver can't support the block instances mode then the tile meshes
+ * are used instead. The default is FV_MAP_PAINTER_MODE_TILE_MESHES.
+ */
+void
+fv_map_painter_set_mode(enum fv_map_painter_mode mode);
 
 struct fv_map_painter *
 fv_map_painter_new(struct fv_image_data *image_data,
-                   struct fv_shader_data *shader_data);
+                   struct fv_shader_data *shader_data,
+                   struct fv_static_geometry *geometry);
 
 void
 fv_map_painter_paint(struct fv_map_painter *painter,
                      struct fv_logic *logic,
                      struct fv_paint_state *paint_state);
 
+void
+fv_map_painter_get_stats(struct fv_map_painter *painter,
+                         struct fv_map_painter_stats *stats);
+
 void
 fv_map_painter_free(struct fv_map_painter *painter);
 
@@ -0,0 +1,701 @@
+/*
+ * Finvenkisto
+ *
+ * Copyright (C) 2026 Neil Roberts
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <string.h>
+#include <stdbool.h>
+#include <assert.h>
+#include <SDL.h>
+
+#include "fv-map.h"
+#include "fv-map-format.h"
+#include "fv-map-painter.h"
+#include "fv-data.h"
+#include "fv-file.h"
+#include "fv-util.h"
+#include "fv-error-message.h"
+#include "data/map-texture-layers.h"
+
+#define FV_MAP_FILENAME "finvenkisto.fvmap"
+
+/* The images are numbered by their slot in the map texture */
+#define FV_MAP_N_IMAGES FV_N_ELEMENTS(fv_map_texture_layers)
+
+struct fv_map
+fv_map;
+
+/* The file data that fv_map points into. This is either in the data
+ * pack, mapped from a separate file or, on big-endian machines, a
+ * byte-swapped copy. */
+static const uint8_t *map_data;
+static size_t map_size;
+/* The separately mapped file if the map isn't in the pack */
+static const uint8_t *mapped_file;
+static uint8_t *map_data_copy;
+
+/* Copies of the blocks and the wall mask that are made the first
+ * time the map is modified */
+static fv_map_block_t *modified_blocks;
+static uint8_t *modified_wall_mask;
+
+/* Reader-writer lock built from a mutex and a condition. The mutex
+ * protects the number of readers and whether the main thread wants
+ * to write. The condition is signalled whenever either changes. */
+static SDL_mutex *lock_mutex;
+static SDL_cond *lock_cond;
+static int n_readers;
+static bool writer_waiting;
+
+static bool
+check_section(size_t offset,
+              uint64_t section_size)
+{
+        return (offset % FV_MAP_FORMAT_ALIGNMENT == 0 &&
+                offset <= map_size &&
+                section_size <= map_size - offset);
+}
+
+static bool
+validate_header(const struct fv_map_format_header *header)
+{
+        uint64_t n_blocks, n_tiles;
+
+        if (map_size < sizeof *header ||
+            memcmp(header->magic,
+                   FV_MAP_FORMAT_MAGIC,
+                   sizeof header->magic))
+                return false;
+
+        if (header->tile_width != FV_MAP_TILE_WIDTH ||
+            header->tile_height != FV_MAP_TILE_HEIGHT)
+                return false;
+
+        /* The special positions are stored in 16 bits */
+        if (header->width == 0 || header->width > UINT16_MAX + 1 ||
+            header->height == 0 || header->height > UINT16_MAX + 1 ||
+            header->width % FV_MAP_TILE_WIDTH ||
+            header->height % FV_MAP_TILE_HEIGHT)
+                return false;
+
+        n_blocks = (uint64_t) header->width * header->height;
+        n_tiles = n_blocks / (FV_MAP_TILE_WIDTH * FV_MAP_TILE_HEIGHT);
+
+        if (!check_section(header->blocks_offset,
+                           n_blocks * sizeof (fv_map_block_t)) ||
+            !check_section(header->tiles_offset,
+                           n_tiles * sizeof (struct fv_map_format_tile)) ||
+            !check_section(header->specials_offset,
+                           (uint64_t) header->n_specials *
+                           sizeof (struct fv_map_special)))
+                return false;
+
+        if ((header->flags & FV_MAP_FORMAT_FLAG_WALL_MASK) &&
+            !check_section(header->wall_mask_offset, (n_blocks + 7) / 8))
+                return false;
+
+        if ((header->flags & FV_MAP_FORMAT_FLAG_MESHES) &&
+            (!check_section(header->meshes_offset,
+                            n_tiles * sizeof (struct fv_map_format_mesh)) ||
+             !check_section(header->vertices_offset,
+                            (uint64_t) header->n_vertices *
+                            FV_MAP_FORMAT_VERTEX_SIZE) ||
+             !check_section(header->indices_offset,
+                            (uint64_t) header->n_indices *
+                            sizeof (uint16_t))))
+                return false;
+
+        return true;
+}
+
+#ifdef HAVE_BIG_ENDIAN
+
+static void
+swap_words(void *data,
+           size_t n_words)
+{
+        uint32_t *p = data;
+        size_t i;
+
+        for (i = 0; i < n_words; i++)
+                p[i] = SDL_SwapLE32(p[i]);
+}
+
+static void
+swap_shorts(void *data,
+            size_t n_shorts)
+{
+        uint16_t *p = data;
+        size_t i;
+
+        for (i = 0; i < n_shorts; i++)
+                p[i] = SDL_SwapLE16(p[i]);
+}
+
+static void
+swap_header(void)
+{
+        struct fv_map_format_header *header =
+                (struct fv_map_format_header *) map_data_copy;
+
+        if (map_size < sizeof *header)
+                return;
+
+        /* Everything after the magic is a 32-bit value */
+        swap_words((uint8_t *) header + sizeof header->magic,
+                   (sizeof *header - sizeof header->magic) /
+                   sizeof (uint32_t));
+}
+
+static void
+swap_sections(const struct fv_map_format_header *header)
+{
+        size_t n_blocks = (size_t) header->width * header->height;
+
+        swap_words(map_data_copy + header->blocks_offset, n_blocks);
+        swap_words(map_data_copy + header->tiles_offset,
+                   n_blocks / (FV_MAP_TILE_WIDTH * FV_MAP_TILE_HEIGHT) *
+                   sizeof (struct fv_map_format_tile) / sizeof (uint32_t));
+        swap_shorts(map_data_copy + header->specials_offset,
+                    header->n_specials *
+                    sizeof (struct fv_map_special) / sizeof (uint16_t));
+
+        /* The vertices are all bytes so they don't need swapping */
+        if ((header->flags & FV_MAP_FORMAT_FLAG_MESHES)) {
+                swap_words(map_data_copy + header->meshes_offset,
+                           n_blocks /
+                           (FV_MAP_TILE_WIDTH * FV_MAP_TILE_HEIGHT) *
+                           sizeof (struct fv_map_format_mesh) /
+                           sizeof (uint32_t));
+                swap_shorts(map_data_copy + header->indices_offset,
+                            header->n_indices);
+        }
+}
+
+#endif /* HAVE_BIG_ENDIAN */
+
+/* Only the ranges of the mesh are checked when the map is loaded so
+ * that the time doesn't depend on the size of the map. The contents
+ * are checked by fv_map_validate_tile_mesh when the mesh is used. */
+static bool
+load_mesh(const struct fv_map_format_header *header,
+          const struct fv_map_format_mesh *mesh,
+          struct fv_map_tile *tile)
+{
+
+        /* The painter has room for five faces per block */
+        if (mesh->first_vertex > header->n_vertices ||
+            mesh->n_vertices > header->n_vertices - mesh->first_vertex ||
+            mesh->n_vertices > FV_MAP_TILE_WIDTH * FV_MAP_TILE_HEIGHT * 5 * 4 ||
+            mesh->first_index > header->n_indices ||
+            mesh->n_indices > header->n_indices - mesh->first_index ||
+            mesh->n_indices > FV_MAP_TILE_WIDTH * FV_MAP_TILE_HEIGHT * 5 * 6)
+                return false;
+
+        tile->vertices = (map_data + header->vertices_offset +
+                          mesh->first_vertex * FV_MAP_FORMAT_VERTEX_SIZE);
+        tile->n_vertices = mesh->n_vertices;
+        tile->indices = ((const uint16_t *)
+                         (map_data + header->indices_offset) +
+                         mesh->first_index);
+        tile->n_indices = mesh->n_indices;
+
+        return true;
+}
+
+bool
+fv_map_validate_tile_mesh(const struct fv_map_tile *tile)
+{
+        int i;
+
+        for (i = 0; i < tile->n_indices; i++) {
+                if (tile->indices[i] >= tile->n_vertices)
+                        return false;
+        }
+
+        for (i = 0; i < tile->n_vertices; i++) {
+                if (tile->vertices[i * FV_MAP_FORMAT_VERTEX_SIZE +
+                                   FV_MAP_FORMAT_VERTEX_IMAGE_OFFSET] >=
+                    FV_MAP_N_IMAGES)
+                        return false;
+        }
+
+        return true;
+}
+
+static bool
+load_tiles(const struct fv_map_format_header *header)
+{
+        const struct fv_map_format_tile *file_tiles =
+                (const struct fv_map_format_tile *)
+                (map_data + header->tiles_offset);
+        const struct fv_map_special *specials =
+                (const struct fv_map_special *)
+                (map_data + header->specials_offset);
+        const struct fv_map_format_mesh *meshes =
+                (const struct fv_map_format_mesh *)
+                (map_data + header->meshes_offset);
+        const struct fv_map_format_tile *file_tile;
+        const struct fv_map_special *special;
+        struct fv_map_tile *tile;
+        int tx, ty, i;
+
+        fv_map.tiles = fv_calloc(sizeof *fv_map.tiles *
+                                 fv_map.tiles_x *
+                                 fv_map.tiles_y);
+
+        for (ty = 0; ty < fv_map.tiles_y; ty++) {
+                for (tx = 0; tx < fv_map.tiles_x; tx++) {
+                        file_tile = file_tiles + ty * fv_map.tiles_x + tx;
+                        tile = fv_map.tiles + ty * fv_map.tiles_x + tx;
+
+                        if (file_tile->first_special > header->n_specials ||
+                            file_tile->n_specials >
+                            header->n_specials - file_tile->first_special)
+                                return false;
+
+                        tile->specials = specials + file_tile->first_special;
+                        tile->n_specials = file_tile->n_specials;
+                        tile->version = 0;
+                        tile->modified_specials = NULL;
+                        tile->vertices = NULL;
+                        tile->n_vertices = 0;
+                        tile->indices = NULL;
+                        tile->n_indices = 0;
+
+                        /* The painter relies on the specials being
+                         * in the tile that they are listed in */
+                        for (i = 0; i < tile->n_specials; i++) {
+                                special = tile->specials + i;
+
+                                if (special->x / FV_MAP_TILE_WIDTH != tx ||
+                                    special->y / FV_MAP_TILE_HEIGHT != ty)
+                                        return false;
+                        }
+
+                        if ((header->flags & FV_MAP_FORMAT_FLAG_MESHES) &&
+                            !load_mesh(header,
+                                       meshes + ty * fv_map.tiles_x + tx,
+                                       tile))
+                                return false;
+                }
+        }
+
+        return true;
+}
+
+static bool
+load_map_data(void)
+{
+        const struct fv_map_format_header *header;
+
+#ifdef HAVE_BIG_ENDIAN
+        /* The file is little-endian so swap a copy of it */
+        map_data_copy = fv_alloc(map_size);
+        memcpy(map_data_copy, map_data, map_size);
+        swap_header();
+        map_data = map_data_copy;
+#endif
+
+        header = (const struct fv_map_format_header *) map_data;
+
+        if (!validate_header(header))
+                return false;
+
+#ifdef HAVE_BIG_ENDIAN
+        swap_sections(header);
+#endif
+
+        fv_map.width = header->width;
+        fv_map.height = header->height;
+        fv_map.tiles_x = header->width / FV_MAP_TILE_WIDTH;
+        fv_map.tiles_y = header->height / FV_MAP_TILE_HEIGHT;
+        fv_map.start_x = header->start_x;
+        fv_map.start_y = header->start_y;
+        fv_map.blocks = (const fv_map_block_t *)
+                (map_data + header->blocks_offset);
+
+        if ((header->flags & FV_MAP_FORMAT_FLAG_WALL_MASK))
+                fv_map.wall_mask = map_data + header->wall_mask_offset;
+        else
+                fv_map.wall_mask = NULL;
+
+        return load_tiles(header);
+}
+
+/* The number of a special indexes the models of the painter. The
+ * images of the blocks don't need checking because the table of
+ * layers has an entry for every possible value. */
+static bool
+validate_specials(void)
+{
+        const struct fv_map_tile *tile;
+        const struct fv_map_special *special;
+        int i, j;
+
+        for (i = 0; i < fv_map.tiles_x * fv_map.tiles_y; i++) {
+                tile = fv_map.tiles + i;
+
+                for (j = 0; j < tile->n_specials; j++) {
+                        special = tile->specials + j;
+
+                        if (special->num >= FV_MAP_PAINTER_N_MODELS) {
+                                fv_error_message("The special at %i,%i in "
+                                                 "the map has an invalid "
+                                                 "number %i",
+                                                 special->x,
+                                                 special->y,
+                                                 special->num);
+                                return false;
+                        }
+                }
+        }
+
+        return true;
+}
+
+static bool
+create_lock(void)
+{
+        lock_mutex = SDL_CreateMutex();
+
+        if (lock_mutex == NULL)
+                return false;
+
+        lock_cond = SDL_CreateCond();
+
+        if (lock_cond == NULL) {
+                SDL_DestroyMutex(lock_mutex);
+                lock_mutex = NULL;
+                return false;
+        }
+
+        n_readers = 0;
+        writer_waiting = false;
+
+        return true;
+}
+
+void
+fv_map_lock_read(void)
+{
+        SDL_LockMutex(lock_mutex);
+
+        /* New readers wait for a writer so that it can't be starved
+         * by the worker threads continuously taking the lock */
+        while (writer_waiting)
+                SDL_CondWait(lock_cond, lock_mutex);
+
+        n_readers++;
+
+        SDL_UnlockMutex(lock_mutex);
+}
+
+void
+fv_map_unlock_read(void)
+{
+        SDL_LockMutex(lock_mutex);
+
+        if (--n_readers == 0)
+                SDL_CondBroadcast(lock_cond);
+
+        SDL_UnlockMutex(lock_mutex);
+}
+
+/* The mutex is kept locked while writing so that no reader can
+ * start until it is finished */
+static void
+lock_write(void)
+{
+        SDL_LockMutex(lock_mutex);
+
+        writer_waiting = true;
+
+        while (n_readers > 0)
+                SDL_CondWait(lock_cond, lock_mutex);
+}
+
+static void
+unlock_write(void)
+{
+        writer_waiting = false;
+        SDL_CondBroadcast(lock_cond);
+
+        SDL_UnlockMutex(lock_mutex);
+}
+
+bool
+fv_map_load(void)
+{
+        char *filename;
+
+        if (!create_lock()) {
+                fv_error_message("Failed to create the map lock: %s",
+                                 SDL_GetError());
+                return false;
+        }
+
+        map_data = fv_data_get_packed(FV_MAP_FILENAME, &map_size);
+
+        if (map_data == NULL) {
+                filename = fv_data_get_filename(FV_MAP_FILENAME);
+
+                if (filename == NULL) {
+                        fv_error_message("Failed to get filename for "
+                                         FV_MAP_FILENAME);
+                        return false;
+                }
+
+                mapped_file = fv_file_map(filename, &map_size);
+
+                if (mapped_file == NULL) {
+                        fv_error_message("Failed to load %s", filename);
+                        fv_free(filename);
+                        return false;
+                }
+
+                fv_free(filename);
+                map_data = mapped_file;
+        }
+
+        if (!load_map_data()) {
+                fv_error_message("The map file is invalid");
+                fv_map_unload();
+                return false;
+        }
+
+        if (!validate_specials()) {
+                fv_map_unload();
+                return false;
+        }
+
+        return true;
+}
+
+static void
+make_blocks_writable(void)
+{
+        size_t n_blocks = (size_t) fv_map.width * fv_map.height;
+
+        if (modified_blocks)
+                return;
+
+        modified_blocks = fv_memdup(fv_map.blocks,
+                                    n_blocks * sizeof (fv_map_block_t));
+        fv_map.blocks = modified_blocks;
+
+        if (fv_map.wall_mask) {
+                modified_wall_mask = fv_memdup(fv_map.wall_mask,
+                                               (n_blocks + 7) / 8);
+                fv_map.wall_mask = modified_wall_mask;
+        }
+}
+
+static struct fv_map_tile *
+get_tile(int x, int y)
+{
+        return fv_map.tiles + ((y / FV_MAP_TILE_HEIGHT) * fv_map.tiles_x +
+                               x / FV_MAP_TILE_WIDTH);
+}
+
+static void
+mark_neighbour_dirty(const struct fv_map_tile *tile,
+                     int x, int y)
+{
+        struct fv_map_tile *neighbour;
+
+        if (x < 0 || x >= fv_map.width || y < 0 || y >= fv_map.height)
+                return;
+
+        neighbour = get_tile(x, y);
+
+        if (neighbour != tile)
+                neighbour->version++;
+}
+
+void
+fv_map_set_block(int x, int y,
+                 fv_map_block_t block)
+{
+        struct fv_map_tile *tile;
+        size_t pos;
+        int dx, dy;
+
+        assert(x >= 0 && x < fv_map.width && y >= 0 && y < fv_map.height);
+
+        lock_write();
+
+        make_blocks_writable();
+
+        pos = (size_t) y * fv_map.width + x;
+
+        modified_blocks[pos] = block;
+
+        if (modified_wall_mask) {
+                if (FV_MAP_IS_WALL(block))
+                        modified_wall_mask[pos / 8] |= 1 << (pos % 8);
+                else
+                        modified_wall_mask[pos / 8] &= ~(1 << (pos % 8));
+        }
+
+        unlock_write();
+
+        tile = get_tile(x, y);
+        tile->version++;
+
+        /* The sides of the neighbouring blocks and the ambient
+         * occlusion of the diagonal ones depend on this block too */
+        for (dy = -1; dy <= 1; dy++) {
+                for (dx = -1; dx <= 1; dx++)
+                        mark_neighbour_dirty(tile, x + dx, y + dy);
+        }
+}
+
+/* Makes sure the specials of the tile are in an allocated array
+ * with space for n_specials */
+static struct fv_map_special *
+make_specials_writable(struct fv_map_tile *tile,
+                       int n_specials)
+{
+        struct fv_map_special *specials;
+
+        if (tile->modified_specials) {
+                specials = fv_realloc(tile->modified_specials,
+                                      MAX(n_specials, 1) * sizeof *specials);
+        } else {
+                specials = fv_alloc(MAX(n_specials, 1) * sizeof *specials);
+                memcpy(specials,
+                       tile->specials,
+                       MIN(n_specials, tile->n_specials) * sizeof *specials);
+        }
+
+        tile->modified_specials = specials;
+        tile->specials = specials;
+
+        return specials;
+}
+
+void
+fv_map_add_special(const struct fv_map_special *special)
+{
+        struct fv_map_tile *tile;
+        struct fv_map_special *specials;
+        fv_map_block_t block;
+        int pos;
+
+        assert(special->x < fv_map.width && special->y < fv_map.height);
+        assert(special->num < FV_MAP_PAINTER_N_MODELS);
+
+        tile = get_tile(special->x, special->y);
+
+        /* The painter combines consecutive specials with the same
+         * number into one draw call */
+        for (pos = 0; pos < tile->n_specials; pos++) {
+                if (tile->specials[pos].num > special->num)
+                        break;
+        }
+
+        specials = make_specials_writable(tile, tile->n_specials + 1);
+
+        memmove(specials + pos + 1,
+                specials + pos,
+                (tile->n_specials - pos) * sizeof *specials);
+        specials[pos] = *special;
+        tile->n_specials++;
+
+        /* Keep the images so that the block can go back to how it
+         * was when the special is removed */
+        block = fv_map.blocks[(size_t) special->y * fv_map.width + special->x];
+        block = (block & ~FV_MAP_BLOCK_TYPE_MASK) | FV_MAP_BLOCK_TYPE_SPECIAL;
+        fv_map_set_block(special->x, special->y, block);
+}
+
+bool
+fv_map_remove_special(int x, int y)
+{
+        struct fv_map_tile *tile;
+        struct fv_map_special *specials;
+        fv_map_block_t block;
+        int pos, i;
+
+        if (x < 0 || x >= fv_map.width || y < 0 || y >= fv_map.height)
+                return false;
+
+        tile = get_tile(x, y);
+
+        for (pos = 0; pos < tile->n_specials; pos++) {
+                if (tile->specials[pos].x == x && tile->specials[pos].y == y)
+                        break;
+        }
+
+        if (pos >= tile->n_specials)
+                return false;
+
+        specials = make_specials_writable(tile, tile->n_specials);
+
+        memmove(specials + pos,
+                specials + pos + 1,
+                (tile->n_specials - pos - 1) * sizeof *specials);
+        tile->n_specials--;
+
+        for (i = 0; i < tile->n_specials; i++) {
+                if (specials[i].x == x && specials[i].y == y)
+                        return true;
+        }
+
+        /* Nothing is left on the block so it becomes walkable */
+        block = fv_map.blocks[(size_t) y * fv_map.width + x];
+        block = (block & ~FV_MAP_BLOCK_TYPE_MASK) | FV_MAP_BLOCK_TYPE_FLOOR;
+        fv_map_set_block(x, y, block);
+
+        return true;
+}
+
+void
+fv_map_unload(void)
+{
+        int i;
+
+        if (fv_map.tiles) {
+                for (i = 0; i < fv_map.tiles_x * fv_map.tiles_y; i++)
+                        fv_free(fv_map.tiles[i].modified_specials);
+        }
+
+        fv_free(fv_map.tiles);
+        fv_free(modified_blocks);
+        fv_free(modified_wall_mask);
+        fv_free(map_data_copy);
+
+        if (mapped_file)
+                fv_file_unmap(mapped_file, map_size);
+
+        if (lock_cond)
+                SDL_DestroyCond(lock_cond);
+        if (lock_mutex)
+                SDL_DestroyMutex(lock_mutex);
+
+        memset(&fv_map, 0, sizeof fv_map);
+        map_data = NULL;
+        mapped_file = NULL;
+        map_data_copy = NULL;
+        modified_blocks = NULL;
+        modified_wall_mask = NULL;
+        lock_cond = NULL;
+        lock_mutex = NULL;
+}
@@ -21,26 +21,15 @@
 #define FV_MAP_H
 
 #include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
 
-#define FV_MAP_WIDTH 40
-#define FV_MAP_HEIGHT 48
-
+/* The size of the map is read from the map file at runtime but the
+ * tile size is fixed. The file must have been generated with the
+ * same tile size. */
 #define FV_MAP_TILE_WIDTH 8
 #define FV_MAP_TILE_HEIGHT 8
 
-#define FV_MAP_TILES_X (FV_MAP_WIDTH / FV_MAP_TILE_WIDTH)
-#define FV_MAP_TILES_Y (FV_MAP_HEIGHT / FV_MAP_TILE_HEIGHT)
-
-/* Start position. When there is more than one player the players are
- * put on a horizontal line centered around this point */
-#define FV_MAP_START_X (FV_MAP_WIDTH / 2.0f)
-#define FV_MAP_START_Y 8.5f
-
-_Static_assert(FV_MAP_WIDTH % FV_MAP_TILE_WIDTH == 0,
-               "The map size must be a multiple of the tile size");
-_Static_assert(FV_MAP_HEIGHT % FV_MAP_TILE_HEIGHT == 0,
-               "The map size must be a multiple of the tile size");
-
 #define FV_MAP_BLOCK_TYPE_SHIFT 30
 #define FV_MAP_BLOCK_TYPE_MASK ((uint32_t) 0x3 << FV_MAP_BLOCK_TYPE_SHIFT)
 
@@ -70,14 +59,117 @@ struct fv_map_special {
 struct fv_map_tile {
         const struct fv_map_special *specials;
         int n_specials;
+        /* Incremented whenever a block changes that affects the
+         * geometry of the tile */
+        unsigned int version;
+        /* A copy of the specials once they have been modified */
+        struct fv_map_special *modified_specials;
+        /* The mesh for the tile that was generated when the game
+         * was built, or NULL if the map file doesn't have one. This
+         * is only valid while the version is still zero. The format
+         * of the vertices is described in fv-map-format.h. */
+        const uint8_t *vertices;
+        int n_vertices;
+        const uint16_t *indices;
+        int n_indices;
 };
 
 struct fv_map {
-        fv_map_block_t blocks[FV_MAP_WIDTH * FV_MAP_HEIGHT];
-        struct fv_map_tile tiles[FV_MAP_TILES_X * FV_MAP_TILES_Y];
+        int width, height;
+        int tiles_x, tiles_y;
+
+        /* Start position. When there is more than one player the
+         * players are put on a horizontal line centered around this
+         * point */
+        float start_x, start_y;
+
+        const fv_map_block_t *blocks;
+        struct fv_map_tile *tiles;
+
+        /* One bit per block, set if the block is a wall. This can be
+         * NULL if the map file doesn't have one */
+        const uint8_t *wall_mask;
 };
 
-extern const struct fv_map
+extern struct fv_map
 fv_map;
 
+/* Loads the map from the data pack or the data directory. This must
+ * be called after fv_data_init and before anything uses fv_map. An
+ * error message is reported if it fails.
+ */
+bool
+fv_map_load(void);
+
+/* Threads other than the main thread must hold the read lock while
+ * they look at the blocks because the main thread might be modifying
+ * them. Any number of threads can hold it at the same time. The main
+ * thread doesn't need it because it is the only one that modifies the
+ * map.
+ */
+void
+fv_map_lock_read(void);
+
+void
+fv_map_unlock_read(void);
+
+/* Checks that the indices and images of the mesh that was generated
+ * at build time for the tile are valid. This isn't done when the map
+ * is loaded so it must be called before using the mesh. It only
+ * reads the map file so it can be called from any thread.
+ */
+bool
+fv_map_validate_tile_mesh(const struct fv_map_tile *tile);
+
+/* Returns whether the block at the given position is a wall. Anything
+ * outside of the map is considered to be a wall.
+ */
+static inline bool
+fv_map_is_wall(int x, int y)
+{
+        size_t pos;
+
+        if (x < 0 || x >= fv_map.width ||
+            y < 0 || y >= fv_map.height)
+                return true;
+
+        pos = (size_t) y * fv_map.width + x;
+
+        if (fv_map.wall_mask)
+                return (fv_map.wall_mask[pos / 8] >> (pos % 8)) & 1;
+
+        return FV_MAP_IS_WALL(fv_map.blocks[pos]);
+}
+
+/* The following functions modify the map. They must only be called
+ * from the main thread. Changing a block waits until no other thread
+ * holds the read lock. Anything painting the map should check the
+ * version of each tile to find out whether it needs to be rebuilt.
+ */
+
+/* Changes a block. The version of the tile that contains it is
+ * incremented. So are the neighbouring tiles if the block is at the
+ * edge, because their walls depend on the height of the block.
+ */
+void
+fv_map_set_block(int x, int y,
+                 fv_map_block_t block);
+
+/* Adds a special. The specials in a tile are kept sorted by their
+ * number. The block under it becomes a special block so that it is a
+ * wall.
+ */
+void
+fv_map_add_special(const struct fv_map_special *special);
+
+/* Removes the special at the given block position. Returns false if
+ * there isn't one. The block becomes floor once there are no specials
+ * left on it.
+ */
+bool
+fv_map_remove_special(int x, int y);
+
+void
+fv_map_unload(void);
+
 #endif /* FV_MAP_H */
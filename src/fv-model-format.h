@@ -0,0 +1,91 @@
+/*
+ * Finvenkisto
+ *
+ * Copyright (C) 2026 Neil Roberts
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FV_MODEL_FORMAT_H
+#define FV_MODEL_FORMAT_H
+
+#include <stdint.h>
+#include <GL/gl.h>
+
+/* A .fvm file contains a model in a form that can be uploaded
+ * directly to GL. They are generated from the PLY files at build time
+ * by make-fvm. The file starts with the header below. The vertices
+ * and the 16-bit indices follow at the offsets given in the header,
+ * each aligned to FV_MODEL_FORMAT_ALIGNMENT. All values are
+ * little-endian.
+ *
+ * The vertices are quantized to save memory bandwidth. The positions
+ * are normalized shorts covering the bounding box of the model so
+ * the shader needs to multiply them by position_scale and add
+ * position_offset to get the original value back. The normals are
+ * packed into a GL_INT_2_10_10_10_REV and the texture coordinates are
+ * normalized unsigned shorts if they fit in the range [0,1].
+ *
+ * The indices can contain several levels of detail for the model.
+ * They all use the same vertices. The first level is the full model
+ * and each one after that has fewer triangles.
+ */
+
+#define FV_MODEL_FORMAT_MAGIC "FVMODEL3"
+
+#define FV_MODEL_FORMAT_ALIGNMENT 16
+
+#define FV_MODEL_FORMAT_MAX_ATTRIBUTES 4
+
+#define FV_MODEL_FORMAT_MAX_LODS 4
+
+#ifndef GL_INT_2_10_10_10_REV
+#define GL_INT_2_10_10_10_REV 0x8D9F
+#endif
+
+/* The values are passed directly to fv_array_object_set_attribute */
+struct fv_model_format_attribute {
+        /* An fv_shader_data_attrib */
+        uint32_t index;
+        uint32_t n_components;
+        /* GL_FLOAT, GL_BYTE, GL_UNSIGNED_BYTE, GL_SHORT,
+         * GL_UNSIGNED_SHORT or GL_INT_2_10_10_10_REV */
+        uint32_t type;
+        uint32_t normalized;
+        /* Offset within a vertex */
+        uint32_t offset;
+};
+
+struct fv_model_format_lod {
+        uint32_t first_index;
+        uint32_t n_indices;
+};
+
+struct fv_model_format_header {
+        char magic[8];
+        uint32_t n_vertices;
+        uint32_t n_indices;
+        uint32_t vertex_size;
+        uint32_t n_attributes;
+        struct fv_model_format_attribute
+        attributes[FV_MODEL_FORMAT_MAX_ATTRIBUTES];
+        float position_scale[3];
+        float position_offset[3];
+        uint32_t n_lods;
+        struct fv_model_format_lod lods[FV_MODEL_FORMAT_MAX_LODS];
+        uint32_t vertices_offset;
+        uint32_t indices_offset;
+};
+
+#endif /* FV_MODEL_FORMAT_H */
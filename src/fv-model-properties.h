@@ -0,0 +1,98 @@
+/*
+ * Finvenkisto
+ *
+ * Copyright (C) 2026 Neil Roberts
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FV_MODEL_PROPERTIES_H
+#define FV_MODEL_PROPERTIES_H
+
+#include <GL/gl.h>
+#include <stdint.h>
+
+#include "fv-shader-data.h"
+
+/* The PLY vertex properties that are used for the models. This is
+ * shared between the model loader and make-fvm so that they always
+ * generate the same vertex layout.
+ */
+
+struct fv_model_property {
+        int n_components;
+        const char *components[3];
+        enum { FV_MODEL_PROPERTY_FLOAT, FV_MODEL_PROPERTY_BYTE } type;
+        GLint attrib_location;
+};
+
+/* Indices into fv_model_properties */
+enum fv_model_property_num {
+        FV_MODEL_PROPERTY_POSITION,
+        FV_MODEL_PROPERTY_TEX_COORD,
+        FV_MODEL_PROPERTY_NORMAL,
+        FV_MODEL_PROPERTY_COLOR
+};
+
+static const struct fv_model_property
+fv_model_properties[] = {
+        /* These should be sorted in descending order of size so that
+           it never ends doing an unaligned write */
+        { 3, { "x", "y", "z" }, FV_MODEL_PROPERTY_FLOAT,
+          FV_SHADER_DATA_ATTRIB_POSITION },
+        { 2, { "s", "t" }, FV_MODEL_PROPERTY_FLOAT,
+          FV_SHADER_DATA_ATTRIB_TEX_COORD },
+        { 3, { "nx", "ny", "nz" }, FV_MODEL_PROPERTY_FLOAT,
+          FV_SHADER_DATA_ATTRIB_NORMAL },
+        { 3, { "red", "green", "blue" }, FV_MODEL_PROPERTY_BYTE,
+          FV_SHADER_DATA_ATTRIB_COLOR }
+};
+
+#define FV_MODEL_N_PROPERTIES (sizeof fv_model_properties /     \
+                               sizeof fv_model_properties[0])
+
+static inline GLenum
+fv_model_property_get_gl_type(const struct fv_model_property *property)
+{
+        switch (property->type) {
+        case FV_MODEL_PROPERTY_FLOAT:
+                return GL_FLOAT;
+        case FV_MODEL_PROPERTY_BYTE:
+                return GL_UNSIGNED_BYTE;
+        }
+
+        return GL_FLOAT;
+}
+
+static inline int
+fv_model_property_get_size(const struct fv_model_property *property)
+{
+        switch (property->type) {
+        case FV_MODEL_PROPERTY_FLOAT:
+                return property->n_components * sizeof (float);
+        case FV_MODEL_PROPERTY_BYTE:
+                return property->n_components * sizeof (uint8_t);
+        }
+
+        return 0;
+}
+
+/* The bytes are colors so they are normalized */
+static inline GLboolean
+fv_model_property_is_normalized(const struct fv_model_property *property)
+{
+        return property->type == FV_MODEL_PROPERTY_BYTE;
+}
+
+#endif /* FV_MODEL_PROPERTIES_H */
@@ -23,6 +23,7 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <assert.h>
+#include <string.h>
 
 #include "fv-model.h"
 #include "fv-util.h"
@@ -31,30 +32,15 @@
 #include "fv-gl.h"
 #include "fv-shader-data.h"
 #include "fv-error-message.h"
+#include "fv-model-properties.h"
+#include "fv-model-format.h"
 
-struct property {
-        int n_components;
-        const char *components[3];
-        enum { PROPERTY_FLOAT, PROPERTY_BYTE } type;
-        GLint attrib_location;
-};
-
-static const struct property
-properties[] = {
-        /* These should be sorted in descending order of size so that
-           it never ends doing an unaligned write */
-        { 3, { "x", "y", "z" }, PROPERTY_FLOAT,
-          FV_SHADER_DATA_ATTRIB_POSITION },
-        { 2, { "s", "t" }, PROPERTY_FLOAT,
-          FV_SHADER_DATA_ATTRIB_TEX_COORD },
-        { 3, { "nx", "ny", "nz" }, PROPERTY_FLOAT,
-          FV_SHADER_DATA_ATTRIB_NORMAL },
-        { 3, { "red", "green", "blue" }, PROPERTY_BYTE,
-          FV_SHADER_DATA_ATTRIB_COLOR }
+struct vertex_layout {
+        int vertex_size;
+        int available_props;
+        int property_offsets[FV_MODEL_N_PROPERTIES];
 };
 
-#define N_PROPERTIES (FV_N_ELEMENTS(properties))
-
 struct data {
         struct fv_model *model;
 
@@ -66,10 +52,8 @@ struct data {
 
         int n_available_components;
         int n_got_components;
-        int vertex_size;
-        int available_props;
 
-        int property_offsets[N_PROPERTIES];
+        struct vertex_layout layout;
 
         long n_vertices;
         uint8_t *current_vertex;
@@ -99,6 +83,7 @@ vertex_read_cb(p_ply_argument argument)
         struct data *data;
         int32_t length, index;
         double value;
+        uint8_t *prop;
 
         ply_get_argument_user_data(argument, (void **) &data, &prop_comp_num);
         ply_get_argument_property(argument, NULL, &length, &index);
@@ -107,13 +92,14 @@ vertex_read_cb(p_ply_argument argument)
         comp_num = prop_comp_num & 0xff;
 
         assert(data->current_vertex <
-               data->vertices + data->n_vertices * data->vertex_size);
+               data->vertices + data->n_vertices * data->layout.vertex_size);
 
         if (length != 1 || index != 0) {
                 fv_error_message("%s: List type property not expected for "
                                  "vertex element '%s'",
                                  data->filename,
-                                 properties[prop_num].components[comp_num]);
+                                 fv_model_properties[prop_num].
+                                 components[comp_num]);
                 data->had_error = true;
 
                 return 0;
@@ -121,16 +107,14 @@ vertex_read_cb(p_ply_argument argument)
 
         value = ply_get_argument_value(argument);
 
-        switch (properties[prop_num].type) {
-        case PROPERTY_FLOAT:
-                ((float *) (data->current_vertex +
-                            data->property_offsets[prop_num]))[comp_num] =
-                        value;
+        prop = data->current_vertex + data->layout.property_offsets[prop_num];
+
+        switch (fv_model_properties[prop_num].type) {
+        case FV_MODEL_PROPERTY_FLOAT:
+                ((float *) prop)[comp_num] = value;
                 break;
-        case PROPERTY_BYTE:
-                ((uint8_t *) (data->current_vertex +
-                              data->property_offsets[prop_num]))[comp_num] =
-                        value;
+        case FV_MODEL_PROPERTY_BYTE:
+                ((uint8_t *) prop)[comp_num] = value;
                 break;
         }
 
@@ -139,7 +123,7 @@ vertex_read_cb(p_ply_argument argument)
         /* If we've got enough properties for a complete vertex then
          * move on to the next one */
         if (data->n_got_components == data->n_available_components) {
-                data->current_vertex += data->vertex_size;
+                data->current_vertex += data->layout.vertex_size;
                 data->n_got_components = 0;
         }
 
@@ -195,13 +179,16 @@ face_read_cb(p_ply_argument argument)
 static bool
 set_property_callbacks(struct data *data)
 {
+        const struct fv_model_property *property;
         int prop, comp;
         const char *component;
         long n_instances;
 
-        for (prop = 0; prop < N_PROPERTIES; prop++) {
-                for (comp = 0; comp < properties[prop].n_components; comp++) {
-                        component = properties[prop].components[comp];
+        for (prop = 0; prop < FV_MODEL_N_PROPERTIES; prop++) {
+                property = fv_model_properties + prop;
+
+                for (comp = 0; comp < property->n_components; comp++) {
+                        component = property->components[comp];
                         n_instances = ply_set_read_cb(data->ply,
                                                       "vertex",
                                                       component,
@@ -229,17 +216,17 @@ set_property_callbacks(struct data *data)
                         data->n_available_components++;
 
                         if (comp == 0) {
-                                data->property_offsets[prop] =
-                                        data->vertex_size;
-                                data->available_props |= (1 << prop);
+                                data->layout.property_offsets[prop] =
+                                        data->layout.vertex_size;
+                                data->layout.available_props |= (1 << prop);
                         }
 
-                        switch (properties[prop].type) {
-                        case PROPERTY_FLOAT:
-                                data->vertex_size += sizeof (float);
+                        switch (property->type) {
+                        case FV_MODEL_PROPERTY_FLOAT:
+                                data->layout.vertex_size += sizeof (float);
                                 break;
-                        case PROPERTY_BYTE:
-                                data->vertex_size += sizeof (uint8_t);
+                        case FV_MODEL_PROPERTY_BYTE:
+                                data->layout.vertex_size += sizeof (uint8_t);
                                 break;
                         }
                 }
@@ -251,90 +238,427 @@ set_property_callbacks(struct data *data)
                                       data, 0);
 
         /* Align the vertex size to the size of a float */
-        data->vertex_size = ((data->vertex_size + sizeof (float) - 1) &
-                             ~(sizeof (float) - 1));
+        data->layout.vertex_size = ((data->layout.vertex_size +
+                                     sizeof (float) - 1) &
+                                    ~(sizeof (float) - 1));
 
         return true;
 }
 
+static int
+get_layout_attributes(const struct vertex_layout *layout,
+                      struct fv_model_format_attribute *attributes)
+{
+        const struct fv_model_property *property;
+        int n_attributes = 0;
+        int i;
+
+        for (i = 0; i < FV_MODEL_N_PROPERTIES; i++) {
+                if (!(layout->available_props & (1 << i)))
+                        continue;
+
+                property = fv_model_properties + i;
+
+                attributes[n_attributes].index = property->attrib_location;
+                attributes[n_attributes].n_components = property->n_components;
+                attributes[n_attributes].type =
+                        fv_model_property_get_gl_type(property);
+                attributes[n_attributes].normalized =
+                        fv_model_property_is_normalized(property);
+                attributes[n_attributes].offset = layout->property_offsets[i];
+                n_attributes++;
+        }
+
+        return n_attributes;
+}
+
 static void
-create_buffer(struct data *data)
+create_buffer(struct fv_model *model,
+              struct fv_static_geometry *geometry,
+              const struct fv_model_format_attribute *attributes,
+              int n_attributes,
+              int vertex_size,
+              const void *vertices,
+              int n_vertices,
+              const uint16_t *indices,
+              int n_indices)
 {
-        struct fv_model *model = data->model;
-        GLenum type = GL_FLOAT;
-        GLboolean normalized = GL_FALSE;
-        GLint attrib;
+        struct fv_static_geometry_range range;
         int i;
 
-        model->n_vertices = data->n_vertices;
-        model->n_indices = data->indices.length / sizeof (uint16_t);
+        fv_static_geometry_add(geometry,
+                               attributes,
+                               n_attributes,
+                               vertex_size,
+                               vertices,
+                               n_vertices,
+                               indices,
+                               n_indices,
+                               &range);
+
+        model->array = range.array;
+        model->first_vertex = range.first_vertex;
+        model->n_vertices = n_vertices;
+        model->n_indices = n_indices;
+        model->n_lods = 1;
+        model->lods[0].first_index = range.first_index;
+        model->lods[0].n_indices = n_indices;
+
+        for (i = 0; i < 3; i++) {
+                model->position_scale[i] = 1.0f;
+                model->position_offset[i] = 0.0f;
+        }
+}
+
+static void
+create_buffer_for_layout(struct fv_model *model,
+                         struct fv_static_geometry *geometry,
+                         const struct vertex_layout *layout,
+                         const void *vertices,
+                         int n_vertices,
+                         const uint16_t *indices,
+                         int n_indices)
+{
+        struct fv_model_format_attribute
+                attributes[FV_MODEL_FORMAT_MAX_ATTRIBUTES];
+        int n_attributes;
+
+        n_attributes = get_layout_attributes(layout, attributes);
+
+        create_buffer(model,
+                      geometry,
+                      attributes,
+                      n_attributes,
+                      layout->vertex_size,
+                      vertices,
+                      n_vertices,
+                      indices,
+                      n_indices);
+}
+
+static bool
+validate_fvm(const struct fv_model_format_header *header,
+             size_t size)
+{
+        const struct fv_model_format_attribute *attribute;
+        const struct fv_model_format_lod *lod;
+        const uint16_t *indices;
+        size_t vertices_size, indices_size;
+        uint32_t attribute_size, index_num;
+        int i;
 
-        model->array = fv_array_object_new();
+        if (size < sizeof *header ||
+            memcmp(header->magic,
+                   FV_MODEL_FORMAT_MAGIC,
+                   sizeof header->magic) ||
+            header->n_vertices > UINT16_MAX ||
+            header->n_attributes > FV_MODEL_FORMAT_MAX_ATTRIBUTES ||
+            header->n_lods < 1 ||
+            header->n_lods > FV_MODEL_MAX_LODS ||
+            header->vertex_size == 0 ||
+            header->vertex_size % sizeof (float) ||
+            header->vertices_offset % FV_MODEL_FORMAT_ALIGNMENT ||
+            header->indices_offset % FV_MODEL_FORMAT_ALIGNMENT)
+                return false;
 
-        fv_gl.glGenBuffers(1, &model->vertices_buffer);
-        fv_gl.glBindBuffer(GL_ARRAY_BUFFER, model->vertices_buffer);
-        fv_gl.glBufferData(GL_ARRAY_BUFFER,
-                           data->n_vertices * data->vertex_size,
-                           data->vertices,
-                           GL_STATIC_DRAW);
+        vertices_size = (size_t) header->n_vertices * header->vertex_size;
+        indices_size = (size_t) header->n_indices * sizeof (uint16_t);
 
-        for (i = 0; i < N_PROPERTIES; i++) {
-                if (!(data->available_props & (1 << i)))
-                        continue;
+        if (header->vertices_offset > size ||
+            size - header->vertices_offset < vertices_size ||
+            header->indices_offset > size ||
+            size - header->indices_offset < indices_size)
+                return false;
 
-                switch (properties[i].type) {
-                case PROPERTY_FLOAT:
-                        type = GL_FLOAT;
-                        normalized = GL_FALSE;
+        for (i = 0; i < header->n_lods; i++) {
+                lod = header->lods + i;
+
+                if (lod->first_index > header->n_indices ||
+                    header->n_indices - lod->first_index < lod->n_indices)
+                        return false;
+        }
+
+        for (i = 0; i < header->n_attributes; i++) {
+                attribute = header->attributes + i;
+
+                if (attribute->index >= FV_GL_MAX_ATTRIBUTES ||
+                    attribute->n_components < 1 ||
+                    attribute->n_components > 4 ||
+                    attribute->offset >= header->vertex_size)
+                        return false;
+
+                switch (attribute->type) {
+                case GL_FLOAT:
+                        attribute_size = attribute->n_components * 4;
                         break;
-                case PROPERTY_BYTE:
-                        type = GL_UNSIGNED_BYTE;
-                        normalized = GL_TRUE;
+                case GL_BYTE:
+                case GL_UNSIGNED_BYTE:
+                        attribute_size = attribute->n_components;
                         break;
+                case GL_SHORT:
+                case GL_UNSIGNED_SHORT:
+                        attribute_size = attribute->n_components * 2;
+                        break;
+                case GL_INT_2_10_10_10_REV:
+                        if (attribute->n_components != 4)
+                                return false;
+                        attribute_size = 4;
+                        break;
+                default:
+                        return false;
+                }
+
+                if (attribute_size > header->vertex_size - attribute->offset)
+                        return false;
+        }
+
+        /* GL would read past the end of the vertex buffer for an
+         * index that is out of range */
+        indices = (const uint16_t *) ((const uint8_t *) header +
+                                      header->indices_offset);
+
+        for (index_num = 0; index_num < header->n_indices; index_num++) {
+                if (indices[index_num] >= header->n_vertices)
+                        return false;
+        }
+
+        return true;
+}
+
+static int8_t
+unpack_10_bit_component(uint32_t packed,
+                        int component)
+{
+        int value = (packed >> (component * 10)) & 0x3ff;
+
+        /* Sign-extend */
+        if (value & 0x200)
+                value -= 0x400;
+
+        /* Round to the nearest byte value */
+        return (value * 127 + (value < 0 ? -255 : 255)) / 511;
+}
+
+/* GLES2 and older versions of GL can’t use GL_INT_2_10_10_10_REV so
+ * the attribute is converted to three normalized bytes. These take
+ * up the same space so the vertex layout doesn’t change.
+ */
+static void
+convert_packed_normals(struct fv_model_format_attribute *attribute,
+                       uint8_t *vertices,
+                       int n_vertices,
+                       int vertex_size)
+{
+        uint8_t *p = vertices + attribute->offset;
+        uint32_t packed;
+        int i, j;
+
+        for (i = 0; i < n_vertices; i++) {
+                memcpy(&packed, p, sizeof packed);
+
+                for (j = 0; j < 3; j++)
+                        p[j] = unpack_10_bit_component(packed, j);
+                p[3] = 0;
+
+                p += vertex_size;
+        }
+
+        attribute->n_components = 3;
+        attribute->type = GL_BYTE;
+}
+
+static bool
+load_fvm_data(struct fv_model *model,
+              struct fv_static_geometry *geometry,
+              const void *data,
+              size_t size)
+{
+        const struct fv_model_format_header *header = data;
+        struct fv_model_format_attribute
+                attributes[FV_MODEL_FORMAT_MAX_ATTRIBUTES];
+        const uint8_t *vertices;
+        uint8_t *converted_vertices = NULL;
+        size_t vertices_size;
+        int first_index;
+        int i;
+
+#ifdef HAVE_BIG_ENDIAN
+        /* The file is little-endian. Fall back to the PLY file */
+        return false;
+#endif
+
+        if (!validate_fvm(header, size))
+                return false;
+
+        memcpy(attributes,
+               header->attributes,
+               header->n_attributes * sizeof attributes[0]);
+
+        vertices = (const uint8_t *) data + header->vertices_offset;
+
+        for (i = 0; i < header->n_attributes; i++) {
+                if (attributes[i].type != GL_INT_2_10_10_10_REV ||
+                    fv_gl.have_vertex_type_2_10_10_10_rev)
+                        continue;
+
+                if (converted_vertices == NULL) {
+                        vertices_size = ((size_t) header->n_vertices *
+                                         header->vertex_size);
+                        converted_vertices = fv_alloc(vertices_size);
+                        memcpy(converted_vertices, vertices, vertices_size);
+                        vertices = converted_vertices;
                 }
 
-                attrib = properties[i].attrib_location;
-
-                fv_array_object_set_attribute(model->array,
-                                              attrib, /* index */
-                                              properties[i].n_components,
-                                              type,
-                                              normalized,
-                                              data->vertex_size,
-                                              0, /* divisor */
-                                              model->vertices_buffer,
-                                              data->property_offsets[i]);
+                convert_packed_normals(attributes + i,
+                                       converted_vertices,
+                                       header->n_vertices,
+                                       header->vertex_size);
+        }
+
+        create_buffer(model,
+                      geometry,
+                      attributes,
+                      header->n_attributes,
+                      header->vertex_size,
+                      vertices,
+                      header->n_vertices,
+                      (const uint16_t *) ((const uint8_t *) data +
+                                          header->indices_offset),
+                      header->n_indices);
+
+        fv_free(converted_vertices);
+
+        /* The LOD offsets are relative to where the indices were put
+         * in the shared buffer */
+        first_index = model->lods[0].first_index;
+
+        model->n_lods = header->n_lods;
+        for (i = 0; i < header->n_lods; i++) {
+                model->lods[i].first_index = (first_index +
+                                              header->lods[i].first_index);
+                model->lods[i].n_indices = header->lods[i].n_indices;
+        }
+        model->n_indices = model->lods[0].n_indices;
+
+        memcpy(model->position_scale,
+               header->position_scale,
+               sizeof model->position_scale);
+        memcpy(model->position_offset,
+               header->position_offset,
+               sizeof model->position_offset);
+
+        return true;
+}
+
+static char *
+get_fvm_filename(const char *filename)
+{
+        const char *dot = strrchr(filename, '.');
+        size_t base_length;
+        char *result;
+
+        if (dot == NULL || strcmp(dot, ".ply"))
+                return NULL;
+
+        base_length = dot - filename;
+        result = fv_alloc(base_length + sizeof ".fvm");
+        memcpy(result, filename, base_length);
+        strcpy(result + base_length, ".fvm");
+
+        return result;
+}
+
+static bool
+load_fvm_file(struct fv_model *model,
+              struct fv_static_geometry *geometry,
+              const char *fvm_filename)
+{
+        char *full_filename;
+        FILE *file;
+        long size;
+        void *data;
+        bool result = false;
+
+        full_filename = fv_data_get_filename(fvm_filename);
+
+        if (full_filename == NULL)
+                return false;
+
+        file = fopen(full_filename, "rb");
+
+        fv_free(full_filename);
+
+        if (file == NULL)
+                return false;
+
+        if (fseek(file, 0, SEEK_END) == 0 &&
+            (size = ftell(file)) > 0 &&
+            fseek(file, 0, SEEK_SET) == 0) {
+                data = fv_alloc(size);
+
+                if (fread(data, 1, size, file) == size)
+                        result = load_fvm_data(model, geometry, data, size);
+
+                fv_free(data);
         }
 
-        fv_gl.glGenBuffers(1, &model->indices_buffer);
+        fclose(file);
 
-        fv_array_object_set_element_buffer(model->array,
-                                           model->indices_buffer);
+        return result;
+}
 
-        fv_gl.glBufferData(GL_ELEMENT_ARRAY_BUFFER,
-                           data->indices.length,
-                           data->indices.data,
-                           GL_STATIC_DRAW);
+/* Tries to load the .fvm file that the build generates for each PLY
+ * file, first from the data pack and then as a separate file. */
+static bool
+load_fvm(struct fv_model *model,
+         struct fv_static_geometry *geometry,
+         const char *filename)
+{
+        char *fvm_filename = get_fvm_filename(filename);
+        const void *packed;
+        size_t packed_size;
+        bool result;
+
+        if (fvm_filename == NULL)
+                return false;
+
+        packed = fv_data_get_packed(fvm_filename, &packed_size);
+
+        /* The data is uploaded straight from the mapped pack */
+        if (packed)
+                result = load_fvm_data(model, geometry, packed, packed_size);
+        else
+                result = load_fvm_file(model, geometry, fvm_filename);
+
+        fv_free(fvm_filename);
+
+        return result;
 }
 
 bool
 fv_model_load(struct fv_model *model,
+              struct fv_static_geometry *geometry,
               const char *filename)
 {
-        char *full_filename = fv_data_get_filename(filename);
+        char *full_filename;
         struct data data;
 
+        if (load_fvm(model, geometry, filename))
+                return true;
+
+        full_filename = fv_data_get_filename(filename);
+
+        if (full_filename == NULL)
+                return false;
+
         data.had_error = false;
         data.model = model;
         data.filename = filename;
 
         data.n_available_components = 0;
         data.n_got_components = 0;
-        data.vertex_size = 0;
-        data.available_props = 0;
-
-        if (full_filename == NULL)
-                return false;
+        data.layout.vertex_size = 0;
+        data.layout.available_props = 0;
 
         data.ply = ply_open(full_filename, error_cb, &data);
 
@@ -347,15 +671,25 @@ fv_model_load(struct fv_model *model,
             !set_property_callbacks(&data)) {
                 data.had_error = true;
         } else {
-                data.vertices = fv_alloc(data.vertex_size * data.n_vertices);
+                data.vertices = fv_alloc(data.layout.vertex_size *
+                                         data.n_vertices);
                 data.current_vertex = data.vertices;
 
                 fv_buffer_init(&data.indices);
 
-                if (!ply_read(data.ply))
+                if (!ply_read(data.ply)) {
                         data.had_error = true;
-                else
-                        create_buffer(&data);
+                } else {
+                        create_buffer_for_layout(model,
+                                                 geometry,
+                                                 &data.layout,
+                                                 data.vertices,
+                                                 data.n_vertices,
+                                                 (const uint16_t *)
+                                                 data.indices.data,
+                                                 data.indices.length /
+                                                 sizeof (uint16_t));
+                }
 
                 fv_buffer_destroy(&data.indices);
 
@@ -370,19 +704,63 @@ fv_model_load(struct fv_model *model,
 void
 fv_model_paint(const struct fv_model *model)
 {
+        fv_model_paint_lod(model, 0);
+}
+
+void
+fv_model_paint_lod(const struct fv_model *model,
+                   int lod)
+{
+        const struct fv_model_lod *model_lod = model->lods + lod;
+        const void *offset =
+                (void *) (intptr_t) (model_lod->first_index *
+                                     sizeof (uint16_t));
+
         fv_array_object_bind(model->array);
 
-        fv_gl_draw_range_elements(GL_TRIANGLES,
-                                  0, model->n_vertices - 1,
-                                  model->n_indices,
-                                  GL_UNSIGNED_SHORT,
-                                  NULL /* offset */);
+        /* Without base vertex drawing the indices were already offset
+         * when they were added to the shared buffer */
+        if (fv_gl.have_draw_elements_base_vertex) {
+                fv_gl.glDrawRangeElementsBaseVertex(GL_TRIANGLES,
+                                                    0,
+                                                    model->n_vertices - 1,
+                                                    model_lod->n_indices,
+                                                    GL_UNSIGNED_SHORT,
+                                                    offset,
+                                                    model->first_vertex);
+        } else {
+                fv_gl_draw_range_elements(GL_TRIANGLES,
+                                          model->first_vertex,
+                                          model->first_vertex +
+                                          model->n_vertices - 1,
+                                          model_lod->n_indices,
+                                          GL_UNSIGNED_SHORT,
+                                          offset);
+        }
 }
 
 void
-fv_model_destroy(struct fv_model *model)
+fv_model_paint_instanced(const struct fv_model *model,
+                         int lod,
+                         int n_instances)
 {
-        fv_array_object_free(model->array);
-        fv_gl.glDeleteBuffers(1, &model->vertices_buffer);
-        fv_gl.glDeleteBuffers(1, &model->indices_buffer);
+        const struct fv_model_lod *model_lod = model->lods + lod;
+        const void *offset =
+                (void *) (intptr_t) (model_lod->first_index *
+                                     sizeof (uint16_t));
+
+        if (fv_gl.have_draw_elements_base_vertex) {
+                fv_gl.glDrawElementsInstancedBaseVertex(GL_TRIANGLES,
+                                                        model_lod->n_indices,
+                                                        GL_UNSIGNED_SHORT,
+                                                        offset,
+                                                        n_instances,
+                                                        model->first_vertex);
+        } else {
+                fv_gl.glDrawElementsInstanced(GL_TRIANGLES,
+                                              model_lod->n_indices,
+                                              GL_UNSIGNED_SHORT,
+                                              offset,
+                                              n_instances);
+        }
 }
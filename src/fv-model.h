@@ -24,23 +24,55 @@
 #include <GL/gl.h>
 
 #include "fv-array-object.h"
+#include "fv-static-geometry.h"
 
+#define FV_MODEL_MAX_LODS 4
+
+/* A range of the indices to draw for one level of detail */
+struct fv_model_lod {
+        int first_index;
+        int n_indices;
+};
+
+/* The vertices and indices of the model are stored in a
+ * fv_static_geometry so the array object is shared with any other
+ * models that have the same vertex format.
+ */
 struct fv_model {
         struct fv_array_object *array;
-        GLuint vertices_buffer;
-        GLuint indices_buffer;
+        /* Position of the first vertex in the shared buffer */
+        int first_vertex;
         int n_vertices;
+        /* Number of indices in the full detail model */
         int n_indices;
+        /* The models generated at build time can have extra levels
+         * of detail. There is always at least one. */
+        int n_lods;
+        struct fv_model_lod lods[FV_MODEL_MAX_LODS];
+        /* The vertex shader should multiply the position attribute
+         * by the scale and add the offset to undo the quantization
+         * of the vertices */
+        float position_scale[3];
+        float position_offset[3];
 };
 
 bool
 fv_model_load(struct fv_model *model,
+              struct fv_static_geometry *geometry,
               const char *filename);
 
 void
 fv_model_paint(const struct fv_model *model);
 
 void
-fv_model_destroy(struct fv_model *model);
+fv_model_paint_lod(const struct fv_model *model,
+                   int lod);
+
+/* Draws several instances of the model. The array object must
+ * already be bound. */
+void
+fv_model_paint_instanced(const struct fv_model *model,
+                         int lod,
+                         int n_instances);
 
 #endif /* FV_MODEL_H */
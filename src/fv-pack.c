@@ -0,0 +1,141 @@
+/*
+ * Finvenkisto
+ *
+ * Copyright (C) 2026 Neil Roberts
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "fv-pack.h"
+#include "fv-util.h"
+#include "fv-file.h"
+
+struct fv_pack {
+        const uint8_t *data;
+        size_t size;
+        const struct fv_pack_entry *entries;
+        int n_entries;
+};
+
+static const char
+fv_pack_magic[8] = "FVPACK01";
+
+static bool
+validate_pack(const uint8_t *data,
+              size_t size)
+{
+        const struct fv_pack_header *header =
+                (const struct fv_pack_header *) data;
+        const struct fv_pack_entry *entries =
+                (const struct fv_pack_entry *) (header + 1);
+        int i;
+
+#ifdef HAVE_BIG_ENDIAN
+        /* The pack is little-endian and it's not worth swapping it */
+        return false;
+#endif
+
+        if (size < sizeof *header ||
+            memcmp(header->magic, fv_pack_magic, sizeof header->magic))
+                return false;
+
+        /* This is written as a division so that it can't overflow
+         * when size_t is 32-bit */
+        if (header->n_entries > (size - sizeof *header) / sizeof *entries)
+                return false;
+
+        for (i = 0; i < header->n_entries; i++) {
+                if (entries[i].offset > size ||
+                    entries[i].size > size - entries[i].offset ||
+                    entries[i].offset % FV_PACK_ALIGNMENT ||
+                    memchr(entries[i].name,
+                           '\0',
+                           sizeof entries[i].name) == NULL)
+                        return false;
+
+                if (i > 0 && strcmp(entries[i - 1].name, entries[i].name) >= 0)
+                        return false;
+        }
+
+        return true;
+}
+
+struct fv_pack *
+fv_pack_open(const char *filename)
+{
+        struct fv_pack *pack;
+        const uint8_t *data;
+        size_t size;
+
+        data = fv_file_map(filename, &size);
+
+        if (data == NULL)
+                return NULL;
+
+        if (!validate_pack(data, size)) {
+                fv_file_unmap(data, size);
+                return NULL;
+        }
+
+        pack = fv_alloc(sizeof *pack);
+        pack->data = data;
+        pack->size = size;
+        pack->n_entries = ((const struct fv_pack_header *) data)->n_entries;
+        pack->entries = (const struct fv_pack_entry *)
+                (data + sizeof (struct fv_pack_header));
+
+        return pack;
+}
+
+static int
+compare_entry_name(const void *name,
+                   const void *entry)
+{
+        return strcmp(name, ((const struct fv_pack_entry *) entry)->name);
+}
+
+const void *
+fv_pack_find(struct fv_pack *pack,
+             const char *name,
+             size_t *size)
+{
+        const struct fv_pack_entry *entry;
+
+        entry = bsearch(name,
+                        pack->entries,
+                        pack->n_entries,
+                        sizeof *entry,
+                        compare_entry_name);
+
+        if (entry == NULL)
+                return NULL;
+
+        *size = entry->size;
+
+        return pack->data + entry->offset;
+}
+
+void
+fv_pack_close(struct fv_pack *pack)
+{
+        fv_file_unmap(pack->data, pack->size);
+        fv_free(pack);
+}
@@ -0,0 +1,82 @@
+/*
+ * Finvenkisto
+ *
+ * Copyright (C) 2026 Neil Roberts
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FV_PACK_H
+#define FV_PACK_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* A pack is a single file containing all of the game data in a form
+ * that can be uploaded straight to GL. It is generated at build time
+ * by make-pack.py. The file starts with a header followed by a table
+ * of contents sorted by name. Each entry's data is aligned to
+ * FV_PACK_ALIGNMENT bytes. All values are little-endian.
+ */
+
+#define FV_PACK_ALIGNMENT 16
+
+#define FV_PACK_ALIGN(x) \
+        (((x) + FV_PACK_ALIGNMENT - 1) & ~(size_t) (FV_PACK_ALIGNMENT - 1))
+
+struct fv_pack_header {
+        char magic[8];
+        uint32_t n_entries;
+        uint32_t reserved;
+};
+
+struct fv_pack_entry {
+        char name[56];
+        uint32_t offset;
+        uint32_t size;
+};
+
+/* Images are stored as this header followed by the tightly packed
+ * pixels with the same number of components that stb_image would
+ * give */
+struct fv_pack_image {
+        uint32_t width, height;
+        uint32_t components;
+        uint32_t reserved;
+};
+
+/* Models are stored as the .fvm files generated by make-fvm. See
+ * fv-model-format.h */
+
+struct fv_pack;
+
+/* Maps the pack into memory. Returns NULL if the file doesn't exist
+ * or is invalid. Errors are not reported because the game can fall
+ * back to loading the individual files.
+ */
+struct fv_pack *
+fv_pack_open(const char *filename);
+
+/* Returns a pointer to the data for the named entry or NULL if there
+ * is no such entry. The data remains valid until the pack is closed.
+ */
+const void *
+fv_pack_find(struct fv_pack *pack,
+             const char *name,
+             size_t *size);
+
+void
+fv_pack_close(struct fv_pack *pack);
+
+#endif /* FV_PACK_H */
@@ -26,6 +26,8 @@ struct fv_paint_state {
         struct fv_transform transform;
         float center_x, center_y;
         float visible_w, visible_h;
+        /* Height in pixels of the viewport being painted */
+        int viewport_height;
 };
 
 #endif /* FV_PAINT_STATE_H */
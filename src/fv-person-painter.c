@@ -47,6 +47,29 @@ textures[] = {
         FV_IMAGE_DATA_PYJAMAS,
 };
 
+struct fv_person_painter_instance {
+        float mvp[16];
+        float normal_transform[3 * 3];
+        uint8_t tex_layer;
+        uint8_t green_tint;
+};
+
+#define FV_PERSON_PAINTER_MAX_INSTANCES 32
+
+/* Height of person.ply. This is used to work out how big a person
+ * will be on the screen. */
+#define FV_PERSON_PAINTER_HEIGHT 1.85f
+
+/* People shorter than this many pixels use the second level of
+ * detail. Each level after that is used below half the size of the
+ * previous one. */
+#define FV_PERSON_PAINTER_LOD_PIXELS 128.0f
+
+/* Every time the number of people painted in the last frame goes
+ * over this times a power of four the level of detail is lowered by
+ * one more step. */
+#define FV_PERSON_PAINTER_CROWD_SIZE 64
+
 struct fv_person_painter {
         struct fv_model model;
 
@@ -60,18 +83,26 @@ struct fv_person_painter {
         GLuint green_tint_uniform;
         GLuint normal_transform_uniform;
 
+        GLint transform_attrib;
+        GLint normal_transform_attrib;
+        GLint tex_layer_attrib;
+        GLint green_tint_attrib;
+
         bool use_instancing;
-};
 
-struct fv_person_painter_instance {
-        float mvp[16];
-        float normal_transform[3 * 3];
-        uint8_t tex_layer;
-        uint8_t green_tint;
+        /* The instances are collected separately for each level of
+         * detail so that each level can be drawn with a single call
+         */
+        struct fv_person_painter_instance
+        instances[FV_MODEL_MAX_LODS][FV_PERSON_PAINTER_MAX_INSTANCES];
+
+        /* Number of people painted so far in this frame across all
+         * of the viewports */
+        int n_people_painted;
+        /* Calculated from the number of people in the last frame */
+        int crowd_lod_bias;
 };
 
-#define FV_PERSON_PAINTER_MAX_INSTANCES 32
-
 static void
 set_texture_properties(GLenum target)
 {
@@ -114,7 +145,7 @@ set_texture(struct fv_person_painter *painter,
                                          tex_num, /* z offset */
                                          textures[tex_num]);
         } else {
-                fv_gl.glBindTexture(GL_TEXTURE_2D, painter->textures[tex_num]);
+                fv_gl_bind_texture(GL_TEXTURE_2D, painter->textures[tex_num]);
                 fv_image_data_set_2d(image_data,
                                      GL_TEXTURE_2D,
                                      0, /* level */
@@ -135,7 +166,7 @@ load_textures(struct fv_person_painter *painter,
 
         if (painter->use_instancing) {
                 fv_gl.glGenTextures(1, painter->textures);
-                fv_gl.glBindTexture(GL_TEXTURE_2D_ARRAY, painter->textures[0]);
+                fv_gl_bind_texture(GL_TEXTURE_2D_ARRAY, painter->textures[0]);
         } else {
                 fv_gl.glGenTextures(FV_N_ELEMENTS(textures), painter->textures);
         }
@@ -170,9 +201,9 @@ load_textures(struct fv_person_painter *painter,
         return true;
 
 error:
-        fv_gl.glDeleteTextures(painter->use_instancing
-                               ? 1 : FV_N_ELEMENTS(textures),
-                               painter->textures);
+        fv_gl_delete_textures(painter->use_instancing
+                              ? 1 : FV_N_ELEMENTS(textures),
+                              painter->textures);
 
         return false;
 }
@@ -193,7 +224,7 @@ set_up_instanced_arrays(struct fv_person_painter *painter)
                 offsetof(struct fv_person_painter_instance, green_tint);
         int i;
 
-        attrib = fv_gl.glGetAttribLocation(painter->program, "transform");
+        attrib = painter->transform_attrib;
 
         for (i = 0; i < 4; i++) {
                 fv_array_object_set_attribute(painter->model.array,
@@ -208,8 +239,7 @@ set_up_instanced_arrays(struct fv_person_painter *painter)
                                                sizeof (float) * i * 4));
         }
 
-        attrib = fv_gl.glGetAttribLocation(painter->program,
-                                           "normal_transform");
+        attrib = painter->normal_transform_attrib;
 
         for (i = 0; i < 3; i++) {
                 fv_array_object_set_attribute(painter->model.array,
@@ -224,7 +254,7 @@ set_up_instanced_arrays(struct fv_person_painter *painter)
                                                sizeof (float) * i * 3));
         }
 
-        attrib = fv_gl.glGetAttribLocation(painter->program, "tex_layer");
+        attrib = painter->tex_layer_attrib;
 
         fv_array_object_set_attribute(painter->model.array,
                                       attrib,
@@ -236,8 +266,7 @@ set_up_instanced_arrays(struct fv_person_painter *painter)
                                       painter->instance_buffer,
                                       tex_layer_offset);
 
-        attrib = fv_gl.glGetAttribLocation(painter->program,
-                                           "green_tint_attrib");
+        attrib = painter->green_tint_attrib;
 
         fv_array_object_set_attribute(painter->model.array,
                                       attrib,
@@ -252,10 +281,11 @@ set_up_instanced_arrays(struct fv_person_painter *painter)
 
 struct fv_person_painter *
 fv_person_painter_new(struct fv_image_data *image_data,
-                      struct fv_shader_data *shader_data)
+                      struct fv_shader_data *shader_data,
+                      struct fv_static_geometry *geometry)
 {
         struct fv_person_painter *painter = fv_calloc(sizeof *painter);
-        GLuint tex_uniform;
+        GLuint uniform;
 
         painter->use_instancing =
                 fv_gl.have_instanced_arrays &&
@@ -264,22 +294,33 @@ fv_person_painter_new(struct fv_image_data *image_data,
         painter->program =
                 shader_data->programs[FV_SHADER_DATA_PROGRAM_PERSON];
 
-        if (!fv_model_load(&painter->model, "person.ply"))
+        if (!fv_model_load(&painter->model, geometry, "person.ply"))
                 goto error;
 
         if (!load_textures(painter, image_data))
-                goto error_model;
+                goto error;
 
         if (painter->use_instancing) {
                 fv_gl.glGenBuffers(1, &painter->instance_buffer);
-                fv_gl.glBindBuffer(GL_ARRAY_BUFFER, painter->instance_buffer);
+                fv_gl_bind_buffer(GL_ARRAY_BUFFER, painter->instance_buffer);
                 fv_gl.glBufferData(GL_ARRAY_BUFFER,
                                    sizeof (struct fv_person_painter_instance) *
                                    FV_PERSON_PAINTER_MAX_INSTANCES,
                                    NULL, /* data */
                                    GL_STREAM_DRAW);
 
-                set_up_instanced_arrays(painter);
+                painter->transform_attrib =
+                        fv_gl.glGetAttribLocation(painter->program,
+                                                  "transform");
+                painter->normal_transform_attrib =
+                        fv_gl.glGetAttribLocation(painter->program,
+                                                  "normal_transform");
+                painter->tex_layer_attrib =
+                        fv_gl.glGetAttribLocation(painter->program,
+                                                  "tex_layer");
+                painter->green_tint_attrib =
+                        fv_gl.glGetAttribLocation(painter->program,
+                                                  "green_tint_attrib");
         } else {
                 painter->transform_uniform =
                         fv_gl.glGetUniformLocation(painter->program,
@@ -292,14 +333,24 @@ fv_person_painter_new(struct fv_image_data *image_data,
                                                    "normal_transform");
         }
 
-        tex_uniform = fv_gl.glGetUniformLocation(painter->program, "tex");
-        fv_gl.glUseProgram(painter->program);
-        fv_gl.glUniform1i(tex_uniform, 0);
+        fv_gl_use_program(painter->program);
+
+        uniform = fv_gl.glGetUniformLocation(painter->program, "tex");
+        fv_gl.glUniform1i(uniform, 0);
+
+        uniform = fv_gl.glGetUniformLocation(painter->program,
+                                             "position_scale");
+        fv_gl.glUniform3fv(uniform,
+                           1, /* count */
+                           painter->model.position_scale);
+        uniform = fv_gl.glGetUniformLocation(painter->program,
+                                             "position_offset");
+        fv_gl.glUniform3fv(uniform,
+                           1, /* count */
+                           painter->model.position_offset);
 
         return painter;
 
-error_model:
-        fv_model_destroy(&painter->model);
 error:
         fv_free(painter);
 
@@ -311,42 +362,97 @@ struct paint_closure {
         const struct fv_paint_state *paint_state;
         struct fv_transform transform;
 
-        struct fv_person_painter_instance *instance_buffer_map;
-        int n_instances;
+        int n_instances[FV_MODEL_MAX_LODS];
+        int crowd_lod_bias;
+        int n_people_painted;
 };
 
 static void
-flush_people(struct paint_closure *data)
+flush_lod(struct paint_closure *data,
+          int lod)
 {
         struct fv_person_painter *painter = data->painter;
         const size_t instance_size = sizeof (struct fv_person_painter_instance);
+        int n_instances = data->n_instances[lod];
+        void *map;
 
-        if (data->n_instances == 0)
+        if (n_instances == 0)
                 return;
 
+        map = fv_map_buffer_map(GL_ARRAY_BUFFER,
+                                instance_size *
+                                FV_PERSON_PAINTER_MAX_INSTANCES,
+                                true /* flush_explicit */,
+                                GL_STREAM_DRAW);
+        memcpy(map, painter->instances[lod], instance_size * n_instances);
         fv_map_buffer_flush(0, /* offset */
-                            instance_size * data->n_instances);
+                            instance_size * n_instances);
         fv_map_buffer_unmap();
 
-        fv_gl.glDrawElementsInstanced(GL_TRIANGLES,
-                                      painter->model.n_indices,
-                                      GL_UNSIGNED_SHORT,
-                                      NULL, /* offset */
-                                      data->n_instances);
+        fv_model_paint_instanced(&painter->model, lod, n_instances);
+
+        data->n_instances[lod] = 0;
+}
+
+static void
+flush_people(struct paint_closure *data)
+{
+        int lod;
+
+        for (lod = 0; lod < data->painter->model.n_lods; lod++)
+                flush_lod(data, lod);
+}
+
+static int
+get_crowd_lod_bias(int n_people)
+{
+        int bias = 0;
+
+        while (n_people > FV_PERSON_PAINTER_CROWD_SIZE) {
+                bias++;
+                n_people /= 4;
+        }
+
+        return bias;
+}
+
+/* Picks the level of detail from how tall the person will be on the
+ * screen. The distance comes from the w component of the transformed
+ * origin of the model. */
+static int
+choose_lod(const struct paint_closure *data)
+{
+        const struct fv_matrix *projection = &data->transform.projection;
+        float w = data->transform.mvp.ww;
+        float threshold = FV_PERSON_PAINTER_LOD_PIXELS;
+        int n_lods = data->painter->model.n_lods;
+        float pixels;
+        int lod = 0;
+
+        if (w > 0.0f) {
+                pixels = (FV_PERSON_PAINTER_HEIGHT * projection->yy / w *
+                          data->paint_state->viewport_height / 2.0f);
+
+                while (lod + 1 < n_lods && pixels < threshold) {
+                        lod++;
+                        threshold /= 2.0f;
+                }
+        }
+
+        lod += data->crowd_lod_bias;
 
-        data->n_instances = 0;
+        return MIN(lod, n_lods - 1);
 }
 
 static void
 paint_person_cb(const struct fv_logic_person *person,
                 void *user_data)
 {
-        const size_t instance_size = sizeof (struct fv_person_painter_instance);
         struct fv_person_painter_instance *instance;
         struct paint_closure *data = user_data;
-        GLsizei buffer_size;
         float green_tint;
         GLuint uniform;
+        int lod;
 
         /* Don't paint people that are out of the visible range */
         if (fabsf(person->x - data->paint_state->center_x) - 0.5f >=
@@ -355,9 +461,6 @@ paint_person_cb(const struct fv_logic_person *person,
             data->paint_state->visible_h / 2.0f)
                 return;
 
-        if (data->n_instances >= FV_PERSON_PAINTER_MAX_INSTANCES)
-                flush_people(data);
-
         data->transform.modelview = data->paint_state->transform.modelview;
         fv_matrix_translate(&data->transform.modelview,
                             person->x, person->y, 0.0f);
@@ -370,18 +473,15 @@ paint_person_cb(const struct fv_logic_person *person,
 
         green_tint = person->esperantified ? 120 : 0;
 
+        lod = choose_lod(data);
+        data->n_people_painted++;
+
         if (data->painter->use_instancing) {
-                if (data->n_instances == 0) {
-                        buffer_size = (instance_size *
-                                       FV_PERSON_PAINTER_MAX_INSTANCES);
-                        data->instance_buffer_map =
-                                fv_map_buffer_map(GL_ARRAY_BUFFER,
-                                                  buffer_size,
-                                                  true /* flush_explicit */,
-                                                  GL_STREAM_DRAW);
-                }
+                if (data->n_instances[lod] >= FV_PERSON_PAINTER_MAX_INSTANCES)
+                        flush_lod(data, lod);
 
-                instance = data->instance_buffer_map + data->n_instances;
+                instance = (data->painter->instances[lod] +
+                            data->n_instances[lod]);
                 memcpy(instance->mvp,
                        &data->transform.mvp.xx,
                        sizeof instance->mvp);
@@ -391,10 +491,10 @@ paint_person_cb(const struct fv_logic_person *person,
                 instance->tex_layer = person->type;
                 instance->green_tint = green_tint;
 
-                data->n_instances++;
+                data->n_instances[lod]++;
         } else {
-                fv_gl.glBindTexture(GL_TEXTURE_2D,
-                                    data->painter->textures[person->type]);
+                fv_gl_bind_texture(GL_TEXTURE_2D,
+                                   data->painter->textures[person->type]);
                 uniform = data->painter->transform_uniform;
                 fv_gl.glUniformMatrix4fv(uniform,
                                          1, /* count */
@@ -407,7 +507,7 @@ paint_person_cb(const struct fv_logic_person *person,
                                          1, /* count */
                                          GL_FALSE, /* transpose */
                                          data->transform.normal_transform);
-                fv_model_paint(&data->painter->model);
+                fv_model_paint_lod(&data->painter->model, lod);
         }
 }
 
@@ -421,33 +521,46 @@ fv_person_painter_paint(struct fv_person_painter *painter,
         data.painter = painter;
         data.paint_state = paint_state;
         data.transform.projection = paint_state->transform.projection;
-        data.n_instances = 0;
-
-        fv_gl.glUseProgram(painter->program);
+        memset(data.n_instances, 0, sizeof data.n_instances);
+        data.n_people_painted = 0;
+        data.crowd_lod_bias = painter->crowd_lod_bias;
 
-        fv_gl.glEnable(GL_DEPTH_TEST);
+        fv_gl_use_program(painter->program);
 
         if (painter->use_instancing) {
-                fv_gl.glBindTexture(GL_TEXTURE_2D_ARRAY, painter->textures[0]);
+                fv_gl_bind_texture(GL_TEXTURE_2D_ARRAY, painter->textures[0]);
                 fv_array_object_bind(painter->model.array);
-                fv_gl.glBindBuffer(GL_ARRAY_BUFFER, painter->instance_buffer);
+                /* The array object is shared with the other models
+                 * that have the same vertex format so the instanced
+                 * attributes need to be set up again every frame */
+                set_up_instanced_arrays(painter);
+                fv_gl_bind_buffer(GL_ARRAY_BUFFER, painter->instance_buffer);
         }
 
         fv_logic_for_each_person(logic, paint_person_cb, &data);
 
         flush_people(&data);
 
-        fv_gl.glDisable(GL_DEPTH_TEST);
+        painter->n_people_painted += data.n_people_painted;
+}
+
+void
+fv_person_painter_end_frame(struct fv_person_painter *painter)
+{
+        /* Use the number of people from this frame to decide whether
+         * to lower the detail for crowds in the next one */
+        painter->crowd_lod_bias =
+                get_crowd_lod_bias(painter->n_people_painted);
+        painter->n_people_painted = 0;
 }
 
 void
 fv_person_painter_free(struct fv_person_painter *painter)
 {
         if (painter->use_instancing)
-                fv_gl.glDeleteBuffers(1, &painter->instance_buffer);
-        fv_gl.glDeleteTextures(painter->use_instancing
-                               ? 1 : FV_N_ELEMENTS(textures),
-                               painter->textures);
-        fv_model_destroy(&painter->model);
+                fv_gl_delete_buffers(1, &painter->instance_buffer);
+        fv_gl_delete_textures(painter->use_instancing
+                              ? 1 : FV_N_ELEMENTS(textures),
+                              painter->textures);
         fv_free(painter);
 }
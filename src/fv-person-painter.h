@@ -24,16 +24,23 @@
 #include "fv-image-data.h"
 #include "fv-shader-data.h"
 #include "fv-paint-state.h"
+#include "fv-static-geometry.h"
 
 struct fv_person_painter *
 fv_person_painter_new(struct fv_image_data *image_data,
-                      struct fv_shader_data *shader_data);
+                      struct fv_shader_data *shader_data,
+                      struct fv_static_geometry *geometry);
 
 void
 fv_person_painter_paint(struct fv_person_painter *painter,
                         struct fv_logic *logic,
                         const struct fv_paint_state *paint_state);
 
+/* Should be called after all of the viewports have been painted for
+ * a frame */
+void
+fv_person_painter_end_frame(struct fv_person_painter *painter);
+
 void
 fv_person_painter_free(struct fv_person_painter *painter);
 
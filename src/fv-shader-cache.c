@@ -0,0 +1,254 @@
+/*
+ * Finvenkisto
+ *
+ * Copyright (C) 2026 Neil Roberts
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "fv-shader-cache.h"
+#include "fv-gl.h"
+#include "fv-data.h"
+#include "fv-util.h"
+
+#define FV_SHADER_CACHE_FNV_PRIME UINT64_C(0x100000001b3)
+
+/* This should be bumped if the file format changes */
+static const char
+fv_shader_cache_magic[8] = "FVPBIN01";
+
+/* Binaries bigger than this are assumed to be corrupt */
+#define FV_SHADER_CACHE_MAX_LENGTH (16 * 1024 * 1024)
+
+struct fv_shader_cache_header {
+        char magic[sizeof fv_shader_cache_magic];
+        uint64_t key;
+        uint32_t format;
+        uint32_t length;
+};
+
+uint64_t
+fv_shader_cache_hash(uint64_t hash,
+                     const void *data,
+                     size_t length)
+{
+        const uint8_t *p = data;
+        size_t i;
+
+        for (i = 0; i < length; i++) {
+                hash ^= p[i];
+                hash *= FV_SHADER_CACHE_FNV_PRIME;
+        }
+
+        return hash;
+}
+
+uint64_t
+fv_shader_cache_hash_string(uint64_t hash,
+                            const char *str)
+{
+        return fv_shader_cache_hash(hash, str, strlen(str) + 1);
+}
+
+static uint64_t
+get_full_key(uint64_t key)
+{
+        static const GLenum strings[] = {
+                GL_VENDOR,
+                GL_RENDERER,
+                GL_VERSION,
+        };
+        const char *str;
+        int i;
+
+        /* A binary is only valid for the exact driver that created
+         * it so the driver identity is part of the key */
+        for (i = 0; i < FV_N_ELEMENTS(strings); i++) {
+                str = (const char *) fv_gl.glGetString(strings[i]);
+                key = fv_shader_cache_hash_string(key, str ? str : "");
+        }
+
+        return key;
+}
+
+static char *
+get_cache_filename(const char *name)
+{
+        char *basename, *filename;
+
+        basename = fv_strconcat("program-", name, ".bin", NULL);
+        filename = fv_data_get_cache_filename(basename);
+        fv_free(basename);
+
+        return filename;
+}
+
+static void *
+read_binary(const char *name,
+            uint64_t key,
+            GLenum *format,
+            GLsizei *length)
+{
+        struct fv_shader_cache_header header;
+        char *filename;
+        void *binary = NULL;
+        FILE *file;
+
+        filename = get_cache_filename(name);
+        if (filename == NULL)
+                return NULL;
+
+        file = fopen(filename, "rb");
+
+        fv_free(filename);
+
+        if (file == NULL)
+                return NULL;
+
+        if (fread(&header, sizeof header, 1, file) != 1 ||
+            memcmp(header.magic,
+                   fv_shader_cache_magic,
+                   sizeof header.magic) ||
+            header.key != key ||
+            header.length == 0 ||
+            header.length > FV_SHADER_CACHE_MAX_LENGTH)
+                goto out;
+
+        binary = fv_alloc(header.length);
+
+        if (fread(binary, 1, header.length, file) != header.length) {
+                fv_free(binary);
+                binary = NULL;
+                goto out;
+        }
+
+        *format = header.format;
+        *length = header.length;
+
+out:
+        fclose(file);
+
+        return binary;
+}
+
+GLuint
+fv_shader_cache_load(const char *name,
+                     uint64_t key)
+{
+        GLint link_status;
+        GLenum format;
+        GLsizei length;
+        GLuint program;
+        void *binary;
+
+        if (!fv_gl.have_program_binary)
+                return 0;
+
+        binary = read_binary(name, get_full_key(key), &format, &length);
+
+        if (binary == NULL)
+                return 0;
+
+        program = fv_gl.glCreateProgram();
+        fv_gl.glProgramBinary(program, format, binary, length);
+
+        fv_free(binary);
+
+        /* The driver is allowed to reject the binary for any reason,
+         * for example if it has been upgraded */
+        fv_gl.glGetProgramiv(program, GL_LINK_STATUS, &link_status);
+
+        if (!link_status) {
+                fv_gl_delete_program(program);
+                return 0;
+        }
+
+        return program;
+}
+
+void
+fv_shader_cache_prepare_program(GLuint program)
+{
+        if (!fv_gl.have_program_binary)
+                return;
+
+        fv_gl.glProgramParameteri(program,
+                                  GL_PROGRAM_BINARY_RETRIEVABLE_HINT,
+                                  GL_TRUE);
+}
+
+void
+fv_shader_cache_save(GLuint program,
+                     const char *name,
+                     uint64_t key)
+{
+        struct fv_shader_cache_header header;
+        GLint length = 0;
+        GLsizei actual_length = 0;
+        GLenum format;
+        char *filename;
+        void *binary;
+        FILE *file;
+
+        if (!fv_gl.have_program_binary)
+                return;
+
+        fv_gl.glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+
+        if (length <= 0 || length > FV_SHADER_CACHE_MAX_LENGTH)
+                return;
+
+        binary = fv_alloc(length);
+
+        fv_gl.glGetProgramBinary(program,
+                                 length,
+                                 &actual_length,
+                                 &format,
+                                 binary);
+
+        if (actual_length <= 0)
+                goto out;
+
+        filename = get_cache_filename(name);
+        if (filename == NULL)
+                goto out;
+
+        file = fopen(filename, "wb");
+
+        fv_free(filename);
+
+        if (file == NULL)
+                goto out;
+
+        memset(&header, 0, sizeof header);
+        memcpy(header.magic, fv_shader_cache_magic, sizeof header.magic);
+        header.key = get_full_key(key);
+        header.format = format;
+        header.length = actual_length;
+
+        /* If the write fails part way through then the length check
+         * will make the load fail */
+        if (fwrite(&header, sizeof header, 1, file) == 1)
+                fwrite(binary, 1, actual_length, file);
+
+        fclose(file);
+
+out:
+        fv_free(binary);
+}
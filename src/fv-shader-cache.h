@@ -0,0 +1,67 @@
+/*
+ * Finvenkisto
+ *
+ * Copyright (C) 2026 Neil Roberts
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FV_SHADER_CACHE_H
+#define FV_SHADER_CACHE_H
+
+#include <GL/gl.h>
+#include <stdint.h>
+#include <stddef.h>
+
+/* The cache is keyed with a 64-bit FNV-1a hash. The caller should
+ * hash everything that affects the linked program such as the
+ * shader sources. The identity of the GL driver is added to the key
+ * automatically.
+ */
+#define FV_SHADER_CACHE_HASH_INIT UINT64_C(0xcbf29ce484222325)
+
+uint64_t
+fv_shader_cache_hash(uint64_t hash,
+                     const void *data,
+                     size_t length);
+
+/* Hashes the string including its terminator so that consecutive
+ * strings can't be confused with each other.
+ */
+uint64_t
+fv_shader_cache_hash_string(uint64_t hash,
+                            const char *str);
+
+/* Tries to create a program from a binary in the cache. Returns 0 if
+ * there is no valid cached binary with a matching key or if the
+ * driver rejects it, in which case the program should be compiled
+ * from source as normal.
+ */
+GLuint
+fv_shader_cache_load(const char *name,
+                     uint64_t key);
+
+/* Must be called before linking a program that will be saved */
+void
+fv_shader_cache_prepare_program(GLuint program);
+
+/* Saves the binary of a successfully linked program. Errors are
+ * silently ignored because the cache is only an optimisation.
+ */
+void
+fv_shader_cache_save(GLuint program,
+                     const char *name,
+                     uint64_t key);
+
+#endif /* FV_SHADER_CACHE_H */
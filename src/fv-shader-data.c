@@ -31,6 +31,7 @@
 #include "fv-buffer.h"
 #include "fv-gl.h"
 #include "fv-error-message.h"
+#include "fv-shader-cache.h"
 
 static const char
 fv_shader_data_version[] =
@@ -46,6 +47,11 @@ fv_shader_data_have_texture_2d_array[] =
         "#extension GL_EXT_texture_array : require\n"
         "#define HAVE_TEXTURE_2D_ARRAY 1\n";
 
+static const char
+fv_shader_data_have_shader_texture_lod[] =
+        "#extension GL_ARB_shader_texture_lod : require\n"
+        "#define HAVE_SHADER_TEXTURE_LOD 1\n";
+
 static const char
 fv_shader_data_have_instanced_arrays[] =
         "#define HAVE_INSTANCED_ARRAYS 1\n";
@@ -101,11 +107,7 @@ fv_shader_data_shaders[] = {
         {
                 GL_FRAGMENT_SHADER,
                 (const char *[]) { "fv-lighting-texture-fragment.glsl", NULL },
-                {
-                        FV_SHADER_DATA_PROGRAM_SPECIAL_TEXTURE,
-                        FV_SHADER_DATA_PROGRAM_MAP,
-                        PROGRAMS_END
-                }
+                { FV_SHADER_DATA_PROGRAM_SPECIAL_TEXTURE, PROGRAMS_END }
         },
         {
                 GL_VERTEX_SHADER,
@@ -135,69 +137,123 @@ fv_shader_data_shaders[] = {
                 (const char *[]) { "fv-hud-vertex.glsl", NULL },
                 { FV_SHADER_DATA_PROGRAM_HUD, PROGRAMS_END }
         },
+        {
+                GL_VERTEX_SHADER,
+                (const char *[]) { "fv-map-vertex.glsl", NULL },
+                { FV_SHADER_DATA_PROGRAM_MAP, PROGRAMS_END }
+        },
         {
                 GL_VERTEX_SHADER,
                 (const char *[]) {
                         "fv-lighting.glsl",
-                        "fv-map-vertex.glsl",
+                        "fv-map-block-vertex.glsl",
                         NULL
                 },
-                { FV_SHADER_DATA_PROGRAM_MAP, PROGRAMS_END }
+                { FV_SHADER_DATA_PROGRAM_MAP_BLOCKS, PROGRAMS_END }
+        },
+        {
+                GL_FRAGMENT_SHADER,
+                (const char *[]) { "fv-map-fragment.glsl", NULL },
+                {
+                        FV_SHADER_DATA_PROGRAM_MAP,
+                        FV_SHADER_DATA_PROGRAM_MAP_BLOCKS,
+                        PROGRAMS_END
+                }
         }
 };
 
-static GLuint
-create_shader(const char *name,
-              GLenum type,
-              const char *source,
-              int source_length)
-{
-        GLuint shader;
-        GLint length, compile_status;
-        GLsizei actual_length;
-        GLchar *info_log;
-        const char *source_strings[6];
-        GLint lengths[FV_N_ELEMENTS(source_strings)];
-        int n_strings = 0;
+struct fv_shader_data_attrib_name {
+        enum fv_shader_data_attrib attrib;
+        const char *name;
+};
 
-        shader = fv_gl.glCreateShader(type);
+static const struct fv_shader_data_attrib_name
+fv_shader_data_attrib_names[] = {
+        { FV_SHADER_DATA_ATTRIB_POSITION, "position" },
+        { FV_SHADER_DATA_ATTRIB_TEX_COORD, "tex_coord_attrib" },
+        { FV_SHADER_DATA_ATTRIB_NORMAL, "normal_attrib" },
+        { FV_SHADER_DATA_ATTRIB_COLOR, "color_attrib" },
+};
 
-        source_strings[n_strings] = fv_shader_data_version;
-        lengths[n_strings++] = sizeof fv_shader_data_version - 1;
+struct fv_shader_data_pending {
+        /* Shaders that have been submitted for compilation but whose
+         * status hasn't been checked yet */
+        GLuint shaders[FV_N_ELEMENTS(fv_shader_data_shaders)];
+        uint64_t keys[FV_SHADER_DATA_N_PROGRAMS];
+        /* Bitmask of programs that weren't in the binary cache */
+        uint32_t uncached_programs;
+};
 
-        if (fv_gl.have_texture_2d_array) {
-                source_strings[n_strings] =
-                        fv_shader_data_have_texture_2d_array;
-                lengths[n_strings++] =
-                        sizeof fv_shader_data_have_texture_2d_array - 1;
-        }
+/* A file that has been read for one of the shaders. Files that are
+ * shared between multiple shaders such as fv-lighting.glsl are only
+ * read once.
+ */
+struct shader_file {
+        const char *filename;
+        const char *contents;
+        size_t length;
+        /* False if the contents point into the data pack */
+        bool owns_contents;
+};
 
-        if (fv_gl.have_instanced_arrays) {
-                source_strings[n_strings] =
-                        fv_shader_data_have_instanced_arrays;
-                lengths[n_strings++] =
-                        sizeof fv_shader_data_have_instanced_arrays - 1;
-        }
+static void
+get_prefix(struct fv_buffer *buffer)
+{
+        fv_buffer_append_string(buffer, fv_shader_data_version);
+
+        if (fv_gl.have_texture_2d_array)
+                fv_buffer_append_string(buffer,
+                                        fv_shader_data_have_texture_2d_array);
+
+        if (fv_gl.have_shader_texture_lod)
+                fv_buffer_append_string(buffer,
+                                        fv_shader_data_have_shader_texture_lod);
+
+        if (fv_gl.have_instanced_arrays)
+                fv_buffer_append_string(buffer,
+                                        fv_shader_data_have_instanced_arrays);
 
 #ifdef EMSCRIPTEN
-        source_strings[n_strings] =
-                fv_shader_data_precision;
-        lengths[n_strings++] =
-                sizeof fv_shader_data_precision - 1;
+        fv_buffer_append_string(buffer, fv_shader_data_precision);
 #endif
 
-        source_strings[n_strings] = fv_shader_data_newline;
-        lengths[n_strings++] = sizeof fv_shader_data_newline - 1;
+        fv_buffer_append_string(buffer, fv_shader_data_newline);
+}
+
+static GLuint
+create_shader(GLenum type,
+              const struct fv_buffer *prefix,
+              const struct fv_buffer *source)
+{
+        GLuint shader;
+        const char *source_strings[2];
+        GLint lengths[FV_N_ELEMENTS(source_strings)];
+
+        shader = fv_gl.glCreateShader(type);
+
+        source_strings[0] = (const char *) prefix->data;
+        lengths[0] = prefix->length;
+        source_strings[1] = (const char *) source->data;
+        lengths[1] = source->length;
 
-        source_strings[n_strings] = source;
-        lengths[n_strings++] = source_length;
         fv_gl.glShaderSource(shader,
-                             n_strings,
+                             FV_N_ELEMENTS(source_strings),
                              (const GLchar **) source_strings,
                              lengths);
 
         fv_gl.glCompileShader(shader);
 
+        return shader;
+}
+
+static bool
+check_shader(const char *name,
+             GLuint shader)
+{
+        GLint length, compile_status;
+        GLsizei actual_length;
+        GLchar *info_log;
+
         fv_gl.glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &length);
 
         if (length > 0) {
@@ -216,110 +272,153 @@ create_shader(const char *name,
 
         if (!compile_status) {
                 fv_error_message("%s compilation failed", name);
-                fv_gl.glDeleteShader(shader);
-                return 0;
+                return false;
         }
 
-        return shader;
+        return true;
 }
 
-static GLuint
-create_shader_from_files(GLenum shader_type,
-                         const char **filenames)
+static struct shader_file *
+add_file(struct fv_buffer *files,
+         const char *filename)
+{
+        struct shader_file *file;
+
+        fv_buffer_set_length(files, files->length + sizeof *file);
+        file = (struct shader_file *) (files->data +
+                                       files->length -
+                                       sizeof *file);
+        file->filename = filename;
+
+        return file;
+}
+
+static const struct shader_file *
+read_file(struct fv_buffer *files,
+          const char *filename)
 {
+        struct shader_file *file;
+        const char *packed;
         char *fullname;
-        char *source, *p;
-        long int *lengths;
-        long int total_length = 0;
-        size_t got;
-        GLuint shader;
-        int n_files;
-        FILE **files;
-        int i;
+        char *contents;
+        FILE *f;
+        long length;
+        size_t packed_length;
+        size_t i;
+
+        for (i = 0; i < files->length / sizeof *file; i++) {
+                file = (struct shader_file *) files->data + i;
+                if (!strcmp(file->filename, filename))
+                        return file;
+        }
 
-        for (n_files = 0, i = 0; filenames[i]; i++)
-                n_files++;
+        packed = fv_data_get_packed(filename, &packed_length);
 
-        files = alloca(sizeof files[0] * n_files);
-        lengths = alloca(sizeof lengths[0] * n_files);
+        if (packed) {
+                file = add_file(files, filename);
+                file->length = packed_length;
+                file->contents = packed;
+                file->owns_contents = false;
+                return file;
+        }
 
-        for (n_files = 0, i = 0; filenames[i]; i++) {
-                fullname = fv_data_get_filename(filenames[i]);
+        fullname = fv_data_get_filename(filename);
 
-                if (fullname == NULL) {
-                        fv_error_message("Couldn't get filename for %s",
-                                         filenames[i]);
-                        shader = 0;
-                        goto out;
-                }
+        if (fullname == NULL) {
+                fv_error_message("Couldn't get filename for %s", filename);
+                return NULL;
+        }
 
-                files[i] = fopen(fullname, "r");
+        f = fopen(fullname, "r");
 
-                fv_free(fullname);
+        fv_free(fullname);
 
-                if (files[i] == NULL) {
-                        fv_error_message("%s: %s",
-                                         filenames[i],
-                                         strerror(errno));
-                        shader = 0;
-                        goto out;
-                }
+        if (f == NULL) {
+                fv_error_message("%s: %s", filename, strerror(errno));
+                return NULL;
+        }
 
-                n_files++;
+        if (fseek(f, 0, SEEK_END) != 0 ||
+            (length = ftell(f)) == -1 ||
+            fseek(f, 0, SEEK_SET) != 0)
+                goto file_error;
 
-                if (fseek(files[i], 0, SEEK_END) != 0)
-                        goto file_error;
+        file = add_file(files, filename);
+        file->length = length;
+        file->contents = contents = fv_alloc(length);
+        file->owns_contents = true;
 
-                lengths[i] = ftell(files[i]);
-                if (lengths[i] == -1)
+        if (fread(contents, 1, length, f) != length) {
+                fv_free(contents);
+                fv_buffer_set_length(files, files->length - sizeof *file);
+                if (ferror(f))
                         goto file_error;
+                fv_error_message("%s: Unexpected EOF", filename);
+                fclose(f);
+                return NULL;
+        }
 
-                if (fseek(files[i], 0, SEEK_SET) != 0)
-                        goto file_error;
+        fclose(f);
 
-                total_length += lengths[i];
-        }
+        return file;
 
-        source = fv_alloc(total_length + 1);
+file_error:
+        fv_error_message("%s: %s", filename, strerror(errno));
+        fclose(f);
+        return NULL;
+}
 
-        for (p = source, i = 0; i < n_files; i++) {
-                got = fread(p, 1, lengths[i], files[i]);
+static bool
+load_source(struct fv_buffer *files,
+            const char **filenames,
+            struct fv_buffer *source)
+{
+        const struct shader_file *file;
+        int i;
 
-                if (got != lengths[i]) {
-                        shader = 0;
-                        fv_free(source);
-                        if (ferror(files[i]))
-                                goto file_error;
-                        fv_error_message("%s: Unexpected EOF",
-                                         filenames[i]);
-                        goto out;
-                }
+        for (i = 0; filenames[i]; i++) {
+                file = read_file(files, filenames[i]);
+                if (file == NULL)
+                        return false;
 
-                p += got;
+                fv_buffer_append(source, file->contents, file->length);
         }
 
         /* Emscripten's version of glShaderSource seems to ignore the
          * length and interpret the string as null-terminated.
          */
-        source[total_length] = '\0';
+        fv_buffer_append_c(source, '\0');
+        source->length--;
 
-        shader = create_shader(filenames[n_files - 1],
-                               shader_type,
-                               source,
-                               total_length);
+        return true;
+}
 
-        fv_free(source);
+static bool
+load_sources(struct fv_buffer *sources)
+{
+        struct fv_buffer files = FV_BUFFER_STATIC_INIT;
+        struct shader_file *file;
+        bool result = true;
+        size_t i;
 
-        goto out;
+        for (i = 0; i < FV_N_ELEMENTS(fv_shader_data_shaders); i++) {
+                if (!load_source(&files,
+                                 fv_shader_data_shaders[i].filenames,
+                                 sources + i)) {
+                        result = false;
+                        break;
+                }
+        }
 
-file_error:
-        fv_error_message("%s: %s", filenames[i], strerror(errno));
-        shader = 0;
-out:
-        for (i = 0; i < n_files; i++)
-                fclose(files[i]);
+        for (i = 0; i < files.length / sizeof *file; i++) {
+                file = (struct shader_file *) files.data + i;
+                if (file->owns_contents)
+                        fv_free((char *) file->contents);
+        }
 
-        return shader;
+        fv_buffer_destroy(&files);
+
+        return result;
 }
 
 static bool
@@ -365,33 +464,79 @@ get_program_name(enum fv_shader_data_program program_num)
         return (char *) buffer.data;
 }
 
+static uint64_t
+get_program_key(const struct fv_buffer *prefix,
+                const struct fv_buffer *sources,
+                enum fv_shader_data_program program_num)
+{
+        const struct fv_shader_data_shader *shader;
+        uint64_t key = FV_SHADER_CACHE_HASH_INIT;
+        uint32_t value;
+        int i;
+
+        key = fv_shader_cache_hash(key, prefix->data, prefix->length);
+
+        for (i = 0; i < FV_N_ELEMENTS(fv_shader_data_attrib_names); i++) {
+                value = fv_shader_data_attrib_names[i].attrib;
+                key = fv_shader_cache_hash(key, &value, sizeof value);
+                key = fv_shader_cache_hash_string(key,
+                                                  fv_shader_data_attrib_names
+                                                  [i].name);
+        }
+
+        for (i = 0; i < FV_N_ELEMENTS(fv_shader_data_shaders); i++) {
+                shader = fv_shader_data_shaders + i;
+
+                if (!shader_contains_program(shader, program_num))
+                        continue;
+
+                value = shader->type;
+                key = fv_shader_cache_hash(key, &value, sizeof value);
+                value = sources[i].length;
+                key = fv_shader_cache_hash(key, &value, sizeof value);
+                key = fv_shader_cache_hash(key,
+                                           sources[i].data,
+                                           sources[i].length);
+        }
+
+        return key;
+}
+
+static void
+get_cache_name(enum fv_shader_data_program program_num,
+               char *name,
+               size_t name_size)
+{
+        snprintf(name, name_size, "%i", program_num);
+}
+
+static void
+link_program(GLuint program)
+{
+        const struct fv_shader_data_attrib_name *attrib;
+        int i;
+
+        for (i = 0; i < FV_N_ELEMENTS(fv_shader_data_attrib_names); i++) {
+                attrib = fv_shader_data_attrib_names + i;
+                fv_gl.glBindAttribLocation(program,
+                                           attrib->attrib,
+                                           attrib->name);
+        }
+
+        fv_shader_cache_prepare_program(program);
+
+        fv_gl.glLinkProgram(program);
+}
+
 static bool
-link_program(struct fv_shader_data *data,
-             enum fv_shader_data_program program_num)
+check_program(GLuint program,
+              enum fv_shader_data_program program_num)
 {
         GLint length, link_status;
         GLsizei actual_length;
         GLchar *info_log;
-        GLuint program;
         char *program_name;
 
-        program = data->programs[program_num];
-
-        fv_gl.glBindAttribLocation(program,
-                                   FV_SHADER_DATA_ATTRIB_POSITION,
-                                   "position");
-        fv_gl.glBindAttribLocation(program,
-                                   FV_SHADER_DATA_ATTRIB_TEX_COORD,
-                                   "tex_coord_attrib");
-        fv_gl.glBindAttribLocation(program,
-                                   FV_SHADER_DATA_ATTRIB_NORMAL,
-                                   "normal_attrib");
-        fv_gl.glBindAttribLocation(program,
-                                   FV_SHADER_DATA_ATTRIB_COLOR,
-                                   "color_attrib");
-
-        fv_gl.glLinkProgram(program);
-
         fv_gl.glGetProgramiv(program, GL_INFO_LOG_LENGTH, &length);
 
         if (length > 0) {
@@ -422,68 +567,224 @@ link_program(struct fv_shader_data *data,
 }
 
 static bool
-link_programs(struct fv_shader_data *data)
+shader_is_needed(const struct fv_shader_data_shader *shader,
+                 uint32_t programs)
 {
         int i;
 
-        for (i = 0; i < FV_SHADER_DATA_N_PROGRAMS; i++) {
-                if (!link_program(data, i))
-                        return false;
+        for (i = 0; shader->programs[i] != PROGRAMS_END; i++) {
+                if (programs & (1 << shader->programs[i]))
+                        return true;
         }
 
-        return true;
+        return false;
 }
 
-bool
-fv_shader_data_init(struct fv_shader_data *data)
+static void
+submit_programs(struct fv_shader_data *data,
+                const struct fv_buffer *prefix,
+                const struct fv_buffer *sources)
 {
+        struct fv_shader_data_pending *pending = data->pending;
         const struct fv_shader_data_shader *shader;
-        GLuint shaders[FV_N_ELEMENTS(fv_shader_data_shaders)];
         GLuint program;
-        bool result = true;
-        int n_shaders;
         int i, j;
 
-        for (n_shaders = 0; n_shaders < FV_N_ELEMENTS(shaders); n_shaders++) {
-                shader = fv_shader_data_shaders + n_shaders;
-                shaders[n_shaders] =
-                        create_shader_from_files(shader->type,
-                                                 shader->filenames);
-                if (shaders[n_shaders] == 0) {
-                        result = false;
-                        goto out;
-                }
+        /* Everything is submitted to GL without querying the status
+         * of anything so that the driver can compile in the
+         * background, possibly with multiple threads, while the rest
+         * of the game is loading */
+
+        for (i = 0; i < FV_N_ELEMENTS(fv_shader_data_shaders); i++) {
+                shader = fv_shader_data_shaders + i;
+
+                if (!shader_is_needed(shader, pending->uncached_programs))
+                        continue;
+
+                pending->shaders[i] = create_shader(shader->type,
+                                                    prefix,
+                                                    sources + i);
         }
 
-        for (i = 0; i < FV_SHADER_DATA_N_PROGRAMS; i++)
-                data->programs[i] = fv_gl.glCreateProgram();
+        for (i = 0; i < FV_SHADER_DATA_N_PROGRAMS; i++) {
+                if (pending->uncached_programs & (1 << i))
+                        data->programs[i] = fv_gl.glCreateProgram();
+        }
+
+        for (i = 0; i < FV_N_ELEMENTS(fv_shader_data_shaders); i++) {
+                if (pending->shaders[i] == 0)
+                        continue;
 
-        for (i = 0; i < FV_N_ELEMENTS(shaders); i++) {
                 shader = fv_shader_data_shaders + i;
+
                 for (j = 0; shader->programs[j] != PROGRAMS_END; j++) {
+                        if (!(pending->uncached_programs &
+                              (1 << shader->programs[j])))
+                                continue;
                         program = data->programs[shader->programs[j]];
-                        fv_gl.glAttachShader(program, shaders[i]);
+                        fv_gl.glAttachShader(program, pending->shaders[i]);
+                }
+        }
+
+        for (i = 0; i < FV_SHADER_DATA_N_PROGRAMS; i++) {
+                if (pending->uncached_programs & (1 << i))
+                        link_program(data->programs[i]);
+        }
+}
+
+static void
+free_pending(struct fv_shader_data *data)
+{
+        struct fv_shader_data_pending *pending = data->pending;
+        int i;
+
+        if (pending == NULL)
+                return;
+
+        for (i = 0; i < FV_N_ELEMENTS(pending->shaders); i++) {
+                if (pending->shaders[i])
+                        fv_gl.glDeleteShader(pending->shaders[i]);
+        }
+
+        fv_free(pending);
+        data->pending = NULL;
+}
+
+static void
+delete_programs(struct fv_shader_data *data)
+{
+        int i;
+
+        for (i = 0; i < FV_SHADER_DATA_N_PROGRAMS; i++) {
+                if (data->programs[i]) {
+                        fv_gl_delete_program(data->programs[i]);
+                        data->programs[i] = 0;
                 }
         }
+}
+
+bool
+fv_shader_data_init(struct fv_shader_data *data)
+{
+        struct fv_buffer sources[FV_N_ELEMENTS(fv_shader_data_shaders)];
+        struct fv_buffer prefix = FV_BUFFER_STATIC_INIT;
+        struct fv_shader_data_pending *pending;
+        char cache_name[16];
+        bool result = true;
+        int i;
+
+        for (i = 0; i < FV_N_ELEMENTS(sources); i++)
+                fv_buffer_init(sources + i);
+
+        memset(data->programs, 0, sizeof data->programs);
+        data->n_cached_programs = 0;
+
+        pending = fv_calloc(sizeof *pending);
+        data->pending = pending;
+
+        get_prefix(&prefix);
 
-        if (!link_programs(data)) {
-                for (i = 0; i < FV_SHADER_DATA_N_PROGRAMS; i++)
-                        fv_gl.glDeleteProgram(data->programs[i]);
+        if (!load_sources(sources)) {
+                free_pending(data);
                 result = false;
+                goto out;
         }
 
+        /* Try to get each program from the binary cache first so
+         * that we only need to compile the shaders for the ones that
+         * are missing */
+        for (i = 0; i < FV_SHADER_DATA_N_PROGRAMS; i++) {
+                pending->keys[i] = get_program_key(&prefix, sources, i);
+                get_cache_name(i, cache_name, sizeof cache_name);
+                data->programs[i] = fv_shader_cache_load(cache_name,
+                                                         pending->keys[i]);
+
+                if (data->programs[i])
+                        data->n_cached_programs++;
+                else
+                        pending->uncached_programs |= 1 << i;
+        }
+
+        if (pending->uncached_programs)
+                submit_programs(data, &prefix, sources);
+        else
+                free_pending(data);
+
 out:
-        for (i = 0; i < n_shaders; i++)
-                fv_gl.glDeleteShader(shaders[i]);
+        for (i = 0; i < FV_N_ELEMENTS(sources); i++)
+                fv_buffer_destroy(sources + i);
+
+        fv_buffer_destroy(&prefix);
 
         return result;
 }
 
-void
-fv_shader_data_destroy(struct fv_shader_data *data)
+/* The shared files such as fv-lighting.glsl come first so the last
+ * file is the one that identifies the shader */
+static const char *
+get_shader_name(const struct fv_shader_data_shader *shader)
+{
+        int n_files = 0;
+
+        while (shader->filenames[n_files])
+                n_files++;
+
+        return shader->filenames[n_files - 1];
+}
+
+bool
+fv_shader_data_finish(struct fv_shader_data *data)
 {
+        struct fv_shader_data_pending *pending = data->pending;
+        const struct fv_shader_data_shader *shader;
+        char cache_name[16];
+        bool result = true;
         int i;
 
-        for (i = 0; i < FV_SHADER_DATA_N_PROGRAMS; i++)
-                fv_gl.glDeleteProgram(data->programs[i]);
+        if (pending == NULL)
+                return true;
+
+        /* This is the first time the status of anything is queried
+         * so it will block until the driver has finished */
+
+        for (i = 0; i < FV_N_ELEMENTS(fv_shader_data_shaders); i++) {
+                shader = fv_shader_data_shaders + i;
+
+                if (pending->shaders[i] &&
+                    !check_shader(get_shader_name(shader),
+                                  pending->shaders[i])) {
+                        result = false;
+                        goto out;
+                }
+        }
+
+        for (i = 0; i < FV_SHADER_DATA_N_PROGRAMS; i++) {
+                if (!(pending->uncached_programs & (1 << i)))
+                        continue;
+
+                if (!check_program(data->programs[i], i)) {
+                        result = false;
+                        goto out;
+                }
+
+                get_cache_name(i, cache_name, sizeof cache_name);
+                fv_shader_cache_save(data->programs[i],
+                                     cache_name,
+                                     pending->keys[i]);
+        }
+
+out:
+        free_pending(data);
+
+        if (!result)
+                delete_programs(data);
+
+        return result;
+}
+
+void
+fv_shader_data_destroy(struct fv_shader_data *data)
+{
+        free_pending(data);
+        delete_programs(data);
 }
@@ -30,6 +30,7 @@ enum fv_shader_data_program {
         FV_SHADER_DATA_PROGRAM_SPECIAL_TEXTURE,
         FV_SHADER_DATA_PROGRAM_TEXTURE,
         FV_SHADER_DATA_PROGRAM_MAP,
+        FV_SHADER_DATA_PROGRAM_MAP_BLOCKS,
         FV_SHADER_DATA_N_PROGRAMS
 };
 
@@ -40,13 +41,34 @@ enum fv_shader_data_attrib {
         FV_SHADER_DATA_ATTRIB_COLOR
 };
 
+struct fv_shader_data_pending;
+
 struct fv_shader_data {
         GLuint programs[FV_SHADER_DATA_N_PROGRAMS];
+
+        /* State for the programs that are still being compiled or
+         * NULL if fv_shader_data_finish has been called */
+        struct fv_shader_data_pending *pending;
+
+        /* Number of programs that were loaded from the binary cache
+         * instead of being compiled */
+        int n_cached_programs;
 };
 
+/* Starts compiling all of the programs. This doesn't wait for the
+ * compilation to complete so the programs can not be used until
+ * fv_shader_data_finish is called.
+ */
 bool
 fv_shader_data_init(struct fv_shader_data *data);
 
+/* Waits for the compilation started by fv_shader_data_init and checks
+ * the result. If it fails then the programs are deleted but
+ * fv_shader_data_destroy still needs to be called.
+ */
+bool
+fv_shader_data_finish(struct fv_shader_data *data);
+
 void
 fv_shader_data_destroy(struct fv_shader_data *data);
 
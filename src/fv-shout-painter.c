@@ -52,7 +52,7 @@ load_texture(struct fv_shout_painter *painter,
              struct fv_image_data *image_data)
 {
         fv_gl.glGenTextures(1, &painter->texture);
-        fv_gl.glBindTexture(GL_TEXTURE_2D, painter->texture);
+        fv_gl_bind_texture(GL_TEXTURE_2D, painter->texture);
 
         fv_image_data_set_2d(image_data,
                              GL_TEXTURE_2D,
@@ -83,7 +83,7 @@ make_buffer(struct fv_shout_painter *painter)
         painter->array = fv_array_object_new();
 
         fv_gl.glGenBuffers(1, &painter->vertex_buffer);
-        fv_gl.glBindBuffer(GL_ARRAY_BUFFER, painter->vertex_buffer);
+        fv_gl_bind_buffer(GL_ARRAY_BUFFER, painter->vertex_buffer);
         fv_gl.glBufferData(GL_ARRAY_BUFFER,
                            sizeof (vertex) * FV_LOGIC_MAX_PLAYERS * 3,
                            NULL,
@@ -125,7 +125,7 @@ fv_shout_painter_new(struct fv_image_data *image_data,
         make_buffer(painter);
 
         tex_uniform = fv_gl.glGetUniformLocation(painter->program, "tex");
-        fv_gl.glUseProgram(painter->program);
+        fv_gl_use_program(painter->program);
         fv_gl.glUniform1i(tex_uniform, 0);
 
         painter->transform_uniform =
@@ -150,8 +150,8 @@ paint_cb(const struct fv_logic_shout *shout,
         float cx, cy, ccx, ccy;
 
         if (data->n_shouts == 0) {
-                fv_gl.glBindBuffer(GL_ARRAY_BUFFER,
-                                   painter->vertex_buffer);
+                fv_gl_bind_buffer(GL_ARRAY_BUFFER,
+                                  painter->vertex_buffer);
                 data->buffer_map =
                         fv_map_buffer_map(GL_ARRAY_BUFFER,
                                           FV_LOGIC_MAX_PLAYERS *
@@ -211,24 +211,24 @@ fv_shout_painter_paint(struct fv_shout_painter *painter,
                             data.n_shouts * 3);
         fv_map_buffer_unmap();
 
-        fv_gl.glUseProgram(painter->program);
+        fv_gl_use_program(painter->program);
         fv_gl.glUniformMatrix4fv(painter->transform_uniform,
                                  1, /* count */
                                  GL_FALSE, /* transpose */
                                  &paint_state->transform.mvp.xx);
         fv_array_object_bind(painter->array);
-        fv_gl.glBindTexture(GL_TEXTURE_2D, painter->texture);
-        fv_gl.glEnable(GL_BLEND);
+        fv_gl_bind_texture(GL_TEXTURE_2D, painter->texture);
+        fv_gl_enable(GL_BLEND);
         fv_gl.glDrawArrays(GL_TRIANGLES, 0, data.n_shouts * 3);
-        fv_gl.glDisable(GL_BLEND);
+        fv_gl_disable(GL_BLEND);
 }
 
 void
 fv_shout_painter_free(struct fv_shout_painter *painter)
 {
         fv_array_object_free(painter->array);
-        fv_gl.glDeleteBuffers(1, &painter->vertex_buffer);
-        fv_gl.glDeleteTextures(1, &painter->texture);
+        fv_gl_delete_buffers(1, &painter->vertex_buffer);
+        fv_gl_delete_textures(1, &painter->texture);
 
         fv_free(painter);
 }
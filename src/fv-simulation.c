@@ -0,0 +1,549 @@
+/*
+ * Finvenkisto
+ *
+ * Copyright (C) 2026 Neil Roberts
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <SDL.h>
+#include <string.h>
+
+#include "fv-simulation.h"
+#include "fv-map.h"
+#include "fv-util.h"
+
+/* Time between updates of the logic in milliseconds */
+#define FV_SIMULATION_TICK_TIME 8
+
+/* Maximum number of commands waiting for the simulation thread. This
+ * must be a power of two. */
+#define FV_SIMULATION_QUEUE_SIZE 64
+
+#define FV_SIMULATION_N_SNAPSHOTS 3
+
+/* Maximum time in microseconds that fetching the state will wait for
+ * the simulation thread to apply the commands that were already
+ * queued so that the frame can show the latest input */
+#define FV_SIMULATION_MAX_LATCH_WAIT 1000
+
+/* Set in the index of the middle snapshot when it has been published
+ * but not yet taken by the main thread */
+#define FV_SIMULATION_FRESH_BIT 0x4
+#define FV_SIMULATION_INDEX_MASK 0x3
+
+enum command_type {
+        COMMAND_TYPE_RESET,
+        COMMAND_TYPE_SET_DIRECTION,
+        COMMAND_TYPE_SHOUT
+};
+
+struct command {
+        enum command_type type;
+        /* The number of players for the reset command */
+        int player_num;
+        float speed;
+        float direction;
+        /* SDL_GetTicks time when the input happened */
+        Uint32 timestamp;
+};
+
+struct snapshot {
+        struct fv_logic *logic;
+        unsigned int serial;
+        /* The start_ticks of the simulation when the snapshot was
+         * taken */
+        Uint32 start_ticks;
+        /* The position of the queue head when the snapshot was
+         * taken, ie, the number of commands that it includes */
+        int n_commands;
+};
+
+struct fv_simulation {
+        /* The logic is only touched by the simulation thread or by
+         * the main thread if there is no simulation thread */
+        struct fv_logic *logic;
+        /* SDL_GetTicks when the logic was last reset */
+        Uint32 start_ticks;
+        /* SDL_GetTicks time that the logic was last updated to */
+        Uint32 last_update;
+        /* Incremented whenever anything visible changes */
+        unsigned int serial;
+
+        /* The snapshots form a triple buffer. The simulation thread
+         * writes to the back snapshot and then atomically swaps it
+         * with the middle one. The main thread swaps the front one
+         * with the middle one when it wants a newer state. That way
+         * neither thread ever has to wait for the other. */
+        struct snapshot snapshots[FV_SIMULATION_N_SNAPSHOTS];
+        int back_snapshot;
+        int front_snapshot;
+        SDL_atomic_t middle_snapshot;
+        /* Whether the front snapshot included all of the commands
+         * queued when it was fetched */
+        bool up_to_date;
+
+        /* Single-producer single-consumer ring buffer of commands
+         * from the main thread. The head is only written by the
+         * simulation thread and the tail by the main thread. */
+        struct command queue[FV_SIMULATION_QUEUE_SIZE];
+        SDL_atomic_t queue_head;
+        SDL_atomic_t queue_tail;
+
+        /* Posted whenever a command is queued or the thread should
+         * quit so that the thread doesn't have to wait until the
+         * next tick */
+        SDL_sem *wakeup;
+        /* Set by the main thread while it is waiting for a snapshot
+         * that includes all of the queued commands. The simulation
+         * thread clears it and posts the semaphore when it publishes
+         * a snapshot. */
+        SDL_atomic_t latch_waiting;
+        SDL_sem *published;
+        SDL_atomic_t quit;
+        SDL_Thread *thread;
+
+        /* Set when the changed event has been pushed and cleared
+         * when the main thread fetches the state */
+        Uint32 changed_event;
+        SDL_atomic_t event_pending;
+};
+
+static bool
+pop_command(struct fv_simulation *simulation,
+            struct command *command)
+{
+        int head = SDL_AtomicGet(&simulation->queue_head);
+
+        if (head == SDL_AtomicGet(&simulation->queue_tail))
+                return false;
+
+        /* Make sure the command is read after seeing the tail */
+        SDL_MemoryBarrierAcquire();
+
+        *command = simulation->queue[head & (FV_SIMULATION_QUEUE_SIZE - 1)];
+
+        /* Make sure the command has been read before the main thread
+         * can reuse its space */
+        SDL_MemoryBarrierRelease();
+
+        SDL_AtomicSet(&simulation->queue_head, head + 1);
+
+        return true;
+}
+
+static bool
+update_logic(struct fv_simulation *simulation,
+             Uint32 time)
+{
+        simulation->last_update = time;
+
+        return fv_logic_update(simulation->logic,
+                               time - simulation->start_ticks);
+}
+
+/* late is how many milliseconds the logic had already been updated
+ * past the time that the input happened */
+static void
+apply_command(struct fv_simulation *simulation,
+              const struct command *command,
+              Uint32 time,
+              Uint32 late)
+{
+        switch (command->type) {
+        case COMMAND_TYPE_RESET:
+                simulation->start_ticks = time;
+                simulation->last_update = time;
+                fv_logic_reset(simulation->logic, command->player_num);
+                break;
+        case COMMAND_TYPE_SET_DIRECTION:
+                fv_logic_set_direction(simulation->logic,
+                                       command->player_num,
+                                       command->speed,
+                                       command->direction,
+                                       late / 1000.0f);
+                break;
+        case COMMAND_TYPE_SHOUT:
+                fv_logic_shout(simulation->logic, command->player_num);
+                break;
+        }
+}
+
+static void
+publish_snapshot(struct fv_simulation *simulation)
+{
+        struct snapshot *snapshot =
+                simulation->snapshots + simulation->back_snapshot;
+        int old_middle;
+
+        fv_logic_copy(snapshot->logic, simulation->logic);
+        snapshot->serial = simulation->serial;
+        snapshot->start_ticks = simulation->start_ticks;
+        snapshot->n_commands = SDL_AtomicGet(&simulation->queue_head);
+
+        /* Make sure the snapshot is written before it is published */
+        SDL_MemoryBarrierRelease();
+
+        old_middle = SDL_AtomicSet(&simulation->middle_snapshot,
+                                   simulation->back_snapshot |
+                                   FV_SIMULATION_FRESH_BIT);
+
+        simulation->back_snapshot = old_middle & FV_SIMULATION_INDEX_MASK;
+}
+
+static void
+run_tick(struct fv_simulation *simulation)
+{
+        struct command command;
+        Uint32 now = SDL_GetTicks();
+        Uint32 time, late;
+        bool changed = false;
+
+        /* The logic checks the walls of the map which the main
+         * thread might be modifying */
+        fv_map_lock_read();
+
+        while (pop_command(simulation, &command)) {
+                /* The logic is moved up to the time that the input
+                 * actually happened before applying the command so
+                 * that a change of direction takes effect part way
+                 * through the tick instead of at the start of the
+                 * next one. The events are usually only handled once
+                 * per frame so the logic has often already gone past
+                 * that time. In that case the command is applied now
+                 * and the logic corrects the position for the time
+                 * that was missed. The logic can't move a player
+                 * back past its last update so the correction never
+                 * covers more than about one tick. The late time is
+                 * limited to that as well so that a stale timestamp
+                 * can't cause a big jump. */
+                time = command.timestamp;
+                late = 0;
+                if ((Sint32) (time - simulation->last_update) < 0) {
+                        late = MIN(simulation->last_update - time,
+                                   FV_SIMULATION_TICK_TIME);
+                        time = simulation->last_update;
+                }
+                if ((Sint32) (time - now) > 0)
+                        time = now;
+
+                if (update_logic(simulation, time))
+                        changed = true;
+
+                apply_command(simulation, &command, time, late);
+                changed = true;
+        }
+
+        if (update_logic(simulation, now))
+                changed = true;
+
+        fv_map_unlock_read();
+
+        /* Every command counts as a change so the snapshot that is
+         * already published includes all of the commands unless
+         * something changed */
+        if (!changed)
+                return;
+
+        simulation->serial++;
+
+        publish_snapshot(simulation);
+
+        if (SDL_AtomicCAS(&simulation->latch_waiting, 1, 0))
+                SDL_SemPost(simulation->published);
+
+        if (SDL_AtomicCAS(&simulation->event_pending, 0, 1)) {
+                SDL_Event event;
+
+                memset(&event, 0, sizeof event);
+                event.type = simulation->changed_event;
+                SDL_PushEvent(&event);
+        }
+}
+
+static int
+simulation_thread(void *user_data)
+{
+        struct fv_simulation *simulation = user_data;
+        Uint32 next_tick = SDL_GetTicks();
+        Uint32 now;
+
+        while (!SDL_AtomicGet(&simulation->quit)) {
+                run_tick(simulation);
+
+                /* If nothing is moving, for example before the game
+                 * starts or after it ends, there's no need to tick
+                 * until a command arrives */
+                if (!fv_logic_is_moving(simulation->logic)) {
+                        SDL_SemWait(simulation->wakeup);
+                        continue;
+                }
+
+                now = SDL_GetTicks();
+
+                /* Commands wake up the thread early so that they are
+                 * applied straight away but the regular ticks stay
+                 * on the same schedule. If the thread has fallen
+                 * behind it starts again from now rather than trying
+                 * to catch up. */
+                if ((Sint32) (next_tick - now) <= 0)
+                        next_tick = now + FV_SIMULATION_TICK_TIME;
+
+                SDL_SemWaitTimeout(simulation->wakeup, next_tick - now);
+        }
+
+        return 0;
+}
+
+static void
+push_command(struct fv_simulation *simulation,
+             const struct command *command)
+{
+        int tail = SDL_AtomicGet(&simulation->queue_tail);
+
+        /* If the queue is full then the simulation has fallen a long
+         * way behind. It's better to wait for it than to lose the
+         * command. */
+        while (tail - SDL_AtomicGet(&simulation->queue_head) >=
+               FV_SIMULATION_QUEUE_SIZE) {
+                if (simulation->thread)
+                        SDL_Delay(1);
+                else
+                        run_tick(simulation);
+        }
+
+        /* Make sure the simulation thread has finished reading the
+         * old command in this space before overwriting it */
+        SDL_MemoryBarrierAcquire();
+
+        simulation->queue[tail & (FV_SIMULATION_QUEUE_SIZE - 1)] = *command;
+
+        /* Make sure the command is written before it is published */
+        SDL_MemoryBarrierRelease();
+
+        SDL_AtomicSet(&simulation->queue_tail, tail + 1);
+
+        if (simulation->thread)
+                SDL_SemPost(simulation->wakeup);
+}
+
+struct fv_simulation *
+fv_simulation_new(uint32_t changed_event)
+{
+        struct fv_simulation *simulation = fv_alloc(sizeof *simulation);
+        int i;
+
+        simulation->logic = fv_logic_new();
+        simulation->start_ticks = SDL_GetTicks();
+        simulation->last_update = simulation->start_ticks;
+        simulation->serial = 0;
+
+        for (i = 0; i < FV_SIMULATION_N_SNAPSHOTS; i++) {
+                simulation->snapshots[i].logic = fv_logic_new();
+                simulation->snapshots[i].serial = 0;
+                simulation->snapshots[i].start_ticks =
+                        simulation->start_ticks;
+                simulation->snapshots[i].n_commands = 0;
+        }
+
+        simulation->front_snapshot = 0;
+        simulation->back_snapshot = 1;
+        SDL_AtomicSet(&simulation->middle_snapshot, 2);
+        simulation->up_to_date = true;
+
+        SDL_AtomicSet(&simulation->queue_head, 0);
+        SDL_AtomicSet(&simulation->queue_tail, 0);
+        SDL_AtomicSet(&simulation->quit, 0);
+
+        simulation->changed_event = changed_event;
+        SDL_AtomicSet(&simulation->event_pending, 0);
+
+        SDL_AtomicSet(&simulation->latch_waiting, 0);
+
+        simulation->thread = NULL;
+        simulation->wakeup = SDL_CreateSemaphore(0);
+        simulation->published = SDL_CreateSemaphore(0);
+
+        /* If the thread can't be created then the logic is updated
+         * on the main thread when the state is fetched */
+        if (simulation->wakeup && simulation->published) {
+                simulation->thread = SDL_CreateThread(simulation_thread,
+                                                       "fv-simulation",
+                                                       simulation);
+        }
+
+        return simulation;
+}
+
+void
+fv_simulation_reset(struct fv_simulation *simulation,
+                    int n_players)
+{
+        struct command command;
+
+        command.type = COMMAND_TYPE_RESET;
+        command.player_num = n_players;
+        command.timestamp = SDL_GetTicks();
+
+        push_command(simulation, &command);
+}
+
+void
+fv_simulation_set_direction(struct fv_simulation *simulation,
+                            int player_num,
+                            float speed,
+                            float direction,
+                            uint32_t timestamp)
+{
+        struct command command;
+
+        command.type = COMMAND_TYPE_SET_DIRECTION;
+        command.player_num = player_num;
+        command.speed = speed;
+        command.direction = direction;
+        command.timestamp = timestamp;
+
+        push_command(simulation, &command);
+}
+
+void
+fv_simulation_shout(struct fv_simulation *simulation,
+                    int player_num,
+                    uint32_t timestamp)
+{
+        struct command command;
+
+        command.type = COMMAND_TYPE_SHOUT;
+        command.player_num = player_num;
+        command.timestamp = timestamp;
+
+        push_command(simulation, &command);
+}
+
+static void
+take_middle_snapshot(struct fv_simulation *simulation)
+{
+        int old_middle;
+
+        if (!(SDL_AtomicGet(&simulation->middle_snapshot) &
+              FV_SIMULATION_FRESH_BIT))
+                return;
+
+        old_middle = SDL_AtomicSet(&simulation->middle_snapshot,
+                                   simulation->front_snapshot);
+        simulation->front_snapshot = old_middle & FV_SIMULATION_INDEX_MASK;
+
+        /* Make sure the snapshot is read after taking it */
+        SDL_MemoryBarrierAcquire();
+}
+
+struct fv_logic *
+fv_simulation_get_logic(struct fv_simulation *simulation,
+                        unsigned int *serial)
+{
+        struct snapshot *snapshot;
+        int tail = SDL_AtomicGet(&simulation->queue_tail);
+        Uint64 deadline, now;
+
+        /* Any changes after this point will need another event */
+        SDL_AtomicSet(&simulation->event_pending, 0);
+
+        if (simulation->thread == NULL)
+                run_tick(simulation);
+
+        take_middle_snapshot(simulation);
+        snapshot = simulation->snapshots + simulation->front_snapshot;
+
+        /* The thread is woken up as soon as a command is queued so
+         * it usually only takes a few microseconds before the input
+         * that was just handled is included in a snapshot. It's worth
+         * waiting a little for it so that the frame doesn't lag one
+         * behind the input. */
+        if (snapshot->n_commands != tail) {
+                deadline = (SDL_GetPerformanceCounter() +
+                            SDL_GetPerformanceFrequency() *
+                            FV_SIMULATION_MAX_LATCH_WAIT / 1000000);
+
+                while (true) {
+                        /* The flag is set before checking for a new
+                         * snapshot so that one published in between
+                         * will still post the semaphore. A post left
+                         * over from a previous wait only causes an
+                         * extra check. */
+                        SDL_AtomicSet(&simulation->latch_waiting, 1);
+
+                        take_middle_snapshot(simulation);
+                        snapshot = (simulation->snapshots +
+                                    simulation->front_snapshot);
+
+                        now = SDL_GetPerformanceCounter();
+
+                        if (snapshot->n_commands == tail || now >= deadline)
+                                break;
+
+                        SDL_SemWaitTimeout(simulation->published,
+                                           (deadline - now) * 1000 /
+                                           SDL_GetPerformanceFrequency() +
+                                           1);
+                }
+
+                SDL_AtomicSet(&simulation->latch_waiting, 0);
+        }
+
+        simulation->up_to_date = snapshot->n_commands == tail;
+
+        /* After the game ends the only thing that changes is the
+         * clock, which the HUD uses to animate the fina venko. The
+         * thread stops publishing then so the clock of the copy is
+         * moved on here instead. */
+        if (fv_logic_get_state(snapshot->logic) == FV_LOGIC_STATE_FINA_VENKO)
+                fv_logic_update(snapshot->logic,
+                                SDL_GetTicks() - snapshot->start_ticks);
+
+        *serial = snapshot->serial;
+
+        return snapshot->logic;
+}
+
+bool
+fv_simulation_is_up_to_date(struct fv_simulation *simulation)
+{
+        return simulation->up_to_date;
+}
+
+void
+fv_simulation_free(struct fv_simulation *simulation)
+{
+        int i;
+
+        if (simulation->thread) {
+                SDL_AtomicSet(&simulation->quit, 1);
+                SDL_SemPost(simulation->wakeup);
+                SDL_WaitThread(simulation->thread, NULL);
+        }
+
+        if (simulation->wakeup)
+                SDL_DestroySemaphore(simulation->wakeup);
+        if (simulation->published)
+                SDL_DestroySemaphore(simulation->published);
+
+        for (i = 0; i < FV_SIMULATION_N_SNAPSHOTS; i++)
+                fv_logic_free(simulation->snapshots[i].logic);
+
+        fv_logic_free(simulation->logic);
+
+        fv_free(simulation);
+}
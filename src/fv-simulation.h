@@ -0,0 +1,79 @@
+/*
+ * Finvenkisto
+ *
+ * Copyright (C) 2026 Neil Roberts
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FV_SIMULATION_H
+#define FV_SIMULATION_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "fv-logic.h"
+
+/* Runs the game logic on a separate thread at a fixed rate so that it
+ * isn't held up by painting. The other functions must all be called
+ * from the same thread. The commands are queued and applied to the
+ * logic on the next tick. Each command has the SDL_GetTicks time that
+ * the input happened and the logic is advanced up to that time before
+ * applying it. If the logic has already gone past that time then a
+ * change of direction also corrects the position of the player for
+ * the time that was missed. If the thread can't be created then the
+ * logic is updated when the state is fetched instead. */
+
+/* An SDL event of the given type is pushed when anything visible
+ * changes. There is never more than one of these events waiting
+ * between calls to fv_simulation_get_logic. */
+struct fv_simulation *
+fv_simulation_new(uint32_t changed_event);
+
+void
+fv_simulation_reset(struct fv_simulation *simulation,
+                    int n_players);
+
+void
+fv_simulation_set_direction(struct fv_simulation *simulation,
+                            int player_num,
+                            float speed,
+                            float direction,
+                            uint32_t timestamp);
+
+void
+fv_simulation_shout(struct fv_simulation *simulation,
+                    int player_num,
+                    uint32_t timestamp);
+
+/* Returns a copy of the latest state of the logic. It stays valid
+ * until the next call. It must only be used to query the state and
+ * not to modify it. The serial number is changed whenever anything
+ * visible changed. If the latest state doesn't include all of the
+ * queued commands yet then this waits briefly for the simulation
+ * thread to catch up. */
+struct fv_logic *
+fv_simulation_get_logic(struct fv_simulation *simulation,
+                        unsigned int *serial);
+
+/* Returns whether the state returned by the last call to
+ * fv_simulation_get_logic included all of the commands that were
+ * queued before it */
+bool
+fv_simulation_is_up_to_date(struct fv_simulation *simulation);
+
+void
+fv_simulation_free(struct fv_simulation *simulation);
+
+#endif /* FV_SIMULATION_H */
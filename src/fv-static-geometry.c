@@ -0,0 +1,240 @@
+/*
+ * Finvenkisto
+ *
+ * Copyright (C) 2026 Neil Roberts
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <string.h>
+#include <assert.h>
+
+#include "fv-static-geometry.h"
+#include "fv-gl.h"
+#include "fv-util.h"
+#include "fv-buffer.h"
+
+struct fv_static_geometry_format {
+        struct fv_model_format_attribute
+        attributes[FV_MODEL_FORMAT_MAX_ATTRIBUTES];
+        int n_attributes;
+        int vertex_size;
+
+        GLuint vertices_buffer;
+        GLuint indices_buffer;
+        struct fv_array_object *array;
+
+        /* The data for all of the models added so far. This is
+         * uploaded in one go once all of the models are loaded and
+         * then freed.
+         */
+        struct fv_buffer vertices;
+        struct fv_buffer indices;
+
+        struct fv_static_geometry_format *next;
+};
+
+struct fv_static_geometry {
+        struct fv_static_geometry_format *formats;
+        bool uploaded;
+};
+
+struct fv_static_geometry *
+fv_static_geometry_new(void)
+{
+        struct fv_static_geometry *geometry = fv_alloc(sizeof *geometry);
+
+        geometry->formats = NULL;
+        geometry->uploaded = false;
+
+        return geometry;
+}
+
+static bool
+format_matches(const struct fv_static_geometry_format *format,
+               const struct fv_model_format_attribute *attributes,
+               int n_attributes,
+               int vertex_size)
+{
+        return (format->n_attributes == n_attributes &&
+                format->vertex_size == vertex_size &&
+                !memcmp(format->attributes,
+                        attributes,
+                        n_attributes * sizeof attributes[0]));
+}
+
+static struct fv_static_geometry_format *
+add_format(struct fv_static_geometry *geometry,
+           const struct fv_model_format_attribute *attributes,
+           int n_attributes,
+           int vertex_size)
+{
+        struct fv_static_geometry_format *format = fv_alloc(sizeof *format);
+        int i;
+
+        memcpy(format->attributes,
+               attributes,
+               n_attributes * sizeof attributes[0]);
+        format->n_attributes = n_attributes;
+        format->vertex_size = vertex_size;
+
+        fv_buffer_init(&format->vertices);
+        fv_buffer_init(&format->indices);
+
+        format->array = fv_array_object_new();
+
+        fv_gl.glGenBuffers(1, &format->vertices_buffer);
+
+        for (i = 0; i < n_attributes; i++) {
+                fv_array_object_set_attribute(format->array,
+                                              attributes[i].index,
+                                              attributes[i].n_components,
+                                              attributes[i].type,
+                                              attributes[i].normalized,
+                                              vertex_size,
+                                              0, /* divisor */
+                                              format->vertices_buffer,
+                                              attributes[i].offset);
+        }
+
+        fv_gl.glGenBuffers(1, &format->indices_buffer);
+        fv_array_object_set_element_buffer(format->array,
+                                           format->indices_buffer);
+
+        format->next = geometry->formats;
+        geometry->formats = format;
+
+        return format;
+}
+
+static struct fv_static_geometry_format *
+find_format(struct fv_static_geometry *geometry,
+            const struct fv_model_format_attribute *attributes,
+            int n_attributes,
+            int vertex_size,
+            int n_vertices)
+{
+        struct fv_static_geometry_format *format;
+        int format_n_vertices;
+
+        for (format = geometry->formats; format; format = format->next) {
+                if (!format_matches(format,
+                                    attributes,
+                                    n_attributes,
+                                    vertex_size))
+                        continue;
+
+                /* Without base vertex drawing the offset indices
+                 * have to fit in a uint16_t */
+                format_n_vertices = format->vertices.length / vertex_size;
+                if (!fv_gl.have_draw_elements_base_vertex &&
+                    format_n_vertices + n_vertices > UINT16_MAX + 1)
+                        continue;
+
+                return format;
+        }
+
+        return add_format(geometry, attributes, n_attributes, vertex_size);
+}
+
+void
+fv_static_geometry_add(struct fv_static_geometry *geometry,
+                       const struct fv_model_format_attribute *attributes,
+                       int n_attributes,
+                       int vertex_size,
+                       const void *vertices,
+                       int n_vertices,
+                       const uint16_t *indices,
+                       int n_indices,
+                       struct fv_static_geometry_range *range)
+{
+        struct fv_static_geometry_format *format;
+        uint16_t *format_indices;
+        int i;
+
+        assert(!geometry->uploaded);
+
+        format = find_format(geometry,
+                             attributes,
+                             n_attributes,
+                             vertex_size,
+                             n_vertices);
+
+        range->array = format->array;
+        range->first_vertex = format->vertices.length / vertex_size;
+        range->first_index = format->indices.length / sizeof (uint16_t);
+
+        fv_buffer_append(&format->vertices,
+                         vertices,
+                         n_vertices * vertex_size);
+        fv_buffer_append(&format->indices,
+                         indices,
+                         n_indices * sizeof (uint16_t));
+
+        if (!fv_gl.have_draw_elements_base_vertex) {
+                format_indices = ((uint16_t *) format->indices.data +
+                                  range->first_index);
+                for (i = 0; i < n_indices; i++)
+                        format_indices[i] += range->first_vertex;
+        }
+}
+
+void
+fv_static_geometry_upload(struct fv_static_geometry *geometry)
+{
+        struct fv_static_geometry_format *format;
+
+        for (format = geometry->formats; format; format = format->next) {
+                fv_gl_bind_buffer(GL_ARRAY_BUFFER, format->vertices_buffer);
+                fv_gl.glBufferData(GL_ARRAY_BUFFER,
+                                   format->vertices.length,
+                                   format->vertices.data,
+                                   GL_STATIC_DRAW);
+
+                fv_array_object_set_element_buffer(format->array,
+                                                   format->indices_buffer);
+                fv_gl.glBufferData(GL_ELEMENT_ARRAY_BUFFER,
+                                   format->indices.length,
+                                   format->indices.data,
+                                   GL_STATIC_DRAW);
+
+                fv_buffer_destroy(&format->vertices);
+                fv_buffer_init(&format->vertices);
+                fv_buffer_destroy(&format->indices);
+                fv_buffer_init(&format->indices);
+        }
+
+        geometry->uploaded = true;
+}
+
+void
+fv_static_geometry_free(struct fv_static_geometry *geometry)
+{
+        struct fv_static_geometry_format *format, *next;
+
+        for (format = geometry->formats; format; format = next) {
+                next = format->next;
+
+                fv_array_object_free(format->array);
+                fv_gl_delete_buffers(1, &format->vertices_buffer);
+                fv_gl_delete_buffers(1, &format->indices_buffer);
+                fv_buffer_destroy(&format->vertices);
+                fv_buffer_destroy(&format->indices);
+                fv_free(format);
+        }
+
+        fv_free(geometry);
+}
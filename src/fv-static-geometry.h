@@ -0,0 +1,74 @@
+/*
+ * Finvenkisto
+ *
+ * Copyright (C) 2026 Neil Roberts
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FV_STATIC_GEOMETRY_H
+#define FV_STATIC_GEOMETRY_H
+
+#include <stdint.h>
+#include <GL/gl.h>
+
+#include "fv-array-object.h"
+#include "fv-model-format.h"
+
+/* Packs the vertices and indices of all of the static models into
+ * one big vertex buffer and index buffer for each vertex format.
+ * Each format has a single array object so the painters can draw
+ * several models without changing the vertex state. If base vertex
+ * drawing is available then the indices are kept relative to the
+ * first vertex of each model. Otherwise they are offset as they are
+ * added and a new buffer is started whenever a format runs out of
+ * 16-bit indices.
+ */
+
+struct fv_static_geometry;
+
+/* Where a mesh ended up after being added */
+struct fv_static_geometry_range {
+        struct fv_array_object *array;
+        /* Index of the mesh’s first vertex in the shared buffer */
+        int first_vertex;
+        /* Index of the mesh’s first index in the shared buffer */
+        int first_index;
+};
+
+struct fv_static_geometry *
+fv_static_geometry_new(void);
+
+void
+fv_static_geometry_add(struct fv_static_geometry *geometry,
+                       const struct fv_model_format_attribute *attributes,
+                       int n_attributes,
+                       int vertex_size,
+                       const void *vertices,
+                       int n_vertices,
+                       const uint16_t *indices,
+                       int n_indices,
+                       struct fv_static_geometry_range *range);
+
+/* Uploads all of the models that have been added in a single
+ * glBufferData for each buffer and frees the copies of the data.
+ * This must be called before painting and no more models can be
+ * added afterwards. */
+void
+fv_static_geometry_upload(struct fv_static_geometry *geometry);
+
+void
+fv_static_geometry_free(struct fv_static_geometry *geometry);
+
+#endif /* FV_STATIC_GEOMETRY_H */
@@ -0,0 +1,762 @@
+/*
+ * Finvenkisto
+ *
+ * Copyright (C) 2026 Neil Roberts
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Converts a PLY model into the .fvm format described in
+ * fv-model-format.h. This is based on the rply convert tool and is
+ * run at build time so that the game doesn't need to parse the PLY
+ * files. The mesh is also optimized for the vertex caches and the
+ * average cache miss ratio (ACMR) before and after is reported.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <math.h>
+
+#include "rply.h"
+#include "fv-model-properties.h"
+#include "fv-model-format.h"
+#include "optimize-mesh.h"
+#include "simplify-mesh.h"
+
+/* Each level of detail aims to have this fraction of the triangles
+ * of the previous one */
+#define LOD_REDUCTION 0.5f
+
+/* If the simplification can’t get rid of at least this fraction of
+ * the triangles then no more levels are generated */
+#define LOD_MIN_REDUCTION 0.1f
+
+struct data {
+        const char *filename;
+
+        int n_vertices;
+        int n_components;
+        int n_got_components;
+        int vertex_size;
+        int available_props;
+        int property_offsets[FV_MODEL_N_PROPERTIES];
+
+        uint8_t *vertices;
+        uint8_t *current_vertex;
+
+        uint16_t *indices;
+        int n_indices;
+        int indices_size;
+
+        int first_vertex;
+        int last_vertex;
+
+        int n_lods;
+        struct fv_model_format_lod lods[FV_MODEL_FORMAT_MAX_LODS];
+};
+
+/* prints an error message and exits */
+static void
+error(const char *fmt, ...)
+{
+        va_list ap;
+
+        va_start(ap, fmt);
+        vfprintf(stderr, fmt, ap);
+        va_end(ap);
+        fputc('\n', stderr);
+
+        exit(EXIT_FAILURE);
+}
+
+static void *
+xmalloc(size_t size)
+{
+        void *ret = malloc(size);
+
+        if (ret == NULL && size > 0)
+                error("Out of memory");
+
+        return ret;
+}
+
+static int
+vertex_read_cb(p_ply_argument argument)
+{
+        struct data *data;
+        long prop_comp_num;
+        int prop_num, comp_num;
+        uint8_t *prop;
+        double value;
+
+        ply_get_argument_user_data(argument, (void **) &data, &prop_comp_num);
+
+        prop_num = prop_comp_num >> 8;
+        comp_num = prop_comp_num & 0xff;
+
+        value = ply_get_argument_value(argument);
+
+        prop = data->current_vertex + data->property_offsets[prop_num];
+
+        switch (fv_model_properties[prop_num].type) {
+        case FV_MODEL_PROPERTY_FLOAT:
+                ((float *) prop)[comp_num] = value;
+                break;
+        case FV_MODEL_PROPERTY_BYTE:
+                ((uint8_t *) prop)[comp_num] = value;
+                break;
+        }
+
+        if (++data->n_got_components == data->n_components) {
+                data->current_vertex += data->vertex_size;
+                data->n_got_components = 0;
+        }
+
+        return 1;
+}
+
+static void
+add_index(struct data *data,
+          int value)
+{
+        if (data->n_indices >= data->indices_size) {
+                data->indices_size = data->indices_size * 2 + 64;
+                data->indices = realloc(data->indices,
+                                        data->indices_size *
+                                        sizeof (uint16_t));
+                if (data->indices == NULL)
+                        error("Out of memory");
+        }
+
+        data->indices[data->n_indices++] = value;
+}
+
+static int
+face_read_cb(p_ply_argument argument)
+{
+        struct data *data;
+        int32_t length, index;
+        long value;
+
+        ply_get_argument_user_data(argument, (void **) &data, NULL);
+        ply_get_argument_property(argument, NULL, &length, &index);
+
+        value = ply_get_argument_value(argument);
+
+        if (value < 0 || value >= data->n_vertices)
+                error("%s: index value out of range", data->filename);
+
+        /* Split the faces into triangles as if they were triangle
+         * fans */
+        if (index == 0) {
+                data->first_vertex = value;
+        } else if (index == 1) {
+                data->last_vertex = value;
+        } else if (index != -1) {
+                add_index(data, data->first_vertex);
+                add_index(data, data->last_vertex);
+                add_index(data, value);
+                data->last_vertex = value;
+        }
+
+        return 1;
+}
+
+static void
+set_callbacks(struct data *data,
+              p_ply ply)
+{
+        const struct fv_model_property *property;
+        const char *component;
+        long n_instances;
+        int prop, comp;
+
+        for (prop = 0; prop < FV_MODEL_N_PROPERTIES; prop++) {
+                property = fv_model_properties + prop;
+
+                for (comp = 0; comp < property->n_components; comp++) {
+                        component = property->components[comp];
+                        n_instances = ply_set_read_cb(ply,
+                                                      "vertex",
+                                                      component,
+                                                      vertex_read_cb,
+                                                      data,
+                                                      (prop << 8) | comp);
+                        if (n_instances == 0) {
+                                if (comp > 0) {
+                                        error("%s: Missing component ‘%s’",
+                                              data->filename,
+                                              component);
+                                }
+                                break;
+                        }
+
+                        if (n_instances > UINT16_MAX) {
+                                error("%s: Too many vertices to fit in a "
+                                      "uint16_t",
+                                      data->filename);
+                        }
+
+                        data->n_vertices = n_instances;
+                        data->n_components++;
+
+                        if (comp == 0) {
+                                data->property_offsets[prop] =
+                                        data->vertex_size;
+                                data->available_props |= 1 << prop;
+                        }
+
+                        switch (property->type) {
+                        case FV_MODEL_PROPERTY_FLOAT:
+                                data->vertex_size += sizeof (float);
+                                break;
+                        case FV_MODEL_PROPERTY_BYTE:
+                                data->vertex_size += sizeof (uint8_t);
+                                break;
+                        }
+                }
+        }
+
+        if (data->n_vertices == 0)
+                error("%s: No vertices found", data->filename);
+
+        if (ply_set_read_cb(ply,
+                            "face", "vertex_indices",
+                            face_read_cb,
+                            data, 0) == 0)
+                error("%s: No faces found", data->filename);
+
+        /* Align the vertex size to the size of a float */
+        data->vertex_size = ((data->vertex_size + sizeof (float) - 1) &
+                             ~(sizeof (float) - 1));
+}
+
+static uint32_t
+align(uint32_t value)
+{
+        return ((value + FV_MODEL_FORMAT_ALIGNMENT - 1) &
+                ~(uint32_t) (FV_MODEL_FORMAT_ALIGNMENT - 1));
+}
+
+static void
+write_padding(FILE *out,
+              long size)
+{
+        while (size-- > 0)
+                fputc(0, out);
+}
+
+static void
+get_bounding_box(const struct data *data,
+                 float *min,
+                 float *max)
+{
+        const float *position;
+        int i, j;
+
+        for (j = 0; j < 3; j++) {
+                min[j] = HUGE_VALF;
+                max[j] = -HUGE_VALF;
+        }
+
+        for (i = 0; i < data->n_vertices; i++) {
+                position = (const float *)
+                        (data->vertices +
+                         i * data->vertex_size +
+                         data->property_offsets[FV_MODEL_PROPERTY_POSITION]);
+
+                for (j = 0; j < 3; j++) {
+                        if (position[j] < min[j])
+                                min[j] = position[j];
+                        if (position[j] > max[j])
+                                max[j] = position[j];
+                }
+        }
+}
+
+static bool
+tex_coords_are_normalized(const struct data *data)
+{
+        const float *tex_coord;
+        int i;
+
+        for (i = 0; i < data->n_vertices; i++) {
+                tex_coord = (const float *)
+                        (data->vertices +
+                         i * data->vertex_size +
+                         data->property_offsets[FV_MODEL_PROPERTY_TEX_COORD]);
+
+                if (tex_coord[0] < 0.0f || tex_coord[0] > 1.0f ||
+                    tex_coord[1] < 0.0f || tex_coord[1] > 1.0f)
+                        return false;
+        }
+
+        return true;
+}
+
+static void
+add_attribute(struct fv_model_format_header *header,
+              const struct fv_model_property *property,
+              int n_components,
+              GLenum type,
+              bool normalized,
+              int size)
+{
+        struct fv_model_format_attribute *attribute =
+                header->attributes + header->n_attributes++;
+
+        attribute->index = property->attrib_location;
+        attribute->n_components = n_components;
+        attribute->type = type;
+        attribute->normalized = normalized;
+        attribute->offset = header->vertex_size;
+
+        /* Keep every attribute aligned to four bytes */
+        header->vertex_size += (size + 3) & ~3;
+}
+
+static void
+choose_layout(const struct data *data,
+              struct fv_model_format_header *header,
+              bool *quantize_tex_coords)
+{
+        const struct fv_model_property *property;
+        int i;
+
+        *quantize_tex_coords = false;
+
+        for (i = 0; i < FV_MODEL_N_PROPERTIES; i++) {
+                if (!(data->available_props & (1 << i)))
+                        continue;
+
+                property = fv_model_properties + i;
+
+                switch (i) {
+                case FV_MODEL_PROPERTY_POSITION:
+                        add_attribute(header, property,
+                                      3, GL_SHORT, true,
+                                      sizeof (int16_t) * 3);
+                        break;
+                case FV_MODEL_PROPERTY_TEX_COORD:
+                        *quantize_tex_coords = tex_coords_are_normalized(data);
+                        if (*quantize_tex_coords) {
+                                add_attribute(header, property,
+                                              2, GL_UNSIGNED_SHORT, true,
+                                              sizeof (uint16_t) * 2);
+                        } else {
+                                add_attribute(header, property,
+                                              2, GL_FLOAT, false,
+                                              sizeof (float) * 2);
+                        }
+                        break;
+                case FV_MODEL_PROPERTY_NORMAL:
+                        add_attribute(header, property,
+                                      4, GL_INT_2_10_10_10_REV, true,
+                                      sizeof (uint32_t));
+                        break;
+                default:
+                        add_attribute(header, property,
+                                      property->n_components,
+                                      fv_model_property_get_gl_type(property),
+                                      fv_model_property_is_normalized(property),
+                                      fv_model_property_get_size(property));
+                        break;
+                }
+        }
+}
+
+static int
+quantize_snorm(float value,
+               int bits)
+{
+        int max_value = (1 << (bits - 1)) - 1;
+
+        if (value < -1.0f)
+                value = -1.0f;
+        else if (value > 1.0f)
+                value = 1.0f;
+
+        return lroundf(value * max_value);
+}
+
+static uint16_t
+quantize_unorm16(float value)
+{
+        return lroundf(value * UINT16_MAX);
+}
+
+static uint32_t
+pack_normal(const float *normal)
+{
+        uint32_t packed = 0;
+        int i;
+
+        for (i = 0; i < 3; i++)
+                packed |= (quantize_snorm(normal[i], 10) & 0x3ff) << (i * 10);
+
+        return packed;
+}
+
+static void
+quantize_vertex(const struct data *data,
+                const struct fv_model_format_header *header,
+                bool quantize_tex_coords,
+                const uint8_t *in,
+                uint8_t *out)
+{
+        const struct fv_model_format_attribute *attribute;
+        const float *position, *tex_coord, *normal;
+        int16_t *out_position;
+        uint16_t *out_tex_coord;
+        uint32_t packed_normal;
+        int attribute_num = 0;
+        int i, j;
+
+        for (i = 0; i < FV_MODEL_N_PROPERTIES; i++) {
+                if (!(data->available_props & (1 << i)))
+                        continue;
+
+                attribute = header->attributes + attribute_num++;
+
+                switch (i) {
+                case FV_MODEL_PROPERTY_POSITION:
+                        position = (const float *)
+                                (in + data->property_offsets[i]);
+                        out_position = (int16_t *) (out + attribute->offset);
+                        for (j = 0; j < 3; j++) {
+                                out_position[j] = quantize_snorm(
+                                        (position[j] -
+                                         header->position_offset[j]) /
+                                        header->position_scale[j],
+                                        16);
+                        }
+                        break;
+                case FV_MODEL_PROPERTY_TEX_COORD:
+                        tex_coord = (const float *)
+                                (in + data->property_offsets[i]);
+                        if (quantize_tex_coords) {
+                                out_tex_coord = (uint16_t *)
+                                        (out + attribute->offset);
+                                for (j = 0; j < 2; j++) {
+                                        out_tex_coord[j] =
+                                                quantize_unorm16(tex_coord[j]);
+                                }
+                        } else {
+                                memcpy(out + attribute->offset,
+                                       tex_coord,
+                                       sizeof (float) * 2);
+                        }
+                        break;
+                case FV_MODEL_PROPERTY_NORMAL:
+                        normal = (const float *)
+                                (in + data->property_offsets[i]);
+                        packed_normal = pack_normal(normal);
+                        memcpy(out + attribute->offset,
+                               &packed_normal,
+                               sizeof packed_normal);
+                        break;
+                default:
+                        memcpy(out + attribute->offset,
+                               in + data->property_offsets[i],
+                               fv_model_property_get_size(fv_model_properties +
+                                                          i));
+                        break;
+                }
+        }
+}
+
+static uint8_t *
+quantize_model(const struct data *data,
+               struct fv_model_format_header *header)
+{
+        bool quantize_tex_coords;
+        float min[3], max[3];
+        uint8_t *vertices;
+        int i;
+
+        get_bounding_box(data, min, max);
+
+        for (i = 0; i < 3; i++) {
+                header->position_scale[i] = (max[i] - min[i]) / 2.0f;
+                header->position_offset[i] = (max[i] + min[i]) / 2.0f;
+
+                /* Avoid dividing by zero for flat models */
+                if (header->position_scale[i] <= 0.0f)
+                        header->position_scale[i] = 1.0f;
+        }
+
+        choose_layout(data, header, &quantize_tex_coords);
+
+        vertices = xmalloc(data->n_vertices * header->vertex_size);
+        memset(vertices, 0, data->n_vertices * header->vertex_size);
+
+        for (i = 0; i < data->n_vertices; i++) {
+                quantize_vertex(data,
+                                header,
+                                quantize_tex_coords,
+                                data->vertices + i * data->vertex_size,
+                                vertices + i * header->vertex_size);
+        }
+
+        return vertices;
+}
+
+static float
+get_attribute_distance(const uint8_t *vertex_a,
+                       const uint8_t *vertex_b,
+                       void *user_data)
+{
+        const struct data *data = user_data;
+        const float *a, *b;
+        float distance = 0.0f;
+        int offset;
+        int i;
+
+        if ((data->available_props & (1 << FV_MODEL_PROPERTY_TEX_COORD))) {
+                offset = data->property_offsets[FV_MODEL_PROPERTY_TEX_COORD];
+                a = (const float *) (vertex_a + offset);
+                b = (const float *) (vertex_b + offset);
+                distance += fabsf(a[0] - b[0]) + fabsf(a[1] - b[1]);
+        }
+
+        if ((data->available_props & (1 << FV_MODEL_PROPERTY_NORMAL))) {
+                offset = data->property_offsets[FV_MODEL_PROPERTY_NORMAL];
+                a = (const float *) (vertex_a + offset);
+                b = (const float *) (vertex_b + offset);
+                distance += 1.0f - (a[0] * b[0] + a[1] * b[1] + a[2] * b[2]);
+        }
+
+        if ((data->available_props & (1 << FV_MODEL_PROPERTY_COLOR))) {
+                offset = data->property_offsets[FV_MODEL_PROPERTY_COLOR];
+                for (i = 0; i < 3; i++) {
+                        distance += abs(vertex_a[offset + i] -
+                                        vertex_b[offset + i]) / 255.0f;
+                }
+        }
+
+        return distance;
+}
+
+/* Generates the extra levels of detail by simplifying the previous
+ * level. These are appended to the indices. */
+static void
+generate_lods(struct data *data)
+{
+        const struct fv_model_format_lod *last_lod;
+        uint16_t *lod_indices;
+        int target_n_indices;
+        int n_lod_indices;
+        int i;
+
+        lod_indices = xmalloc(data->n_indices * sizeof (uint16_t));
+
+        while (data->n_lods < FV_MODEL_FORMAT_MAX_LODS) {
+                last_lod = data->lods + data->n_lods - 1;
+                target_n_indices = last_lod->n_indices / 3 *
+                        LOD_REDUCTION * 3;
+
+                n_lod_indices = simplify_mesh(data->vertices,
+                                              data->n_vertices,
+                                              data->vertex_size,
+                                              data->property_offsets
+                                              [FV_MODEL_PROPERTY_POSITION],
+                                              get_attribute_distance,
+                                              data,
+                                              data->indices +
+                                              last_lod->first_index,
+                                              last_lod->n_indices,
+                                              target_n_indices,
+                                              lod_indices);
+
+                if (n_lod_indices >
+                    last_lod->n_indices * (1.0f - LOD_MIN_REDUCTION))
+                        break;
+
+                data->lods[data->n_lods].first_index = data->n_indices;
+                data->lods[data->n_lods].n_indices = n_lod_indices;
+                data->n_lods++;
+
+                for (i = 0; i < n_lod_indices; i++)
+                        add_index(data, lod_indices[i]);
+        }
+
+        free(lod_indices);
+}
+
+/* This is done after quantizing so that vertices which end up with
+ * the same bytes get merged as well */
+static void
+optimize_model(struct data *data,
+               struct fv_model_format_header *header,
+               uint8_t *vertices)
+{
+        const struct fv_model_format_lod *lod;
+        int n_vertices = data->n_vertices;
+        float acmr_before, acmr_after;
+        int i;
+
+        /* The ACMR is only reported for the full model */
+        acmr_before = optimize_mesh_get_acmr(data->indices,
+                                             data->lods[0].n_indices,
+                                             n_vertices);
+
+        n_vertices = optimize_mesh_deduplicate(vertices,
+                                               n_vertices,
+                                               header->vertex_size,
+                                               data->indices,
+                                               data->n_indices);
+
+        for (i = 0; i < data->n_lods; i++) {
+                lod = data->lods + i;
+                optimize_mesh_reorder_triangles(data->indices +
+                                                lod->first_index,
+                                                lod->n_indices,
+                                                n_vertices);
+        }
+
+        /* The simplified levels only use vertices from the full
+         * model so they will all be ordered by the first level */
+        n_vertices = optimize_mesh_reorder_vertices(vertices,
+                                                    n_vertices,
+                                                    header->vertex_size,
+                                                    data->indices,
+                                                    data->n_indices);
+
+        acmr_after = optimize_mesh_get_acmr(data->indices,
+                                            data->lods[0].n_indices,
+                                            n_vertices);
+
+        printf("%s: %i -> %i vertices, ACMR %.3f -> %.3f, triangles",
+               data->filename,
+               data->n_vertices,
+               n_vertices,
+               acmr_before,
+               acmr_after);
+
+        for (i = 0; i < data->n_lods; i++)
+                printf(" %i", data->lods[i].n_indices / 3);
+
+        fputc('\n', stdout);
+
+        header->n_vertices = n_vertices;
+}
+
+static void
+write_model(struct data *data,
+            const char *oname)
+{
+        struct fv_model_format_header header;
+        uint32_t vertices_size;
+        uint8_t *vertices;
+        FILE *out;
+
+        memset(&header, 0, sizeof header);
+        memcpy(header.magic, FV_MODEL_FORMAT_MAGIC, sizeof header.magic);
+        header.n_indices = data->n_indices;
+        header.n_lods = data->n_lods;
+        memcpy(header.lods, data->lods, sizeof header.lods);
+
+        vertices = quantize_model(data, &header);
+
+        optimize_model(data, &header, vertices);
+
+        vertices_size = header.n_vertices * header.vertex_size;
+        header.vertices_offset = align(sizeof header);
+        header.indices_offset = align(header.vertices_offset + vertices_size);
+
+        out = fopen(oname, "wb");
+        if (out == NULL)
+                error("Unable to create file '%s'", oname);
+
+        fwrite(&header, sizeof header, 1, out);
+        write_padding(out, header.vertices_offset - sizeof header);
+        fwrite(vertices, 1, vertices_size, out);
+        write_padding(out,
+                      header.indices_offset -
+                      header.vertices_offset -
+                      vertices_size);
+        fwrite(data->indices, sizeof (uint16_t), data->n_indices, out);
+
+        if (fclose(out) == EOF)
+                error("Error writing '%s'", oname);
+
+        free(vertices);
+}
+
+int
+main(int argc, char **argv)
+{
+        struct data data;
+        uint16_t byte_order = 1;
+        bool lods = false;
+        p_ply ply;
+
+        /* The file format is little-endian and this just writes out
+         * the native structs. This is checked at runtime rather than
+         * with config.h because when cross-compiling config.h
+         * describes the host instead of the machine running this. */
+        if (*(uint8_t *) &byte_order != 1)
+                error("make-fvm only works on little-endian machines");
+
+        /* The levels of detail are only generated when asked for
+         * because only some of the painters use them */
+        if (argc == 4 && !strcmp(argv[1], "-l")) {
+                lods = true;
+                argv++;
+                argc--;
+        }
+
+        if (argc != 3)
+                error("Usage: make-fvm [-l] <input.ply> <output.fvm>");
+
+        memset(&data, 0, sizeof data);
+        data.filename = argv[1];
+
+        ply = ply_open(argv[1], NULL, NULL);
+        if (!ply)
+                error("Unable to open file '%s'", argv[1]);
+        if (!ply_read_header(ply))
+                error("Failed reading '%s' header", argv[1]);
+
+        set_callbacks(&data, ply);
+
+        data.vertices = xmalloc(data.n_vertices * data.vertex_size);
+        memset(data.vertices, 0, data.n_vertices * data.vertex_size);
+        data.current_vertex = data.vertices;
+
+        if (!ply_read(ply))
+                error("Failed reading '%s'", argv[1]);
+
+        ply_close(ply);
+
+        data.n_lods = 1;
+        data.lods[0].first_index = 0;
+        data.lods[0].n_indices = data.n_indices;
+
+        if (lods)
+                generate_lods(&data);
+
+        write_model(&data, argv[2]);
+
+        free(data.vertices);
+        free(data.indices);
+
+        return EXIT_SUCCESS;
+}
@@ -0,0 +1,407 @@
+/*
+ * Finvenkisto
+ *
+ * Copyright (C) 2026 Neil Roberts
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <math.h>
+
+#include "optimize-mesh.h"
+
+/* Size of the LRU cache modelled by the triangle reordering. The
+ * other values are the tuning parameters suggested in the article.
+ */
+#define CACHE_SIZE 32
+#define CACHE_DECAY_POWER 1.5f
+#define LAST_TRIANGLE_SCORE 0.75f
+#define VALENCE_BOOST_SCALE 2.0f
+#define VALENCE_BOOST_POWER 0.5f
+
+struct vertex {
+        /* Position in the simulated cache or -1 */
+        int cache_position;
+        float score;
+        /* The triangles that use this vertex. The first
+         * n_remaining_triangles of these are the ones that haven’t
+         * been added yet.
+         */
+        int *triangles;
+        int n_remaining_triangles;
+};
+
+struct triangle {
+        bool added;
+        float score;
+};
+
+static const uint8_t *sort_vertices;
+static int sort_vertex_size;
+
+static void *
+xmalloc(size_t size)
+{
+        void *ret = malloc(size);
+
+        if (ret == NULL && size > 0) {
+                fputs("Out of memory\n", stderr);
+                exit(EXIT_FAILURE);
+        }
+
+        return ret;
+}
+
+static int
+compare_vertices(const void *a,
+                 const void *b)
+{
+        int index_a = *(const int *) a;
+        int index_b = *(const int *) b;
+        int result;
+
+        result = memcmp(sort_vertices + index_a * sort_vertex_size,
+                        sort_vertices + index_b * sort_vertex_size,
+                        sort_vertex_size);
+
+        if (result)
+                return result;
+
+        /* Sort equal vertices by index so that the first one in each
+         * run is the one that is kept */
+        return index_a - index_b;
+}
+
+int
+optimize_mesh_deduplicate(uint8_t *vertices,
+                          int n_vertices,
+                          int vertex_size,
+                          uint16_t *indices,
+                          int n_indices)
+{
+        int *order = xmalloc(n_vertices * sizeof (int));
+        int *remap = xmalloc(n_vertices * sizeof (int));
+        int n_unique = 0;
+        int first = 0;
+        int i;
+
+        for (i = 0; i < n_vertices; i++)
+                order[i] = i;
+
+        sort_vertices = vertices;
+        sort_vertex_size = vertex_size;
+        qsort(order, n_vertices, sizeof (int), compare_vertices);
+
+        /* Point each vertex at the lowest numbered copy of itself */
+        for (i = 0; i < n_vertices; i++) {
+                if (memcmp(vertices + order[i] * vertex_size,
+                           vertices + order[first] * vertex_size,
+                           vertex_size))
+                        first = i;
+                remap[order[i]] = order[first];
+        }
+
+        /* Compact the vertices that are kept. This doesn’t change
+         * their order so the destination never overtakes the source.
+         */
+        for (i = 0; i < n_vertices; i++) {
+                if (remap[i] == i) {
+                        memmove(vertices + n_unique * vertex_size,
+                                vertices + i * vertex_size,
+                                vertex_size);
+                        remap[i] = n_unique++;
+                } else {
+                        remap[i] = remap[remap[i]];
+                }
+        }
+
+        for (i = 0; i < n_indices; i++)
+                indices[i] = remap[indices[i]];
+
+        free(remap);
+        free(order);
+
+        return n_unique;
+}
+
+static float
+get_vertex_score(const struct vertex *vertex)
+{
+        float score = 0.0f;
+        float scaler;
+
+        /* Vertices that aren’t used anymore shouldn’t be picked */
+        if (vertex->n_remaining_triangles <= 0)
+                return -1.0f;
+
+        if (vertex->cache_position < 0) {
+                /* Not in the cache so no score */
+        } else if (vertex->cache_position < 3) {
+                /* The vertex was used in the last triangle. This is
+                 * given a fixed score so that it doesn’t matter which
+                 * of the three vertices it was.
+                 */
+                score = LAST_TRIANGLE_SCORE;
+        } else {
+                scaler = 1.0f / (CACHE_SIZE - 3);
+                score = 1.0f - (vertex->cache_position - 3) * scaler;
+                score = powf(score, CACHE_DECAY_POWER);
+        }
+
+        /* Boost the score of vertices with only a few triangles left
+         * so that lone triangles get cleared up */
+        score += VALENCE_BOOST_SCALE *
+                powf(vertex->n_remaining_triangles, -VALENCE_BOOST_POWER);
+
+        return score;
+}
+
+static void
+remove_triangle_from_vertex(struct vertex *vertex,
+                            int triangle)
+{
+        int i;
+
+        for (i = 0; i < vertex->n_remaining_triangles; i++) {
+                if (vertex->triangles[i] == triangle) {
+                        vertex->n_remaining_triangles--;
+                        vertex->triangles[i] =
+                                vertex->triangles[vertex->
+                                                  n_remaining_triangles];
+                        vertex->triangles[vertex->n_remaining_triangles] =
+                                triangle;
+                        return;
+                }
+        }
+}
+
+static int
+find_best_triangle(const struct triangle *triangles,
+                   int n_triangles)
+{
+        int best_triangle = -1;
+        float best_score = -1.0f;
+        int i;
+
+        for (i = 0; i < n_triangles; i++) {
+                if (!triangles[i].added && triangles[i].score > best_score) {
+                        best_score = triangles[i].score;
+                        best_triangle = i;
+                }
+        }
+
+        return best_triangle;
+}
+
+void
+optimize_mesh_reorder_triangles(uint16_t *indices,
+                                int n_indices,
+                                int n_vertices)
+{
+        int n_triangles = n_indices / 3;
+        struct vertex *vertices = xmalloc(n_vertices * sizeof *vertices);
+        struct triangle *triangles = xmalloc(n_triangles * sizeof *triangles);
+        int *vertex_triangles = xmalloc(n_indices * sizeof (int));
+        uint16_t *output = xmalloc(n_indices * sizeof (uint16_t));
+        int cache[CACHE_SIZE + 3], new_cache[CACHE_SIZE + 3];
+        int cache_length = 0, new_cache_length;
+        const uint16_t *tri_indices;
+        struct triangle *triangle;
+        struct vertex *vertex;
+        int best_triangle;
+        float best_score;
+        int t, i, j, v;
+        int offset;
+
+        /* Build the list of triangles for each vertex */
+        for (i = 0; i < n_vertices; i++)
+                vertices[i].n_remaining_triangles = 0;
+        for (i = 0; i < n_triangles * 3; i++)
+                vertices[indices[i]].n_remaining_triangles++;
+
+        offset = 0;
+        for (i = 0; i < n_vertices; i++) {
+                vertices[i].triangles = vertex_triangles + offset;
+                offset += vertices[i].n_remaining_triangles;
+                vertices[i].n_remaining_triangles = 0;
+                vertices[i].cache_position = -1;
+        }
+
+        for (i = 0; i < n_triangles * 3; i++) {
+                vertex = vertices + indices[i];
+                vertex->triangles[vertex->n_remaining_triangles++] = i / 3;
+        }
+
+        for (i = 0; i < n_vertices; i++)
+                vertices[i].score = get_vertex_score(vertices + i);
+
+        for (t = 0; t < n_triangles; t++) {
+                triangles[t].added = false;
+                triangles[t].score = 0.0f;
+                for (i = 0; i < 3; i++)
+                        triangles[t].score +=
+                                vertices[indices[t * 3 + i]].score;
+        }
+
+        best_triangle = find_best_triangle(triangles, n_triangles);
+
+        for (t = 0; t < n_triangles; t++) {
+                /* If none of the triangles touching the cache are
+                 * left then start again from the best remaining
+                 * triangle */
+                if (best_triangle < 0)
+                        best_triangle = find_best_triangle(triangles,
+                                                           n_triangles);
+
+                tri_indices = indices + best_triangle * 3;
+                triangles[best_triangle].added = true;
+                memcpy(output + t * 3, tri_indices, sizeof (uint16_t) * 3);
+
+                /* Move the triangle’s vertices to the front of the
+                 * cache */
+                new_cache_length = 0;
+
+                for (i = 0; i < 3; i++) {
+                        remove_triangle_from_vertex(vertices +
+                                                    tri_indices[i],
+                                                    best_triangle);
+                        new_cache[new_cache_length++] = tri_indices[i];
+                }
+
+                for (i = 0; i < cache_length; i++) {
+                        v = cache[i];
+                        if (v != tri_indices[0] &&
+                            v != tri_indices[1] &&
+                            v != tri_indices[2])
+                                new_cache[new_cache_length++] = v;
+                }
+
+                /* Update the scores of everything that was in the
+                 * cache, including the vertices that have just fallen
+                 * out of it */
+                for (i = 0; i < new_cache_length; i++) {
+                        vertex = vertices + new_cache[i];
+                        vertex->cache_position =
+                                i < CACHE_SIZE ? i : -1;
+                        vertex->score = get_vertex_score(vertex);
+                }
+
+                best_triangle = -1;
+                best_score = -1.0f;
+
+                for (i = 0; i < new_cache_length; i++) {
+                        vertex = vertices + new_cache[i];
+
+                        for (j = 0; j < vertex->n_remaining_triangles; j++) {
+                                triangle = triangles + vertex->triangles[j];
+                                tri_indices =
+                                        indices + vertex->triangles[j] * 3;
+
+                                triangle->score =
+                                        vertices[tri_indices[0]].score +
+                                        vertices[tri_indices[1]].score +
+                                        vertices[tri_indices[2]].score;
+
+                                if (triangle->score > best_score) {
+                                        best_score = triangle->score;
+                                        best_triangle = vertex->triangles[j];
+                                }
+                        }
+                }
+
+                if (new_cache_length > CACHE_SIZE)
+                        cache_length = CACHE_SIZE;
+                else
+                        cache_length = new_cache_length;
+                memcpy(cache, new_cache, cache_length * sizeof (int));
+        }
+
+        memcpy(indices, output, n_triangles * 3 * sizeof (uint16_t));
+
+        free(output);
+        free(vertex_triangles);
+        free(triangles);
+        free(vertices);
+}
+
+int
+optimize_mesh_reorder_vertices(uint8_t *vertices,
+                               int n_vertices,
+                               int vertex_size,
+                               uint16_t *indices,
+                               int n_indices)
+{
+        int *remap = xmalloc(n_vertices * sizeof (int));
+        uint8_t *copy = xmalloc(n_vertices * vertex_size);
+        int n_used = 0;
+        int i;
+
+        memcpy(copy, vertices, n_vertices * vertex_size);
+
+        for (i = 0; i < n_vertices; i++)
+                remap[i] = -1;
+
+        for (i = 0; i < n_indices; i++) {
+                if (remap[indices[i]] == -1) {
+                        memcpy(vertices + n_used * vertex_size,
+                               copy + indices[i] * vertex_size,
+                               vertex_size);
+                        remap[indices[i]] = n_used++;
+                }
+
+                indices[i] = remap[indices[i]];
+        }
+
+        free(copy);
+        free(remap);
+
+        return n_used;
+}
+
+float
+optimize_mesh_get_acmr(const uint16_t *indices,
+                       int n_indices,
+                       int n_vertices)
+{
+        /* The number of misses when each vertex was last added to
+         * the cache */
+        int *added_time;
+        int n_misses = 0;
+        int i;
+
+        if (n_indices < 3)
+                return 0.0f;
+
+        added_time = xmalloc(n_vertices * sizeof (int));
+
+        for (i = 0; i < n_vertices; i++)
+                added_time[i] = -OPTIMIZE_MESH_FIFO_SIZE - 1;
+
+        for (i = 0; i < n_indices; i++) {
+                if (n_misses - added_time[indices[i]] >
+                    OPTIMIZE_MESH_FIFO_SIZE) {
+                        added_time[indices[i]] = n_misses++;
+                }
+        }
+
+        free(added_time);
+
+        return n_misses / (float) (n_indices / 3);
+}
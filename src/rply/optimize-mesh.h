@@ -0,0 +1,70 @@
+/*
+ * Finvenkisto
+ *
+ * Copyright (C) 2026 Neil Roberts
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef OPTIMIZE_MESH_H
+#define OPTIMIZE_MESH_H
+
+#include <stdint.h>
+
+/* Functions used by make-fvm to reorder the triangles and vertices
+ * of a mesh so that they are more friendly to the GPU’s caches.
+ */
+
+/* Merges vertices that have exactly the same bytes and updates the
+ * indices to match. Returns the new number of vertices.
+ */
+int
+optimize_mesh_deduplicate(uint8_t *vertices,
+                          int n_vertices,
+                          int vertex_size,
+                          uint16_t *indices,
+                          int n_indices);
+
+/* Reorders the triangles to make better use of the post-transform
+ * vertex cache using Tom Forsyth’s “Linear-Speed Vertex Cache
+ * Optimisation” algorithm.
+ */
+void
+optimize_mesh_reorder_triangles(uint16_t *indices,
+                                int n_indices,
+                                int n_vertices);
+
+/* Reorders the vertices so that they are in the order that the
+ * indices first use them. Any unused vertices are removed. Returns
+ * the new number of vertices.
+ */
+int
+optimize_mesh_reorder_vertices(uint8_t *vertices,
+                               int n_vertices,
+                               int vertex_size,
+                               uint16_t *indices,
+                               int n_indices);
+
+/* Returns the average number of cache misses per triangle when
+ * rendering the indices with a FIFO cache of
+ * OPTIMIZE_MESH_FIFO_SIZE vertices.
+ */
+#define OPTIMIZE_MESH_FIFO_SIZE 16
+
+float
+optimize_mesh_get_acmr(const uint16_t *indices,
+                       int n_indices,
+                       int n_vertices);
+
+#endif /* OPTIMIZE_MESH_H */
@@ -0,0 +1,801 @@
+/*
+ * Finvenkisto
+ *
+ * Copyright (C) 2026 Neil Roberts
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <math.h>
+
+#include "simplify-mesh.h"
+
+/* Cost added for each unit of attribute distance when a collapse
+ * has to reuse a vertex with different attributes */
+#define ATTRIBUTE_WEIGHT 0.01
+
+/* Collapses that would turn a triangle by more than this are
+ * rejected. This is the cosine of the angle.
+ */
+#define MIN_NORMAL_DOT 0.2f
+
+struct candidate {
+        /* Position ids to collapse from and to */
+        int from, to;
+        double cost;
+};
+
+/* Maps the vertices of the position being removed to a vertex of
+ * the position that it is collapsed onto */
+struct wedge {
+        int from, to;
+};
+
+struct simplify {
+        const uint8_t *vertices;
+        int vertex_size;
+        int position_offset;
+        simplify_mesh_distance_func distance_func;
+        void *user_data;
+
+        int n_vertices;
+        /* The lowest numbered vertex with the same position as each
+         * vertex. This is used as the id of the position. */
+        int *position_ids;
+        /* Quadric for each position id. Only the top half of the
+         * symmetric 4x4 matrix is stored. */
+        double (*quadrics)[10];
+
+        uint16_t *indices;
+        bool *removed;
+        int n_triangles;
+        int n_live_triangles;
+
+        /* The triangles touching each position id */
+        int *adjacency_start;
+        int *adjacency;
+
+        int *marks;
+        int mark_stamp;
+        bool *touched;
+
+        struct wedge *wedges;
+        int n_wedges;
+
+        struct candidate *candidates;
+};
+
+static const uint8_t *sort_vertices;
+static int sort_vertex_size;
+static int sort_position_offset;
+
+static void *
+xmalloc(size_t size)
+{
+        void *ret = malloc(size);
+
+        if (ret == NULL && size > 0) {
+                fputs("Out of memory\n", stderr);
+                exit(EXIT_FAILURE);
+        }
+
+        return ret;
+}
+
+static const float *
+get_position(const struct simplify *s,
+             int vertex)
+{
+        return (const float *) (s->vertices +
+                                vertex * s->vertex_size +
+                                s->position_offset);
+}
+
+static int
+compare_positions(const void *a,
+                  const void *b)
+{
+        int index_a = *(const int *) a;
+        int index_b = *(const int *) b;
+        int result;
+
+        result = memcmp(sort_vertices +
+                        index_a * sort_vertex_size +
+                        sort_position_offset,
+                        sort_vertices +
+                        index_b * sort_vertex_size +
+                        sort_position_offset,
+                        sizeof (float) * 3);
+
+        if (result)
+                return result;
+
+        return index_a - index_b;
+}
+
+static void
+init_position_ids(struct simplify *s)
+{
+        int *order = xmalloc(s->n_vertices * sizeof (int));
+        int first = 0;
+        int i;
+
+        for (i = 0; i < s->n_vertices; i++)
+                order[i] = i;
+
+        sort_vertices = s->vertices;
+        sort_vertex_size = s->vertex_size;
+        sort_position_offset = s->position_offset;
+        qsort(order, s->n_vertices, sizeof (int), compare_positions);
+
+        for (i = 0; i < s->n_vertices; i++) {
+                if (memcmp(get_position(s, order[i]),
+                           get_position(s, order[first]),
+                           sizeof (float) * 3))
+                        first = i;
+                s->position_ids[order[i]] = order[first];
+        }
+
+        free(order);
+}
+
+static void
+get_normal(const float *a,
+           const float *b,
+           const float *c,
+           float *normal)
+{
+        float ab[3], ac[3];
+        int i;
+
+        for (i = 0; i < 3; i++) {
+                ab[i] = b[i] - a[i];
+                ac[i] = c[i] - a[i];
+        }
+
+        normal[0] = ab[1] * ac[2] - ab[2] * ac[1];
+        normal[1] = ab[2] * ac[0] - ab[0] * ac[2];
+        normal[2] = ab[0] * ac[1] - ab[1] * ac[0];
+}
+
+static float
+get_length(const float *v)
+{
+        return sqrtf(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+}
+
+static void
+init_quadrics(struct simplify *s)
+{
+        const uint16_t *tri;
+        const float *p;
+        float normal[3];
+        double plane[4], weight, *q;
+        float length;
+        int t, i;
+
+        memset(s->quadrics, 0, sizeof s->quadrics[0] * s->n_vertices);
+
+        for (t = 0; t < s->n_triangles; t++) {
+                tri = s->indices + t * 3;
+                p = get_position(s, tri[0]);
+
+                get_normal(p,
+                           get_position(s, tri[1]),
+                           get_position(s, tri[2]),
+                           normal);
+                length = get_length(normal);
+
+                if (length <= 0.0f)
+                        continue;
+
+                for (i = 0; i < 3; i++)
+                        plane[i] = normal[i] / length;
+                plane[3] = -(plane[0] * p[0] +
+                             plane[1] * p[1] +
+                             plane[2] * p[2]);
+
+                /* Weight the planes by the area of the triangle */
+                weight = length / 2.0;
+
+                for (i = 0; i < 3; i++) {
+                        q = s->quadrics[s->position_ids[tri[i]]];
+                        q[0] += weight * plane[0] * plane[0];
+                        q[1] += weight * plane[0] * plane[1];
+                        q[2] += weight * plane[0] * plane[2];
+                        q[3] += weight * plane[0] * plane[3];
+                        q[4] += weight * plane[1] * plane[1];
+                        q[5] += weight * plane[1] * plane[2];
+                        q[6] += weight * plane[1] * plane[3];
+                        q[7] += weight * plane[2] * plane[2];
+                        q[8] += weight * plane[2] * plane[3];
+                        q[9] += weight * plane[3] * plane[3];
+                }
+        }
+}
+
+static double
+evaluate_quadric(const double *q,
+                 const float *p)
+{
+        double x = p[0], y = p[1], z = p[2];
+
+        return (q[0] * x * x + 2.0 * q[1] * x * y + 2.0 * q[2] * x * z +
+                2.0 * q[3] * x +
+                q[4] * y * y + 2.0 * q[5] * y * z + 2.0 * q[6] * y +
+                q[7] * z * z + 2.0 * q[8] * z +
+                q[9]);
+}
+
+static void
+build_adjacency(struct simplify *s)
+{
+        const uint16_t *tri;
+        int pos;
+        int t, i;
+
+        memset(s->adjacency_start,
+               0,
+               sizeof (int) * (s->n_vertices + 1));
+
+        for (t = 0; t < s->n_triangles; t++) {
+                if (s->removed[t])
+                        continue;
+                tri = s->indices + t * 3;
+                for (i = 0; i < 3; i++)
+                        s->adjacency_start[s->position_ids[tri[i]] + 1]++;
+        }
+
+        for (i = 0; i < s->n_vertices; i++)
+                s->adjacency_start[i + 1] += s->adjacency_start[i];
+
+        /* Use the marks as a fill pointer for each position */
+        memcpy(s->marks, s->adjacency_start, sizeof (int) * s->n_vertices);
+
+        for (t = 0; t < s->n_triangles; t++) {
+                if (s->removed[t])
+                        continue;
+                tri = s->indices + t * 3;
+                for (i = 0; i < 3; i++) {
+                        pos = s->position_ids[tri[i]];
+                        s->adjacency[s->marks[pos]++] = t;
+                }
+        }
+
+        memset(s->marks, 0, sizeof (int) * s->n_vertices);
+        s->mark_stamp = 0;
+}
+
+/* Returns the index of the corner of the triangle with the given
+ * position id or -1 */
+static int
+find_corner(const struct simplify *s,
+            int triangle,
+            int pos)
+{
+        const uint16_t *tri = s->indices + triangle * 3;
+        int i;
+
+        for (i = 0; i < 3; i++) {
+                if (s->position_ids[tri[i]] == pos)
+                        return i;
+        }
+
+        return -1;
+}
+
+static int
+count_edge_triangles(const struct simplify *s,
+                     int pos_a,
+                     int pos_b)
+{
+        int count = 0;
+        int i;
+
+        for (i = s->adjacency_start[pos_a];
+             i < s->adjacency_start[pos_a + 1];
+             i++) {
+                if (find_corner(s, s->adjacency[i], pos_b) != -1)
+                        count++;
+        }
+
+        return count;
+}
+
+/* Positions on the border of the mesh, or on an edge shared by more
+ * than two triangles, are never removed so that the silhouette of
+ * the mesh is kept.
+ */
+static bool
+is_locked(const struct simplify *s,
+          int pos)
+{
+        const uint16_t *tri;
+        int other;
+        int i, j;
+
+        for (i = s->adjacency_start[pos];
+             i < s->adjacency_start[pos + 1];
+             i++) {
+                tri = s->indices + s->adjacency[i] * 3;
+
+                for (j = 0; j < 3; j++) {
+                        other = s->position_ids[tri[j]];
+                        if (other != pos &&
+                            count_edge_triangles(s, pos, other) != 2)
+                                return true;
+                }
+        }
+
+        return false;
+}
+
+/* Checks that the only positions connected to both ends of the edge
+ * are the two opposite corners of the triangles sharing the edge.
+ * Otherwise the collapse would make the mesh non-manifold.
+ */
+static bool
+check_link_condition(struct simplify *s,
+                     int from,
+                     int to)
+{
+        const uint16_t *tri;
+        int n_shared = 0;
+        int other;
+        int i, j;
+
+        s->mark_stamp += 2;
+
+        for (i = s->adjacency_start[from];
+             i < s->adjacency_start[from + 1];
+             i++) {
+                tri = s->indices + s->adjacency[i] * 3;
+                for (j = 0; j < 3; j++)
+                        s->marks[s->position_ids[tri[j]]] = s->mark_stamp;
+        }
+
+        for (i = s->adjacency_start[to];
+             i < s->adjacency_start[to + 1];
+             i++) {
+                tri = s->indices + s->adjacency[i] * 3;
+                for (j = 0; j < 3; j++) {
+                        other = s->position_ids[tri[j]];
+                        if (other != from && other != to &&
+                            s->marks[other] == s->mark_stamp) {
+                                s->marks[other] = s->mark_stamp + 1;
+                                n_shared++;
+                        }
+                }
+        }
+
+        return n_shared == 2;
+}
+
+static int
+find_wedge(const struct simplify *s,
+           int vertex)
+{
+        int i;
+
+        for (i = 0; i < s->n_wedges; i++) {
+                if (s->wedges[i].from == vertex)
+                        return i;
+        }
+
+        return -1;
+}
+
+static void
+add_wedge(struct simplify *s,
+          int from,
+          int to)
+{
+        s->wedges[s->n_wedges].from = from;
+        s->wedges[s->n_wedges].to = to;
+        s->n_wedges++;
+}
+
+/* Finds the vertex at the target position whose attributes are
+ * closest to the given vertex */
+static int
+find_closest_vertex(const struct simplify *s,
+                    int vertex,
+                    int pos,
+                    float *distance_out)
+{
+        float best_distance = HUGE_VALF, distance;
+        int best_vertex = -1;
+        int triangle, corner;
+        int i;
+
+        for (i = s->adjacency_start[pos];
+             i < s->adjacency_start[pos + 1];
+             i++) {
+                triangle = s->adjacency[i];
+                corner = s->indices[triangle * 3 + find_corner(s,
+                                                               triangle,
+                                                               pos)];
+                distance = s->distance_func(s->vertices +
+                                            vertex * s->vertex_size,
+                                            s->vertices +
+                                            corner * s->vertex_size,
+                                            s->user_data);
+                if (distance < best_distance) {
+                        best_distance = distance;
+                        best_vertex = corner;
+                }
+        }
+
+        *distance_out = best_distance;
+
+        return best_vertex;
+}
+
+/* Works out which vertex each vertex at the from position should be
+ * replaced with. Returns false if the collapse isn’t possible. */
+static bool
+build_wedges(struct simplify *s,
+             int from,
+             int to,
+             float *penalty_out)
+{
+        const uint16_t *tri;
+        float penalty = 0.0f, distance;
+        int triangle, vertex, wedge;
+        int from_corner, to_corner;
+        int i;
+
+        s->n_wedges = 0;
+
+        /* The triangles along the edge give a direct mapping */
+        for (i = s->adjacency_start[from];
+             i < s->adjacency_start[from + 1];
+             i++) {
+                triangle = s->adjacency[i];
+                to_corner = find_corner(s, triangle, to);
+
+                if (to_corner == -1)
+                        continue;
+
+                tri = s->indices + triangle * 3;
+                from_corner = find_corner(s, triangle, from);
+                wedge = find_wedge(s, tri[from_corner]);
+
+                if (wedge == -1)
+                        add_wedge(s, tri[from_corner], tri[to_corner]);
+                else if (s->wedges[wedge].to != tri[to_corner])
+                        return false;
+        }
+
+        /* Any other vertices use the closest match */
+        for (i = s->adjacency_start[from];
+             i < s->adjacency_start[from + 1];
+             i++) {
+                triangle = s->adjacency[i];
+                tri = s->indices + triangle * 3;
+                vertex = tri[find_corner(s, triangle, from)];
+
+                if (find_wedge(s, vertex) != -1)
+                        continue;
+
+                add_wedge(s,
+                          vertex,
+                          find_closest_vertex(s, vertex, to, &distance));
+                penalty += distance;
+        }
+
+        *penalty_out = penalty;
+
+        return true;
+}
+
+/* Rejects collapses that would flip or squash any of the triangles
+ * that remain */
+static bool
+check_triangles(const struct simplify *s,
+                int from,
+                int to)
+{
+        const float *to_position = get_position(s, to);
+        const float *positions[3];
+        float old_normal[3], new_normal[3];
+        float old_length, new_length, dot;
+        const uint16_t *tri;
+        int triangle, corner;
+        int i, j;
+
+        for (i = s->adjacency_start[from];
+             i < s->adjacency_start[from + 1];
+             i++) {
+                triangle = s->adjacency[i];
+
+                if (find_corner(s, triangle, to) != -1)
+                        continue;
+
+                tri = s->indices + triangle * 3;
+                corner = find_corner(s, triangle, from);
+
+                for (j = 0; j < 3; j++)
+                        positions[j] = get_position(s, tri[j]);
+                get_normal(positions[0], positions[1], positions[2],
+                           old_normal);
+
+                positions[corner] = to_position;
+                get_normal(positions[0], positions[1], positions[2],
+                           new_normal);
+
+                old_length = get_length(old_normal);
+                new_length = get_length(new_normal);
+
+                if (new_length <= old_length * 1e-3f)
+                        return false;
+
+                dot = (old_normal[0] * new_normal[0] +
+                       old_normal[1] * new_normal[1] +
+                       old_normal[2] * new_normal[2]);
+
+                if (dot < MIN_NORMAL_DOT * old_length * new_length)
+                        return false;
+        }
+
+        return true;
+}
+
+static bool
+evaluate_collapse(struct simplify *s,
+                  int from,
+                  int to,
+                  double *cost_out)
+{
+        float penalty;
+
+        if (!check_link_condition(s, from, to) ||
+            !check_triangles(s, from, to) ||
+            !build_wedges(s, from, to, &penalty))
+                return false;
+
+        *cost_out = (evaluate_quadric(s->quadrics[from],
+                                      get_position(s, to)) +
+                     penalty * ATTRIBUTE_WEIGHT);
+
+        return true;
+}
+
+static bool
+find_best_collapse(struct simplify *s,
+                   int from,
+                   struct candidate *candidate)
+{
+        const uint16_t *tri;
+        bool found = false;
+        double cost;
+        int other;
+        int i, j;
+
+        for (i = s->adjacency_start[from];
+             i < s->adjacency_start[from + 1];
+             i++) {
+                tri = s->indices + s->adjacency[i] * 3;
+
+                for (j = 0; j < 3; j++) {
+                        other = s->position_ids[tri[j]];
+
+                        if (other == from ||
+                            !evaluate_collapse(s, from, other, &cost))
+                                continue;
+
+                        if (!found || cost < candidate->cost) {
+                                candidate->from = from;
+                                candidate->to = other;
+                                candidate->cost = cost;
+                                found = true;
+                        }
+                }
+        }
+
+        return found;
+}
+
+static void
+apply_collapse(struct simplify *s,
+               const struct candidate *candidate)
+{
+        uint16_t *tri;
+        int triangle, corner, wedge;
+        float penalty;
+        int i;
+
+        /* Fill in the wedges again for the chosen collapse */
+        build_wedges(s, candidate->from, candidate->to, &penalty);
+
+        for (i = s->adjacency_start[candidate->from];
+             i < s->adjacency_start[candidate->from + 1];
+             i++) {
+                triangle = s->adjacency[i];
+
+                if (find_corner(s, triangle, candidate->to) != -1) {
+                        s->removed[triangle] = true;
+                        s->n_live_triangles--;
+                        continue;
+                }
+
+                tri = s->indices + triangle * 3;
+                corner = find_corner(s, triangle, candidate->from);
+                wedge = find_wedge(s, tri[corner]);
+                tri[corner] = s->wedges[wedge].to;
+        }
+
+        for (i = 0; i < 10; i++)
+                s->quadrics[candidate->to][i] +=
+                        s->quadrics[candidate->from][i];
+}
+
+static void
+touch_neighbors(struct simplify *s,
+                int pos)
+{
+        const uint16_t *tri;
+        int i, j;
+
+        for (i = s->adjacency_start[pos];
+             i < s->adjacency_start[pos + 1];
+             i++) {
+                tri = s->indices + s->adjacency[i] * 3;
+                for (j = 0; j < 3; j++)
+                        s->touched[s->position_ids[tri[j]]] = true;
+        }
+}
+
+static int
+compare_candidates(const void *a,
+                   const void *b)
+{
+        const struct candidate *candidate_a = a;
+        const struct candidate *candidate_b = b;
+
+        if (candidate_a->cost < candidate_b->cost)
+                return -1;
+        if (candidate_a->cost > candidate_b->cost)
+                return 1;
+        return 0;
+}
+
+/* Runs one pass over the mesh. Each pass collapses the cheapest
+ * half of the candidates as long as they don’t touch a part of the
+ * mesh that has already been changed in the same pass. Returns false
+ * if nothing could be collapsed.
+ */
+static bool
+run_pass(struct simplify *s,
+         int target_n_triangles)
+{
+        const struct candidate *candidate;
+        int n_candidates = 0;
+        int n_collapses = 0;
+        int pos, i;
+
+        build_adjacency(s);
+
+        for (pos = 0; pos < s->n_vertices; pos++) {
+                if (s->position_ids[pos] != pos ||
+                    s->adjacency_start[pos] == s->adjacency_start[pos + 1] ||
+                    is_locked(s, pos))
+                        continue;
+
+                if (find_best_collapse(s, pos, s->candidates + n_candidates))
+                        n_candidates++;
+        }
+
+        if (n_candidates == 0)
+                return false;
+
+        qsort(s->candidates,
+              n_candidates,
+              sizeof (struct candidate),
+              compare_candidates);
+
+        memset(s->touched, 0, sizeof (bool) * s->n_vertices);
+
+        for (i = 0; i < (n_candidates + 1) / 2; i++) {
+                if (s->n_live_triangles <= target_n_triangles)
+                        break;
+
+                candidate = s->candidates + i;
+
+                if (s->touched[candidate->from] ||
+                    s->touched[candidate->to])
+                        continue;
+
+                touch_neighbors(s, candidate->from);
+                apply_collapse(s, candidate);
+                n_collapses++;
+        }
+
+        return n_collapses > 0;
+}
+
+int
+simplify_mesh(const uint8_t *vertices,
+              int n_vertices,
+              int vertex_size,
+              int position_offset,
+              simplify_mesh_distance_func distance_func,
+              void *user_data,
+              const uint16_t *indices,
+              int n_indices,
+              int target_n_indices,
+              uint16_t *out_indices)
+{
+        struct simplify s;
+        int n_out_indices = 0;
+        int t;
+
+        s.vertices = vertices;
+        s.vertex_size = vertex_size;
+        s.position_offset = position_offset;
+        s.distance_func = distance_func;
+        s.user_data = user_data;
+        s.n_vertices = n_vertices;
+        s.n_triangles = n_indices / 3;
+        s.n_live_triangles = s.n_triangles;
+
+        s.position_ids = xmalloc(sizeof (int) * n_vertices);
+        s.quadrics = xmalloc(sizeof s.quadrics[0] * n_vertices);
+        s.indices = xmalloc(sizeof (uint16_t) * s.n_triangles * 3);
+        s.removed = xmalloc(sizeof (bool) * s.n_triangles);
+        s.adjacency_start = xmalloc(sizeof (int) * (n_vertices + 1));
+        s.adjacency = xmalloc(sizeof (int) * s.n_triangles * 3);
+        s.marks = xmalloc(sizeof (int) * n_vertices);
+        s.touched = xmalloc(sizeof (bool) * n_vertices);
+        s.wedges = xmalloc(sizeof (struct wedge) * s.n_triangles * 3);
+        s.candidates = xmalloc(sizeof (struct candidate) * n_vertices);
+
+        memcpy(s.indices, indices, sizeof (uint16_t) * s.n_triangles * 3);
+        memset(s.removed, 0, sizeof (bool) * s.n_triangles);
+
+        init_position_ids(&s);
+        init_quadrics(&s);
+
+        while (s.n_live_triangles * 3 > target_n_indices &&
+               run_pass(&s, target_n_indices / 3))
+                ;
+
+        for (t = 0; t < s.n_triangles; t++) {
+                if (s.removed[t])
+                        continue;
+                memcpy(out_indices + n_out_indices,
+                       s.indices + t * 3,
+                       sizeof (uint16_t) * 3);
+                n_out_indices += 3;
+        }
+
+        free(s.candidates);
+        free(s.wedges);
+        free(s.touched);
+        free(s.marks);
+        free(s.adjacency);
+        free(s.adjacency_start);
+        free(s.removed);
+        free(s.indices);
+        free(s.quadrics);
+        free(s.position_ids);
+
+        return n_out_indices;
+}
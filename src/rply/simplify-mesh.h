@@ -0,0 +1,57 @@
+/*
+ * Finvenkisto
+ *
+ * Copyright (C) 2026 Neil Roberts
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SIMPLIFY_MESH_H
+#define SIMPLIFY_MESH_H
+
+#include <stdint.h>
+
+/* Returns how different the attributes of two vertices are, ignoring
+ * the position. This is used to pick a replacement vertex when a
+ * collapse would otherwise have to invent a new combination of
+ * attributes.
+ */
+typedef float
+(* simplify_mesh_distance_func)(const uint8_t *vertex_a,
+                                const uint8_t *vertex_b,
+                                void *user_data);
+
+/* Reduces the number of triangles in a mesh with a series of
+ * half-edge collapses picked using quadric error metrics. Vertices
+ * are never moved or created so the simplified indices can share the
+ * same vertex buffer as the original mesh. The positions must be
+ * three floats at position_offset within each vertex. Simplification
+ * stops once the mesh has target_n_indices or fewer indices, or when
+ * there are no more collapses that wouldn’t damage the mesh. The new
+ * indices are written to out_indices, which must be big enough to
+ * hold n_indices. Returns the number of indices written.
+ */
+int
+simplify_mesh(const uint8_t *vertices,
+              int n_vertices,
+              int vertex_size,
+              int position_offset,
+              simplify_mesh_distance_func distance_func,
+              void *user_data,
+              const uint16_t *indices,
+              int n_indices,
+              int target_n_indices,
+              uint16_t *out_indices);
+
+#endif /* SIMPLIFY_MESH_H */
@@ -0,0 +1,330 @@
+/*
+ * Finvenkisto
+ *
+ * Copyright (C) 2026 Neil Roberts
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Checks the map that is built into the game. The meshes that were
+ * generated by make-map.py are compared with the ones that the game
+ * generates itself and then the map is modified in various places
+ * to check that the right blocks, specials and tiles are updated.
+ * This doesn't need GL or a display so it can be run during the
+ * build. */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <SDL.h>
+
+#include "fv-map.h"
+#include "fv-map-mesh.h"
+#include "fv-data.h"
+#include "fv-util.h"
+#include "fv-error-message.h"
+
+/* The errors are always written to stderr instead of showing a
+ * message box so that they end up in the log of the tests */
+void
+fv_error_message(const char *format, ...)
+{
+        va_list ap;
+
+        va_start(ap, format);
+        vfprintf(stderr, format, ap);
+        fputc('\n', stderr);
+        va_end(ap);
+}
+
+static const struct fv_map_tile *
+get_tile(int x, int y)
+{
+        return fv_map.tiles + ((y / FV_MAP_TILE_HEIGHT) * fv_map.tiles_x +
+                               x / FV_MAP_TILE_WIDTH);
+}
+
+static bool
+tile_matches_mesh(const struct fv_map_mesh *data,
+                  const struct fv_map_tile *map_tile)
+{
+        return (data->vertices.length ==
+                map_tile->n_vertices * sizeof (struct fv_map_mesh_vertex) &&
+                data->indices.length ==
+                map_tile->n_indices * sizeof (uint16_t) &&
+                !memcmp(data->vertices.data,
+                        map_tile->vertices,
+                        data->vertices.length) &&
+                !memcmp(data->indices.data,
+                        map_tile->indices,
+                        data->indices.length));
+}
+
+static bool
+check_meshes(void)
+{
+        const struct fv_map_tile *map_tile;
+        struct fv_map_mesh data;
+        int tx, ty;
+        bool ret = true;
+
+        fv_buffer_init(&data.vertices);
+        fv_buffer_init(&data.indices);
+        data.merge_faces = true;
+
+        for (ty = 0; ty < fv_map.tiles_y; ty++) {
+                for (tx = 0; tx < fv_map.tiles_x; tx++) {
+                        map_tile = fv_map.tiles + ty * fv_map.tiles_x + tx;
+
+                        if (map_tile->vertices == NULL)
+                                continue;
+
+                        if (!fv_map_validate_tile_mesh(map_tile)) {
+                                fv_error_message("The mesh for the tile at "
+                                                 "%i,%i in the map file is "
+                                                 "invalid",
+                                                 tx, ty);
+                                ret = false;
+                                goto out;
+                        }
+
+                        fv_buffer_set_length(&data.vertices, 0);
+                        fv_buffer_set_length(&data.indices, 0);
+                        fv_map_mesh_generate(&data, tx, ty);
+
+                        if (!tile_matches_mesh(&data, map_tile)) {
+                                fv_error_message("The mesh for the tile at "
+                                                 "%i,%i in the map file is "
+                                                 "different from the one "
+                                                 "generated by the game",
+                                                 tx, ty);
+                                ret = false;
+                                goto out;
+                        }
+                }
+        }
+
+out:
+        fv_buffer_destroy(&data.vertices);
+        fv_buffer_destroy(&data.indices);
+
+        return ret;
+}
+
+static bool
+check_set_block(int x, int y)
+{
+        int n_tiles = fv_map.tiles_x * fv_map.tiles_y;
+        unsigned int *versions = fv_alloc(n_tiles * sizeof *versions);
+        size_t pos = (size_t) y * fv_map.width + x;
+        fv_map_block_t old_block = fv_map.blocks[pos];
+        fv_map_block_t block;
+        /* The tile of the block and the tiles of its neighbours
+         * should be rebuilt but no others */
+        int tx1 = MAX(x - 1, 0) / FV_MAP_TILE_WIDTH;
+        int ty1 = MAX(y - 1, 0) / FV_MAP_TILE_HEIGHT;
+        int tx2 = MIN(x + 1, fv_map.width - 1) / FV_MAP_TILE_WIDTH;
+        int ty2 = MIN(y + 1, fv_map.height - 1) / FV_MAP_TILE_HEIGHT;
+        int tx, ty, i;
+        bool expected, ret = true;
+
+        for (i = 0; i < n_tiles; i++)
+                versions[i] = fv_map.tiles[i].version;
+
+        /* Toggle whether the block is a wall so that the geometry
+         * and the wall mask both change */
+        block = old_block & ~FV_MAP_BLOCK_TYPE_MASK;
+        if (!FV_MAP_IS_WALL(old_block))
+                block |= FV_MAP_BLOCK_TYPE_FULL_WALL;
+
+        fv_map_set_block(x, y, block);
+
+        if (fv_map.blocks[pos] != block ||
+            fv_map_is_wall(x, y) != FV_MAP_IS_WALL(block)) {
+                fv_error_message("The block at %i,%i wasn't changed", x, y);
+                ret = false;
+                goto out;
+        }
+
+        for (ty = 0; ty < fv_map.tiles_y; ty++) {
+                for (tx = 0; tx < fv_map.tiles_x; tx++) {
+                        i = ty * fv_map.tiles_x + tx;
+                        expected = (tx >= tx1 && tx <= tx2 &&
+                                    ty >= ty1 && ty <= ty2);
+
+                        if ((fv_map.tiles[i].version != versions[i]) ==
+                            expected)
+                                continue;
+
+                        fv_error_message("Changing the block at %i,%i %s "
+                                         "the tile at %i,%i",
+                                         x, y,
+                                         expected ?
+                                         "didn't update" :
+                                         "unnecessarily updated",
+                                         tx, ty);
+                        ret = false;
+                        goto out;
+                }
+        }
+
+out:
+        fv_map_set_block(x, y, old_block);
+        fv_free(versions);
+
+        return ret;
+}
+
+static int
+count_specials_at(const struct fv_map_tile *tile,
+                  int x, int y)
+{
+        int i, count = 0;
+
+        for (i = 0; i < tile->n_specials; i++) {
+                if (tile->specials[i].x == x && tile->specials[i].y == y)
+                        count++;
+        }
+
+        return count;
+}
+
+static bool
+specials_sorted(const struct fv_map_tile *tile)
+{
+        int i;
+
+        for (i = 1; i < tile->n_specials; i++) {
+                if (tile->specials[i].num < tile->specials[i - 1].num)
+                        return false;
+        }
+
+        return true;
+}
+
+static bool
+check_specials(int x, int y)
+{
+        const struct fv_map_tile *tile = get_tile(x, y);
+        int n_specials = tile->n_specials;
+        int n_here = count_specials_at(tile, x, y);
+        size_t pos = (size_t) y * fv_map.width + x;
+        fv_map_block_t old_block = fv_map.blocks[pos];
+        struct fv_map_special special;
+        bool ret = true;
+
+        special.x = x;
+        special.y = y;
+        special.rotation = 0;
+        special.num = 0;
+
+        fv_map_add_special(&special);
+
+        if (tile->n_specials != n_specials + 1 ||
+            count_specials_at(tile, x, y) != n_here + 1 ||
+            !specials_sorted(tile) ||
+            FV_MAP_GET_BLOCK_TYPE(fv_map.blocks[pos]) !=
+            FV_MAP_BLOCK_TYPE_SPECIAL ||
+            !fv_map_is_wall(x, y)) {
+                fv_error_message("Adding a special at %i,%i failed", x, y);
+                ret = false;
+                goto out;
+        }
+
+        if (!fv_map_remove_special(x, y) ||
+            tile->n_specials != n_specials ||
+            count_specials_at(tile, x, y) != n_here ||
+            !specials_sorted(tile) ||
+            fv_map_is_wall(x, y) != (n_here > 0)) {
+                fv_error_message("Removing the special at %i,%i failed",
+                                 x, y);
+                ret = false;
+                goto out;
+        }
+
+        if (n_here == 0 && fv_map_remove_special(x, y)) {
+                fv_error_message("A special was removed from %i,%i "
+                                 "where there wasn't one",
+                                 x, y);
+                ret = false;
+                goto out;
+        }
+
+out:
+        fv_map_set_block(x, y, old_block);
+
+        return ret;
+}
+
+static bool
+check_edits(void)
+{
+        /* The corners of the map, either side of the first tile
+         * boundary and the middle of a tile */
+        int xs[] = {
+                0,
+                FV_MAP_TILE_WIDTH - 1,
+                FV_MAP_TILE_WIDTH,
+                FV_MAP_TILE_WIDTH + FV_MAP_TILE_WIDTH / 2,
+                fv_map.width - 1
+        };
+        int ys[] = {
+                0,
+                FV_MAP_TILE_HEIGHT - 1,
+                FV_MAP_TILE_HEIGHT,
+                FV_MAP_TILE_HEIGHT + FV_MAP_TILE_HEIGHT / 2,
+                fv_map.height - 1
+        };
+        int i, j;
+
+        for (j = 0; j < FV_N_ELEMENTS(ys); j++) {
+                if (ys[j] >= fv_map.height)
+                        continue;
+
+                for (i = 0; i < FV_N_ELEMENTS(xs); i++) {
+                        if (xs[i] >= fv_map.width)
+                                continue;
+
+                        if (!check_set_block(xs[i], ys[j]) ||
+                            !check_specials(xs[i], ys[j]))
+                                return false;
+                }
+        }
+
+        return true;
+}
+
+int
+main(int argc, char **argv)
+{
+        bool ret;
+
+        fv_data_init();
+
+        /* The meshes are checked first while the map is still the
+         * same as the one in the file */
+        if (fv_map_load()) {
+                ret = check_meshes() && check_edits();
+                fv_map_unload();
+        } else {
+                ret = false;
+        }
+
+        fv_data_deinit();
+
+        return ret ? EXIT_SUCCESS : EXIT_FAILURE;
+}